@@ -0,0 +1,449 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/param.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define	AC_SSSE3
+#endif
+
+#include "acmatch.h"
+
+#define	AC_HIT		0x80000000U	/* the target state reports */
+#define	AC_BUCKETS	8
+/* no prefilter if more than this share of byte pairs gets through */
+#define	AC_MAXPASS	(65536 / 8)
+/* give up on the prefilter for a chunk if it skips less than this */
+#define	AC_MINSKIP	8
+#define	AC_SKIPTRIES	64
+/* and leave it out for this many chunks after that */
+#define	AC_BACKOFF	32
+/* room for full transition rows, well within an L2 cache */
+#define	AC_DENSEMAX	(1024 * 1024)
+
+/*
+ * States are numbered breadth first.  The first ac_ndense have a full
+ * row of transitions.  The others, deeper and seldom visited, only
+ * keep their children, which being enqueued together are numbered
+ * ac_kid[s] up to ac_kid[s + 1], and their failure state, and the
+ * scan walks down failure states until it finds a transition.  That
+ * keeps the tables small enough for thousands of patterns.
+ */
+struct acauto {
+	uint8_t		 ac_class[256];
+	uint32_t	 ac_nclass;
+	uint32_t	 ac_shift;	/* log2 of the row size */
+	uint32_t	 ac_nstates;
+	uint32_t	 ac_ndense;
+	uint32_t	*ac_next;	/* [state << shift | class] */
+	uint32_t	*ac_kid;	/* first child, by state */
+	uint8_t		*ac_kidclass;	/* class of the edge into a state */
+	uint32_t	*ac_fail;
+	uint32_t	*ac_outidx;	/* by state, into ac_out */
+	int		*ac_out;	/* patterns reported */
+	int		 ac_prefilter;
+	/* the prefilter's nibble tables, one bit per bucket */
+	uint8_t		 ac_lo1[16] __attribute__((aligned(16)));
+	uint8_t		 ac_hi1[16] __attribute__((aligned(16)));
+	uint8_t		 ac_lo2[16] __attribute__((aligned(16)));
+	uint8_t		 ac_hi2[16] __attribute__((aligned(16)));
+};
+
+static int
+ac_pair(const struct acauto *ac, u_char a, u_char b)
+{
+	return ((ac->ac_lo1[a & 15] & ac->ac_hi1[a >> 4] &
+	    ac->ac_lo2[b & 15] & ac->ac_hi2[b >> 4]) != 0);
+}
+
+/*
+ * Sets up the prefilter: each pattern goes into a bucket by its first
+ * two bytes, and a pair of bytes gets through if the nibbles of both
+ * are in the same bucket.  That lets through every pair which begins
+ * a pattern, and some which do not.
+ */
+static void
+ac_buckets(struct acauto *ac, const char *const *pats, const size_t *lens,
+    int npats)
+{
+	const u_char *p;
+	int a, b, i, pass;
+
+	for (i = 0; i < npats; i++)
+		if (lens[i] < 2)
+			return;
+	for (i = 0; i < npats; i++) {
+		p = (const u_char *)pats[i];
+		b = 1 << ((p[0] * 31 + p[1]) % AC_BUCKETS);
+		ac->ac_lo1[p[0] & 15] |= b;
+		ac->ac_hi1[p[0] >> 4] |= b;
+		ac->ac_lo2[p[1] & 15] |= b;
+		ac->ac_hi2[p[1] >> 4] |= b;
+	}
+	pass = 0;
+	for (a = 0; a < 256; a++)
+		for (b = 0; b < 256; b++)
+			pass += ac_pair(ac, a, b);
+	ac->ac_prefilter = pass <= AC_MAXPASS;
+}
+
+/*
+ * Builds the trie, then fills in every missing transition with the
+ * one its failure state would take, breadth first so that failure
+ * states are always complete before they are used.  States are then
+ * renumbered in that order, which keeps the shallow and busy ones
+ * together.
+ */
+struct acauto *
+ac_compile(const char *const *pats, const size_t *lens, int npats,
+    int flags)
+{
+	struct acauto *ac;
+	uint32_t *trie, *fail, *queue, *renum, *nout;
+	int *first, *chain;
+	size_t total, n;
+	uint32_t c, f, i, j, k, s, t, u, nnodes, ncls;
+	int p, err;
+
+	if ((ac = calloc(1, sizeof(*ac))) == NULL)
+		return (NULL);
+	total = 1;
+	for (p = 0; p < npats; p++) {
+		if (lens[p] == 0) {
+			free(ac);
+			errno = EINVAL;
+			return (NULL);
+		}
+		total += lens[p];
+		for (n = 0; n < lens[p]; n++)
+			ac->ac_class[(u_char)pats[p][n]] = 1;
+	}
+	/* a class for each byte in some pattern, 0 for all others */
+	for (ncls = 1, c = 0; c < 256; c++)
+		if (ac->ac_class[c])
+			ac->ac_class[c] = ncls++;
+	ac->ac_nclass = ncls;
+	while ((1U << ac->ac_shift) < ncls)
+		ac->ac_shift++;
+	if (total >= AC_HIT) {
+		free(ac);
+		errno = E2BIG;
+		return (NULL);
+	}
+	err = ENOMEM;
+	trie = calloc(total * ncls, sizeof(*trie));
+	fail = calloc(total, sizeof(*fail));
+	queue = malloc(total * sizeof(*queue));
+	renum = malloc(total * sizeof(*renum));
+	nout = calloc(total, sizeof(*nout));
+	first = malloc(total * sizeof(*first));
+	chain = malloc((npats + 1) * sizeof(*chain));
+	if (trie == NULL || fail == NULL || queue == NULL || renum == NULL ||
+	    nout == NULL || first == NULL || chain == NULL)
+		goto bad;
+	/* 0 is the root, and never anybody's child */
+	memset(first, 0xff, total * sizeof(*first));
+	nnodes = 1;
+	for (p = 0; p < npats; p++) {
+		for (s = 0, n = 0; n < lens[p]; n++) {
+			c = ac->ac_class[(u_char)pats[p][n]];
+			if (trie[s * ncls + c] == 0)
+				trie[s * ncls + c] = nnodes++;
+			s = trie[s * ncls + c];
+		}
+		chain[p] = first[s];
+		first[s] = p;
+		nout[s]++;
+	}
+	j = 0;
+	queue[j++] = 0;
+	for (i = 0; i < j; i++) {
+		u = queue[i];
+		renum[u] = i;
+		if (u != 0)
+			nout[u] += nout[fail[u]];
+		for (c = 0; c < ncls; c++) {
+			t = trie[u * ncls + c];
+			f = u == 0 ? 0 : trie[fail[u] * ncls + c];
+			if (t == 0) {
+				trie[u * ncls + c] = f;
+				continue;
+			}
+			fail[t] = f;
+			queue[j++] = t;
+		}
+	}
+	ac->ac_nstates = nnodes;
+	ac->ac_ndense = MIN(nnodes,
+	    AC_DENSEMAX / (sizeof(uint32_t) << ac->ac_shift));
+	ac->ac_next = calloc((size_t)ac->ac_ndense << ac->ac_shift,
+	    sizeof(*ac->ac_next));
+	ac->ac_kid = malloc((nnodes + 1) * sizeof(*ac->ac_kid));
+	ac->ac_kidclass = malloc(nnodes);
+	ac->ac_fail = malloc(nnodes * sizeof(*ac->ac_fail));
+	ac->ac_outidx = malloc((nnodes + 1) * sizeof(*ac->ac_outidx));
+	if (ac->ac_next == NULL || ac->ac_kid == NULL ||
+	    ac->ac_kidclass == NULL || ac->ac_fail == NULL ||
+	    ac->ac_outidx == NULL)
+		goto bad;
+	for (k = 0, i = 0; i < nnodes; i++) {
+		ac->ac_outidx[i] = k;
+		k += nout[queue[i]];
+	}
+	ac->ac_outidx[nnodes] = k;
+	if ((ac->ac_out = malloc((k + 1) * sizeof(*ac->ac_out))) == NULL)
+		goto bad;
+	ac->ac_kidclass[0] = 0;
+	for (j = 1, i = 0; i < nnodes; i++) {
+		u = queue[i];
+		ac->ac_fail[i] = renum[fail[u]];
+		ac->ac_kid[i] = j;
+		for (c = 0; c < ncls; c++) {
+			t = trie[u * ncls + c];
+			/* a child, rather than a failure transition */
+			if (t != 0 && renum[t] == j) {
+				ac->ac_kidclass[j] = c;
+				j++;
+			}
+			if (i < ac->ac_ndense)
+				ac->ac_next[i << ac->ac_shift | c] = renum[t] |
+				    (nout[t] > 0 ? AC_HIT : 0);
+		}
+		/* its own patterns, then those of its failure state */
+		k = ac->ac_outidx[i];
+		for (p = first[u]; p >= 0; p = chain[p])
+			ac->ac_out[k++] = p;
+		if (u != 0)
+			for (s = ac->ac_outidx[renum[fail[u]]];
+			    s < ac->ac_outidx[renum[fail[u]] + 1]; s++)
+				ac->ac_out[k++] = ac->ac_out[s];
+	}
+	ac->ac_kid[nnodes] = j;
+#ifdef AC_SSSE3
+	if (!(flags & AC_NOPREFILTER) && __builtin_cpu_supports("ssse3"))
+		ac_buckets(ac, pats, lens, npats);
+#else
+	(void)flags;
+#endif
+	err = 0;
+bad:
+	free(trie);
+	free(fail);
+	free(queue);
+	free(renum);
+	free(nout);
+	free(first);
+	free(chain);
+	if (err != 0) {
+		ac_free(ac);
+		errno = err;
+		return (NULL);
+	}
+	return (ac);
+}
+
+#ifdef AC_SSSE3
+/*
+ * Where to resume the DFA from its start state, at or after p: just
+ * before the first pair of bytes which may begin a pattern, since the
+ * byte before it may be a prefix too, or at the last byte, whose
+ * pair is not in this chunk.
+ */
+__attribute__((target("ssse3")))
+static const u_char *
+ac_skip(const struct acauto *ac, const u_char *p, const u_char *end)
+{
+	__m128i lo1, hi1, lo2, hi2, nib, a, b, m;
+	const u_char *q;
+	u_int mask;
+
+	lo1 = _mm_load_si128((const __m128i *)(const void *)ac->ac_lo1);
+	hi1 = _mm_load_si128((const __m128i *)(const void *)ac->ac_hi1);
+	lo2 = _mm_load_si128((const __m128i *)(const void *)ac->ac_lo2);
+	hi2 = _mm_load_si128((const __m128i *)(const void *)ac->ac_hi2);
+	nib = _mm_set1_epi8(0x0f);
+	for (q = p; end - q > 16; q += 16) {
+		a = _mm_loadu_si128((const __m128i *)(const void *)q);
+		b = _mm_loadu_si128((const __m128i *)(const void *)(q + 1));
+		m = _mm_and_si128(
+		    _mm_and_si128(_mm_shuffle_epi8(lo1, _mm_and_si128(a, nib)),
+		    _mm_shuffle_epi8(hi1,
+		    _mm_and_si128(_mm_srli_epi16(a, 4), nib))),
+		    _mm_and_si128(_mm_shuffle_epi8(lo2, _mm_and_si128(b, nib)),
+		    _mm_shuffle_epi8(hi2,
+		    _mm_and_si128(_mm_srli_epi16(b, 4), nib))));
+		mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(m,
+		    _mm_setzero_si128())) & 0xffff;
+		if (mask != 0) {
+			q += __builtin_ctz(mask);
+			return (q > p ? q - 1 : p);
+		}
+	}
+	for (; end - q > 1; q++)
+		if (ac_pair(ac, q[0], q[1]))
+			return (q > p ? q - 1 : p);
+	return (end - 1 > p ? end - 1 : p);
+}
+#endif
+
+static void
+ac_report(const struct acauto *ac, uint32_t s, uint64_t off, ac_hit_t hit,
+    void *arg)
+{
+	uint32_t i;
+
+	for (i = ac->ac_outidx[s]; i < ac->ac_outidx[s + 1]; i++)
+		hit(arg, ac->ac_out[i], off);
+}
+
+void
+ac_reset(const struct acauto *ac __attribute__((unused)),
+    struct acstate *as)
+{
+	as->as_state = 0;
+	as->as_off = 0;
+	as->as_nopf = 0;
+}
+
+/*
+ * The transition from s on byte class k, with AC_HIT set if the state
+ * it leads to reports.
+ */
+static inline uint32_t
+ac_step(const struct acauto *ac, uint32_t s, u_int k)
+{
+	uint32_t j;
+
+	while (s >= ac->ac_ndense) {
+		for (j = ac->ac_kid[s]; j < ac->ac_kid[s + 1]; j++)
+			if (ac->ac_kidclass[j] == k)
+				return (j | (ac->ac_outidx[j] !=
+				    ac->ac_outidx[j + 1] ? AC_HIT : 0));
+		s = ac->ac_fail[s];
+	}
+	return (ac->ac_next[s << ac->ac_shift | k]);
+}
+
+void
+ac_scan(const struct acauto *ac, struct acstate *as, const char *buf,
+    size_t len, ac_hit_t hit, void *arg)
+{
+	const u_char *base, *p, *end;
+	const uint8_t *cls;
+	uint32_t s, v;
+#ifdef AC_SSSE3
+	const u_char *q;
+	size_t skipped, tries;
+#endif
+
+	base = p = (const u_char *)buf;
+	end = p + len;
+	cls = ac->ac_class;
+	s = as->as_state;
+#ifdef AC_SSSE3
+	if (ac->ac_prefilter && as->as_nopf > 0)
+		as->as_nopf--;
+	else if (ac->ac_prefilter) {
+		/*
+		 * Back to the prefilter whenever the DFA is back home,
+		 * unless the data is so full of candidates that it does
+		 * not pay.
+		 */
+		skipped = tries = 0;
+		while (p < end) {
+			if (s == 0) {
+				q = ac_skip(ac, p, end);
+				skipped += q - p;
+				if (++tries == AC_SKIPTRIES) {
+					if (skipped < AC_SKIPTRIES * AC_MINSKIP) {
+						as->as_nopf = AC_BACKOFF;
+						break;
+					}
+					skipped = tries = 0;
+				}
+				p = q;
+			}
+			do {
+				v = ac_step(ac, s, cls[*p++]);
+				s = v & ~AC_HIT;
+				if (v & AC_HIT)
+					ac_report(ac, s, as->as_off +
+					    (p - base), hit, arg);
+			} while (s != 0 && p < end);
+		}
+	}
+#endif
+	while (p < end) {
+		v = ac_step(ac, s, cls[*p++]);
+		s = v & ~AC_HIT;
+		if (v & AC_HIT)
+			ac_report(ac, s, as->as_off + (p - base), hit, arg);
+	}
+	as->as_state = s;
+	as->as_off += len;
+}
+
+int
+ac_nstates(const struct acauto *ac)
+{
+	return (ac->ac_nstates);
+}
+
+size_t
+ac_size(const struct acauto *ac)
+{
+	return (((size_t)ac->ac_ndense << ac->ac_shift) * sizeof(uint32_t) +
+	    ac->ac_nstates * (3 * sizeof(uint32_t) + 1) +
+	    ac->ac_outidx[ac->ac_nstates] * sizeof(int));
+}
+
+int
+ac_prefiltered(const struct acauto *ac)
+{
+	return (ac->ac_prefilter);
+}
+
+void
+ac_free(struct acauto *ac)
+{
+	if (ac == NULL)
+		return;
+	free(ac->ac_next);
+	free(ac->ac_kid);
+	free(ac->ac_kidclass);
+	free(ac->ac_fail);
+	free(ac->ac_outidx);
+	free(ac->ac_out);
+	free(ac);
+}
@@ -0,0 +1,74 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef	ACMATCH_DOT_H_
+#define	ACMATCH_DOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Multi-pattern matching of literal strings, Aho-Corasick style.  The
+ * patterns are compiled into a DFA over byte classes whose transitions
+ * already include the failure links, so scanning costs one table
+ * lookup per byte however many patterns there are.  A stream is
+ * scanned a chunk at a time: all there is to remember between chunks
+ * is the DFA state, and matches which straddle two chunks are found
+ * like any other.
+ *
+ * While the DFA sits in its start state, where it spends most of its
+ * time, a prefilter looks 16 bytes at a time for any pair of bytes
+ * which may begin a pattern, like the Teddy algorithm does, and the
+ * DFA skips to the first one.  It needs SSSE3 and is left out when
+ * some pattern is a single byte or when the patterns begin with too
+ * many different pairs for it to skip much.  A stream on which it
+ * stops paying scans the next AC_BACKOFF chunks without it.
+ */
+struct acauto;
+
+struct acstate {
+	uint32_t	as_state;
+	uint64_t	as_off;		/* bytes scanned so far */
+	uint32_t	as_nopf;	/* chunks left without the prefilter */
+};
+
+/* called with the pattern and the offset just past its end */
+typedef void (*ac_hit_t)(void *, int, uint64_t);
+
+struct acauto *ac_compile(const char *const *, const size_t *, int, int);
+void ac_reset(const struct acauto *, struct acstate *);
+void ac_scan(const struct acauto *, struct acstate *, const char *,
+    size_t, ac_hit_t, void *);
+int ac_nstates(const struct acauto *);
+size_t ac_size(const struct acauto *);
+int ac_prefiltered(const struct acauto *);
+void ac_free(struct acauto *);
+
+/* ac_compile() flags */
+#define	AC_NOPREFILTER	0x01
+#endif	/* ACMATCH_DOT_H_ */
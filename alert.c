@@ -0,0 +1,273 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+
+#include <ctype.h>
+#include <err.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <utmpx.h>
+
+#include "utmp.h"
+#include "termlog.h"
+#include "alert.h"
+
+static struct acauto *alerts;
+static char **rules;		/* as written, for the messages */
+static size_t *rulelens;	/* of the strings they stand for */
+static int nrules;
+static atomic_ulong al_bytes;	/* scanned */
+static atomic_ulong al_hits;
+static atomic_ulong al_dropped;	/* over ALERT_RATE */
+
+struct alerthit {
+	struct alertsess *ah_as;
+	const char	*ah_user;
+	const char	*ah_line;
+};
+
+static int
+hexval(int c)
+{
+	if (isdigit(c))
+		return (c - '0');
+	return (tolower(c) - 'a' + 10);
+}
+
+/*
+ * Undoes the escapes in place.  Returns the length of the string, or
+ * -1 if an escape is not valid.
+ */
+static int
+unescape(char *str)
+{
+	char *p, *q;
+
+	for (p = q = str; *p != '\0'; p++) {
+		if (*p != '\\') {
+			*q++ = *p;
+			continue;
+		}
+		switch (*++p) {
+		case '\\':
+			*q++ = '\\';
+			break;
+		case 'e':
+			*q++ = '\033';
+			break;
+		case 'n':
+			*q++ = '\n';
+			break;
+		case 'r':
+			*q++ = '\r';
+			break;
+		case 't':
+			*q++ = '\t';
+			break;
+		case 'x':
+			if (!isxdigit((u_char)p[1]) || !isxdigit((u_char)p[2]))
+				return (-1);
+			*q++ = hexval((u_char)p[1]) << 4 | hexval((u_char)p[2]);
+			p += 2;
+			break;
+		default:
+			return (-1);
+		}
+	}
+	return (q - str);
+}
+
+/*
+ * Make room for one more rule in rules, *patsp and rulelens, and copy
+ * buf into the first two.  Whatever grew is kept either way.
+ */
+static int
+addrule(const char *buf, char ***patsp)
+{
+	char **r;
+	size_t *l;
+
+	if ((r = realloc(rules, (nrules + 1) * sizeof(*r))) == NULL)
+		return (-1);
+	rules = r;
+	if ((r = realloc(*patsp, (nrules + 1) * sizeof(*r))) == NULL)
+		return (-1);
+	*patsp = r;
+	if ((l = realloc(rulelens, (nrules + 1) * sizeof(*l))) == NULL)
+		return (-1);
+	rulelens = l;
+	if ((rules[nrules] = strdup(buf)) == NULL)
+		return (-1);
+	if (((*patsp)[nrules] = strdup(buf)) == NULL) {
+		free(rules[nrules]);
+		return (-1);
+	}
+	return (0);
+}
+
+int
+alert_load(const char *path)
+{
+	char *buf, **pats;
+	size_t cap;
+	ssize_t len;
+	int lineno, n, ret;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		warn("%s", path);
+		return (-1);
+	}
+	buf = NULL;
+	pats = NULL;
+	cap = 0;
+	lineno = 0;
+	ret = 0;
+	while ((len = getline(&buf, &cap, fp)) != -1) {
+		lineno++;
+		while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == '\r'))
+			buf[--len] = '\0';
+		if (len == 0 || buf[0] == '#')
+			continue;
+		if (addrule(buf, &pats) < 0) {
+			warn("%s", path);
+			ret = -1;
+			break;
+		}
+		if ((n = unescape(pats[nrules])) <= 0) {
+			warnx("%s:%d: invalid escape", path, lineno);
+			free(rules[nrules]);
+			free(pats[nrules]);
+			ret = -1;
+			break;
+		}
+		rulelens[nrules++] = n;
+	}
+	if (ret == 0 && ferror(fp)) {
+		warn("%s", path);
+		ret = -1;
+	}
+	fclose(fp);
+	free(buf);
+	if (ret == 0 && nrules == 0) {
+		warnx("%s: no rules", path);
+		ret = -1;
+	}
+	if (ret == 0) {
+		alerts = ac_compile((const char *const *)pats, rulelens,
+		    nrules, 0);
+		if (alerts == NULL) {
+			warn("%s", path);
+			ret = -1;
+		}
+	}
+	for (n = 0; n < nrules && pats != NULL; n++)
+		free(pats[n]);
+	free(pats);
+	return (ret);
+}
+
+int
+alert_enabled(void)
+{
+	return (alerts != NULL);
+}
+
+void
+alert_init(struct alertsess *as)
+{
+	memset(as, 0, sizeof(*as));
+	if (alerts != NULL)
+		ac_reset(alerts, &as->al_state);
+}
+
+static void
+alert_hit(void *arg, int rule, uint64_t end)
+{
+	struct alerthit *ah;
+	struct alertsess *as;
+	time_t now;
+
+	ah = arg;
+	as = ah->ah_as;
+	atomic_fetch_add(&al_hits, 1);
+	now = time(NULL);
+	if (now != as->al_second) {
+		as->al_second = now;
+		as->al_count = 0;
+	}
+	if (as->al_count++ >= ALERT_RATE) {
+		as->al_dropped++;
+		atomic_fetch_add(&al_dropped, 1);
+		return;
+	}
+	if (as->al_dropped > 0) {
+		dolog("alert: %s on %s offset %ju: %s (%lu more not logged)",
+		    ah->ah_user, ah->ah_line,
+		    (uintmax_t)(end - rulelens[rule]), rules[rule],
+		    as->al_dropped);
+		as->al_dropped = 0;
+	} else
+		dolog("alert: %s on %s offset %ju: %s", ah->ah_user,
+		    ah->ah_line, (uintmax_t)(end - rulelens[rule]),
+		    rules[rule]);
+}
+
+/*
+ * Runs a session's output, in the order it was read, through the
+ * automaton.  Calls for a session must not overlap.
+ */
+void
+alert_scan(struct alertsess *as, const char *user, const char *line,
+    const char *buf, size_t len)
+{
+	struct alerthit ah;
+
+	ah.ah_as = as;
+	ah.ah_user = user;
+	ah.ah_line = line;
+	ac_scan(alerts, &as->al_state, buf, len, alert_hit, &ah);
+	atomic_fetch_add(&al_bytes, len);
+}
+
+void
+alert_dumpstats(FILE *fp)
+{
+	if (!alert_enabled())
+		return;
+	fprintf(fp, "Alert statistics:\n%-8s %-10s %-10s %-14s %-10s %s\n",
+	    "RULES", "STATES", "PREFILTER", "BYTES", "ALERTS", "NOTLOGGED");
+	fprintf(fp, "%-8d %-10d %-10s %-14lu %-10lu %lu\n", nrules,
+	    ac_nstates(alerts), ac_prefiltered(alerts) ? "yes" : "no",
+	    atomic_load(&al_bytes), atomic_load(&al_hits),
+	    atomic_load(&al_dropped));
+}
@@ -0,0 +1,65 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef	ALERT_DOT_H_
+#define	ALERT_DOT_H_
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <time.h>
+
+#include "acmatch.h"
+
+/*
+ * Alerts on strings appearing in the output of sessions.  The rules
+ * file has one literal string per line, which may use the escapes
+ * \\, \t, \r, \n, \e and \xHH, and lines starting with # are comments.
+ * All the rules are compiled into one automaton (acmatch.c) which each
+ * session's output goes through on its way to the log, so a match is
+ * found however the output was split into reads.  Every match is
+ * logged with the session and the offset of its first byte in the
+ * session's output.  Past ALERT_RATE alerts in a second a session's
+ * alerts are only counted, and the count is logged with its next one.
+ */
+#define	ALERT_RATE	10
+
+struct alertsess {
+	struct acstate	al_state;
+	time_t		al_second;	/* being counted */
+	u_int		al_count;	/* alerts logged in it */
+	u_long		al_dropped;	/* since the last one logged */
+};
+
+int alert_load(const char *);
+int alert_enabled(void);
+void alert_init(struct alertsess *);
+void alert_scan(struct alertsess *, const char *, const char *,
+    const char *, size_t);
+void alert_dumpstats(FILE *);
+#endif	/* ALERT_DOT_H_ */
@@ -0,0 +1,279 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * acbench: throughput of the alert matcher.
+ *
+ * Scans a synthetic stream of terminal output, words and paths split
+ * into lines, for sets of random patterns of two or three words, in
+ * chunks the size of a typical read, with and without the prefilter.
+ * By default every word of a pattern comes from the vocabulary of the
+ * stream, which is the worst case: the automaton hardly ever gets back
+ * to its start state.  With -m only that percentage of the words do,
+ * the others being made up the same way.  Before timing, the hits are checked against a
+ * naive search and against a scan of the stream in one piece.  One
+ * JSON object is written per pattern count and prefilter setting.
+ */
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "acmatch.h"
+
+#define	NWORDS		4096
+#define	CHECKSIZE	(1024 * 1024)
+
+static char *words[2 * NWORDS];	/* the stream's, then others */
+static uint64_t hits;
+static uint64_t hitsum;
+
+static uint64_t
+nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static void
+mkwords(void)
+{
+	static const char alpha[] = "abcdefghijklmnopqrstuvwxyz0123456789_-./";
+	int i, j, len;
+
+	for (i = 0; i < 2 * NWORDS; i++) {
+		len = 2 + random() % 9;
+		if ((words[i] = malloc(len + 1)) == NULL)
+			err(1, "malloc");
+		for (j = 0; j < len; j++)
+			words[i][j] = alpha[random() % (j == 0 ? 26 :
+			    sizeof(alpha) - 1)];
+		words[i][len] = '\0';
+	}
+}
+
+static char *
+mkstream(size_t size)
+{
+	const char *w;
+	size_t off, col, len;
+	char *buf;
+
+	if ((buf = malloc(size)) == NULL)
+		err(1, "malloc");
+	for (off = col = 0; off < size; off += len) {
+		w = words[random() % NWORDS];
+		len = strlen(w);
+		if (len > size - off)
+			len = size - off;
+		memcpy(buf + off, w, len);
+		col += len;
+		if (off + len < size) {
+			buf[off + len] = col > 60 + random() % 40 ?
+			    '\n' : ' ';
+			col = buf[off + len] == '\n' ? 0 : col + 1;
+			len++;
+		}
+	}
+	return (buf);
+}
+
+/* two or three words, as in "rm -rf /" */
+static void
+mkpats(int n, int mix, char ***pats, size_t **lens)
+{
+	char buf[64];
+	int i, j, len, nw;
+
+	*pats = malloc(n * sizeof(**pats));
+	*lens = malloc(n * sizeof(**lens));
+	if (*pats == NULL || *lens == NULL)
+		err(1, "malloc");
+	for (i = 0; i < n; i++) {
+		nw = 2 + random() % 2;
+		for (len = 0, j = 0; j < nw; j++)
+			len += snprintf(buf + len, sizeof(buf) - len, "%s%s",
+			    j > 0 ? " " : "", words[random() % NWORDS +
+			    (random() % 100 < mix ? 0 : NWORDS)]);
+		(*pats)[i] = strdup(buf);
+		(*lens)[i] = strlen(buf);
+	}
+}
+
+static void
+onhit(void *arg __attribute__((unused)), int pat, uint64_t off)
+{
+	hits++;
+	hitsum += off * 31 + pat;
+}
+
+static void
+scan(const struct acauto *ac, const char *buf, size_t size, size_t chunk)
+{
+	struct acstate as;
+	size_t off;
+
+	ac_reset(ac, &as);
+	for (off = 0; off < size; off += chunk)
+		ac_scan(ac, &as, buf + off, chunk < size - off ? chunk :
+		    size - off, onhit, NULL);
+}
+
+static void
+naive(char **pats, size_t *lens, int npats, const char *buf, size_t size)
+{
+	const char *p;
+	int i;
+
+	for (i = 0; i < npats; i++)
+		for (p = buf; (p = memmem(p, size - (p - buf), pats[i],
+		    lens[i])) != NULL; p++)
+			onhit(NULL, i, p - buf + lens[i]);
+}
+
+static void
+check(const struct acauto *ac, char **pats, size_t *lens, int npats,
+    const char *buf, size_t chunk)
+{
+	uint64_t h[3], s[3];
+
+	hits = hitsum = 0;
+	naive(pats, lens, npats, buf, CHECKSIZE);
+	h[0] = hits, s[0] = hitsum;
+	hits = hitsum = 0;
+	scan(ac, buf, CHECKSIZE, CHECKSIZE);
+	h[1] = hits, s[1] = hitsum;
+	hits = hitsum = 0;
+	scan(ac, buf, CHECKSIZE, chunk);
+	h[2] = hits, s[2] = hitsum;
+	if (h[0] != h[1] || h[0] != h[2] || s[0] != s[1] || s[0] != s[2])
+		errx(1, "%d patterns: %ju hits expected, %ju in one piece, "
+		    "%ju in chunks", npats, (uintmax_t)h[0], (uintmax_t)h[1],
+		    (uintmax_t)h[2]);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	    "usage: acbench [-c chunk] [-d ms] [-m mix] [-n counts] "
+	    "[-s mbytes]\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct acauto *ac;
+	char *counts, *cnt, *last, *buf, **pats;
+	size_t *lens, size, chunk;
+	uint64_t t0, t1, reps;
+	int ch, i, mix, npats, msecs, pf;
+
+	counts = strdup("10,1000,10000");
+	size = 64;
+	chunk = 4096;
+	msecs = 1000;
+	mix = 100;
+	while ((ch = getopt(argc, argv, "c:d:m:n:s:")) != -1)
+		switch (ch) {
+		case 'c':
+			chunk = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			msecs = atoi(optarg);
+			break;
+		case 'm':
+			mix = atoi(optarg);
+			break;
+		case 'n':
+			counts = optarg;
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+		}
+	if (chunk == 0 || size == 0 || msecs <= 0 || mix < 0 || mix > 100)
+		usage();
+	size *= 1024 * 1024;
+	if (size < CHECKSIZE)
+		size = CHECKSIZE;
+	srandom(1);
+	mkwords();
+	buf = mkstream(size);
+	for (cnt = strtok_r(counts, ",", &last); cnt != NULL;
+	    cnt = strtok_r(NULL, ",", &last)) {
+		npats = atoi(cnt);
+		if (npats <= 0)
+			usage();
+		mkpats(npats, mix, &pats, &lens);
+		for (pf = 1; pf >= 0; pf--) {
+			ac = ac_compile((const char *const *)pats, lens, npats,
+			    pf ? 0 : AC_NOPREFILTER);
+			if (ac == NULL)
+				err(1, "ac_compile");
+			if (pf && !ac_prefiltered(ac)) {
+				ac_free(ac);
+				continue;
+			}
+			check(ac, pats, lens, npats, buf, chunk);
+			hits = 0;
+			reps = 0;
+			t0 = nsec();
+			do {
+				scan(ac, buf, size, chunk);
+				reps++;
+				t1 = nsec();
+			} while (t1 - t0 < msecs * 1000000ULL);
+			printf("{\"patterns\":%d,\"mix\":%d,\"prefilter\":%s,"
+			    "\"states\":%d,\"bytes\":%zu,\"chunk\":%zu,"
+			    "\"hits_per_mb\":%.1f,\"mb_s\":%.1f}\n", npats, mix,
+			    pf ? "true" : "false", ac_nstates(ac), ac_size(ac),
+			    chunk, (double)hits / reps / (size / 1048576.0),
+			    (double)size * reps / 1048576.0 /
+			    ((t1 - t0) / 1e9));
+			fflush(stdout);
+			ac_free(ac);
+		}
+		for (i = 0; i < npats; i++)
+			free(pats[i]);
+		free(pats);
+		free(lens);
+	}
+	return (0);
+}
@@ -0,0 +1,249 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * lockbench: rdwrlock against pthread_rwlock_t.
+ *
+ * Every thread loops taking the lock for reading or writing, in the
+ * proportion given, over a small shared table; the writers bump every
+ * entry and the readers check that the entries agree, so a broken
+ * lock shows up as errors.  Between two acquisitions each thread does
+ * some work of its own.  One JSON object is written per lock, thread
+ * count and read ratio.
+ */
+#include <sys/types.h>
+
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rdwrlock.h"
+
+#define	NSLOTS		16
+#define	MAXTHREADS	64
+
+struct lockops {
+	const char	*lo_name;
+	void		(*lo_rdlock)(void);
+	void		(*lo_wrlock)(void);
+	void		(*lo_unlock)(void);
+};
+
+static struct rdwrlock rwl;
+static pthread_rwlock_t prwl = PTHREAD_RWLOCK_INITIALIZER;
+static volatile uint64_t table[NSLOTS];
+static pthread_barrier_t barrier;
+static atomic_int running;
+static atomic_ulong errors;
+static const struct lockops *ops;
+static int readpct;
+static int localwork = 50;
+
+static void
+rw_rd(void)
+{
+	rd_lock(&rwl);
+}
+
+static void
+rw_wr(void)
+{
+	wr_lock(&rwl);
+}
+
+static void
+rw_un(void)
+{
+	rdwr_unlock(&rwl);
+}
+
+static void
+p_rd(void)
+{
+	pthread_rwlock_rdlock(&prwl);
+}
+
+static void
+p_wr(void)
+{
+	pthread_rwlock_wrlock(&prwl);
+}
+
+static void
+p_un(void)
+{
+	pthread_rwlock_unlock(&prwl);
+}
+
+static const struct lockops locks[] = {
+	{ "rdwrlock", rw_rd, rw_wr, rw_un },
+	{ "pthread_rwlock", p_rd, p_wr, p_un },
+};
+
+static void *
+worker(void *arg)
+{
+	uint64_t ops_done, seed, v;
+	volatile uint64_t sink;
+	int i;
+
+	seed = (uintptr_t)arg * 2654435761U + 1;
+	ops_done = 0;
+	sink = 0;
+	pthread_barrier_wait(&barrier);
+	while (atomic_load_explicit(&running, memory_order_relaxed)) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		if ((int)((seed >> 33) % 100) < readpct) {
+			ops->lo_rdlock();
+			v = table[0];
+			for (i = 1; i < NSLOTS; i++)
+				if (table[i] != v)
+					atomic_fetch_add(&errors, 1);
+			ops->lo_unlock();
+		} else {
+			ops->lo_wrlock();
+			for (i = 0; i < NSLOTS; i++)
+				table[i]++;
+			ops->lo_unlock();
+		}
+		for (i = 0; i < localwork; i++)
+			sink += i;
+		ops_done++;
+	}
+	return ((void *)(uintptr_t)ops_done);
+}
+
+static double
+run(int nthreads, int ms)
+{
+	pthread_t thr[MAXTHREADS];
+	struct timespec t0, t1, d;
+	uint64_t total;
+	void *ret;
+	int i;
+
+	atomic_store(&running, 1);
+	pthread_barrier_init(&barrier, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create(&thr[i], NULL, worker,
+		    (void *)(uintptr_t)i))
+			err(1, "pthread_create failed");
+	pthread_barrier_wait(&barrier);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	d.tv_sec = ms / 1000;
+	d.tv_nsec = (ms % 1000) * 1000000L;
+	nanosleep(&d, NULL);
+	atomic_store(&running, 0);
+	total = 0;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(thr[i], &ret);
+		total += (uintptr_t)ret;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	pthread_barrier_destroy(&barrier);
+	return (total / ((t1.tv_sec - t0.tv_sec) +
+	    (t1.tv_nsec - t0.tv_nsec) / 1e9));
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: lockbench [-d ms] [-r readpct,...] "
+	    "[-t threads,...] [-w work]\n");
+	exit(1);
+}
+
+static int
+parselist(char *str, int *list, int max)
+{
+	char *tok;
+	int n;
+
+	for (n = 0; n < max && (tok = strsep(&str, ",")) != NULL; n++)
+		list[n] = atoi(tok);
+	return (n);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int threads[16] = { 1, 2, 4, 8, 16, 32, 64 };
+	int ratios[16] = { 100, 99, 90, 50, 0 };
+	int nthreads, nratios, ms, ch, t, r;
+	u_int l;
+	double rate;
+
+	nthreads = 7;
+	nratios = 5;
+	ms = 250;
+	while ((ch = getopt(argc, argv, "d:r:t:w:")) != -1)
+		switch (ch) {
+		case 'd':
+			ms = atoi(optarg);
+			break;
+		case 'r':
+			nratios = parselist(optarg, ratios, 16);
+			break;
+		case 't':
+			nthreads = parselist(optarg, threads, 16);
+			break;
+		case 'w':
+			localwork = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	rdwr_lock_init(&rwl);
+	for (r = 0; r < nratios; r++)
+		for (t = 0; t < nthreads; t++) {
+			if (threads[t] < 1 || threads[t] > MAXTHREADS)
+				errx(1, "%d: between 1 and %d threads",
+				    threads[t], MAXTHREADS);
+			for (l = 0; l < sizeof(locks) / sizeof(locks[0]);
+			    l++) {
+				ops = &locks[l];
+				readpct = ratios[r];
+				atomic_store(&errors, 0);
+				rate = run(threads[t], ms);
+				printf("{\"lock\": \"%s\", \"threads\": %d, "
+				    "\"read_pct\": %d, \"ops_per_s\": %.0f, "
+				    "\"errors\": %lu}\n", ops->lo_name,
+				    threads[t], readpct, rate,
+				    atomic_load(&errors));
+				fflush(stdout);
+			}
+		}
+	return (0);
+}
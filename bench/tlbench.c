@@ -0,0 +1,879 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * tlbench: drive a termlog with a synthetic load and measure it.
+ *
+ * A number of ptys is opened and each gets a session which generates
+ * traffic of one kind: typing at keystroke rate, cat-style floods,
+ * top-style screen redraws, or a recorded binary log (termlog -B)
+ * played back at some multiple of its original speed.  On Linux the
+ * sessions run under termlog-pty, elsewhere directly on the tty.  The
+ * sessions are registered in utmp, so a termlog started by us finds
+ * them like any other login.
+ *
+ * Every session writes a marker line, "@TLB id seq usec", every
+ * MARKER_INTERVAL.  We watch the log directory, and the time between
+ * a marker being written to the tty and it turning up in a log is
+ * the write-to-disk latency; markers that never turn up are lost.
+ * termlog's CPU time comes from wait4(2) once it has been stopped.
+ *
+ * The results are written as a single JSON object, one per run, so
+ * they can be collected and compared.  This needs to run as root.
+ */
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <paths.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <utmpx.h>
+
+#include "compat.h"
+#include "logfmt.h"
+
+#define	MARKER_INTERVAL	(100 * 1000)	/* usec */
+#define	MARKER_TAG	"@TLB "
+#define	WARMUP		(2 * 1000000)	/* before sessions start, usec */
+#define	GRACE		(3 * 1000000)	/* for the logs to catch up, usec */
+#define	SCANPERIOD	(5 * 1000)	/* log polling, usec */
+#define	LINEMAX		256
+#define	MADE_WORKDIR	0x01		/* the directories we created */
+#define	MADE_LOGS	0x02
+#define	MADE_SPOOL	0x04
+
+enum { M_TYPING, M_FLOOD, M_REDRAW, M_REPLAY, M_COUNT };
+
+static const char *const modes[M_COUNT] = {
+	"typing", "flood", "redraw", "replay"
+};
+
+/* a log file being watched */
+struct watched {
+	char		w_name[MAXPATHLEN];
+	int		w_fd;
+	size_t		w_carry;
+	char		w_line[LINEMAX];
+};
+
+static struct watched *files;
+static size_t nfiles;
+static uint64_t *lat;			/* marker latencies, usec */
+static size_t nlat, maxlat;
+static uint64_t logged;			/* bytes found in the logs */
+static u_long overflows;		/* TTY overflow markers */
+static atomic_int stopping;
+static uint64_t runstart;
+
+static const char *workdir;
+static const char *replayfile;
+static double speed = 1.0;
+static uint64_t duration = 10 * 1000000;
+
+static uint64_t
+now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+static void
+sleep_usec(uint64_t usec)
+{
+	struct timespec ts;
+
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+static int
+rmentry(const char *path, const struct stat *sb __unused, int flag __unused,
+    struct FTW *ftw __unused)
+{
+	if (remove(path) < 0)
+		warn("%s", path);
+	return (0);
+}
+
+/*
+ * Remove what we made ourselves, without following symbolic links out
+ * of it, and never the directory we were pointed at with -C.
+ */
+static void
+cleanup(const char *logdir, const char *spool, int made)
+{
+	if (made & MADE_LOGS)
+		(void)nftw(logdir, rmentry, 16, FTW_DEPTH | FTW_PHYS);
+	if (made & MADE_SPOOL)
+		(void)nftw(spool, rmentry, 16, FTW_DEPTH | FTW_PHYS);
+	if ((made & MADE_WORKDIR) && rmdir(workdir) < 0)
+		warn("%s", workdir);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	    "usage: tlbench [-k] [-C workdir] [-d seconds] [-m mix] "
+	    "[-n sessions]\n"
+	    "               [-o output] [-P termlog-pty] [-r replaylog] "
+	    "[-s speed]\n"
+	    "               [-T termlog] [-- termlog arguments]\n");
+	exit(1);
+}
+
+/*
+ * Session side.  Runs on the pty and writes its kind of traffic to
+ * standard output until the duration is up, then leaves the number
+ * of bytes and markers it wrote in the work directory.
+ */
+struct emitter {
+	int		e_id;
+	int		e_mode;
+	uint64_t	e_bytes;
+	u_long		e_markers;
+	uint64_t	e_nextmark;
+	uint64_t	e_end;
+};
+
+static void
+emit(struct emitter *e, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(STDOUT_FILENO, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			/* the tty went away */
+			exit(0);
+		}
+		buf += n;
+		len -= n;
+		e->e_bytes += n;
+	}
+}
+
+static void
+mark(struct emitter *e)
+{
+	char buf[64];
+	uint64_t now;
+	int len;
+
+	now = now_usec();
+	if (now < e->e_nextmark)
+		return;
+	len = snprintf(buf, sizeof(buf), "\n" MARKER_TAG "%d %lu %ju\n",
+	    e->e_id, e->e_markers, (uintmax_t)now);
+	emit(e, buf, len);
+	e->e_markers++;
+	e->e_nextmark = now + MARKER_INTERVAL;
+}
+
+static void
+typing(struct emitter *e)
+{
+	char c;
+
+	while (now_usec() < e->e_end) {
+		/* about eight keys a second */
+		sleep_usec(60000 + random() % 120000);
+		if (random() % 30 == 0)
+			emit(e, "\r\n$ ", 4);
+		else {
+			c = 'a' + random() % 26;
+			emit(e, &c, 1);
+		}
+		mark(e);
+	}
+}
+
+static void
+flood(struct emitter *e)
+{
+	char buf[16384];
+	size_t len;
+	u_long line;
+	int n;
+
+	line = 0;
+	while (now_usec() < e->e_end) {
+		for (len = 0; len < sizeof(buf) - 80; len += n)
+			n = snprintf(buf + len, sizeof(buf) - len,
+			    "%8lu the quick brown fox jumps over the lazy "
+			    "dog %d\n", line++, e->e_id);
+		emit(e, buf, len);
+		mark(e);
+	}
+}
+
+static void
+redraw(struct emitter *e)
+{
+	char buf[4096];
+	size_t len;
+	int i, n;
+
+	while (now_usec() < e->e_end) {
+		len = snprintf(buf, sizeof(buf),
+		    "\033[H\033[2Jload averages: %.2f %.2f %.2f\r\n"
+		    "\033[7m  PID USERNAME  THR PRI NICE   SIZE    RES "
+		    "STATE    TIME    WCPU COMMAND\033[m\r\n",
+		    random() % 400 / 100.0, random() % 400 / 100.0,
+		    random() % 400 / 100.0);
+		for (i = 0; i < 22; i++) {
+			n = snprintf(buf + len, sizeof(buf) - len,
+			    "%5ld root        %2ld  20    0 %5ldM %5ldM "
+			    "select %3ld:%02ld %6.2f%% proc%d\r\n",
+			    random() % 99999, random() % 32,
+			    random() % 9999, random() % 999,
+			    random() % 999, random() % 60,
+			    random() % 10000 / 100.0, i);
+			len += n;
+		}
+		emit(e, buf, len);
+		mark(e);
+		sleep_usec(1000000);
+		mark(e);
+	}
+}
+
+/*
+ * Play the data records of a binary log with their original spacing
+ * divided by the speed, over and over until the time is up.
+ */
+static void
+replay(struct emitter *e)
+{
+	struct logread lf;
+	struct logrec lr;
+	uint64_t prev, wait;
+
+	if (logread_open(&lf, replayfile) < 0)
+		err(1, "%s", replayfile);
+	while (now_usec() < e->e_end) {
+		logread_seek(&lf, 0);
+		prev = 0;
+		while (logread_next(&lf, &lr) > 0 && now_usec() < e->e_end) {
+			if (lr.lr_type != REC_DATA)
+				continue;
+			if (prev != 0 && lr.lr_time > prev) {
+				wait = (lr.lr_time - prev) / speed;
+				while (wait > 0 && now_usec() < e->e_end) {
+					sleep_usec(MIN(wait, MARKER_INTERVAL));
+					wait -= MIN(wait, MARKER_INTERVAL);
+					mark(e);
+				}
+			}
+			if (lr.lr_time != 0)
+				prev = lr.lr_time;
+			emit(e, lr.lr_data, lr.lr_len);
+			mark(e);
+		}
+	}
+	logread_close(&lf);
+}
+
+static void
+emitter(int id, int mode)
+{
+	struct emitter e;
+	char path[MAXPATHLEN];
+	FILE *fp;
+
+	memset(&e, 0, sizeof(e));
+	e.e_id = id;
+	e.e_mode = mode;
+	srandom(getpid());
+	/* give termlog time to attach */
+	sleep_usec(WARMUP);
+	e.e_end = now_usec() + duration;
+	switch (mode) {
+	case M_TYPING:
+		typing(&e);
+		break;
+	case M_FLOOD:
+		flood(&e);
+		break;
+	case M_REDRAW:
+		redraw(&e);
+		break;
+	case M_REPLAY:
+		replay(&e);
+		break;
+	}
+	e.e_nextmark = 0;
+	mark(&e);
+	snprintf(path, sizeof(path), "%s/sent.%d", workdir, id);
+	if ((fp = fopen(path, "w")) == NULL)
+		err(1, "%s", path);
+	fprintf(fp, "%d %s %ju %lu\n", id, modes[mode], (uintmax_t)e.e_bytes,
+	    e.e_markers);
+	fclose(fp);
+	/* let the tty drain before it goes away */
+	tcdrain(STDOUT_FILENO);
+	sleep_usec(500000);
+	exit(0);
+}
+
+/*
+ * Watching side.
+ */
+static void
+scanline(const char *line, size_t len, uint64_t now)
+{
+	unsigned long long usec;
+	u_long seq;
+	int id;
+
+	if (len > sizeof(MARKER_TAG) - 1 &&
+	    memcmp(line, MARKER_TAG, sizeof(MARKER_TAG) - 1) == 0) {
+		if (sscanf(line + sizeof(MARKER_TAG) - 1, "%d %lu %llu", &id,
+		    &seq, &usec) != 3 || usec > now)
+			return;
+		/* a replayed log may carry markers of an earlier run */
+		if (usec < runstart)
+			return;
+		if (nlat == maxlat) {
+			maxlat = maxlat == 0 ? 4096 : maxlat * 2;
+			if ((lat = realloc(lat, maxlat * sizeof(*lat))) == NULL)
+				err(1, "realloc failed");
+		}
+		lat[nlat++] = now - usec;
+	} else if (len > 3 && line[0] == ';' && line[1] == ';' &&
+	    memmem(line, len, "TTY overflow", 12) != NULL)
+		overflows++;
+}
+
+static void
+scanfile(struct watched *w, uint64_t now)
+{
+	char buf[65536];
+	ssize_t n, i, start;
+
+	while ((n = read(w->w_fd, buf, sizeof(buf))) > 0) {
+		logged += n;
+		for (start = 0, i = 0; i < n; i++) {
+			if (buf[i] != '\n')
+				continue;
+			if (w->w_carry > 0) {
+				/* finish the line started in the last read */
+				if (w->w_carry + (i - start) <= LINEMAX) {
+					memcpy(w->w_line + w->w_carry,
+					    buf + start, i - start);
+					scanline(w->w_line,
+					    w->w_carry + (i - start), now);
+				}
+				w->w_carry = 0;
+			} else
+				scanline(buf + start, i - start, now);
+			start = i + 1;
+		}
+		if (start < n) {
+			if (w->w_carry + (n - start) <= LINEMAX) {
+				memcpy(w->w_line + w->w_carry, buf + start,
+				    n - start);
+				w->w_carry += n - start;
+			} else
+				w->w_carry = LINEMAX + 1;
+		}
+	}
+}
+
+static void
+scandir_logs(const char *dir)
+{
+	struct dirent *de;
+	struct watched *w;
+	char path[MAXPATHLEN];
+	size_t i;
+	DIR *d;
+	int fd;
+
+	if ((d = opendir(dir)) == NULL)
+		return;
+	while ((de = readdir(d)) != NULL) {
+		if (strstr(de->d_name, ".log") == NULL ||
+		    strstr(de->d_name, LOGIDX_SUFFIX) != NULL ||
+		    strstr(de->d_name, LOGZ_SUFFIX) != NULL)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		for (i = 0; i < nfiles; i++)
+			if (strcmp(files[i].w_name, path) == 0)
+				break;
+		if (i < nfiles)
+			continue;
+		if ((fd = open(path, O_RDONLY)) < 0)
+			continue;
+		files = realloc(files, (nfiles + 1) * sizeof(*files));
+		if (files == NULL)
+			err(1, "realloc failed");
+		w = &files[nfiles++];
+		memset(w, 0, sizeof(*w));
+		strlcpy(w->w_name, path, sizeof(w->w_name));
+		w->w_fd = fd;
+	}
+	closedir(d);
+}
+
+static void *
+watcher(void *arg)
+{
+	const char *dir;
+	uint64_t now, lastscan;
+	size_t i;
+
+	dir = (const char *)arg;
+	lastscan = 0;
+	while (!atomic_load(&stopping)) {
+		now = now_usec();
+		if (now - lastscan > 200000) {
+			scandir_logs(dir);
+			lastscan = now;
+		}
+		for (i = 0; i < nfiles; i++)
+			scanfile(&files[i], now);
+		sleep_usec(SCANPERIOD);
+	}
+	scandir_logs(dir);
+	for (i = 0; i < nfiles; i++)
+		scanfile(&files[i], now_usec());
+	return (NULL);
+}
+
+/*
+ * Nobody reads the ttys, so we have to or the sessions would block.
+ */
+static struct pollfd *masters;
+static int nmasters;
+
+static void *
+drainer(void *arg __unused)
+{
+	char buf[65536];
+	int i, n;
+
+	while (!atomic_load(&stopping)) {
+		if (poll(masters, nmasters, 100) <= 0)
+			continue;
+		for (i = 0; i < nmasters; i++) {
+			if (masters[i].revents == 0)
+				continue;
+			n = read(masters[i].fd, buf, sizeof(buf));
+			/* a hung up pty keeps polling ready */
+			if (n == 0 ||
+			    (n < 0 && errno != EAGAIN && errno != EINTR))
+				masters[i].fd = -masters[i].fd - 1;
+		}
+	}
+	return (NULL);
+}
+
+static void
+setutmp(const char *line, pid_t pid, int type)
+{
+	struct utmpx ut;
+	struct timeval tv;
+	size_t len;
+
+	memset(&ut, 0, sizeof(ut));
+	ut.ut_type = type;
+	ut.ut_pid = pid;
+	strncpy(ut.ut_line, line, sizeof(ut.ut_line));
+	strncpy(ut.ut_user, "root", sizeof(ut.ut_user));
+	len = strlen(line);
+	strncpy(ut.ut_id, line + (len > sizeof(ut.ut_id) ?
+	    len - sizeof(ut.ut_id) : 0), sizeof(ut.ut_id));
+	gettimeofday(&tv, NULL);
+	ut.ut_tv.tv_sec = tv.tv_sec;
+	ut.ut_tv.tv_usec = tv.tv_usec;
+	setutxent();
+	if (pututxline(&ut) == NULL)
+		warn("pututxline %s", line);
+	endutxent();
+}
+
+/*
+ * "typing=70,flood=20,redraw=10" gives the share of each kind of
+ * session.
+ */
+static void
+parsemix(const char *str, int *weights)
+{
+	char *s, *p, *tok, *eq, *endp;
+	int i;
+
+	memset(weights, 0, M_COUNT * sizeof(int));
+	if ((s = strdup(str)) == NULL)
+		err(1, "strdup failed");
+	for (p = s; (tok = strsep(&p, ",")) != NULL;) {
+		if ((eq = strchr(tok, '=')) == NULL)
+			errx(1, "%s: invalid mix", str);
+		*eq++ = '\0';
+		for (i = 0; i < M_COUNT; i++)
+			if (strcmp(tok, modes[i]) == 0)
+				break;
+		if (i == M_COUNT)
+			errx(1, "%s: unknown session kind", tok);
+		weights[i] = strtol(eq, &endp, 10);
+		if (*endp != '\0' || weights[i] < 0)
+			errx(1, "%s: invalid weight", eq);
+	}
+	free(s);
+}
+
+/*
+ * Pick kinds so that every prefix of the sessions has about the
+ * right mix, in case the run is cut short.
+ */
+static int
+pickmode(const int *weights, int *given, int n)
+{
+	int i, best, total;
+	double lag, bestlag;
+
+	total = 0;
+	for (i = 0; i < M_COUNT; i++)
+		total += weights[i];
+	best = -1;
+	bestlag = 0;
+	for (i = 0; i < M_COUNT; i++) {
+		if (weights[i] == 0)
+			continue;
+		lag = (double)weights[i] / total * (n + 1) - given[i];
+		if (best < 0 || lag > bestlag) {
+			best = i;
+			bestlag = lag;
+		}
+	}
+	given[best]++;
+	return (best);
+}
+
+static int
+cmp64(const void *a, const void *b)
+{
+	uint64_t x, y;
+
+	x = *(const uint64_t *)a;
+	y = *(const uint64_t *)b;
+	return (x < y ? -1 : x > y);
+}
+
+static double
+pct(double p)
+{
+	if (nlat == 0)
+		return (0);
+	return (lat[MIN((size_t)(p * nlat), nlat - 1)] / 1000.0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char self[MAXPATHLEN], logdir[MAXPATHLEN], spool[MAXPATHLEN];
+	char path[MAXPATHLEN], mode[16], id[16], dur[32], spd[32];
+	char copt[] = "-C", popt[] = "-P";
+	char **targv, (*lines)[32];
+	const char *progname, *termlog, *ptyprog, *mix, *output;
+	int weights[M_COUNT], given[M_COUNT], sessions, emitmode, kflag;
+	int ch, i, n, eid, slave, status, made;
+	uint64_t sent, marks, b, t0, elapsed;
+	u_long m;
+	struct rusage ru;
+	struct rlimit rl;
+	pthread_t wthr, dthr;
+	pid_t *pids, tpid;
+	double mb, cpu;
+	FILE *fp;
+
+	progname = argv[0];
+	termlog = "./termlog";
+	ptyprog = "./termlog-pty";
+	mix = "typing=70,flood=20,redraw=10";
+	output = NULL;
+	workdir = NULL;
+	sessions = 16;
+	emitmode = -1;
+	eid = 0;
+	kflag = 0;
+	while ((ch = getopt(argc, argv, "C:d:E:i:km:n:o:P:r:s:T:")) != -1)
+		switch (ch) {
+		case 'C':
+			workdir = optarg;
+			break;
+		case 'd':
+			duration = strtod(optarg, NULL) * 1000000;
+			break;
+		case 'E':
+			for (emitmode = 0; emitmode < M_COUNT; emitmode++)
+				if (strcmp(optarg, modes[emitmode]) == 0)
+					break;
+			if (emitmode == M_COUNT)
+				usage();
+			break;
+		case 'i':
+			eid = atoi(optarg);
+			break;
+		case 'k':
+			kflag = 1;
+			break;
+		case 'm':
+			mix = optarg;
+			break;
+		case 'n':
+			sessions = atoi(optarg);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'P':
+			ptyprog = optarg;
+			break;
+		case 'r':
+			replayfile = optarg;
+			break;
+		case 's':
+			speed = strtod(optarg, NULL);
+			break;
+		case 'T':
+			termlog = optarg;
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (emitmode >= 0)
+		emitter(eid, emitmode);
+	if (sessions <= 0 || duration == 0 || speed <= 0)
+		usage();
+	parsemix(mix, weights);
+	if (weights[M_REPLAY] > 0 && replayfile == NULL)
+		errx(1, "replay sessions need a log to replay, see -r");
+	if (replayfile != NULL && realpath(replayfile, path) != NULL)
+		replayfile = strdup(path);
+	if (realpath("/proc/self/exe", self) == NULL &&
+	    realpath(progname, self) == NULL)
+		errx(1, "can not find myself");
+
+	if (workdir == NULL) {
+		snprintf(path, sizeof(path), "/tmp/tlbench.%d", getpid());
+		workdir = strdup(path);
+	}
+	snprintf(logdir, sizeof(logdir), "%s/logs", workdir);
+	snprintf(spool, sizeof(spool), "%s/spool", workdir);
+	made = 0;
+	if (mkdir(workdir, 0755) == 0)
+		made |= MADE_WORKDIR;
+	else if (errno != EEXIST)
+		err(1, "mkdir %s", workdir);
+	if (mkdir(logdir, 0755) == 0)
+		made |= MADE_LOGS;
+	else if (errno != EEXIST)
+		err(1, "mkdir %s", logdir);
+	if (mkdir(spool, 01777) == 0)
+		made |= MADE_SPOOL;
+	else if (errno != EEXIST)
+		err(1, "mkdir %s", spool);
+
+	/* a pty each, plus what termlog-pty and the logs need */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+	    rl.rlim_cur < (rlim_t)sessions * 2 + 64) {
+		rl.rlim_cur = MIN(rl.rlim_max, (rlim_t)sessions * 2 + 64);
+		(void)setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	/* termlog, with whatever arguments were given after -- */
+	targv = calloc(argc + 8, sizeof(char *));
+	if (targv == NULL)
+		err(1, "calloc failed");
+	n = 0;
+	targv[n++] = (char *)(uintptr_t)termlog;
+	targv[n++] = copt;
+	targv[n++] = logdir;
+	targv[n++] = popt;
+	targv[n++] = spool;
+	for (i = 0; i < argc; i++)
+		targv[n++] = argv[i];
+	targv[n] = NULL;
+	if ((tpid = fork()) < 0)
+		err(1, "fork failed");
+	if (tpid == 0) {
+		execv(termlog, targv);
+		err(1, "%s", termlog);
+	}
+
+	runstart = now_usec();
+	masters = calloc(sessions, sizeof(*masters));
+	pids = calloc(sessions, sizeof(*pids));
+	lines = calloc(sessions, sizeof(*lines));
+	if (masters == NULL || pids == NULL || lines == NULL)
+		err(1, "calloc failed");
+	memset(given, 0, sizeof(given));
+	snprintf(dur, sizeof(dur), "%f", duration / 1e6);
+	snprintf(spd, sizeof(spd), "%f", speed);
+	for (i = 0; i < sessions; i++) {
+		masters[i].fd = posix_openpt(O_RDWR | O_NOCTTY);
+		if (masters[i].fd < 0 || grantpt(masters[i].fd) < 0 ||
+		    unlockpt(masters[i].fd) < 0)
+			err(1, "unable to allocate pty %d", i);
+		masters[i].events = POLLIN;
+		(void)fcntl(masters[i].fd, F_SETFL, O_NONBLOCK);
+		strlcpy(path, ptsname(masters[i].fd), sizeof(path));
+		strlcpy(mode, modes[pickmode(weights, given, i)],
+		    sizeof(mode));
+		snprintf(id, sizeof(id), "%d", i);
+		if ((pids[i] = fork()) < 0)
+			err(1, "fork failed");
+		if (pids[i] == 0) {
+			setsid();
+			if ((slave = open(path, O_RDWR)) < 0)
+				err(1, "%s", path);
+			(void)ioctl(slave, TIOCSCTTY, 0);
+			dup2(slave, STDIN_FILENO);
+			dup2(slave, STDOUT_FILENO);
+			dup2(slave, STDERR_FILENO);
+			if (slave > STDERR_FILENO)
+				close(slave);
+			/* the list ends early without a replay log */
+#ifdef __linux__
+			execl(ptyprog, ptyprog, "-d", spool, "--", self, "-C",
+			    workdir, "-d", dur, "-E", mode, "-i", id, "-s",
+			    spd, replayfile != NULL ? "-r" : NULL,
+			    replayfile, (char *)NULL);
+			err(1, "%s", ptyprog);
+#else
+			execl(self, self, "-C", workdir, "-d", dur, "-E",
+			    mode, "-i", id, "-s", spd,
+			    replayfile != NULL ? "-r" : NULL, replayfile,
+			    (char *)NULL);
+			err(1, "%s", self);
+#endif
+		}
+		strlcpy(lines[i], path + strlen(_PATH_DEV), sizeof(lines[i]));
+		setutmp(lines[i], pids[i], USER_PROCESS);
+	}
+	nmasters = sessions;
+	fprintf(stderr, "tlbench: %d sessions (%s) for %.1fs, work "
+	    "directory %s\n", sessions, mix, duration / 1e6, workdir);
+
+	if (pthread_create(&wthr, NULL, watcher, logdir) ||
+	    pthread_create(&dthr, NULL, drainer, NULL))
+		err(1, "pthread_create failed");
+	t0 = now_usec();
+	for (i = 0; i < sessions; i++) {
+		while (waitpid(pids[i], &status, 0) < 0 && errno == EINTR)
+			;
+		setutmp(lines[i], pids[i], DEAD_PROCESS);
+	}
+	/* the time the sessions had, without start up and drain */
+	elapsed = now_usec() - t0;
+	if (elapsed > WARMUP)
+		elapsed -= WARMUP;
+	sleep_usec(GRACE);
+	kill(tpid, SIGTERM);
+	if (wait4(tpid, &status, 0, &ru) < 0)
+		err(1, "wait4 failed");
+	atomic_store(&stopping, 1);
+	pthread_join(wthr, NULL);
+	pthread_join(dthr, NULL);
+
+	sent = marks = 0;
+	for (i = 0; i < sessions; i++) {
+		snprintf(path, sizeof(path), "%s/sent.%d", workdir, i);
+		if ((fp = fopen(path, "r")) == NULL)
+			continue;
+		if (fscanf(fp, "%*d %*s %ju %lu", &b, &m) == 2) {
+			sent += b;
+			marks += m;
+		}
+		fclose(fp);
+		if (!kflag)
+			unlink(path);
+	}
+	qsort(lat, nlat, sizeof(*lat), cmp64);
+	mb = logged / 1048576.0;
+	cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+	    ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+
+	fp = stdout;
+	if (output != NULL && (fp = fopen(output, "a")) == NULL)
+		err(1, "%s", output);
+	fprintf(fp, "{\"sessions\": %d, \"mix\": \"%s\", \"duration_s\": "
+	    "%.3f, \"speed\": %.2f, \"bytes_sent\": %ju, \"bytes_logged\": "
+	    "%ju, \"throughput_mb_s\": %.3f, \"cpu_user_s\": %.3f, "
+	    "\"cpu_sys_s\": %.3f, \"cpu_s_per_mb\": %.5f, \"max_rss_kb\": "
+	    "%ld, \"overflows\": %lu, \"markers_sent\": %ju, "
+	    "\"markers_seen\": %zu, \"loss_rate\": %.6f, \"latency_ms\": "
+	    "{\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p999\": %.3f, "
+	    "\"max\": %.3f}}\n",
+	    sessions, mix, elapsed / 1e6, speed, (uintmax_t)sent,
+	    (uintmax_t)logged, mb / (elapsed / 1e6),
+	    ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6,
+	    ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6,
+	    mb > 0 ? cpu / mb : 0.0, ru.ru_maxrss, overflows,
+	    (uintmax_t)marks, nlat,
+	    marks > 0 && nlat < marks ? 1 - (double)nlat / marks : 0.0,
+	    pct(0.5), pct(0.9), pct(0.99), pct(0.999),
+	    nlat > 0 ? lat[nlat - 1] / 1000.0 : 0.0);
+	if (output != NULL)
+		fclose(fp);
+	if (!kflag) {
+		for (i = 0; i < (int)nfiles; i++)
+			unlink(files[i].w_name);
+		cleanup(logdir, spool, made);
+	}
+	return (0);
+}
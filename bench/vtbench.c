@@ -0,0 +1,289 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * vtbench: throughput of the -N escape stripper.
+ *
+ * Strips synthetic terminal output in chunks the size of a typical
+ * read, once a byte at a time through the state machine (the scalar
+ * baseline) and once with each run finder the CPU has.  The streams
+ * are "plain" (lines of words, no escapes, like build output), "shell"
+ * (prompts with a title and colors, commands and colored listings)
+ * and "tui" (a full screen program repainting: cursor motion and a
+ * color change every few cells).  Before timing, every way of
+ * stripping is checked to give the same text, in one piece and in
+ * chunks.  One JSON object is written per stream and method.
+ */
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vtstrip.h"
+
+#define	CHECKSIZE	(1024 * 1024)
+
+typedef size_t (*strip_t)(struct vtstate *, char *, size_t, const char *,
+    size_t);
+
+struct buf {
+	char	*b_buf;
+	size_t	 b_len;
+	size_t	 b_cap;
+	size_t	 b_esc;		/* escape sequences in it */
+};
+
+static uint64_t
+nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static void
+put(struct buf *b, const char *s)
+{
+	size_t len;
+
+	len = strlen(s);
+	if (b->b_len + len > b->b_cap)
+		len = b->b_cap - b->b_len;
+	memcpy(b->b_buf + b->b_len, s, len);
+	b->b_len += len;
+	if (s[0] == '\033')
+		b->b_esc++;
+}
+
+static const char *
+word(void)
+{
+	static char w[16];
+	int i, len;
+
+	len = 2 + random() % 9;
+	for (i = 0; i < len; i++)
+		w[i] = 'a' + random() % 26;
+	w[len] = '\0';
+	return (w);
+}
+
+static void
+mkplain(struct buf *b)
+{
+	int col;
+
+	for (col = 0; b->b_len < b->b_cap; ) {
+		put(b, word());
+		if (++col < 6 + random() % 10)
+			put(b, " ");
+		else {
+			put(b, "\r\n");
+			col = 0;
+		}
+	}
+}
+
+static void
+mkshell(struct buf *b)
+{
+	static const char *colors[] = { "01;34", "01;32", "01;36", "00",
+	    "01;31", "40;33;01" };
+	char sgr[32];
+	int i, n;
+
+	while (b->b_len < b->b_cap) {
+		put(b, "\033]0;alice@build: ~/src\007");
+		put(b, "\033[01;32m");
+		put(b, "alice@build");
+		put(b, "\033[00m");
+		put(b, ":");
+		put(b, "\033[01;34m");
+		put(b, "~/src");
+		put(b, "\033[00m");
+		put(b, "$ ls --color\b\b\b\b\b\b\b\b");
+		put(b, "\033[K");
+		put(b, "-la\r\n");
+		for (n = 2 + random() % 12; n > 0; n--) {
+			for (i = 0; i < 4; i++) {
+				snprintf(sgr, sizeof(sgr), "\033[%sm",
+				    colors[random() % 6]);
+				put(b, sgr);
+				put(b, word());
+				put(b, "\033[0m");
+				put(b, "  ");
+			}
+			put(b, "\r\n");
+		}
+		for (n = random() % 8; n > 0; n--) {
+			for (i = 6 + random() % 10; i > 0; i--) {
+				put(b, word());
+				put(b, " ");
+			}
+			put(b, "\r\n");
+		}
+	}
+}
+
+static void
+mktui(struct buf *b)
+{
+	char seq[32];
+	int row, col;
+
+	while (b->b_len < b->b_cap) {
+		row = 1 + random() % 50;
+		col = 1 + random() % 200;
+		snprintf(seq, sizeof(seq), "\033[%d;%dH", row, col);
+		put(b, seq);
+		snprintf(seq, sizeof(seq), "\033[%d;%dm", (int)(30 + random() % 8),
+		    (int)(40 + random() % 8));
+		put(b, seq);
+		put(b, word() + random() % 2);
+		if (random() % 16 == 0)
+			put(b, "\033(B\033[m\033[K");
+	}
+}
+
+static void
+run(strip_t fn, const char *in, size_t size, size_t chunk, char *out,
+    size_t *olen)
+{
+	struct vtstate vs;
+	size_t off, n;
+
+	vt_init(&vs);
+	*olen = 0;
+	for (off = 0; off < size; off += n) {
+		n = chunk < size - off ? chunk : size - off;
+		*olen = fn(&vs, out, *olen, in + off, n);
+	}
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	    "usage: vtbench [-c chunk] [-d ms] [-s mbytes] [-w workload]\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const char *methods[] = { "bytewise", "scalar", "sse2",
+	    "avx2" };
+	static const struct {
+		const char	*name;
+		void		(*make)(struct buf *);
+	} loads[] = {
+		{ "plain", mkplain },
+		{ "shell", mkshell },
+		{ "tui", mktui },
+	};
+	struct buf b;
+	char *out, *ref;
+	const char *only;
+	size_t size, chunk, olen, rlen;
+	uint64_t t0, t1, reps;
+	strip_t fn;
+	int ch, l, m, msecs;
+
+	size = 64;
+	chunk = 4096;
+	msecs = 1000;
+	only = NULL;
+	while ((ch = getopt(argc, argv, "c:d:s:w:")) != -1)
+		switch (ch) {
+		case 'c':
+			chunk = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			msecs = atoi(optarg);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			only = optarg;
+			break;
+		default:
+			usage();
+		}
+	if (chunk == 0 || size == 0 || msecs <= 0)
+		usage();
+	size *= 1024 * 1024;
+	if (size < CHECKSIZE)
+		size = CHECKSIZE;
+	if ((b.b_buf = malloc(size)) == NULL ||
+	    (out = malloc(size)) == NULL || (ref = malloc(size)) == NULL)
+		err(1, "malloc");
+	for (l = 0; l < (int)(sizeof(loads) / sizeof(loads[0])); l++) {
+		if (only != NULL && strcmp(only, loads[l].name) != 0)
+			continue;
+		srandom(1);
+		b.b_len = b.b_esc = 0;
+		b.b_cap = size;
+		loads[l].make(&b);
+		run(vt_strip_scalar, b.b_buf, CHECKSIZE, CHECKSIZE, ref, &rlen);
+		for (m = 0; m < (int)(sizeof(methods) / sizeof(methods[0]));
+		    m++) {
+			fn = vt_strip;
+			if (m == 0)
+				fn = vt_strip_scalar;
+			else if (vt_select(methods[m]) < 0)
+				continue;
+			run(fn, b.b_buf, CHECKSIZE, chunk, out, &olen);
+			if (olen != rlen || memcmp(out, ref, rlen) != 0)
+				errx(1, "%s, %s: stripped text differs",
+				    loads[l].name, methods[m]);
+			reps = 0;
+			t0 = nsec();
+			do {
+				run(fn, b.b_buf, size, chunk, out, &olen);
+				reps++;
+				t1 = nsec();
+			} while (t1 - t0 < msecs * 1000000ULL);
+			printf("{\"workload\":\"%s\",\"method\":\"%s\","
+			    "\"chunk\":%zu,\"escapes_per_kb\":%.1f,"
+			    "\"text_ratio\":%.3f,\"gb_s\":%.3f}\n",
+			    loads[l].name, methods[m], chunk,
+			    b.b_esc / (size / 1024.0), (double)olen / size,
+			    (double)size * reps / 1e9 / ((t1 - t0) / 1e9));
+			fflush(stdout);
+		}
+	}
+	return (0);
+}
@@ -0,0 +1,324 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/param.h>
+
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compat.h"
+#include "budget.h"
+
+#define	BUDGET_HASHSIZE	64
+
+#if defined(CLOCK_MONOTONIC_COARSE)
+#define	CLOCK_BUDGET	CLOCK_MONOTONIC_COARSE
+#elif defined(CLOCK_MONOTONIC_FAST)
+#define	CLOCK_BUDGET	CLOCK_MONOTONIC_FAST
+#else
+#define	CLOCK_BUDGET	CLOCK_MONOTONIC
+#endif
+
+/*
+ * One per user with a session attached, shared by all of them and
+ * found by name when a session is set up.
+ */
+struct budget_user {
+	char		bu_name[64];
+	int		bu_refs;	/* protected by bu_tablock */
+	pthread_mutex_t	bu_lock;	/* protects bu_bucket */
+	struct bucket	bu_bucket;
+	LIST_ENTRY(budget_user) bu_link;
+};
+
+struct budget_conf sessbudget;
+struct budget_conf userbudget;
+
+static LIST_HEAD(, budget_user) bu_hash[BUDGET_HASHSIZE];
+static pthread_mutex_t bu_tablock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_ulong bg_summaries;	/* summaries started */
+static atomic_ulong bg_chunks;		/* chunks summarized */
+static atomic_ulong bg_bytes;		/* ... and their size */
+static atomic_ulong bg_exempt;		/* small chunks let through */
+
+static int
+parsesize(const char *str, char **endp, int64_t *val)
+{
+	*val = strtoll(str, endp, 10);
+	if (*endp == str || *val <= 0)
+		return (-1);
+	switch (**endp) {
+	case 'g':
+	case 'G':
+		*val *= 1024;
+		/* FALL THROUGH */
+	case 'm':
+	case 'M':
+		*val *= 1024;
+		/* FALL THROUGH */
+	case 'k':
+	case 'K':
+		*val *= 1024;
+		(*endp)++;
+		break;
+	}
+	return (0);
+}
+
+/*
+ * A budget is a rate in bytes per second, optionally followed by a
+ * colon and the burst, both with an optional k, m or g suffix.  The
+ * burst defaults to one second's worth.
+ */
+int
+budget_parse(const char *str, struct budget_conf *bc)
+{
+	char *endp;
+
+	if (parsesize(str, &endp, &bc->bc_rate) < 0)
+		return (-1);
+	bc->bc_burst = bc->bc_rate;
+	if (*endp == ':' &&
+	    parsesize(endp + 1, &endp, &bc->bc_burst) < 0)
+		return (-1);
+	if (*endp != '\0')
+		return (-1);
+	return (0);
+}
+
+int
+budget_enabled(void)
+{
+	return (sessbudget.bc_rate > 0 || userbudget.bc_rate > 0);
+}
+
+static u_int
+budget_hash(const char *name)
+{
+	u_int h;
+
+	for (h = 2166136261U; *name != '\0'; name++)
+		h = (h ^ (u_char)*name) * 16777619U;
+	return (h % BUDGET_HASHSIZE);
+}
+
+struct budget *
+budget_new(const char *user)
+{
+	struct budget_user *bu;
+	struct budget *b;
+	u_int h;
+
+	b = calloc(1, sizeof(*b));
+	if (b == NULL)
+		return (NULL);
+	if (userbudget.bc_rate == 0)
+		return (b);
+	h = budget_hash(user);
+	pthread_mutex_lock(&bu_tablock);
+	LIST_FOREACH(bu, &bu_hash[h], bu_link)
+		if (strcmp(bu->bu_name, user) == 0)
+			break;
+	if (bu == NULL) {
+		bu = calloc(1, sizeof(*bu));
+		if (bu == NULL) {
+			pthread_mutex_unlock(&bu_tablock);
+			free(b);
+			return (NULL);
+		}
+		strlcpy(bu->bu_name, user, sizeof(bu->bu_name));
+		pthread_mutex_init(&bu->bu_lock, NULL);
+		LIST_INSERT_HEAD(&bu_hash[h], bu, bu_link);
+	}
+	bu->bu_refs++;
+	pthread_mutex_unlock(&bu_tablock);
+	b->bg_user = bu;
+	return (b);
+}
+
+void
+budget_free(struct budget *b)
+{
+	struct budget_user *bu;
+
+	if ((bu = b->bg_user) != NULL) {
+		pthread_mutex_lock(&bu_tablock);
+		if (--bu->bu_refs == 0) {
+			LIST_REMOVE(bu, bu_link);
+			pthread_mutex_destroy(&bu->bu_lock);
+			free(bu);
+		}
+		pthread_mutex_unlock(&bu_tablock);
+	}
+	free(b);
+}
+
+static void
+refill(struct bucket *bk, const struct budget_conf *bc, uint64_t now)
+{
+	double add;
+
+	if (bk->bk_last == 0) {
+		bk->bk_tokens = bc->bc_burst;
+		bk->bk_last = now;
+		return;
+	}
+	/* wait for at least a whole byte so fractions are not lost */
+	add = (double)(now - bk->bk_last) * bc->bc_rate / 1000000;
+	if (add < 1)
+		return;
+	if (add >= bc->bc_burst - bk->bk_tokens)
+		bk->bk_tokens = bc->bc_burst;
+	else
+		bk->bk_tokens += (int64_t)add;
+	bk->bk_last = now;
+}
+
+/*
+ * While summarizing, a bucket has to refill to half its burst before
+ * we go back to logging everything, or a session writing just above
+ * its rate would flip in and out of summaries all the time.
+ */
+static int
+enough(const struct bucket *bk, const struct budget_conf *bc, int over,
+    size_t len)
+{
+	if (over)
+		return (bk->bk_tokens >= bc->bc_burst / 2);
+	return (bk->bk_tokens >= MIN((int64_t)len, bc->bc_burst));
+}
+
+static void
+charge(struct bucket *bk, size_t len)
+{
+	bk->bk_tokens = bk->bk_tokens > (int64_t)len ?
+	    bk->bk_tokens - (int64_t)len : 0;
+}
+
+/*
+ * Account for len bytes of output and tell whether they are within
+ * budget.  Output that gets summarized is charged as well, so a
+ * session stays over budget for as long as it keeps writing faster
+ * than its rate.  Called by whoever is servicing the session.
+ */
+int
+budget_take(struct budget *b, size_t len)
+{
+	struct budget_user *bu;
+	struct timespec ts;
+	uint64_t now;
+	int ok;
+
+	clock_gettime(CLOCK_BUDGET, &ts);
+	now = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	ok = 1;
+	if (sessbudget.bc_rate > 0) {
+		refill(&b->bg_bucket, &sessbudget, now);
+		ok = enough(&b->bg_bucket, &sessbudget, b->bg_over, len);
+		charge(&b->bg_bucket, len);
+	}
+	if ((bu = b->bg_user) != NULL) {
+		pthread_mutex_lock(&bu->bu_lock);
+		refill(&bu->bu_bucket, &userbudget, now);
+		if (len <= BUDGET_SMALL && !b->bg_over) {
+			if (!enough(&bu->bu_bucket, &userbudget, 0, len))
+				atomic_fetch_add(&bg_exempt, 1);
+		} else if (ok)
+			ok = enough(&bu->bu_bucket, &userbudget, b->bg_over,
+			    len);
+		charge(&bu->bu_bucket, len);
+		pthread_mutex_unlock(&bu->bu_lock);
+	}
+	if (!ok && !b->bg_over) {
+		b->bg_over = 1;
+		atomic_fetch_add(&bg_summaries, 1);
+	}
+	return (ok);
+}
+
+/*
+ * Keep the last BUDGET_SAMPLE bytes of what is being summarized.
+ */
+void
+budget_stash(struct budget *b, const char *ptr, size_t len)
+{
+	size_t off, n;
+
+	if (len == 0)
+		return;
+	b->bg_skipped += len;
+	atomic_fetch_add(&bg_chunks, 1);
+	atomic_fetch_add(&bg_bytes, len);
+	if (len >= BUDGET_SAMPLE) {
+		memcpy(b->bg_tail, ptr + len - BUDGET_SAMPLE, BUDGET_SAMPLE);
+		b->bg_tailoff = 0;
+		b->bg_taillen = BUDGET_SAMPLE;
+		return;
+	}
+	off = (b->bg_tailoff + b->bg_taillen) % BUDGET_SAMPLE;
+	n = MIN(len, BUDGET_SAMPLE - off);
+	memcpy(b->bg_tail + off, ptr, n);
+	memcpy(b->bg_tail, ptr + n, len - n);
+	b->bg_taillen += len;
+	if (b->bg_taillen > BUDGET_SAMPLE) {
+		b->bg_tailoff = (b->bg_tailoff + b->bg_taillen -
+		    BUDGET_SAMPLE) % BUDGET_SAMPLE;
+		b->bg_taillen = BUDGET_SAMPLE;
+	}
+}
+
+/*
+ * The summary has been written out: start afresh.
+ */
+void
+budget_ended(struct budget *b)
+{
+	b->bg_over = 0;
+	b->bg_head = 0;
+	b->bg_skipped = 0;
+	b->bg_tailoff = 0;
+	b->bg_taillen = 0;
+}
+
+void
+budget_dumpstats(FILE *fp)
+{
+	if (!budget_enabled())
+		return;
+	fprintf(fp, "Budget statistics:\n%-10s %-12s %-14s %s\n",
+	    "SUMMARIES", "CHUNKS", "BYTES", "EXEMPT");
+	fprintf(fp, "%-10lu %-12lu %-14lu %lu\n", atomic_load(&bg_summaries),
+	    atomic_load(&bg_chunks), atomic_load(&bg_bytes),
+	    atomic_load(&bg_exempt));
+}
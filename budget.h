@@ -0,0 +1,80 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef	BUDGET_DOT_H_
+#define	BUDGET_DOT_H_
+
+#include <stdint.h>
+
+/*
+ * I/O budgets, kept as token buckets per session and per user.  A
+ * session which runs out has its output summarized until it has been
+ * under budget for a while: the first BUDGET_SAMPLE bytes are logged,
+ * the rest is only counted, and the last BUDGET_SAMPLE bytes are
+ * logged when the summary ends.  Chunks of up to BUDGET_SMALL bytes
+ * are typed input echoing back and prompts; another session of the
+ * same user going over the user's budget never holds those back.
+ */
+#define	BUDGET_SAMPLE	512
+#define	BUDGET_SMALL	128
+
+struct budget_conf {
+	int64_t		bc_rate;	/* bytes per second, 0 if unlimited */
+	int64_t		bc_burst;
+};
+
+struct bucket {
+	int64_t		bk_tokens;
+	uint64_t	bk_last;	/* last refill, usec */
+};
+
+struct budget_user;
+
+struct budget {
+	struct bucket	bg_bucket;	/* the session's own */
+	struct budget_user *bg_user;
+	int		bg_over;	/* summarizing */
+	size_t		bg_head;	/* of the summary, logged so far */
+	uint64_t	bg_skipped;	/* bytes not logged */
+	char		bg_tail[BUDGET_SAMPLE];
+	size_t		bg_tailoff;	/* oldest byte of the tail */
+	size_t		bg_taillen;
+};
+
+extern struct budget_conf sessbudget;
+extern struct budget_conf userbudget;
+
+int budget_parse(const char *, struct budget_conf *);
+int budget_enabled(void);
+struct budget *budget_new(const char *);
+void budget_free(struct budget *);
+int budget_take(struct budget *, size_t);
+void budget_stash(struct budget *, const char *, size_t);
+void budget_ended(struct budget *);
+void budget_dumpstats(FILE *);
+#endif	/* BUDGET_DOT_H_ */
@@ -0,0 +1,68 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef	CAPTURE_DOT_H_
+#define	CAPTURE_DOT_H_
+
+/*
+ * A capture source is whatever mechanism we use to obtain a copy of
+ * the I/O on a tty line.  Historically this was always snp(4); the
+ * event loop now only talks to the source through this table.
+ *
+ * cs_readv() returns the number of bytes read, 0 if nothing is
+ * available right now, -1 on error, or one of the following when
+ * the source has something else to report.  Notification is edge
+ * triggered, so it must not return 0 while data may still be queued:
+ * an interrupted read is retried.
+ *
+ * cs_bufsize() returns how much the source can queue for us before
+ * it has to drop data, after trying to enlarge that to size if size
+ * is larger.
+ */
+#define	CS_OFLOW	(-2)	/* data may have been dropped */
+#define	CS_DETACH	(-3)	/* the tty went away */
+
+struct iovec;
+struct capsrc {
+	const char	*cs_name;
+	int		(*cs_init)(void);
+	void	       *(*cs_attach)(char *line);
+	int		(*cs_fd)(void *handle);
+	int		(*cs_readv)(void *handle, struct iovec *iov, int cnt);
+	int		(*cs_overflow)(void *handle);
+	int		(*cs_bufsize)(void *handle, int size);
+	void		(*cs_detach)(void *handle);
+};
+
+#ifdef __FreeBSD__
+extern struct capsrc snp_capsrc;
+#endif
+#ifdef __linux__
+extern struct capsrc pty_capsrc;
+#endif
+#endif	/* CAPTURE_DOT_H_ */
@@ -0,0 +1,251 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include <utmpx.h>
+#include "utmp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <paths.h>
+#include <err.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "compat.h"
+#include "termlog.h"
+#include "capture.h"
+
+#ifdef __linux__
+/*
+ * Linux has no equivalent of snp(4), so sessions which are to be
+ * logged have to run under termlog-pty(1).  The proxy sits between
+ * the login tty and a private pty, and tee(2)s everything the session
+ * writes into a fifo named after the login tty in the spool
+ * directory.  Attaching to a tty therefore just means opening that
+ * fifo.  The proxy never blocks on us: if the fifo fills up it drops
+ * data and bumps a counter in a small file it shares with us, which
+ * we report the same way snp(4) reports an overflow.
+ */
+struct ptyhandle {
+	int		ph_fd;
+	int		ph_size;	/* capacity of the fifo */
+	_Atomic(uint64_t) *ph_drops;	/* shared with the proxy */
+	uint64_t	ph_seen;
+};
+
+static _Atomic(uint64_t) *
+pty_mapoflow(char *fifo, uid_t uid)
+{
+	char path[MAXPATHLEN];
+	struct stat sb;
+	void *p;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s%s", fifo, TERMLOG_OFLOW_SUFFIX);
+	fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (fd < 0)
+		return (NULL);
+	p = MAP_FAILED;
+	if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) &&
+	    (sb.st_uid == uid || sb.st_uid == 0) &&
+	    sb.st_size >= (off_t)sizeof(uint64_t))
+		p = mmap(NULL, sizeof(uint64_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	return (p == MAP_FAILED ? NULL : p);
+}
+
+extern char *rootfs;
+extern char *spooldir;
+extern int vflag;
+
+static int
+pty_init(void)
+{
+	char path[MAXPATHLEN];
+
+	snprintf(path, sizeof(path), "%s%s", rootfs, spooldir);
+	if (mkdir(path, 01777) < 0 && errno != EEXIST)
+		err(1, "mkdir %s failed", path);
+	/* mkdir(2) is subject to our umask */
+	if (chmod(path, 01777) < 0)
+		err(1, "chmod %s failed", path);
+	return (0);
+}
+
+static void *
+pty_attach(char *tty_line)
+{
+	char line[MAXPATHLEN], fifo[MAXPATHLEN], *p;
+	struct ptyhandle *ph;
+	struct stat sb, fsb;
+	int fd;
+
+	assert(tty_line != NULL);
+	snprintf(line, sizeof(line), "%s%s%s", rootfs, _PATH_DEV,
+	    tty_line);
+	if (stat(line, &sb) < 0) {
+		warn("stat %s failed", tty_line);
+		return (NULL);
+	}
+	if ((sb.st_mode & S_IFMT) != S_IFCHR) {
+		warn("%s not a device", tty_line);
+		return (NULL);
+	}
+	snprintf(fifo, sizeof(fifo), "%s%s/", rootfs, spooldir);
+	p = fifo + strlen(fifo);
+	strlcpy(p, tty_line, sizeof(fifo) - (p - fifo));
+	while ((p = index(p, '/')) != NULL)
+		*p = '_';
+	fd = open(fifo, O_RDONLY | O_NONBLOCK);
+	if (fd < 0) {
+		DEBUG(vflag, "%s is not proxied: retrying on next "
+		    "login/logout event", tty_line);
+		return (NULL);
+	}
+	/*
+	 * The spool directory is world writable, so make sure the fifo
+	 * really belongs to whoever owns the tty.
+	 */
+	if (fstat(fd, &fsb) < 0 || !S_ISFIFO(fsb.st_mode) ||
+	    (fsb.st_uid != sb.st_uid && fsb.st_uid != 0)) {
+		warnx("%s: bad owner or type, ignoring", fifo);
+		close(fd);
+		return (NULL);
+	}
+	ph = malloc(sizeof(struct ptyhandle));
+	if (ph == NULL) {
+		close(fd);
+		return (NULL);
+	}
+	ph->ph_fd = fd;
+	ph->ph_size = fcntl(fd, F_GETPIPE_SZ);
+	ph->ph_drops = pty_mapoflow(fifo, sb.st_uid);
+	ph->ph_seen = ph->ph_drops != NULL ? atomic_load(ph->ph_drops) : 0;
+	DEBUG(vflag, "fifo %s fd %d attached to tty %s", fifo, fd, line);
+	return (ph);
+}
+
+static int
+pty_fd(void *handle)
+{
+	struct ptyhandle *ph;
+
+	ph = (struct ptyhandle *)handle;
+	return (ph->ph_fd);
+}
+
+static int
+pty_readv(void *handle, struct iovec *iov, int cnt)
+{
+	struct ptyhandle *ph;
+	ssize_t n;
+
+	ph = (struct ptyhandle *)handle;
+	if (ph->ph_drops != NULL &&
+	    atomic_load_explicit(ph->ph_drops, memory_order_relaxed) !=
+	    ph->ph_seen) {
+		ph->ph_seen = atomic_load(ph->ph_drops);
+		return (CS_OFLOW);
+	}
+	while ((n = readv(ph->ph_fd, iov, cnt)) < 0 && errno == EINTR)
+		;
+	if (n < 0 && errno == EAGAIN)
+		return (0);
+	/* end of file: the proxy has gone away */
+	if (n == 0)
+		return (CS_DETACH);
+	return (n);
+}
+
+/*
+ * Unlike snp(4) the fifo survives an overflow, the data that is
+ * still queued in it is valid.
+ */
+static int
+pty_overflow(void *handle __unused)
+{
+	return (0);
+}
+
+/*
+ * The fifo can grow up to whatever fs.pipe-max-size and the owner's
+ * pipe quota allow.  Failure just leaves it the size it was.
+ */
+static int
+pty_bufsize(void *handle, int size)
+{
+	struct ptyhandle *ph;
+	int n;
+
+	ph = (struct ptyhandle *)handle;
+	if (size > ph->ph_size) {
+		n = fcntl(ph->ph_fd, F_SETPIPE_SZ, size);
+		if (n < 0)
+			DEBUG(vflag, "F_SETPIPE_SZ %d failed: %s", size,
+			    strerror(errno));
+		else
+			ph->ph_size = n;
+	}
+	return (ph->ph_size);
+}
+
+static void
+pty_detach(void *handle)
+{
+	struct ptyhandle *ph;
+
+	ph = (struct ptyhandle *)handle;
+	close(ph->ph_fd);
+	if (ph->ph_drops != NULL)
+		munmap(ph->ph_drops, sizeof(uint64_t));
+	free(ph);
+}
+
+struct capsrc pty_capsrc = {
+	"pty",
+	pty_init,
+	pty_attach,
+	pty_fd,
+	pty_readv,
+	pty_overflow,
+	pty_bufsize,
+	pty_detach
+};
+#endif	/* __linux__ */
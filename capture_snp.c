@@ -0,0 +1,276 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+#include <sys/uio.h>
+#ifdef __FreeBSD__
+#include <sys/module.h>
+#include <sys/linker.h>
+#include <sys/snoop.h>
+#include <sys/filio.h>
+#endif
+
+#include <utmpx.h>
+#include "utmp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <paths.h>
+#include <err.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "compat.h"
+#include "termlog.h"
+#include "capture.h"
+#include "epoch.h"
+#include "conf.h"
+
+#ifdef __FreeBSD__
+#define	SNP_MAXLEN	(64 * 1024)	/* SNOOP_MAXLEN in tty_snoop.c */
+
+struct snphandle {
+	int		sh_fd;
+	char		sh_line[UT_LINESIZE];
+};
+
+extern char *rootfs;
+extern int vflag;
+extern int fflag;
+
+static int
+build_snp_device(int minor)
+{
+	char devpath[MAXPATHLEN];
+	dev_t dev;
+	snprintf(devpath, sizeof(devpath) - 1,
+	    "%s/snp%d", _PATH_DEV, minor);
+	dev = makedev(_SNP_MAJOR, minor);
+	if (mknod(devpath, S_IFCHR | 0600, dev) < 0)
+		err(1, "mknod %s failed", devpath);
+	DEBUG(vflag, "created device snp%d", minor);
+	return (0);
+}
+
+static int
+getsnpfd(char **snp, size_t len)
+{
+	struct stat sb;
+	char *snppath;
+	int nflag, unit, fd;
+
+	assert(*snp != NULL || len != 0);
+	snppath = *snp;
+	CONF_GET(tc_nflag, nflag);
+	for (unit = 0; unit < nflag; unit++) {
+		snprintf(snppath, len - 1, "%ssnp%d",
+		    _PATH_DEV, unit);
+		if (fflag)
+			if (stat(snppath, &sb) < 0 &&
+			    errno == ENOENT)
+				build_snp_device(unit);
+		fd = open(snppath, O_RDONLY | O_NONBLOCK);
+		if (fd < 0 && errno != EBUSY) {
+			err(1, "open %s failed", snppath);
+		} else if (fd < 0) {
+			continue;
+		} else
+			return (fd);
+	}
+	return (-1);
+}
+
+static int
+snpattach(char *tty_line)
+{
+	char *ptr, snpdev[MAXPATHLEN], line[MAXPATHLEN];
+	struct stat sb;
+#if __FreeBSD_version > 600000
+	int sdev;
+#else
+	dev_t sdev;
+#endif
+	int fd;
+
+	assert(tty_line != NULL);
+	ptr = &snpdev[0];
+	snprintf(line, sizeof(line) - 1, "%s%s%s", rootfs, _PATH_DEV,
+	    tty_line);
+	if (stat(line, &sb) < 0) {
+		warn("stat %s failed", tty_line);
+		return (-1);
+	}
+	if ((sb.st_mode & S_IFMT) != S_IFCHR) {
+		warn("%s not a device", tty_line);
+		return (-1);
+	}
+	if ((fd = getsnpfd(&ptr, MAXPATHLEN)) < 0) {
+		DEBUG(vflag,
+		    "snp open failed: retrying on next login/logout event\n");
+		return (-1);
+	}
+#if __FreeBSD_version > 600000
+	sdev = open(line, O_RDONLY | O_NONBLOCK);
+	if (sdev < 0) {
+		warn("open failed");
+		return (-1);
+	}
+#else
+	sdev = sb.st_rdev;
+#endif
+	if (ioctl(fd, SNPSTTY, &sdev) < 0) {
+		warn("ioctl SNPSTTY failed");
+		close(fd);
+		return (-1);
+	}
+#if __FreeBSD_version > 600000
+	close(sdev);
+#endif
+	DEBUG(vflag, "%s fd %d %s attached to tty %s",
+	    snpdev, fd, ptr, line);
+	return (fd);
+}
+
+static int
+snp_init(void)
+{
+	if (modfind("snp") == -1)
+		if (kldload("snp") == -1 || modfind("snp") == -1)
+			err(1, "snp module not available");
+	return (0);
+}
+
+static void *
+snp_attach(char *tty_line)
+{
+	struct snphandle *sh;
+
+	sh = malloc(sizeof(struct snphandle));
+	if (sh == NULL)
+		return (NULL);
+	strlcpy(sh->sh_line, tty_line, sizeof(sh->sh_line));
+	sh->sh_fd = snpattach(sh->sh_line);
+	if (sh->sh_fd < 0) {
+		free(sh);
+		return (NULL);
+	}
+	return (sh);
+}
+
+static int
+snp_fd(void *handle)
+{
+	struct snphandle *sh;
+
+	sh = (struct snphandle *)handle;
+	return (sh->sh_fd);
+}
+
+/*
+ * The device is non-blocking, so we get EWOULDBLOCK once drained.
+ * A failed read means it has detached from the tty, FIONREAD then
+ * tells us whether that was because of an overflow.
+ */
+static int
+snp_readv(void *handle, struct iovec *iov, int cnt)
+{
+	struct snphandle *sh;
+	ssize_t n;
+	int nbytes;
+
+	sh = (struct snphandle *)handle;
+	while ((n = readv(sh->sh_fd, iov, cnt)) < 0 && errno == EINTR)
+		;
+	if (n > 0)
+		return (n);
+	if (n < 0 && errno == EWOULDBLOCK)
+		return (0);
+	if (ioctl(sh->sh_fd, FIONREAD, &nbytes) < 0)
+		err(1, "ioctl FIONREAD failed");
+	switch (nbytes) {
+	case SNP_OFLOW:
+		return (CS_OFLOW);
+	case SNP_DETACH:
+	case SNP_TTYCLOSE:
+		return (CS_DETACH);
+	}
+	return (n < 0 ? -1 : 0);
+}
+
+/*
+ * snp(4) detaches itself from the tty when its buffer overflows, so
+ * the only way to recover is to grab a new device and re-attach.
+ */
+static int
+snp_reattach(void *handle)
+{
+	struct snphandle *sh;
+
+	sh = (struct snphandle *)handle;
+	close(sh->sh_fd);
+	sh->sh_fd = snpattach(sh->sh_line);
+	return (sh->sh_fd > 0 ? 0 : -1);
+}
+
+/*
+ * The device buffer grows by itself up to SNP_MAXLEN and cannot be
+ * made any larger from here.
+ */
+static int
+snp_bufsize(void *handle __unused, int size __unused)
+{
+	return (SNP_MAXLEN);
+}
+
+static void
+snp_detach(void *handle)
+{
+	struct snphandle *sh;
+
+	sh = (struct snphandle *)handle;
+	if (sh->sh_fd >= 0)
+		close(sh->sh_fd);
+	free(sh);
+}
+
+struct capsrc snp_capsrc = {
+	"snp",
+	snp_init,
+	snp_attach,
+	snp_fd,
+	snp_readv,
+	snp_reattach,
+	snp_bufsize,
+	snp_detach
+};
+#endif	/* __FreeBSD__ */
@@ -0,0 +1,104 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <err.h>
+#include <unistd.h>
+
+#include "logfmt.h"
+
+/*
+ * termlog-cat: turn session logs back into the plain text format.
+ * Binary logs lose their framing; text logs are copied as they are.
+ */
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: termlog-cat [-s sid] file ...\n");
+	exit(1);
+}
+
+static int
+catlog(const char *path, long sid)
+{
+	struct logread lf;
+	struct logrec lr;
+	int ret;
+
+	if (logread_open(&lf, path) < 0) {
+		warn("%s", path);
+		return (1);
+	}
+	while ((ret = logread_next(&lf, &lr)) > 0) {
+		if (lr.lr_type == REC_TIME)
+			continue;
+		if (sid >= 0 && lr.lr_sid != (uint32_t)sid)
+			continue;
+		if (fwrite(lr.lr_data, 1, lr.lr_len, stdout) != lr.lr_len)
+			err(1, "stdout");
+	}
+	logread_close(&lf);
+	if (ret < 0) {
+		warnx("%s: truncated or corrupt at offset %jd", path,
+		    (intmax_t)lr.lr_off);
+		return (1);
+	}
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	long sid;
+	int ch, error;
+
+	sid = -1;
+	while ((ch = getopt(argc, argv, "s:")) != -1)
+		switch (ch) {
+		case 's':
+			sid = strtol(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc == 0)
+		usage();
+	error = 0;
+	for (; argc > 0; argc--, argv++)
+		error |= catlog(*argv, sid);
+	if (fflush(stdout) != 0)
+		err(1, "stdout");
+	return (error);
+}
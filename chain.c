@@ -0,0 +1,131 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <err.h>
+#include <unistd.h>
+
+#include "compat.h"
+#include "digest.h"
+#include "chain.h"
+
+static pthread_mutex_t ch_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *ch_fp;
+static u_long ch_seq;
+static char ch_link[DIGEST_SHA256_LEN];
+
+/*
+ * Compute the link for a segment from the one before it.
+ */
+int
+chain_link(const char *prev, const char *sha256, off_t size,
+    const char *name, char *link)
+{
+	struct digest d;
+	struct digestval dv;
+	char buf[1024];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%s %s %jd %s\n", prev, sha256,
+	    (intmax_t)size, name);
+	if (len < 0 || len >= (int)sizeof(buf))
+		return (-1);
+	if (digest_init(&d, DIGEST_SHA256) < 0)
+		return (-1);
+	digest_update(&d, buf, len);
+	digest_final(&d, &dv);
+	digest_free(&d);
+	strlcpy(link, dv.dv_sha256, DIGEST_SHA256_LEN);
+	return (0);
+}
+
+/*
+ * Open the manifest for appending and pick up the chain where the
+ * last run left it.
+ */
+int
+chain_open(const char *path)
+{
+	char line[1024], link[DIGEST_SHA256_LEN];
+	u_long seq;
+
+	ch_fp = fopen(path, "a+");
+	if (ch_fp == NULL)
+		return (-1);
+	memset(ch_link, '0', DIGEST_SHA256_LEN - 1);
+	ch_link[DIGEST_SHA256_LEN - 1] = '\0';
+	ch_seq = 0;
+	rewind(ch_fp);
+	while (fgets(line, sizeof(line), ch_fp) != NULL) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%lu %64s", &seq, link) != 2 ||
+		    strlen(link) != DIGEST_SHA256_LEN - 1) {
+			warnx("%s: ignoring malformed line %lu", path,
+			    ch_seq + 1);
+			continue;
+		}
+		ch_seq = seq;
+		strlcpy(ch_link, link, sizeof(ch_link));
+	}
+	if (ftello(ch_fp) == 0)
+		fprintf(ch_fp, "%s\n", CHAIN_MAGIC);
+	fflush(ch_fp);
+	return (0);
+}
+
+int
+chain_append(const char *name, const char *sha256, off_t size)
+{
+	char link[DIGEST_SHA256_LEN];
+	int error;
+
+	if (ch_fp == NULL)
+		return (0);
+	pthread_mutex_lock(&ch_lock);
+	error = chain_link(ch_link, sha256, size, name, link);
+	if (error == 0) {
+		fprintf(ch_fp, "%lu %s %s %jd %s\n", ch_seq + 1, link,
+		    sha256, (intmax_t)size, name);
+		if (fflush(ch_fp) == 0) {
+			ch_seq++;
+			strlcpy(ch_link, link, sizeof(ch_link));
+		} else
+			error = -1;
+	}
+	pthread_mutex_unlock(&ch_lock);
+	if (error)
+		warnx("%s: could not add to manifest", name);
+	return (error);
+}
@@ -0,0 +1,58 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef	CHAIN_DOT_H_
+#define	CHAIN_DOT_H_
+
+/*
+ * Tamper evidence for closed log segments.  Each segment gets a line
+ * in the manifest
+ *
+ *	<seq> <link> <sha256> <bytes> <name>
+ *
+ * where link is the SHA-256 of "<previous link> <sha256> <bytes>
+ * <name>\n" and the first link follows 64 zeros.  Altering, removing
+ * or reordering a segment or a manifest line breaks every link after
+ * it.  Within a segment, checkpoint records
+ *
+ *	\n;; Checkpoint: <offset> <sha256>\n
+ *
+ * give the SHA-256 of the segment up to offset, so damage can be
+ * narrowed down to a range.  The offset is where the record starts,
+ * or in a binary log where its framing starts, no more than
+ * CHAIN_CKPTSLOP bytes earlier.  A session can print the same, so a
+ * record that does not match only means session output.
+ */
+#define	CHAIN_MAGIC	"# termlog manifest 1"
+#define	CHAIN_CKPT	"\n;; Checkpoint: "
+#define	CHAIN_CKPTSLOP	64
+
+int chain_open(const char *);
+int chain_append(const char *, const char *, off_t);
+int chain_link(const char *, const char *, off_t, const char *, char *);
+#endif	/* CHAIN_DOT_H_ */
@@ -0,0 +1,272 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <stdio.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "compat.h"
+#include "compress.h"
+#include "flusher.h"
+#include "logfmt.h"
+
+extern int durability;
+
+struct czjob {
+	STAILQ_ENTRY(czjob)	 cj_link;
+	char			 cj_path[MAXPATHLEN];
+};
+
+static pthread_mutex_t cz_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cz_work = PTHREAD_COND_INITIALIZER;
+static STAILQ_HEAD(, czjob) cz_queue = STAILQ_HEAD_INITIALIZER(cz_queue);
+static int cz_level;			/* 0 when not compressing */
+
+/* protected by cz_lock */
+static u_long cz_queued;
+static u_long cz_done;
+static u_long cz_failed;
+static u_long cz_pending;
+static uint64_t cz_in;
+static uint64_t cz_out;
+
+static int
+writeall(int fd, const unsigned char *buf, size_t len)
+{
+	ssize_t cc;
+
+	while (len > 0) {
+		cc = write(fd, buf, len);
+		if (cc < 0) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		buf += cc;
+		len -= cc;
+	}
+	return (0);
+}
+
+/*
+ * Deflate base into fd as a run of gzip members.  zcat and friends
+ * read the result as a single stream, and a reader that only wants
+ * the tail can start at any member.
+ */
+static int
+deflatefile(int fd, const unsigned char *base, size_t size, size_t *outlen)
+{
+	z_stream zs;
+	unsigned char *obuf;
+	size_t off, len, olen;
+	int ret;
+
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, cz_level, Z_DEFLATED, 15 + 16, 8,
+	    Z_DEFAULT_STRATEGY) != Z_OK)
+		return (-1);
+	olen = deflateBound(&zs, COMPRESS_FRAME);
+	if ((obuf = malloc(olen)) == NULL) {
+		deflateEnd(&zs);
+		return (-1);
+	}
+	*outlen = 0;
+	ret = 0;
+	for (off = 0; off < size && ret == 0; off += len) {
+		len = MIN(size - off, COMPRESS_FRAME);
+		zs.next_in = (unsigned char *)(uintptr_t)(base + off);
+		zs.avail_in = len;
+		zs.next_out = obuf;
+		zs.avail_out = olen;
+		if (deflate(&zs, Z_FINISH) != Z_STREAM_END ||
+		    writeall(fd, obuf, olen - zs.avail_out) < 0)
+			ret = -1;
+		*outlen += olen - zs.avail_out;
+		deflateReset(&zs);
+	}
+	free(obuf);
+	deflateEnd(&zs);
+	return (ret);
+}
+
+/*
+ * Replace path with path.gz.  The compressed copy is complete, and
+ * synced if we have been asked for durability, before the original
+ * goes away.
+ */
+static int
+compressfile(const char *path)
+{
+	char tmp[MAXPATHLEN + 16], gz[MAXPATHLEN + 8];
+	struct stat sb;
+	unsigned char *base;
+	size_t olen;
+	int fd, ofd, ret;
+
+	snprintf(gz, sizeof(gz), "%s%s", path, LOGZ_SUFFIX);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", gz);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (-1);
+	if (fstat(fd, &sb) < 0) {
+		close(fd);
+		return (-1);
+	}
+	base = NULL;
+	if (sb.st_size > 0) {
+		base = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (base == MAP_FAILED) {
+			close(fd);
+			return (-1);
+		}
+		(void)madvise(base, sb.st_size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+	ret = -1;
+	ofd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+	if (ofd >= 0) {
+		if (deflatefile(ofd, base, sb.st_size, &olen) == 0 &&
+		    (durability != DURABLE_FDATASYNC || fdatasync(ofd) == 0))
+			ret = 0;
+		if (close(ofd) < 0)
+			ret = -1;
+		if (ret == 0 && rename(tmp, gz) < 0)
+			ret = -1;
+		if (ret < 0)
+			(void)unlink(tmp);
+	}
+	if (base != NULL)
+		munmap(base, sb.st_size);
+	if (ret < 0)
+		return (-1);
+	if (unlink(path) < 0) {
+		/* keep the original rather than two copies */
+		(void)unlink(gz);
+		return (-1);
+	}
+	pthread_mutex_lock(&cz_lock);
+	cz_in += sb.st_size;
+	cz_out += olen;
+	pthread_mutex_unlock(&cz_lock);
+	return (0);
+}
+
+static void *
+compressor(void *arg __unused)
+{
+	struct czjob *cj;
+	int ret;
+
+	pthread_mutex_lock(&cz_lock);
+	for (;;) {
+		while ((cj = STAILQ_FIRST(&cz_queue)) == NULL)
+			pthread_cond_wait(&cz_work, &cz_lock);
+		STAILQ_REMOVE_HEAD(&cz_queue, cj_link);
+		pthread_mutex_unlock(&cz_lock);
+		ret = compressfile(cj->cj_path);
+		if (ret < 0)
+			warn("%s: not compressed", cj->cj_path);
+		pthread_mutex_lock(&cz_lock);
+		cz_pending--;
+		if (ret < 0)
+			cz_failed++;
+		else
+			cz_done++;
+		free(cj);
+	}
+	/* NOTREACHED */
+	return (NULL);
+}
+
+int
+compress_init(int level, int jobs)
+{
+	pthread_t thr;
+
+	if (level <= 0)
+		return (0);
+	cz_level = MIN(level, Z_BEST_COMPRESSION);
+	if (jobs <= 0)
+		jobs = 1;
+	while (jobs-- > 0)
+		if (pthread_create(&thr, NULL, compressor, NULL))
+			return (-1);
+	return (0);
+}
+
+/*
+ * Called once a segment is closed and all of it has reached the file.
+ */
+void
+compress_segment(const char *path)
+{
+	struct czjob *cj;
+
+	if (cz_level == 0)
+		return;
+	cj = malloc(sizeof(*cj));
+	if (cj == NULL) {
+		warn("%s: not compressed", path);
+		return;
+	}
+	strlcpy(cj->cj_path, path, sizeof(cj->cj_path));
+	pthread_mutex_lock(&cz_lock);
+	STAILQ_INSERT_TAIL(&cz_queue, cj, cj_link);
+	cz_queued++;
+	cz_pending++;
+	pthread_cond_signal(&cz_work);
+	pthread_mutex_unlock(&cz_lock);
+}
+
+void
+compress_dumpstats(FILE *fp)
+{
+	if (cz_level == 0)
+		return;
+	pthread_mutex_lock(&cz_lock);
+	fprintf(fp, "Compression statistics:\n"
+	    "%-10s %-10s %-10s %-10s %-14s %-14s %s\n",
+	    "QUEUED", "DONE", "FAILED", "PENDING", "BYTESIN", "BYTESOUT",
+	    "RATIO");
+	fprintf(fp, "%-10lu %-10lu %-10lu %-10lu %-14ju %-14ju %.2f\n",
+	    cz_queued, cz_done, cz_failed, cz_pending, (uintmax_t)cz_in,
+	    (uintmax_t)cz_out, cz_out > 0 ? (double)cz_in / cz_out : 0.0);
+	pthread_mutex_unlock(&cz_lock);
+}
@@ -0,0 +1,290 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "epoch.h"
+#include "policy.h"
+#include "conf.h"
+
+/* a -t or -u on the command line */
+struct confrule {
+	int		 cr_kind;
+	const char	*cr_pat;
+};
+
+struct tlconf confargs = {
+	.tc_iflag = 500000,
+	.tc_nflag = 20,
+};
+
+static struct confrule *rules;
+static int nrules;
+static const char **files;
+static int nfiles;
+static _Atomic(struct tlconf *) curconf;
+static u_int lastgen;
+
+int
+conf_addrule(int kind, const char *pat)
+{
+	struct confrule *cr;
+
+	cr = realloc(rules, (nrules + 1) * sizeof(*cr));
+	if (cr == NULL)
+		return (-1);
+	rules = cr;
+	rules[nrules].cr_kind = kind;
+	rules[nrules].cr_pat = pat;
+	nrules++;
+	return (0);
+}
+
+int
+conf_addfile(const char *path)
+{
+	const char **f;
+
+	f = realloc(files, (nfiles + 1) * sizeof(*f));
+	if (f == NULL)
+		return (-1);
+	files = f;
+	files[nfiles++] = path;
+	return (0);
+}
+
+static int
+setnum(const char *arg, long max, long *val)
+{
+	char *endp;
+
+	errno = 0;
+	*val = strtol(arg, &endp, 0);
+	if (errno != 0 || endp == arg || *endp != '\0' || *val < 0 ||
+	    *val > max)
+		return (-1);
+	return (0);
+}
+
+/*
+ * A setting in a policy file.  Returns -1 if it is not one, or if its
+ * value is not valid.
+ */
+static int
+setconf(struct tlconf *tc, const char *kw, const char *arg)
+{
+	long val;
+
+	if (strcmp(kw, "appendonly") == 0) {
+		if (strcmp(arg, "yes") == 0)
+			tc->tc_appendonly = 1;
+		else if (strcmp(arg, "no") == 0)
+			tc->tc_appendonly = 0;
+		else
+			return (-1);
+	} else if (strcmp(kw, "maxsize") == 0) {
+		if (setnum(arg, INT_MAX, &val) < 0)
+			return (-1);
+		tc->tc_maxfsize = val;
+	} else if (strcmp(kw, "interval") == 0) {
+		if (setnum(arg, LONG_MAX, &val) < 0 || val == 0)
+			return (-1);
+		tc->tc_iflag = val;
+	} else if (strcmp(kw, "devices") == 0) {
+		if (setnum(arg, INT_MAX, &val) < 0)
+			return (-1);
+		tc->tc_nflag = val;
+	} else if (strcmp(kw, "rotate") == 0) {
+		if (setnum(arg, LONG_MAX, &val) < 0)
+			return (-1);
+		tc->tc_rotsecs = val;
+	} else if (strcmp(kw, "idle") == 0) {
+		if (setnum(arg, LONG_MAX, &val) < 0)
+			return (-1);
+		tc->tc_idlesecs = val;
+	} else
+		return (-1);
+	return (0);
+}
+
+/*
+ * Reads a policy file.  Each line names a kind of rule followed by
+ * any number of names or patterns, a leading ! making a rule
+ * exclusive, or a setting and its value.
+ *
+ *	# comment
+ *	user	alice bob build-*
+ *	group	wheel !contractors
+ *	tty	ttyv? pts/[0-9]* !pts/0
+ *	maxsize	1048576
+ */
+static int
+conf_parse(struct tlconf *tc, const char *path)
+{
+	char *buf, *kw, *arg, *last, *p;
+	int group, kind, lineno, n, ret, verdict;
+	size_t cap;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		warn("%s", path);
+		return (-1);
+	}
+	buf = NULL;
+	cap = 0;
+	lineno = 0;
+	ret = 0;
+	while (ret == 0 && getline(&buf, &cap, fp) != -1) {
+		lineno++;
+		if ((p = strchr(buf, '#')) != NULL)
+			*p = '\0';
+		kw = strtok_r(buf, " \t\r\n", &last);
+		if (kw == NULL)
+			continue;
+		group = 0;
+		if (strcmp(kw, "user") == 0)
+			kind = POL_USER;
+		else if (strcmp(kw, "group") == 0) {
+			kind = POL_USER;
+			group = 1;
+		} else if (strcmp(kw, "tty") == 0)
+			kind = POL_TTY;
+		else {
+			arg = strtok_r(NULL, " \t\r\n", &last);
+			if (arg == NULL || strtok_r(NULL, " \t\r\n",
+			    &last) != NULL || setconf(tc, kw, arg) < 0) {
+				warnx("%s:%d: %s: invalid setting", path,
+				    lineno, kw);
+				ret = -1;
+			}
+			continue;
+		}
+		for (n = 0; (arg = strtok_r(NULL, " \t\r\n", &last)) != NULL;
+		    n++) {
+			verdict = POL_INCL;
+			if (*arg == '!') {
+				verdict = POL_EXCL;
+				arg++;
+			}
+			if ((group ?
+			    policy_addgroup(tc->tc_policy, arg, verdict) :
+			    policy_add(tc->tc_policy, kind, arg, verdict)) < 0) {
+				if (group && errno == ENOENT)
+					warnx("%s:%d: %s: no such group",
+					    path, lineno, arg);
+				else
+					warn("%s:%d: %s", path, lineno, arg);
+				ret = -1;
+				break;
+			}
+		}
+		if (ret == 0 && n == 0) {
+			warnx("%s:%d: %s: nothing to match", path, lineno, kw);
+			ret = -1;
+		}
+	}
+	if (ret == 0 && ferror(fp)) {
+		warn("%s", path);
+		ret = -1;
+	}
+	free(buf);
+	fclose(fp);
+	return (ret);
+}
+
+/*
+ * A new snapshot from the command line and the policy files, or NULL
+ * if one of them is not valid.  Groups are looked up again as well.
+ */
+struct tlconf *
+conf_build(void)
+{
+	struct tlconf *tc;
+	int i;
+
+	if ((tc = malloc(sizeof(*tc))) == NULL)
+		return (NULL);
+	*tc = confargs;
+	if ((tc->tc_policy = policy_new()) == NULL) {
+		free(tc);
+		return (NULL);
+	}
+	for (i = 0; i < nrules; i++)
+		if (policy_add(tc->tc_policy, rules[i].cr_kind,
+		    rules[i].cr_pat, POL_INCL) < 0) {
+			warn("%s", rules[i].cr_pat);
+			goto bad;
+		}
+	for (i = 0; i < nfiles; i++)
+		if (conf_parse(tc, files[i]) < 0)
+			goto bad;
+	if (policy_compile(tc->tc_policy) < 0)
+		goto bad;
+	return (tc);
+bad:
+	conf_free(tc);
+	return (NULL);
+}
+
+static void
+conf_dtor(void *arg)
+{
+	conf_free(arg);
+}
+
+void
+conf_publish(struct tlconf *tc)
+{
+	struct tlconf *old;
+
+	tc->tc_gen = ++lastgen;
+	old = atomic_exchange_explicit(&curconf, tc, memory_order_acq_rel);
+	if (old != NULL)
+		epoch_defer(old, conf_dtor);
+}
+
+const struct tlconf *
+conf_get(void)
+{
+	return (atomic_load_explicit(&curconf, memory_order_acquire));
+}
+
+void
+conf_free(struct tlconf *tc)
+{
+	policy_free(tc->tc_policy);
+	free(tc);
+}
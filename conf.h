@@ -0,0 +1,72 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef	CONF_DOT_H_
+#define	CONF_DOT_H_
+
+#include <sys/types.h>
+
+/*
+ * Settings which can be changed while running: the policy, from -t,
+ * -u and -p, and -a, -c, -i, -L, -n and -R, which a policy file may
+ * override.
+ * They are kept in a snapshot which is never modified once published.
+ * On SIGHUP a new one is built from the command line and the policy
+ * files as they are then and swapped in; sessions already attached
+ * are left alone.  The old snapshot is released once no thread can be
+ * using it, so readers only hold on to what conf_get() returns between
+ * epoch_enter() and epoch_exit().
+ */
+struct tlconf {
+	struct policy	*tc_policy;
+	int		 tc_appendonly;	/* -a */
+	int		 tc_maxfsize;	/* -c */
+	long		 tc_iflag;	/* -i */
+	int		 tc_nflag;	/* -n */
+	long		 tc_rotsecs;	/* -R */
+	long		 tc_idlesecs;	/* -L */
+	u_int		 tc_gen;	/* bumped by every reload */
+};
+
+/* the command line, which every snapshot starts out from */
+extern struct tlconf confargs;
+
+/* read a single setting, for callers outside of an epoch section */
+#define	CONF_GET(field, var)	do {					\
+		epoch_enter();						\
+		(var) = conf_get()->field;				\
+		epoch_exit();						\
+	} while (0)
+
+int conf_addrule(int, const char *);
+int conf_addfile(const char *);
+struct tlconf *conf_build(void);
+void conf_publish(struct tlconf *);
+const struct tlconf *conf_get(void);
+void conf_free(struct tlconf *);
+#endif	/* CONF_DOT_H_ */
@@ -0,0 +1,186 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <string.h>
+#ifdef __linux__
+#include <openssl/evp.h>
+#endif
+
+#include "compat.h"
+#include "digest.h"
+
+/*
+ * Only the algorithms asked for in algs are computed; the strings for
+ * the others are left empty.
+ */
+#ifdef __FreeBSD__
+int
+digest_init(struct digest *d, int algs)
+{
+	d->d_algs = algs;
+	if (algs & DIGEST_SHA1)
+		SHA1_Init(&d->d_sha1);
+	if (algs & DIGEST_SHA256)
+		SHA256_Init(&d->d_sha256);
+	return (0);
+}
+
+void
+digest_update(struct digest *d, const void *buf, size_t len)
+{
+	if (d->d_algs & DIGEST_SHA1)
+		SHA1_Update(&d->d_sha1, buf, len);
+	if (d->d_algs & DIGEST_SHA256)
+		SHA256_Update(&d->d_sha256, buf, len);
+}
+
+/*
+ * The digests of everything so far, without disturbing the running
+ * state.
+ */
+void
+digest_peek(struct digest *d, struct digestval *dv)
+{
+	struct digest tmp;
+
+	tmp = *d;
+	dv->dv_sha1[0] = dv->dv_sha256[0] = '\0';
+	if (d->d_algs & DIGEST_SHA1)
+		SHA1_End(&tmp.d_sha1, dv->dv_sha1);
+	if (d->d_algs & DIGEST_SHA256)
+		SHA256_End(&tmp.d_sha256, dv->dv_sha256);
+}
+
+/*
+ * Finish the digests and start over, ready for the next segment.
+ */
+void
+digest_final(struct digest *d, struct digestval *dv)
+{
+	dv->dv_sha1[0] = dv->dv_sha256[0] = '\0';
+	if (d->d_algs & DIGEST_SHA1)
+		SHA1_End(&d->d_sha1, dv->dv_sha1);
+	if (d->d_algs & DIGEST_SHA256)
+		SHA256_End(&d->d_sha256, dv->dv_sha256);
+	digest_init(d, d->d_algs);
+}
+
+void
+digest_free(struct digest *d __unused)
+{
+}
+#else	/* !__FreeBSD__ */
+static void
+tohex(char *buf, const unsigned char *md, unsigned int len)
+{
+	static const char hex[] = "0123456789abcdef";
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		buf[i * 2] = hex[md[i] >> 4];
+		buf[i * 2 + 1] = hex[md[i] & 0x0f];
+	}
+	buf[i * 2] = '\0';
+}
+
+static void
+finish(EVP_MD_CTX *ctx, char *buf, const EVP_MD *md, int reinit)
+{
+	unsigned char val[EVP_MAX_MD_SIZE];
+	unsigned int len;
+
+	EVP_DigestFinal_ex(ctx, val, &len);
+	tohex(buf, val, len);
+	if (reinit)
+		EVP_DigestInit_ex(ctx, md, NULL);
+}
+
+int
+digest_init(struct digest *d, int algs)
+{
+	d->d_algs = algs;
+	d->d_sha1 = d->d_sha256 = NULL;
+	if (algs & DIGEST_SHA1)
+		if ((d->d_sha1 = EVP_MD_CTX_new()) == NULL ||
+		    EVP_DigestInit_ex(d->d_sha1, EVP_sha1(), NULL) != 1)
+			goto fail;
+	if (algs & DIGEST_SHA256)
+		if ((d->d_sha256 = EVP_MD_CTX_new()) == NULL ||
+		    EVP_DigestInit_ex(d->d_sha256, EVP_sha256(), NULL) != 1)
+			goto fail;
+	return (0);
+fail:
+	digest_free(d);
+	return (-1);
+}
+
+void
+digest_update(struct digest *d, const void *buf, size_t len)
+{
+	if (d->d_sha1 != NULL)
+		EVP_DigestUpdate(d->d_sha1, buf, len);
+	if (d->d_sha256 != NULL)
+		EVP_DigestUpdate(d->d_sha256, buf, len);
+}
+
+void
+digest_peek(struct digest *d, struct digestval *dv)
+{
+	EVP_MD_CTX *tmp;
+
+	dv->dv_sha1[0] = dv->dv_sha256[0] = '\0';
+	if ((tmp = EVP_MD_CTX_new()) == NULL)
+		return;
+	if (d->d_sha1 != NULL && EVP_MD_CTX_copy_ex(tmp, d->d_sha1) == 1)
+		finish(tmp, dv->dv_sha1, NULL, 0);
+	if (d->d_sha256 != NULL && EVP_MD_CTX_copy_ex(tmp, d->d_sha256) == 1)
+		finish(tmp, dv->dv_sha256, NULL, 0);
+	EVP_MD_CTX_free(tmp);
+}
+
+void
+digest_final(struct digest *d, struct digestval *dv)
+{
+	dv->dv_sha1[0] = dv->dv_sha256[0] = '\0';
+	if (d->d_sha1 != NULL)
+		finish(d->d_sha1, dv->dv_sha1, EVP_sha1(), 1);
+	if (d->d_sha256 != NULL)
+		finish(d->d_sha256, dv->dv_sha256, EVP_sha256(), 1);
+}
+
+void
+digest_free(struct digest *d)
+{
+	EVP_MD_CTX_free(d->d_sha1);
+	EVP_MD_CTX_free(d->d_sha256);
+	d->d_sha1 = d->d_sha256 = NULL;
+}
+#endif	/* __FreeBSD__ */
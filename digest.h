@@ -0,0 +1,71 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef	DIGEST_DOT_H_
+#define	DIGEST_DOT_H_
+
+/*
+ * Running SHA1 and SHA-256 over everything written to a log, so the
+ * checksums are ready the moment a segment is closed.  The hashing
+ * itself is left to libmd(3) on FreeBSD and libcrypto on Linux, both
+ * of which use the SHA extensions of the CPU when present.
+ */
+#ifdef __FreeBSD__
+#include <sha.h>
+#include <sha256.h>
+#endif
+
+#define	DIGEST_SHA1		0x01
+#define	DIGEST_SHA256		0x02
+#define	DIGEST_ALL		(DIGEST_SHA1 | DIGEST_SHA256)
+
+#define	DIGEST_SHA1_LEN		41	/* hex plus nul */
+#define	DIGEST_SHA256_LEN	65
+
+struct digest {
+	int		d_algs;
+#ifdef __FreeBSD__
+	SHA1_CTX	d_sha1;
+	SHA256_CTX	d_sha256;
+#else
+	void		*d_sha1;	/* EVP_MD_CTX */
+	void		*d_sha256;
+#endif
+};
+
+struct digestval {
+	char		dv_sha1[DIGEST_SHA1_LEN];
+	char		dv_sha256[DIGEST_SHA256_LEN];
+};
+
+int digest_init(struct digest *, int);
+void digest_update(struct digest *, const void *, size_t);
+void digest_peek(struct digest *, struct digestval *);
+void digest_final(struct digest *, struct digestval *);
+void digest_free(struct digest *);
+#endif	/* DIGEST_DOT_H_ */
@@ -0,0 +1,156 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/queue.h>
+
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <err.h>
+#include <assert.h>
+
+#include "epoch.h"
+
+struct epoch_thread {
+	atomic_uint		et_epoch;	/* global epoch on entry */
+	atomic_int		et_active;
+	struct epoch_thread    *et_next;
+};
+
+struct epoch_limbo {
+	void		       *el_ptr;
+	void			(*el_dtor)(void *);
+	u_int			el_epoch;
+	STAILQ_ENTRY(epoch_limbo) el_glue;
+};
+
+static _Atomic(struct epoch_thread *) epoch_threads;
+static atomic_uint epoch_global;
+static __thread struct epoch_thread *epoch_self;
+static pthread_mutex_t limbo_lock = PTHREAD_MUTEX_INITIALIZER;
+static STAILQ_HEAD(, epoch_limbo) limbo = STAILQ_HEAD_INITIALIZER(limbo);
+
+static struct epoch_thread *
+epoch_register(void)
+{
+	struct epoch_thread *et;
+
+	et = calloc(1, sizeof(struct epoch_thread));
+	if (et == NULL)
+		err(1, "calloc failed");
+	et->et_next = atomic_load(&epoch_threads);
+	while (!atomic_compare_exchange_weak(&epoch_threads, &et->et_next, et))
+		;
+	return (et);
+}
+
+void
+epoch_enter(void)
+{
+	struct epoch_thread *et;
+
+	if ((et = epoch_self) == NULL)
+		et = epoch_self = epoch_register();
+	assert(atomic_load_explicit(&et->et_active,
+	    memory_order_relaxed) == 0);
+	atomic_store(&et->et_active, 1);
+	atomic_store(&et->et_epoch, atomic_load(&epoch_global));
+}
+
+void
+epoch_exit(void)
+{
+	assert(epoch_self != NULL);
+	atomic_store_explicit(&epoch_self->et_active, 0,
+	    memory_order_release);
+}
+
+/*
+ * The global epoch may only move on once every thread inside a
+ * critical section has observed its current value.
+ */
+static u_int
+epoch_advance(void)
+{
+	struct epoch_thread *et;
+	u_int e;
+
+	e = atomic_load(&epoch_global);
+	for (et = atomic_load(&epoch_threads); et != NULL; et = et->et_next)
+		if (atomic_load(&et->et_active) &&
+		    atomic_load(&et->et_epoch) != e)
+			return (e);
+	atomic_compare_exchange_strong(&epoch_global, &e, e + 1);
+	return (atomic_load(&epoch_global));
+}
+
+void
+epoch_defer(void *ptr, void (*dtor)(void *))
+{
+	struct epoch_limbo *el;
+
+	el = malloc(sizeof(struct epoch_limbo));
+	if (el == NULL)
+		err(1, "malloc failed");
+	el->el_ptr = ptr;
+	el->el_dtor = dtor;
+	el->el_epoch = atomic_load(&epoch_global);
+	pthread_mutex_lock(&limbo_lock);
+	STAILQ_INSERT_TAIL(&limbo, el, el_glue);
+	pthread_mutex_unlock(&limbo_lock);
+}
+
+/*
+ * Release whatever can be released.  Returns the number of objects
+ * still waiting.
+ */
+int
+epoch_reclaim(void)
+{
+	struct epoch_limbo *el;
+	u_int e;
+	int n;
+
+	e = epoch_advance();
+	n = 0;
+	pthread_mutex_lock(&limbo_lock);
+	while ((el = STAILQ_FIRST(&limbo)) != NULL &&
+	    e - el->el_epoch >= 2) {
+		STAILQ_REMOVE_HEAD(&limbo, el_glue);
+		pthread_mutex_unlock(&limbo_lock);
+		el->el_dtor(el->el_ptr);
+		free(el);
+		pthread_mutex_lock(&limbo_lock);
+	}
+	STAILQ_FOREACH(el, &limbo, el_glue)
+		n++;
+	pthread_mutex_unlock(&limbo_lock);
+	return (n);
+}
@@ -0,0 +1,119 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "evq.h"
+
+int
+evq_init(struct evq *eq)
+{
+	assert(eq != NULL);
+#ifdef __linux__
+	eq->eq_fd = epoll_create1(EPOLL_CLOEXEC);
+#else
+	eq->eq_fd = kqueue();
+#endif
+	return (eq->eq_fd < 0 ? -1 : 0);
+}
+
+int
+evq_add(struct evq *eq, int fd, void *udata)
+{
+#ifdef __linux__
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.ptr = udata;
+	return (epoll_ctl(eq->eq_fd, EPOLL_CTL_ADD, fd, &ev));
+#else
+	struct kevent kev;
+
+	EV_SET(&kev, fd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, udata);
+	return (kevent(eq->eq_fd, &kev, 1, NULL, 0, NULL));
+#endif
+}
+
+int
+evq_del(struct evq *eq, int fd)
+{
+#ifdef __linux__
+	struct epoll_event ev;
+
+	return (epoll_ctl(eq->eq_fd, EPOLL_CTL_DEL, fd, &ev));
+#else
+	struct kevent kev;
+
+	EV_SET(&kev, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+	return (kevent(eq->eq_fd, &kev, 1, NULL, 0, NULL));
+#endif
+}
+
+/*
+ * Wait up to timo milliseconds for readiness and store the pointers
+ * registered with the ready fds in ready[].  Returns the number of
+ * entries filled in, 0 on timeout or -1 on error.
+ */
+int
+evq_wait(struct evq *eq, void **ready, int nready, int timo)
+{
+#ifdef __linux__
+	struct epoll_event evs[EVQ_MAXEVENTS];
+#else
+	struct kevent evs[EVQ_MAXEVENTS];
+	struct timespec ts;
+#endif
+	int i, n;
+
+	assert(ready != NULL && nready > 0);
+	if (nready > EVQ_MAXEVENTS)
+		nready = EVQ_MAXEVENTS;
+#ifdef __linux__
+	n = epoll_wait(eq->eq_fd, evs, nready, timo);
+	for (i = 0; i < n; i++)
+		ready[i] = evs[i].data.ptr;
+#else
+	ts.tv_sec = timo / 1000;
+	ts.tv_nsec = (timo % 1000) * 1000000;
+	n = kevent(eq->eq_fd, NULL, 0, evs, nready, &ts);
+	for (i = 0; i < n; i++)
+		ready[i] = evs[i].udata;
+#endif
+	return (n);
+}
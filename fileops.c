@@ -30,10 +30,7 @@
 #include <sys/queue.h>
 #include <sys/stat.h>
 #include <sys/param.h>
-#include <sys/snoop.h>
-#include <sys/event.h>
 #include <sys/time.h>
-#include <sys/filio.h>
 
 #include <utmpx.h>
 #include <signal.h>
@@ -48,36 +45,517 @@
 #include <errno.h>
 #include <unistd.h>
 #include <limits.h>
+#include <stdint.h>
 #include <assert.h>
-#include <sha.h>
 
+#include "compat.h"
+#include "budget.h"
 #include "utmp.h"
 #include "termlog.h"
 #include "fileops.h"
+#include "chain.h"
+#include "logfmt.h"
+#include "flusher.h"
+#include "compress.h"
+#include "indexer.h"
+#include "stats.h"
+#include "epoch.h"
+#include "conf.h"
+#include "rotate.h"
 
-int maxfsize = 0;
-int appendonly = 0;
+int ckptsize = 0;
+int binfmt = 0;
+int vtstrip = 0;
+int idxbytes = 0;
+int idxsecs = 0;
+atomic_ulong sm_chunks;
+atomic_ulong sm_writes;
+static atomic_uint sm_nextsid;
 
+static void sm_endsummary(struct snpmeta *);
+static char *sm_segname(struct snpmeta *, char *, size_t);
+
+#define	SM_IDXBATCH	256		/* index entries buffered per log */
+
+/*
+ * A clock for record deltas which is read without entering the
+ * kernel; a few milli-seconds of resolution is plenty for replay.
+ */
+#if defined(CLOCK_MONOTONIC_COARSE)
+#define	CLOCK_RECORD	CLOCK_MONOTONIC_COARSE
+#elif defined(CLOCK_MONOTONIC_FAST)
+#define	CLOCK_RECORD	CLOCK_MONOTONIC_FAST
+#else
+#define	CLOCK_RECORD	CLOCK_MONOTONIC
+#endif
+
+/*
+ * The date and time are only formatted again when the second
+ * changes; each thread keeps its own copy.
+ */
 static char *
 timestamp(void)
 {
-	static char buf[32];
-	struct timeval tv;
-	struct tm *tm;
-	register int s;
-	char date[16];
-
-	gettimeofday(&tv, 0);
-	tm = localtime((time_t *)&tv.tv_sec);
-	strftime(date, sizeof(date) - 1, "%Y-%m-%d", tm);
-	s = tv.tv_sec % 86400;
-	snprintf(buf, sizeof(buf) - 1,
-	    "%s %02d:%02d:%02d.%06u",
-	    date, (s / 3600), ((s % 3600) / 60),
-	    (s % 60), ((u_int32_t)tv.tv_usec));
+	static __thread char buf[40];
+	static __thread time_t last = -1;
+	static __thread size_t len;
+	struct timespec ts;
+	struct tm tm;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if (ts.tv_sec != last) {
+		localtime_r(&ts.tv_sec, &tm);
+		len = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+		last = ts.tv_sec;
+	}
+	snprintf(buf + len, sizeof(buf) - len, ".%06ld", ts.tv_nsec / 1000);
 	return (&buf[0]);
 }
 
+static uint64_t
+usecs(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+/*
+ * The stdio backend: one buffered FILE per log.  Writers flush
+ * themselves before stdio would, so that every write(2) is accounted
+ * for.
+ */
+static int
+stdio_flush(struct snpmeta *sm)
+{
+	int error;
+
+	if (sm->sm_pending == 0)
+		return (0);
+	error = fflush(sm->fp);
+	atomic_fetch_add(&sm_writes, 1);
+	sm->sm_pending = 0;
+	return (error == 0 ? 1 : -1);
+}
+
+static int
+stdio_sync(struct snpmeta *sm)
+{
+	return (fdatasync(fileno(sm->fp)));
+}
+
+static void
+stdio_write(struct snpmeta *sm, const char *ptr, size_t size, int data)
+{
+	if (sm->sm_pending > 0 && sm->sm_pending + size > SM_BUFSIZE)
+		stdio_flush(sm);
+	fwrite(ptr, size, 1, sm->fp);
+	sm->sm_pending += size;
+	if (data)
+		sm->counter += size;
+	if (sm->sm_pending >= SM_BUFSIZE)
+		stdio_flush(sm);
+}
+
+static int
+stdio_preopen(const char *fname)
+{
+	int appendonly, fd;
+
+	fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+	    S_IWUSR | S_IRUSR);
+	if (fd < 0)
+		return (-1);
+	if (fchmod(fd, S_IWUSR | S_IRUSR) < 0)
+		warn("chmod failed");
+	CONF_GET(tc_appendonly, appendonly);
+	if (appendonly)
+		if (chflags(fname, SF_APPEND) < 0)
+			warn("chflags failed");
+	return (fd);
+}
+
+static int
+stdio_open(struct snpmeta *sm, const char *fname)
+{
+	int fd;
+
+	if (sm->sm_iobuf == NULL) {
+		sm->sm_iobuf = malloc(SM_BUFSIZE);
+		if (sm->sm_iobuf == NULL)
+			return (-1);
+	}
+	if ((fd = stdio_preopen(fname)) < 0)
+		return (-1);
+	if ((sm->fp = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		return (-1);
+	}
+	setvbuf(sm->fp, sm->sm_iobuf, _IOFBF, SM_BUFSIZE);
+	sm->sm_pending = 0;
+	return (0);
+}
+
+/*
+ * What is left of a segment once the log has moved on.
+ */
+struct stdio_old {
+	FILE			*so_fp;
+	char			*so_buf;
+	char			 so_name[MAXPATHLEN];
+	struct digestval	 so_dv;
+	quad_t			 so_counter;
+};
+
+static void
+stdio_retire(void *arg)
+{
+	struct stdio_old *so;
+
+	so = arg;
+	fclose(so->so_fp);
+	free(so->so_buf);
+	log_message_digest(so->so_name, &so->so_dv, so->so_counter);
+	compress_segment(so->so_name);
+	indexer_segment(so->so_name);
+	free(so);
+}
+
+/*
+ * The old stream has been flushed, so closing it in the rotation
+ * thread writes nothing; it keeps its buffer until then.
+ */
+static int
+stdio_rotate(struct snpmeta *sm, const char *oname, struct digestval *dv,
+    const char *nname __unused, int nfd)
+{
+	struct stdio_old *so;
+	char *buf;
+	FILE *fp;
+
+	so = malloc(sizeof(*so));
+	buf = malloc(SM_BUFSIZE);
+	if (so == NULL || buf == NULL || (fp = fdopen(nfd, "w")) == NULL) {
+		free(so);
+		free(buf);
+		return (-1);
+	}
+	stdio_flush(sm);
+	so->so_fp = sm->fp;
+	so->so_buf = sm->sm_iobuf;
+	strlcpy(so->so_name, oname, sizeof(so->so_name));
+	so->so_dv = *dv;
+	so->so_counter = sm->counter;
+	setvbuf(fp, buf, _IOFBF, SM_BUFSIZE);
+	sm->fp = fp;
+	sm->sm_iobuf = buf;
+	sm->sm_pending = 0;
+	if (rotate_defer(sm, stdio_retire, so) < 0)
+		stdio_retire(so);
+	return (0);
+}
+
+static int
+stdio_close(struct snpmeta *sm, const char *fname, struct digestval *dv)
+{
+	pthread_mutex_lock(&sm->sm_lock);
+	stdio_flush(sm);
+	pthread_mutex_unlock(&sm->sm_lock);
+	/* after this the flusher will not touch sm again */
+	flusher_forget(sm);
+	fclose(sm->fp);
+	log_message_digest(fname, dv, sm->counter);
+	compress_segment(fname);
+	indexer_segment(fname);
+	free(sm->sm_iobuf);
+	return (0);
+}
+
+struct logio logio_stdio = {
+	"stdio",
+	0,
+	NULL,
+	stdio_open,
+	stdio_write,
+	stdio_flush,
+	stdio_sync,
+	stdio_preopen,
+	stdio_rotate,
+	stdio_close,
+	NULL,
+	NULL
+};
+
+struct logio *logio = &logio_stdio;
+
+/*
+ * Everything that ends up in a log goes through here.  Data is only
+ * buffered; the flusher decides when it is written out.  The digests
+ * are kept up to date as we go, so nothing has to be read back when
+ * the segment is closed.
+ */
+static void
+sm_put(struct snpmeta *sm, const void *ptr, size_t size, int data)
+{
+	digest_update(&sm->sm_digest, ptr, size);
+	logio->li_write(sm, ptr, size, data);
+	sm->sm_fsize += size;
+}
+
+/*
+ * Put a record header in front of the next size bytes; see logfmt.h.
+ */
+static void
+sm_frame(struct snpmeta *sm, int type, size_t size)
+{
+	unsigned char hdr[LOGFMT_HDRLEN + 8];
+	uint64_t now;
+
+	now = usecs(CLOCK_RECORD);
+	if (sm->sm_fsize == 0)
+		sm_put(sm, LOGFMT_MAGIC, LOGFMT_MAGICLEN, 0);
+	if (sm->sm_lastts == 0 || now - sm->sm_lastts > UINT32_MAX) {
+		logfmt_header(hdr, REC_TIME, 8, 0, sm->sm_sid);
+		logfmt_time(hdr + LOGFMT_HDRLEN, usecs(CLOCK_REALTIME));
+		sm_put(sm, hdr, sizeof(hdr), 0);
+		sm->sm_lastts = now;
+	}
+	logfmt_header(hdr, type, size, now - sm->sm_lastts, sm->sm_sid);
+	sm_put(sm, hdr, LOGFMT_HDRLEN, 0);
+	sm->sm_lastts = now;
+}
+
+/*
+ * Append buf to the plain text copy of segment seg, opening it first
+ * if *fdp is -1.
+ */
+static void
+sm_textout(int *fdp, const char *seg, const char *buf, size_t len)
+{
+	char path[MAXPATHLEN];
+	ssize_t n;
+	size_t off;
+
+	if (len == 0)
+		return;
+	if (*fdp < 0) {
+		if ((size_t)snprintf(path, sizeof(path), "%s%s", seg,
+		    LOGTXT_SUFFIX) >= sizeof(path)) {
+			warnx("%s%s: name too long", seg, LOGTXT_SUFFIX);
+			return;
+		}
+		*fdp = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+		    S_IRUSR | S_IWUSR);
+		if (*fdp < 0) {
+			warn("%s", path);
+			return;
+		}
+	}
+	for (off = 0; off < len; off += n)
+		if ((n = write(*fdp, buf + off, len - off)) < 0) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			warn("text of %s", seg);
+			break;
+		}
+}
+
+/*
+ * Write out the plain text copy of the current segment (-N).  Called
+ * with sm_lock held, by the flusher after the log itself and when the
+ * log is closed; the writer only ever fills buffers.
+ */
+void
+sm_textflush(struct snpmeta *sm)
+{
+	char seg[MAXPATHLEN], *s;
+
+	if (sm->sm_ntxtout == 0 && sm->sm_ntxt == 0)
+		return;
+	s = sm_segname(sm, seg, sizeof(seg));
+	sm_textout(&sm->sm_txtfd, s, sm->sm_txtout, sm->sm_ntxtout);
+	sm_textout(&sm->sm_txtfd, s, sm->sm_txt, sm->sm_ntxt);
+	sm->sm_ntxtout = sm->sm_ntxt = 0;
+}
+
+/*
+ * Add to the plain text copy.  Session data is stripped of escape
+ * sequences; our own ";;" lines already are plain.  Stripping never
+ * makes text longer, so a chunk that fits the buffer needs no more
+ * than its own size.  A full buffer is handed to the flusher; if it
+ * still has the last one, text is left out rather than written here,
+ * and a ";;" line later says how much.
+ */
+static void
+sm_text(struct snpmeta *sm, const char *ptr, size_t size, int data)
+{
+	char note[64], *p;
+	size_t n;
+
+	if (sm->sm_txt == NULL &&
+	    (sm->sm_txt = malloc(SM_TXTBUF)) == NULL)
+		return;
+	while (size > 0) {
+		if (sm->sm_ntxt == SM_TXTBUF) {
+			if (sm->sm_ntxtout != 0) {
+				sm->sm_txtlost += size;
+				return;
+			}
+			if (sm->sm_txtout == NULL &&
+			    (sm->sm_txtout = malloc(SM_TXTBUF)) == NULL) {
+				sm->sm_txtlost += size;
+				return;
+			}
+			p = sm->sm_txtout;
+			sm->sm_txtout = sm->sm_txt;
+			sm->sm_ntxtout = sm->sm_ntxt;
+			sm->sm_txt = p;
+			sm->sm_ntxt = 0;
+			flusher_kick(sm);
+		}
+		if (sm->sm_txtlost != 0 &&
+		    SM_TXTBUF - sm->sm_ntxt >= sizeof(note)) {
+			n = snprintf(note, sizeof(note),
+			    "\n;; %zu bytes of text left out\n",
+			    sm->sm_txtlost);
+			memcpy(sm->sm_txt + sm->sm_ntxt, note, n);
+			sm->sm_ntxt += n;
+			sm->sm_txtlost = 0;
+		}
+		n = SM_TXTBUF - sm->sm_ntxt;
+		if (n > size)
+			n = size;
+		if (data)
+			sm->sm_ntxt = vt_strip(&sm->sm_vt, sm->sm_txt,
+			    sm->sm_ntxt, ptr, n);
+		else {
+			memcpy(sm->sm_txt + sm->sm_ntxt, ptr, n);
+			sm->sm_ntxt += n;
+		}
+		ptr += n;
+		size -= n;
+	}
+}
+
+static void
+sm_write(struct snpmeta *sm, const char *ptr, size_t size, int data)
+{
+	if (binfmt)
+		sm_frame(sm, data ? REC_DATA : REC_META, size);
+	sm_put(sm, ptr, size, data);
+	if (vtstrip)
+		sm_text(sm, ptr, size, data);
+	flusher_dirty(sm);
+}
+
+static void
+sm_printf(struct snpmeta *sm, const char *fmt, ...)
+{
+	char buf[512];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len >= (int)sizeof(buf))
+		len = sizeof(buf) - 1;
+	if (len > 0)
+		sm_write(sm, buf, len, 0);
+}
+
+/*
+ * Record the digest of the segment so far, so a verifier can tell
+ * where damage starts.  See chain.h.
+ */
+static void
+sm_checkpoint(struct snpmeta *sm)
+{
+	struct digestval dv;
+
+	digest_peek(&sm->sm_digest, &dv);
+	sm->sm_ckpt = sm->sm_fsize;
+	sm_printf(sm, "%s%jd %s\n", CHAIN_CKPT, (intmax_t)sm->sm_fsize,
+	    dv.dv_sha256);
+}
+
+/*
+ * Name of the segment currently being written.
+ */
+static char *
+sm_segname(struct snpmeta *sm, char *buf, size_t len)
+{
+	if (sm->unit == 2)
+		return (sm->fname);
+	(void)snprintf(buf, len, "%s%d", sm->fname, sm->unit - 1);
+	return (buf);
+}
+
+/*
+ * Append the buffered entries to the sidecar index of the current
+ * segment.
+ */
+static void
+sm_idxflush(struct snpmeta *sm)
+{
+	char path[MAXPATHLEN], seg[MAXPATHLEN];
+	int fd;
+
+	if (sm->sm_nidx == 0)
+		return;
+	snprintf(path, sizeof(path), "%s%s",
+	    sm_segname(sm, seg, sizeof(seg)), LOGIDX_SUFFIX);
+	fd = open(path, O_WRONLY | O_CREAT | O_APPEND |
+	    (sm->sm_idxfile ? 0 : O_TRUNC), S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		warn("%s", path);
+		sm->sm_nidx = 0;
+		return;
+	}
+	if ((!sm->sm_idxfile &&
+	    write(fd, LOGIDX_MAGIC, LOGIDX_MAGICLEN) != LOGIDX_MAGICLEN) ||
+	    write(fd, sm->sm_idx, sm->sm_nidx * LOGIDX_ENTLEN) < 0)
+		warn("%s", path);
+	close(fd);
+	sm->sm_idxfile = 1;
+	sm->sm_nidx = 0;
+}
+
+/*
+ * Add an entry to the sidecar index if enough data or time has gone
+ * by since the last one.  Called before a chunk is written, so the
+ * entry points at it.
+ */
+static void
+sm_index(struct snpmeta *sm)
+{
+	uint64_t now;
+
+	now = usecs(CLOCK_RECORD);
+	if (sm->sm_idxts != 0 &&
+	    (idxbytes == 0 || sm->sm_fsize - sm->sm_idxoff < idxbytes) &&
+	    (idxsecs == 0 || now - sm->sm_idxts < idxsecs * 1000000ULL))
+		return;
+	if (sm->sm_idx == NULL &&
+	    (sm->sm_idx = malloc(SM_IDXBATCH * LOGIDX_ENTLEN)) == NULL)
+		return;
+	if (binfmt) {
+		if (sm->sm_fsize == 0)
+			sm_put(sm, LOGFMT_MAGIC, LOGFMT_MAGICLEN, 0);
+		sm->sm_lastts = 0;	/* so the chunk follows a REC_TIME */
+	}
+	logidx_entry(sm->sm_idx + sm->sm_nidx * LOGIDX_ENTLEN,
+	    usecs(CLOCK_REALTIME), sm->sm_fsize);
+	sm->sm_idxoff = sm->sm_fsize;
+	sm->sm_idxts = now;
+	if (++sm->sm_nidx == SM_IDXBATCH)
+		sm_idxflush(sm);
+}
+
+
 void *
 snp_setup(void *m_data, char *config __unused)
 {
@@ -86,7 +564,7 @@ snp_setup(void *m_data, char *config __unused)
 	char logname[256];
 
 	assert(m_data != NULL);
-	sm = malloc(sizeof(struct snpmeta));
+	sm = calloc(1, sizeof(struct snpmeta));
 	if (sm == NULL)
 		return (NULL);
 	snp = (struct snp_d *)m_data;
@@ -94,24 +572,44 @@ snp_setup(void *m_data, char *config __unused)
 	    "%s_%s_%d.log", snp->s_username,
 	    snp->s_line, time(0));
 	while(index(logname,'/')) *(index(logname,'/')) = '_';
-	sm->fp = fopen(logname, "w");
-	if (sm->fp == NULL)
+	if (digest_init(&sm->sm_digest, DIGEST_ALL) < 0) {
+		free(sm);
+		return (NULL);
+	}
+	if (budget_enabled() &&
+	    (sm->sm_budget = budget_new(snp->s_username)) == NULL) {
+		digest_free(&sm->sm_digest);
+		free(sm);
+		return (NULL);
+	}
+	if (logio->li_open(sm, logname) < 0) {
+		if (sm->sm_budget != NULL)
+			budget_free(sm->sm_budget);
+		digest_free(&sm->sm_digest);
+		free(sm->sm_iobuf);
+		free(sm);
 		return (NULL);
+	}
+	pthread_mutex_init(&sm->sm_lock, NULL);
 	sm->unit = 2;
-	sm->counter = 0;
+	sm->sm_txtfd = -1;
+	vt_init(&sm->sm_vt);
+	sm->sm_nextfd = -1;
+	sm->sm_segstart = time(NULL);
+	sm->sm_sid = atomic_fetch_add(&sm_nextsid, 1) + 1;
+	sm->sm_stats = snp->s_stats;
+	sm->sm_stats->ss_sid = sm->sm_sid;
 	dolog("%s session %s created", timestamp(), logname);
 	strlcpy(sm->fname, logname, sizeof(sm->fname));
-	if (chmod(logname, S_IWUSR | S_IRUSR) < 0)
-		warn("chmod failed");
-	if (appendonly)
-		if (chflags(sm->fname, SF_APPEND) < 0)
-			warn("chflags failed");
-	fprintf(sm->fp,
+	pthread_mutex_lock(&sm->sm_lock);
+	sm_printf(sm,
 	    ";; Session started: %s\n"
 	    ";; Username: %s\n"
 	    ";; TTY line: %s\n",
 	    timestamp(), snp->s_username,
 	    snp->s_line);
+	pthread_mutex_unlock(&sm->sm_lock);
+	rotate_add(sm);
 	return (sm);
 }
 
@@ -121,9 +619,11 @@ snp_overflow(void *m_data)
 	struct snpmeta *sm;
 
 	sm = (struct snpmeta *)m_data;
-	fprintf(sm->fp,
+	pthread_mutex_lock(&sm->sm_lock);
+	sm_printf(sm,
 	    "\n;; %s TTY overflow: Possibly missing data\n\n",
 	    timestamp());
+	pthread_mutex_unlock(&sm->sm_lock);
 	return (0);
 }
 
@@ -131,61 +631,241 @@ int
 snp_remove(void *m_data)
 {
 	struct snpmeta *sm;
+	struct digestval dv;
+	char fname[MAXPATHLEN], *f;
 
 	assert(m_data != NULL);
 	sm = (struct snpmeta *)m_data;
-	fprintf(sm->fp, "\n;; Session closed: %s\n", timestamp());
-	fclose(sm->fp);
-	log_message_digest(sm);
+	if (sm->sm_budget != NULL && sm->sm_budget->bg_over)
+		sm_endsummary(sm);
+	rotate_forget(sm);
+	pthread_mutex_lock(&sm->sm_lock);
+	sm_printf(sm, "\n;; Session closed: %s\n", timestamp());
+	sm_idxflush(sm);
+	sm_textflush(sm);
+	if (sm->sm_txtfd >= 0)
+		close(sm->sm_txtfd);
+	f = sm_segname(sm, fname, sizeof(fname));
+	digest_final(&sm->sm_digest, &dv);
+	chain_append(f, dv.dv_sha256, sm->sm_fsize);
+	pthread_mutex_unlock(&sm->sm_lock);
+	logio->li_close(sm, f, &dv);
+	flusher_forget(sm);
+	if (sm->sm_nextfd >= 0) {
+		/* opened ahead but never used */
+		close(sm->sm_nextfd);
+		if ((size_t)snprintf(fname, sizeof(fname), "%s%d", sm->fname,
+		    sm->unit) >= sizeof(fname))
+			warnx("%s%d: name too long", sm->fname, sm->unit);
+		else {
+			(void)chflags(fname, 0);
+			if (unlink(fname) < 0)
+				warn("%s", fname);
+		}
+	}
+	digest_free(&sm->sm_digest);
+	pthread_mutex_destroy(&sm->sm_lock);
+	if (sm->sm_budget != NULL)
+		budget_free(sm->sm_budget);
+	free(sm->sm_idx);
+	free(sm->sm_txtout);
+	free(sm->sm_txt);
 	free(sm);
 	return (0);
 }
 
+/*
+ * What the rotation thread does for a segment once it is closed.
+ */
+struct sm_old {
+	char			so_name[MAXPATHLEN];
+	char			so_sha256[DIGEST_SHA256_LEN];
+	off_t			so_size;
+	int			so_txtfd;
+	char			*so_txtout;	/* its plain text, as in */
+	size_t			so_ntxtout;	/* struct snpmeta */
+	char			*so_txt;
+	size_t			so_ntxt;
+};
+
+static void
+sm_retire(void *arg)
+{
+	struct sm_old *so;
+
+	so = arg;
+	chain_append(so->so_name, so->so_sha256, so->so_size);
+	sm_textout(&so->so_txtfd, so->so_name, so->so_txtout,
+	    so->so_ntxtout);
+	sm_textout(&so->so_txtfd, so->so_name, so->so_txt, so->so_ntxt);
+	if (so->so_txtfd >= 0)
+		close(so->so_txtfd);
+	free(so->so_txtout);
+	free(so->so_txt);
+	free(so);
+}
+
+/*
+ * Move on to the next segment, if it has been opened ahead; if not,
+ * ask for it and return -1, and the log carries on in this one for
+ * now.  Nor can it while the writer is parked in the middle of a
+ * chunk (see ur_getbuf()), once the log is being closed, or if the
+ * name of the next segment does not fit.  Called with sm_lock held.
+ */
+int
+sm_rotate(struct snpmeta *sm, int why)
+{
+	struct digestval dv;
+	struct sm_old *so;
+	char fname[MAXPATHLEN], oname[MAXPATHLEN], *o;
+
+	if (sm->sm_parked || sm->sm_closing)
+		return (-1);
+	if (sm->sm_nextfd < 0) {
+		if (!sm->sm_late) {
+			sm->sm_late = 1;
+			rotate_count(ROT_LATE);
+		}
+		rotate_ahead(sm);
+		return (-1);
+	}
+	if ((size_t)snprintf(fname, sizeof(fname), "%s%d", sm->fname,
+	    sm->unit) >= sizeof(fname))
+		return (-1);
+	if ((so = malloc(sizeof(*so))) == NULL)
+		return (-1);
+	sm_idxflush(sm);
+	o = sm_segname(sm, oname, sizeof(oname));
+	digest_peek(&sm->sm_digest, &dv);
+	if (logio->li_rotate(sm, o, &dv, fname, sm->sm_nextfd) < 0) {
+		free(so);
+		return (-1);
+	}
+	digest_final(&sm->sm_digest, &dv);
+	strlcpy(so->so_name, o, sizeof(so->so_name));
+	strlcpy(so->so_sha256, dv.dv_sha256, sizeof(so->so_sha256));
+	so->so_size = sm->sm_fsize;
+	so->so_txtfd = sm->sm_txtfd;
+	so->so_txtout = sm->sm_txtout;
+	so->so_ntxtout = sm->sm_ntxtout;
+	so->so_txt = sm->sm_txt;
+	so->so_ntxt = sm->sm_ntxt;
+	if (rotate_defer(sm, sm_retire, so) < 0)
+		sm_retire(so);
+	sm->unit++;
+	sm->sm_nextfd = sm->sm_txtfd = -1;
+	sm->sm_txtout = sm->sm_txt = NULL;
+	sm->sm_ntxtout = sm->sm_ntxt = 0;
+	sm->sm_fsize = sm->sm_ckpt = 0;
+	sm->sm_lastts = sm->sm_idxts = 0;
+	sm->sm_idxfile = 0;
+	sm->sm_late = 0;
+	sm->sm_segstart = time(NULL);
+	sm->sm_lastout = 0;
+	rotate_count(why);
+	return (0);
+}
+
 int
 snp_write_log(void *m_data, char *ptr, int size)
 {
 	struct snpmeta *sm;
-	char fname[MAXPATHLEN];
+	int maxfsize;
 
 	assert(m_data != NULL || ptr != NULL);
 	sm = (struct snpmeta *)m_data;
-	if (maxfsize > 0 && ftell(sm->fp) > maxfsize) {
-		fclose(sm->fp);
-		log_message_digest(sm);
-		sprintf(fname, "%s%d", sm->fname, sm->unit++);
-		sm->fp = fopen(fname, "w");
-		if (sm->fp == NULL) 
-			err(1, "fopen %s failed", fname);
-		if (chmod(fname, S_IWUSR | S_IRUSR) < 0)
-			err(1, "chmod failed");
-		if (appendonly)
-			if (chflags(fname, SF_APPEND) < 0)
-				err(1, "chflags failed");
+	atomic_fetch_add(&sm_chunks, 1);
+	CONF_GET(tc_maxfsize, maxfsize);
+	pthread_mutex_lock(&sm->sm_lock);
+	if (maxfsize > 0 && sm->sm_fsize > ROTATE_AHEAD(maxfsize)) {
+		if (sm->sm_fsize > maxfsize)
+			(void)sm_rotate(sm, ROT_SIZE);
+		else
+			rotate_ahead(sm);
 	}
-	fwrite(ptr, size, 1, sm->fp);
-	sm->counter += size;
-	fflush(sm->fp);
+	if (idxbytes > 0 || idxsecs > 0)
+		sm_index(sm);
+	sm->sm_lastout = usecs(CLOCK_RECORD);
+	sm_write(sm, ptr, size, 1);
+	if (ckptsize > 0 && sm->sm_fsize - sm->sm_ckpt >= ckptsize)
+		sm_checkpoint(sm);
+	STATS_SET(sm->sm_stats->ss_qdepth, sm->sm_pending);
+	pthread_mutex_unlock(&sm->sm_lock);
 	return (0);
 }
 
+/*
+ * Close the summary of output that went over budget with what was
+ * left out and the tail of it.
+ */
+static void
+sm_endsummary(struct snpmeta *sm)
+{
+	struct budget *b;
+	size_t n;
+
+	b = sm->sm_budget;
+	pthread_mutex_lock(&sm->sm_lock);
+	sm_printf(sm, "\n;; %s Over budget: %ju bytes not logged, "
+	    "the last %zu follow\n", timestamp(),
+	    (uintmax_t)(b->bg_skipped - b->bg_taillen), b->bg_taillen);
+	pthread_mutex_unlock(&sm->sm_lock);
+	n = MIN(b->bg_taillen, BUDGET_SAMPLE - b->bg_tailoff);
+	if (n > 0)
+		snp_write_log(sm, b->bg_tail + b->bg_tailoff, n);
+	if (b->bg_taillen > n)
+		snp_write_log(sm, b->bg_tail, b->bg_taillen - n);
+	pthread_mutex_lock(&sm->sm_lock);
+	sm_printf(sm, "\n;; %s End of summary\n\n", timestamp());
+	pthread_mutex_unlock(&sm->sm_lock);
+	budget_ended(b);
+}
+
+/*
+ * Used instead of snp_write_log() when budgets are in force.  Once a
+ * session goes over budget its output is summarized: the head of it
+ * is logged, the rest only counted and sampled until the session is
+ * back within its budget or goes away.
+ */
 int
-log_message_digest(struct snpmeta *sm)
-{
-	char fname[MAXPATHLEN], *f, *hash;
-
-	if (sm->unit != 2) {
-		(void)snprintf(fname, sizeof(fname) - 1,
-		    "%s%d", sm->fname, sm->unit - 1);
-		f = &fname[0];
-	} else
-		f = &sm->fname[0];
-	hash = SHA1_File(f, 0);
-	if (hash == NULL) {
-		warnx("digest calculation failed");
-		return (1);
-	}
-	dolog("%s session %s closed sha1 checksum %s bytes logged %qu",
-	    timestamp(), f, hash, sm->counter);
-	free(hash);
+snp_write_budget(void *m_data, char *ptr, int size)
+{
+	struct snpmeta *sm;
+	struct budget *b;
+	int n, over;
+
+	sm = (struct snpmeta *)m_data;
+	b = sm->sm_budget;
+	over = b->bg_over;
+	if (budget_take(b, size)) {
+		if (over)
+			sm_endsummary(sm);
+		return (snp_write_log(m_data, ptr, size));
+	}
+	if (!over) {
+		pthread_mutex_lock(&sm->sm_lock);
+		sm_printf(sm, "\n;; %s Over budget: summarizing output\n\n",
+		    timestamp());
+		pthread_mutex_unlock(&sm->sm_lock);
+	}
+	n = MIN(size, (int)(BUDGET_SAMPLE - b->bg_head));
+	if (n > 0) {
+		snp_write_log(m_data, ptr, n);
+		b->bg_head += n;
+	}
+	budget_stash(b, ptr + n, size - n);
+	return (0);
+}
+
+/*
+ * The SHA1 part of the message is what it has always been; SHA-256
+ * is tacked on at the end so existing parsers keep working.
+ */
+int
+log_message_digest(const char *f, struct digestval *dv, quad_t counter)
+{
+	dolog("%s session %s closed sha1 checksum %s bytes logged %qu "
+	    "sha256 checksum %s", timestamp(), f, dv->dv_sha1, counter,
+	    dv->dv_sha256);
 	return (0);
 }
@@ -29,15 +29,109 @@
 #ifndef	FILE_OPS_DOT_H_
 #define	FILE_OPS_DOT_H_
 
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "digest.h"
+#include "vtstrip.h"
+
+#define	SM_BUFSIZE	(64 * 1024)	/* stdio buffer per log */
+#define	SM_TXTBUF	(64 * 1024)	/* plain text not yet written */
+
+struct snpmeta;
+
+/*
+ * How log data gets to the disk.  Synchronous backends write from
+ * whatever thread calls them.  Asynchronous ones only stage data in
+ * li_write and rely on the flusher to call li_flush/li_sync for every
+ * dirty log and li_commit once per batch; li_close must not return
+ * before the log is closed on disk.  li_preopen opens a segment from
+ * the rotation thread and li_rotate switches over to it; li_rotate
+ * only fails before it has changed anything, leaving the descriptor
+ * to the caller, and leaves work on the old segment to rotate_defer().
+ */
+struct logio {
+	const char	*li_name;
+	int		li_async;
+	int		(*li_init)(void);
+	int		(*li_open)(struct snpmeta *, const char *);
+	void		(*li_write)(struct snpmeta *, const char *, size_t,
+			    int);
+	int		(*li_flush)(struct snpmeta *);
+	int		(*li_sync)(struct snpmeta *);
+	int		(*li_preopen)(const char *);
+	int		(*li_rotate)(struct snpmeta *, const char *,
+			    struct digestval *, const char *, int);
+	int		(*li_close)(struct snpmeta *, const char *,
+			    struct digestval *);
+	void		(*li_commit)(void);
+	void		(*li_dumpstats)(FILE *);
+};
+
+extern struct logio *logio;
+extern struct logio logio_stdio;
+#ifdef __linux__
+extern struct logio logio_uring;
+#endif
+
 struct snpmeta {
 	FILE		*fp;
+	void		*sm_io;		/* private to the logio backend */
 	char		fname[MAXPATHLEN];
 	int		unit;
 	quad_t		counter;
+	pthread_mutex_t	sm_lock;	/* serializes writer and flusher */
+	struct digest	sm_digest;	/* of the current segment */
+	char		*sm_iobuf;
+	off_t		sm_fsize;	/* size of the current segment */
+	off_t		sm_ckpt;	/* offset of the last checkpoint */
+	uint32_t	sm_sid;		/* session id in binary records */
+	uint64_t	sm_lastts;	/* of the last record, usec */
+	unsigned char	*sm_idx;	/* index entries not yet written */
+	int		sm_nidx;
+	int		sm_idxfile;	/* index of this segment exists */
+	off_t		sm_idxoff;	/* of the last index entry */
+	uint64_t	sm_idxts;	/* of the last index entry, usec */
+	size_t		sm_pending;	/* bytes not yet given to the kernel */
+	int		sm_dirty;	/* on the flusher's queue */
+	int		sm_flushing;	/* being flushed right now */
+	struct timespec	sm_deadline;
+	TAILQ_ENTRY(snpmeta) sm_dirtyq;
+	TAILQ_ENTRY(snpmeta) sm_batchq;	/* flusher's, while sm_flushing */
+	struct stats_session *sm_stats;	/* the session's counters */
+	struct budget	*sm_budget;	/* NULL if unlimited */
+#ifdef LATENCY_TRACE
+	uint64_t	sm_tdirty;	/* when unflushed data appeared */
+#endif
+	struct vtstate	sm_vt;		/* -N: where the stripper left off */
+	char		*sm_txt;	/* -N: plain text being added to */
+	size_t		sm_ntxt;
+	char		*sm_txtout;	/* -N: full, left to the flusher */
+	size_t		sm_ntxtout;
+	size_t		sm_txtlost;	/* -N: bytes left out since */
+	int		sm_txtfd;	/* -N: the segment's text, or -1 */
+	int		sm_nextfd;	/* next segment, opened ahead, or -1 */
+	int		sm_ahead;	/* its open is queued */
+	int		sm_late;	/* due but the open is not done */
+	int		sm_parked;	/* writer waiting without sm_lock */
+	int		sm_closing;	/* no more rotation work, see rotate.c */
+	time_t		sm_retry;	/* no open before, after a failure */
+	time_t		sm_segstart;	/* wall clock the segment began */
+	uint64_t	sm_lastout;	/* of the last output, usec, or 0 */
+	int		sm_rotjobs;	/* queued for rotation, see rotate.c */
+	TAILQ_ENTRY(snpmeta) sm_rotq;
 };
+
+extern atomic_ulong sm_chunks;		/* writes handed to us */
+extern atomic_ulong sm_writes;		/* writes handed to the kernel */
+
 void *snp_setup(void *, char *);
 int snp_remove(void *);
 int snp_write_log(void *, char *, int);
+int snp_write_budget(void *, char *, int);
 int snp_overflow(void *);
-int log_message_digest(struct snpmeta *);
+void sm_textflush(struct snpmeta *);
+int sm_rotate(struct snpmeta *, int);
+int log_message_digest(const char *, struct digestval *, quad_t);
 #endif	/* FILE_OPS_DOT_H_ */
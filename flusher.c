@@ -0,0 +1,311 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/param.h>
+#include <sys/time.h>
+
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "compat.h"
+#include "fileops.h"
+#include "flusher.h"
+#include "latency.h"
+#include "stats.h"
+
+long flushlatency = 5000;		/* budget in micro-seconds */
+int durability = DURABLE_FLUSH;
+
+extern int vtstrip;
+
+static pthread_mutex_t wq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wq_work;		/* on CLOCK_MONOTONIC */
+static pthread_cond_t wq_done = PTHREAD_COND_INITIALIZER;
+static TAILQ_HEAD(, snpmeta) wq_dirty = TAILQ_HEAD_INITIALIZER(wq_dirty);
+static int wq_urgent;			/* do not wait for the deadline */
+
+/* protected by wq_lock */
+static u_long wq_batches;
+static u_long wq_flushes;
+static u_long wq_syncs;
+static u_long wq_maxbatch;
+
+static void
+deadline(struct timespec *ts, long usec)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	ts->tv_sec += usec / 1000000;
+	ts->tv_nsec += (usec % 1000000) * 1000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static int
+expired(struct timespec *ts)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec > ts->tv_sec ||
+	    (now.tv_sec == ts->tv_sec && now.tv_nsec >= ts->tv_nsec));
+}
+
+/*
+ * Called with sm_lock held after data has been appended.
+ */
+void
+flusher_dirty(struct snpmeta *sm)
+{
+	if (durability == DURABLE_NONE)
+		return;
+	LAT_STAMP(sm->sm_tdirty);
+	if (flushlatency == 0) {
+		if (logio->li_async) {
+			flusher_kick(sm);
+			return;
+		}
+		if (logio->li_flush(sm) > 0)
+			STATS_INC(sm->sm_stats->ss_flushes);
+		STATS_SET(sm->sm_stats->ss_qdepth, sm->sm_pending);
+		if (durability == DURABLE_FDATASYNC)
+			logio->li_sync(sm);
+		LAT_SINCE(LAT_DURABLE, sm->sm_tdirty);
+		return;
+	}
+	if (sm->sm_dirty)
+		return;
+	pthread_mutex_lock(&wq_lock);
+	sm->sm_dirty = 1;
+	deadline(&sm->sm_deadline, flushlatency);
+	if (TAILQ_EMPTY(&wq_dirty))
+		pthread_cond_signal(&wq_work);
+	TAILQ_INSERT_TAIL(&wq_dirty, sm, sm_dirtyq);
+	pthread_mutex_unlock(&wq_lock);
+}
+
+/*
+ * Have sm written out right away, rather than at the end of the
+ * latency budget.  Asynchronous backends use this once they have a
+ * full buffer, a rotation or a close queued, and -N once it has a
+ * full buffer of text.
+ */
+void
+flusher_kick(struct snpmeta *sm)
+{
+	pthread_mutex_lock(&wq_lock);
+	if (!sm->sm_dirty) {
+		sm->sm_dirty = 1;
+		clock_gettime(CLOCK_MONOTONIC, &sm->sm_deadline);
+		TAILQ_INSERT_TAIL(&wq_dirty, sm, sm_dirtyq);
+	}
+	wq_urgent = 1;
+	pthread_cond_signal(&wq_work);
+	pthread_mutex_unlock(&wq_lock);
+}
+
+/*
+ * Make sure the flusher is done with sm before it goes away.  Called
+ * without sm_lock held.
+ */
+void
+flusher_forget(struct snpmeta *sm)
+{
+	pthread_mutex_lock(&wq_lock);
+	while (sm->sm_flushing)
+		pthread_cond_wait(&wq_done, &wq_lock);
+	if (sm->sm_dirty) {
+		TAILQ_REMOVE(&wq_dirty, sm, sm_dirtyq);
+		sm->sm_dirty = 0;
+	}
+	pthread_mutex_unlock(&wq_lock);
+}
+
+/*
+ * Logs are queued in the order they became dirty, so the head of the
+ * queue always has the nearest deadline.  When it expires everything
+ * that is dirty goes out in the same batch.
+ */
+static void *
+flusher(void *arg __unused)
+{
+	TAILQ_HEAD(, snpmeta) batch;
+	struct snpmeta *sm;
+	u_long n, nsync;
+
+	pthread_mutex_lock(&wq_lock);
+	for (;;) {
+		while ((sm = TAILQ_FIRST(&wq_dirty)) == NULL)
+			pthread_cond_wait(&wq_work, &wq_lock);
+		if (!wq_urgent && !expired(&sm->sm_deadline)) {
+			pthread_cond_timedwait(&wq_work, &wq_lock,
+			    &sm->sm_deadline);
+			continue;
+		}
+		wq_urgent = 0;
+		/*
+		 * The batch has its own link: a log written to while it
+		 * is being flushed goes back on wq_dirty meanwhile.
+		 */
+		TAILQ_INIT(&batch);
+		while ((sm = TAILQ_FIRST(&wq_dirty)) != NULL) {
+			TAILQ_REMOVE(&wq_dirty, sm, sm_dirtyq);
+			sm->sm_dirty = 0;
+			sm->sm_flushing = 1;
+			TAILQ_INSERT_TAIL(&batch, sm, sm_batchq);
+		}
+		pthread_mutex_unlock(&wq_lock);
+		n = nsync = 0;
+		TAILQ_FOREACH(sm, &batch, sm_batchq) {
+			pthread_mutex_lock(&sm->sm_lock);
+			if (logio->li_flush(sm) > 0) {
+				n++;
+				STATS_INC(sm->sm_stats->ss_flushes);
+			}
+			sm_textflush(sm);
+			STATS_SET(sm->sm_stats->ss_qdepth, sm->sm_pending);
+			if (durability != DURABLE_FDATASYNC)
+				LAT_SINCE(LAT_DURABLE, sm->sm_tdirty);
+			pthread_mutex_unlock(&sm->sm_lock);
+		}
+		/*
+		 * Sync after everything has been written so the disk
+		 * sees the whole batch at once.
+		 */
+		if (durability == DURABLE_FDATASYNC)
+			TAILQ_FOREACH(sm, &batch, sm_batchq) {
+				pthread_mutex_lock(&sm->sm_lock);
+				if (logio->li_sync(sm) == 0)
+					nsync++;
+				LAT_SINCE(LAT_DURABLE, sm->sm_tdirty);
+				pthread_mutex_unlock(&sm->sm_lock);
+			}
+		if (logio->li_commit != NULL)
+			logio->li_commit();
+		pthread_mutex_lock(&wq_lock);
+		TAILQ_FOREACH(sm, &batch, sm_batchq)
+			sm->sm_flushing = 0;
+		pthread_cond_broadcast(&wq_done);
+		wq_batches++;
+		wq_flushes += n;
+		wq_syncs += nsync;
+		STATS_INC(stats->sh_global.sg_batches);
+		atomic_fetch_add_explicit(&stats->sh_global.sg_flushes, n,
+		    memory_order_relaxed);
+		atomic_fetch_add_explicit(&stats->sh_global.sg_syncs, nsync,
+		    memory_order_relaxed);
+		if (n > wq_maxbatch)
+			wq_maxbatch = n;
+	}
+	/* NOTREACHED */
+	return (NULL);
+}
+
+int
+flusher_init(void)
+{
+	pthread_condattr_t attr;
+	pthread_t thr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&wq_work, &attr);
+	pthread_condattr_destroy(&attr);
+	/* -N hands full text buffers to the flusher in any case */
+	if (!logio->li_async && !vtstrip &&
+	    (durability == DURABLE_NONE || flushlatency == 0))
+		return (0);
+	return (pthread_create(&thr, NULL, flusher, NULL));
+}
+
+void
+flusher_dumpstats(FILE *fp)
+{
+	u_long chunks, writes;
+
+	chunks = atomic_load(&sm_chunks);
+	writes = atomic_load(&sm_writes);
+	pthread_mutex_lock(&wq_lock);
+	fprintf(fp, "Log writer statistics:\n"
+	    "%-10s %-10s %-10s %-10s %-10s %-10s %s\n",
+	    "CHUNKS", "WRITES", "SAVED", "BATCHES", "FLUSHES", "SYNCS",
+	    "MAXBATCH");
+	fprintf(fp, "%-10lu %-10lu %-10lu %-10lu %-10lu %-10lu %lu\n",
+	    chunks, writes, chunks > writes ? chunks - writes : 0,
+	    wq_batches, wq_flushes, wq_syncs, wq_maxbatch);
+	pthread_mutex_unlock(&wq_lock);
+	if (logio->li_dumpstats != NULL)
+		logio->li_dumpstats(fp);
+}
+
+/*
+ * Accepts a number with an optional us, ms or s suffix; the default
+ * unit is milli-seconds.
+ */
+int
+flusher_parselatency(const char *str, long *usec)
+{
+	char *endp;
+	long val;
+
+	val = strtol(str, &endp, 10);
+	if (endp == str || val < 0)
+		return (-1);
+	if (strcmp(endp, "us") == 0)
+		*usec = val;
+	else if (*endp == '\0' || strcmp(endp, "ms") == 0)
+		*usec = val * 1000;
+	else if (strcmp(endp, "s") == 0)
+		*usec = val * 1000000;
+	else
+		return (-1);
+	return (0);
+}
+
+int
+flusher_parsemode(const char *str)
+{
+	if (strcmp(str, "none") == 0)
+		return (DURABLE_NONE);
+	if (strcmp(str, "flush") == 0)
+		return (DURABLE_FLUSH);
+	if (strcmp(str, "fdatasync") == 0)
+		return (DURABLE_FDATASYNC);
+	return (-1);
+}
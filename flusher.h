@@ -0,0 +1,53 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef	FLUSHER_DOT_H_
+#define	FLUSHER_DOT_H_
+
+/*
+ * Group commit for session logs.  Writers append to the buffer of
+ * their log and mark it dirty; the flusher thread pushes every dirty
+ * log to the kernel in one pass once the oldest unflushed data
+ * reaches the latency budget.  With the stdio backend a log whose
+ * buffer fills up is flushed inline by the writer; asynchronous
+ * backends kick the flusher instead.
+ */
+#define	DURABLE_NONE		0	/* only flush when buffers fill */
+#define	DURABLE_FLUSH		1	/* write(2) within the budget */
+#define	DURABLE_FDATASYNC	2	/* ... and fdatasync(2) each batch */
+
+struct snpmeta;
+
+int flusher_init(void);
+void flusher_dirty(struct snpmeta *);
+void flusher_kick(struct snpmeta *);
+void flusher_forget(struct snpmeta *);
+void flusher_dumpstats(FILE *);
+int flusher_parselatency(const char *, long *);
+int flusher_parsemode(const char *);
+#endif	/* FLUSHER_DOT_H_ */
@@ -0,0 +1,321 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include <stdio.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <time.h>
+
+#include "compat.h"
+#include "indexer.h"
+#include "trindex.h"
+
+struct ixjob {
+	STAILQ_ENTRY(ixjob)	 ij_link;
+	int			 ij_setonly;	/* set written before a restart */
+	uint32_t		*ij_tris;
+	size_t			 ij_ntris;
+	char			 ij_day[TRI_DAYLEN];
+	char			 ij_name[MAXPATHLEN];
+};
+
+STAILQ_HEAD(ixlist, ixjob);
+
+static pthread_mutex_t ix_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ix_work = PTHREAD_COND_INITIALIZER;
+static struct ixlist ix_queue = STAILQ_HEAD_INITIALIZER(ix_queue);
+static const char *ix_dir;		/* NULL when not indexing */
+
+/* protected by ix_lock */
+static u_long ix_queued;
+static u_long ix_done;
+static u_long ix_failed;
+static u_long ix_pending;
+static u_long ix_merges;
+static uint64_t ix_trigrams;
+
+static void
+setpath(char *buf, size_t len, const char *name)
+{
+	snprintf(buf, len, "%s/%s%s", ix_dir, name, TRI_SUFFIX);
+}
+
+/*
+ * Merge the jobs of one day into its shard and drop their sets.
+ * Returns 0 if the shard has them all.
+ */
+static int
+mergeday(struct ixjob **jobs, int n)
+{
+	char path[MAXPATHLEN];
+	const char **names;
+	uint32_t **tris;
+	size_t *ntris;
+	int i, ret;
+
+	names = calloc(n, sizeof(*names));
+	tris = calloc(n, sizeof(*tris));
+	ntris = calloc(n, sizeof(*ntris));
+	ret = -1;
+	if (names != NULL && tris != NULL && ntris != NULL) {
+		for (i = 0; i < n; i++) {
+			names[i] = jobs[i]->ij_name;
+			tris[i] = jobs[i]->ij_tris;
+			ntris[i] = jobs[i]->ij_ntris;
+		}
+		snprintf(path, sizeof(path), "%s/%s%s", ix_dir,
+		    jobs[0]->ij_day, SHARD_SUFFIX);
+		ret = shard_merge(path, names, tris, ntris, n);
+		if (ret < 0)
+			warn("%s: not merged", path);
+	}
+	if (ret == 0)
+		for (i = 0; i < n; i++) {
+			setpath(path, sizeof(path), jobs[i]->ij_name);
+			(void)unlink(path);
+		}
+	free(names);
+	free(tris);
+	free(ntris);
+	return (ret);
+}
+
+static int
+byday(const void *a, const void *b)
+{
+	const struct ixjob *const *x = a, *const *y = b;
+
+	return (strcmp((*x)->ij_day, (*y)->ij_day));
+}
+
+/*
+ * Index a batch: extract and save the set of every segment, then
+ * merge them a day at a time.
+ */
+static void
+indexbatch(struct triset *ts, struct ixlist *batch)
+{
+	char path[MAXPATHLEN];
+	struct ixjob *ij, **jobs;
+	uint64_t ntris;
+	u_long done, failed;
+	int i, j, n;
+
+	n = 0;
+	STAILQ_FOREACH(ij, batch, ij_link)
+		n++;
+	jobs = calloc(n, sizeof(*jobs));
+	done = failed = 0;
+	ntris = 0;
+	n = 0;
+	STAILQ_FOREACH(ij, batch, ij_link) {
+		setpath(path, sizeof(path), ij->ij_name);
+		if (ij->ij_setonly) {
+			if (tri_read(path, &ij->ij_tris, &ij->ij_ntris) < 0) {
+				warn("%s: not indexed", path);
+				failed++;
+				continue;
+			}
+		} else {
+			if (tri_segment(ts, ij->ij_name, &ij->ij_tris,
+			    &ij->ij_ntris) < 0) {
+				warn("%s: not indexed", ij->ij_name);
+				failed++;
+				continue;
+			}
+			/* so it is not lost if we go away before merging */
+			if (tri_write(path, ij->ij_tris, ij->ij_ntris) < 0)
+				warn("%s", path);
+		}
+		ntris += ij->ij_ntris;
+		if (jobs != NULL)
+			jobs[n] = ij;
+		n++;
+	}
+	if (jobs != NULL) {
+		qsort(jobs, n, sizeof(*jobs), byday);
+		for (i = 0; i < n; i = j) {
+			for (j = i + 1; j < n; j++)
+				if (strcmp(jobs[j]->ij_day,
+				    jobs[i]->ij_day) != 0)
+					break;
+			if (mergeday(jobs + i, j - i) == 0)
+				done += j - i;
+			else
+				failed += j - i;
+		}
+	} else {
+		warn("%d segments not merged", n);
+		failed += n;
+	}
+	free(jobs);
+	while ((ij = STAILQ_FIRST(batch)) != NULL) {
+		STAILQ_REMOVE_HEAD(batch, ij_link);
+		free(ij->ij_tris);
+		free(ij);
+	}
+	pthread_mutex_lock(&ix_lock);
+	ix_done += done;
+	ix_failed += failed;
+	ix_pending -= done + failed;
+	ix_merges++;
+	ix_trigrams += ntris;
+	pthread_mutex_unlock(&ix_lock);
+}
+
+static void *
+indexer(void *arg __unused)
+{
+	struct triset ts;
+	struct ixlist batch;
+	struct ixjob *ij;
+	int n;
+
+	if (triset_init(&ts) < 0)
+		err(1, "indexer");
+	STAILQ_INIT(&batch);
+	pthread_mutex_lock(&ix_lock);
+	for (;;) {
+		while (STAILQ_EMPTY(&ix_queue))
+			pthread_cond_wait(&ix_work, &ix_lock);
+		for (n = 0; n < INDEXER_BATCH &&
+		    (ij = STAILQ_FIRST(&ix_queue)) != NULL; n++) {
+			STAILQ_REMOVE_HEAD(&ix_queue, ij_link);
+			STAILQ_INSERT_TAIL(&batch, ij, ij_link);
+		}
+		pthread_mutex_unlock(&ix_lock);
+		indexbatch(&ts, &batch);
+		pthread_mutex_lock(&ix_lock);
+	}
+	/* NOTREACHED */
+	return (NULL);
+}
+
+static void
+enqueue(const char *name, time_t closed, int setonly)
+{
+	struct ixjob *ij;
+
+	ij = calloc(1, sizeof(*ij));
+	if (ij == NULL) {
+		warn("%s: not indexed", name);
+		return;
+	}
+	strlcpy(ij->ij_name, name, sizeof(ij->ij_name));
+	ij->ij_setonly = setonly;
+	tri_day(closed, ij->ij_day);
+	pthread_mutex_lock(&ix_lock);
+	STAILQ_INSERT_TAIL(&ix_queue, ij, ij_link);
+	ix_queued++;
+	ix_pending++;
+	pthread_cond_signal(&ix_work);
+	pthread_mutex_unlock(&ix_lock);
+}
+
+/*
+ * Queue the sets left over from before, by the day they were written.
+ */
+static void
+leftovers(void)
+{
+	char path[MAXPATHLEN], name[MAXPATHLEN];
+	struct dirent *de;
+	struct stat sb;
+	size_t len, slen;
+	DIR *dp;
+
+	if ((dp = opendir(ix_dir)) == NULL)
+		return;
+	slen = strlen(TRI_SUFFIX);
+	while ((de = readdir(dp)) != NULL) {
+		len = strlen(de->d_name);
+		if (len <= slen || len - slen >= sizeof(name) ||
+		    strcmp(de->d_name + len - slen, TRI_SUFFIX) != 0)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", ix_dir, de->d_name);
+		if (stat(path, &sb) < 0)
+			continue;
+		memcpy(name, de->d_name, len - slen);
+		name[len - slen] = '\0';
+		enqueue(name, sb.st_mtime, 1);
+	}
+	closedir(dp);
+}
+
+int
+indexer_init(const char *dir)
+{
+	pthread_t thr;
+
+	if (dir == NULL)
+		return (0);
+	if (mkdir(dir, S_IRWXU) < 0 && errno != EEXIST)
+		return (-1);
+	ix_dir = dir;
+	leftovers();
+	if (pthread_create(&thr, NULL, indexer, NULL))
+		return (-1);
+	return (0);
+}
+
+/*
+ * Called once a segment is closed and all of it has reached the file,
+ * with its name relative to the log directory.
+ */
+void
+indexer_segment(const char *path)
+{
+	if (ix_dir == NULL)
+		return;
+	enqueue(path, time(NULL), 0);
+}
+
+void
+indexer_dumpstats(FILE *fp)
+{
+	if (ix_dir == NULL)
+		return;
+	pthread_mutex_lock(&ix_lock);
+	fprintf(fp, "Index statistics:\n"
+	    "%-10s %-10s %-10s %-10s %-10s %s\n",
+	    "QUEUED", "DONE", "FAILED", "PENDING", "MERGES", "TRIGRAMS");
+	fprintf(fp, "%-10lu %-10lu %-10lu %-10lu %-10lu %ju\n",
+	    ix_queued, ix_done, ix_failed, ix_pending, ix_merges,
+	    (uintmax_t)ix_trigrams);
+	pthread_mutex_unlock(&ix_lock);
+}
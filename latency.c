@@ -0,0 +1,183 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/param.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <err.h>
+#include <time.h>
+
+#include "latency.h"
+
+#ifdef LATENCY_TRACE
+struct lathist {
+	_Atomic uint64_t	lh_count[LAT_NBUCKETS];
+	_Atomic uint64_t	lh_max;
+};
+
+struct latthread {
+	struct latthread	*lt_next;
+	struct lathist		 lt_hist[LAT_NSTAGES];
+};
+
+static _Atomic(struct latthread *) lat_threads;
+static _Thread_local struct latthread *lat_self;
+
+static const char *const lat_names[LAT_NSTAGES] = {
+	"readable", "read", "write", "durable", "qlock-wait", "qlock-hold"
+};
+
+static u_int
+lat_bucket(uint64_t v)
+{
+	u_int e;
+
+	if (v < (2U << LAT_SUBBITS))
+		return (v);
+	if (v >= (1ULL << LAT_MAXBITS))
+		return (LAT_NBUCKETS - 1);
+	e = 63 - __builtin_clzll(v) - LAT_SUBBITS;
+	return (((e + 1) << LAT_SUBBITS) +
+	    (u_int)(v >> e) - (1U << LAT_SUBBITS));
+}
+
+/* the largest value that lands in bucket i */
+static uint64_t
+lat_value(u_int i)
+{
+	u_int e;
+
+	if (i < (2U << LAT_SUBBITS))
+		return (i);
+	e = (i >> LAT_SUBBITS) - 1;
+	return ((((uint64_t)(i & ((1U << LAT_SUBBITS) - 1)) +
+	    (1U << LAT_SUBBITS) + 1) << e) - 1);
+}
+
+static struct latthread *
+lat_register(void)
+{
+	struct latthread *lt;
+
+	lt = calloc(1, sizeof(*lt));
+	if (lt == NULL)
+		err(1, "calloc failed");
+	lt->lt_next = atomic_load(&lat_threads);
+	while (!atomic_compare_exchange_weak(&lat_threads, &lt->lt_next, lt))
+		;
+	lat_self = lt;
+	return (lt);
+}
+
+void
+lat_record(int stage, uint64_t ns)
+{
+	struct latthread *lt;
+	struct lathist *lh;
+	_Atomic uint64_t *c;
+
+	if ((lt = lat_self) == NULL)
+		lt = lat_register();
+	lh = &lt->lt_hist[stage];
+	/* we are the only writer */
+	c = &lh->lh_count[lat_bucket(ns)];
+	atomic_store_explicit(c, atomic_load_explicit(c,
+	    memory_order_relaxed) + 1, memory_order_relaxed);
+	if (ns > atomic_load_explicit(&lh->lh_max, memory_order_relaxed))
+		atomic_store_explicit(&lh->lh_max, ns, memory_order_relaxed);
+}
+#endif	/* LATENCY_TRACE */
+
+uint64_t
+lat_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/*
+ * Merge every thread's histograms and print percentiles, in micro
+ * seconds, for each stage.
+ */
+void
+lat_dump(FILE *fp)
+{
+#ifdef LATENCY_TRACE
+	static const double pct[] = { 0.5, 0.9, 0.99, 0.999 };
+	struct latthread *lt;
+	uint64_t *sum, total, max, v, seen;
+	u_int i, j, k;
+	int st;
+
+	sum = calloc(LAT_NBUCKETS, sizeof(*sum));
+	if (sum == NULL)
+		return;
+	fprintf(fp, "Latency (usec):\n%-11s %-10s %-9s %-9s %-9s %-9s %s\n",
+	    "STAGE", "COUNT", "P50", "P90", "P99", "P99.9", "MAX");
+	for (st = 0; st < LAT_NSTAGES; st++) {
+		memset(sum, 0, LAT_NBUCKETS * sizeof(*sum));
+		total = max = 0;
+		for (lt = atomic_load(&lat_threads); lt != NULL;
+		    lt = lt->lt_next) {
+			for (i = 0; i < LAT_NBUCKETS; i++) {
+				v = atomic_load_explicit(
+				    &lt->lt_hist[st].lh_count[i],
+				    memory_order_relaxed);
+				sum[i] += v;
+				total += v;
+			}
+			v = atomic_load_explicit(&lt->lt_hist[st].lh_max,
+			    memory_order_relaxed);
+			if (v > max)
+				max = v;
+		}
+		fprintf(fp, "%-11s %-10ju", lat_names[st], (uintmax_t)total);
+		for (j = 0, i = 0, seen = 0; j < sizeof(pct) / sizeof(pct[0]);
+		    j++) {
+			for (k = i; k < LAT_NBUCKETS; k++) {
+				if (seen + sum[k] >= pct[j] * total)
+					break;
+				seen += sum[k];
+			}
+			i = k;
+			v = total == 0 ? 0 : lat_value(MIN(k, LAT_NBUCKETS - 1));
+			fprintf(fp, " %-9.1f", MIN(v, max) / 1000.0);
+		}
+		fprintf(fp, " %.1f\n", max / 1000.0);
+	}
+	free(sum);
+#else
+	(void)fp;
+#endif
+}
@@ -0,0 +1,379 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "logfmt.h"
+
+static void
+put32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t
+get32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+	    (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+static uint64_t
+get64(const unsigned char *p)
+{
+	return (get32(p) | (uint64_t)get32(p + 4) << 32);
+}
+
+static const void *
+mapfile(const char *path, size_t *size)
+{
+	struct stat sb;
+	void *base;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return (NULL);
+	if (fstat(fd, &sb) < 0) {
+		close(fd);
+		return (NULL);
+	}
+	*size = sb.st_size;
+	base = NULL;
+	if (sb.st_size > 0)
+		base = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return (NULL);
+	/* an empty file maps to an address nobody dereferences */
+	return (base != NULL ? base : "");
+}
+
+static void
+unmapfile(const void *base, size_t size)
+{
+	if (size > 0)
+		munmap((void *)(uintptr_t)base, size);
+}
+
+void
+logfmt_header(unsigned char *p, int type, uint32_t len, uint32_t delta,
+    uint32_t sid)
+{
+	put32(p, len);
+	put32(p + 4, delta);
+	put32(p + 8, sid);
+	p[12] = type;
+	p[13] = type >> 8;
+	p[14] = p[15] = 0;
+}
+
+/*
+ * Payload of a REC_TIME record, 8 bytes.
+ */
+void
+logfmt_time(unsigned char *p, uint64_t usec)
+{
+	put32(p, usec);
+	put32(p + 4, usec >> 32);
+}
+
+void
+logread_init(struct logread *lf, const void *base, size_t size)
+{
+	memset(lf, 0, sizeof(*lf));
+	lf->lf_base = base;
+	lf->lf_size = size;
+	if (size >= LOGFMT_MAGICLEN &&
+	    memcmp(base, LOGFMT_MAGIC, LOGFMT_MAGICLEN) == 0) {
+		lf->lf_binary = 1;
+		lf->lf_pos = LOGFMT_MAGICLEN;
+	}
+}
+
+/*
+ * Inflate a run of gzip members into a malloc'd buffer.
+ */
+static void *
+inflatebuf(const unsigned char *base, size_t size, size_t *outlen)
+{
+	z_stream zs;
+	unsigned char *buf, *nbuf;
+	size_t cap;
+	int ret;
+
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, 15 + 16) != Z_OK)
+		return (NULL);
+	cap = size * 4 + 4096;
+	if ((buf = malloc(cap)) == NULL)
+		goto fail;
+	zs.next_in = (unsigned char *)(uintptr_t)base;
+	zs.avail_in = size;
+	*outlen = 0;
+	for (;;) {
+		if (*outlen == cap) {
+			if ((nbuf = realloc(buf, cap * 2)) == NULL)
+				goto fail;
+			buf = nbuf;
+			cap *= 2;
+		}
+		zs.next_out = buf + *outlen;
+		zs.avail_out = cap - *outlen;
+		ret = inflate(&zs, Z_NO_FLUSH);
+		*outlen = cap - zs.avail_out;
+		if (ret == Z_STREAM_END) {
+			if (zs.avail_in == 0)
+				break;
+			inflateReset(&zs);	/* next member */
+		} else if (ret != Z_OK && ret != Z_BUF_ERROR)
+			goto fail;
+		else if (ret == Z_BUF_ERROR && zs.avail_in == 0)
+			goto fail;		/* truncated */
+	}
+	inflateEnd(&zs);
+	return (buf);
+fail:
+	inflateEnd(&zs);
+	free(buf);
+	errno = EINVAL;
+	return (NULL);
+}
+
+/*
+ * Map the log at path, or inflate it if it has been compressed.  A
+ * segment that is not found under its own name is looked for with
+ * LOGZ_SUFFIX, so names from a manifest or index keep working.
+ */
+const void *
+logfmt_load(const char *path, size_t *size, int *how)
+{
+	char zpath[1024];
+	const unsigned char *base;
+	void *buf;
+	size_t zsize;
+
+	base = mapfile(path, size);
+	if (base == NULL && errno == ENOENT) {
+		snprintf(zpath, sizeof(zpath), "%s%s", path, LOGZ_SUFFIX);
+		base = mapfile(zpath, size);
+		if (base == NULL)
+			errno = ENOENT;
+	}
+	if (base == NULL)
+		return (NULL);
+	*how = LF_MAPPED;
+	if (*size < 2 || base[0] != 0x1f || base[1] != 0x8b)
+		return (base);
+	zsize = *size;
+	buf = inflatebuf(base, zsize, size);
+	unmapfile(base, zsize);
+	if (buf == NULL)
+		return (NULL);
+	*how = LF_INFLATED;
+	return (buf);
+}
+
+void
+logfmt_unload(const void *base, size_t size, int how)
+{
+	if (how == LF_MAPPED)
+		unmapfile(base, size);
+	else if (how == LF_INFLATED)
+		free((void *)(uintptr_t)base);
+}
+
+int
+logread_open(struct logread *lf, const char *path)
+{
+	const void *base;
+	size_t size;
+	int how;
+
+	if ((base = logfmt_load(path, &size, &how)) == NULL)
+		return (-1);
+	logread_init(lf, base, size);
+	lf->lf_mapped = how;
+	return (0);
+}
+
+/*
+ * Returns 1 and fills in lr for the next record, 0 at the end of the
+ * log and -1 if the rest of the log can not be parsed.
+ */
+int
+logread_next(struct logread *lf, struct logrec *lr)
+{
+	const unsigned char *p;
+	uint32_t len;
+
+	if (lf->lf_pos >= lf->lf_size)
+		return (0);
+	lr->lr_off = lf->lf_pos;
+	if (!lf->lf_binary) {
+		lr->lr_type = REC_DATA;
+		lr->lr_sid = 0;
+		lr->lr_time = 0;
+		lr->lr_data = (const char *)lf->lf_base + lf->lf_pos;
+		lr->lr_len = lf->lf_size - lf->lf_pos;
+		lf->lf_pos = lf->lf_size;
+		return (1);
+	}
+	if (lf->lf_size - lf->lf_pos < LOGFMT_HDRLEN)
+		return (-1);
+	p = lf->lf_base + lf->lf_pos;
+	len = get32(p);
+	if (lf->lf_size - lf->lf_pos - LOGFMT_HDRLEN < len)
+		return (-1);
+	lr->lr_type = p[12] | p[13] << 8;
+	lr->lr_sid = get32(p + 8);
+	lr->lr_data = (const char *)p + LOGFMT_HDRLEN;
+	lr->lr_len = len;
+	if (lr->lr_type == REC_TIME && len >= 8)
+		lf->lf_time = get64(p + LOGFMT_HDRLEN);
+	else
+		lf->lf_time += get32(p + 4);
+	lr->lr_time = lf->lf_time;
+	lf->lf_pos += LOGFMT_HDRLEN + len;
+	return (1);
+}
+
+/*
+ * Carry on reading at off, which in a binary log must be an indexed
+ * offset.
+ */
+void
+logread_seek(struct logread *lf, off_t off)
+{
+	if ((size_t)off > lf->lf_size)
+		off = lf->lf_size;
+	if (lf->lf_binary && (size_t)off < LOGFMT_MAGICLEN)
+		off = LOGFMT_MAGICLEN;
+	lf->lf_pos = off;
+}
+
+void
+logread_close(struct logread *lf)
+{
+	if (lf->lf_base != NULL)
+		logfmt_unload(lf->lf_base, lf->lf_size, lf->lf_mapped);
+	lf->lf_base = NULL;
+}
+
+void
+logidx_entry(unsigned char *p, uint64_t usec, uint64_t off)
+{
+	put32(p, usec);
+	put32(p + 4, usec >> 32);
+	put32(p + 8, off);
+	put32(p + 12, off >> 32);
+}
+
+/*
+ * Map the index of the segment at path.
+ */
+int
+logidx_open(struct logidx *lx, const char *path)
+{
+	char ipath[1024];
+	size_t len;
+
+	memset(lx, 0, sizeof(*lx));
+	/* the index is named after the uncompressed segment */
+	len = strlen(path);
+	if (len > sizeof(LOGZ_SUFFIX) - 1 && strcmp(path + len -
+	    (sizeof(LOGZ_SUFFIX) - 1), LOGZ_SUFFIX) == 0)
+		len -= sizeof(LOGZ_SUFFIX) - 1;
+	snprintf(ipath, sizeof(ipath), "%.*s%s", (int)len, path,
+	    LOGIDX_SUFFIX);
+	if ((lx->lx_base = mapfile(ipath, &lx->lx_size)) == NULL)
+		return (-1);
+	if (lx->lx_size < LOGIDX_MAGICLEN ||
+	    memcmp(lx->lx_base, LOGIDX_MAGIC, LOGIDX_MAGICLEN) != 0) {
+		logidx_close(lx);
+		return (-1);
+	}
+	lx->lx_count = (lx->lx_size - LOGIDX_MAGICLEN) / LOGIDX_ENTLEN;
+	return (0);
+}
+
+void
+logidx_get(struct logidx *lx, size_t i, uint64_t *usec, off_t *off)
+{
+	const unsigned char *p;
+
+	p = lx->lx_base + LOGIDX_MAGICLEN + i * LOGIDX_ENTLEN;
+	*usec = get64(p);
+	*off = get64(p + 8);
+}
+
+/*
+ * The last entry at or before usec, or the first one if there is
+ * none.
+ */
+size_t
+logidx_find(struct logidx *lx, uint64_t usec)
+{
+	size_t lo, hi, mid;
+	uint64_t t;
+	off_t off;
+
+	lo = 0;
+	hi = lx->lx_count;
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		logidx_get(lx, mid, &t, &off);
+		if (t <= usec)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return (lo);
+}
+
+void
+logidx_close(struct logidx *lx)
+{
+	if (lx->lx_base != NULL)
+		unmapfile(lx->lx_base, lx->lx_size);
+	lx->lx_base = NULL;
+}
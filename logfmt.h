@@ -0,0 +1,126 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef	LOGFMT_DOT_H_
+#define	LOGFMT_DOT_H_
+
+#include <stdint.h>
+
+/*
+ * The binary session log format (termlog -B).  A file starts with
+ * LOGFMT_MAGIC and is followed by records, each a 16 byte header
+ *
+ *	uint32_t	length of the payload
+ *	uint32_t	micro-seconds since the previous record
+ *	uint32_t	session id
+ *	uint16_t	record type
+ *	uint16_t	reserved, zero
+ *
+ * in little endian order and the payload.  REC_DATA carries session
+ * output and REC_META the ";;" lines of the text format, so dropping
+ * the headers gives back exactly what a text log would hold.
+ * REC_TIME carries the wall clock as 64 bit micro-seconds; it starts
+ * every segment and is repeated whenever the delta would not fit.
+ *
+ * Text logs can be read through the same interface; they come back
+ * as a single REC_DATA record with no timing.
+ *
+ * A segment may have a sidecar index, the segment name plus
+ * LOGIDX_SUFFIX, mapping wall clock time to offsets: LOGIDX_MAGIC
+ * followed by 16 byte entries, the time in micro-seconds and the
+ * offset, both 64 bit little endian and both ascending.  In a binary
+ * log every indexed offset holds a REC_TIME record, so reading can
+ * start there.  The index refers to the uncompressed log.
+ *
+ * Closed segments may have been compressed (termlog -z) into a file
+ * with LOGZ_SUFFIX appended.  logfmt_load() and everything built on
+ * it inflate those transparently, given either name.
+ *
+ * With termlog -N each segment also gets a plain text copy of what
+ * the session showed, the segment name plus LOGTXT_SUFFIX, with the
+ * escape sequences and carriage returns taken out (see vtstrip.h).
+ * It is for grep and friends and is never compressed or digested.
+ */
+#define	LOGFMT_MAGIC	"TLOGBIN1"
+#define	LOGFMT_MAGICLEN	8
+#define	LOGFMT_HDRLEN	16
+
+#define	LOGIDX_MAGIC	"TLOGIDX1"
+#define	LOGIDX_MAGICLEN	8
+#define	LOGIDX_ENTLEN	16
+#define	LOGIDX_SUFFIX	".idx"
+
+#define	LOGZ_SUFFIX	".gz"
+#define	LOGTXT_SUFFIX	".txt"
+
+#define	LF_MAPPED	1	/* how logfmt_load() got the file */
+#define	LF_INFLATED	2
+
+#define	REC_DATA	1
+#define	REC_META	2
+#define	REC_TIME	3
+
+struct logrec {
+	int			lr_type;
+	uint32_t		lr_sid;
+	uint64_t		lr_time;	/* wall clock, usec; 0 unknown */
+	const char		*lr_data;
+	size_t			lr_len;
+	off_t			lr_off;		/* of the record */
+};
+
+struct logread {
+	const unsigned char	*lf_base;
+	size_t			lf_size;
+	size_t			lf_pos;
+	int			lf_binary;
+	int			lf_mapped;
+	uint64_t		lf_time;
+};
+
+struct logidx {
+	const unsigned char	*lx_base;
+	size_t			lx_size;
+	size_t			lx_count;
+};
+
+void logfmt_header(unsigned char *, int, uint32_t, uint32_t, uint32_t);
+void logfmt_time(unsigned char *, uint64_t);
+const void *logfmt_load(const char *, size_t *, int *);
+void logfmt_unload(const void *, size_t, int);
+int logread_open(struct logread *, const char *);
+void logread_init(struct logread *, const void *, size_t);
+int logread_next(struct logread *, struct logrec *);
+void logread_seek(struct logread *, off_t);
+void logread_close(struct logread *);
+void logidx_entry(unsigned char *, uint64_t, uint64_t);
+int logidx_open(struct logidx *, const char *);
+void logidx_get(struct logidx *, size_t, uint64_t *, off_t *);
+size_t logidx_find(struct logidx *, uint64_t);
+void logidx_close(struct logidx *);
+#endif	/* LOGFMT_DOT_H_ */
@@ -0,0 +1,682 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifdef __linux__
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/param.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "compat.h"
+#include "compress.h"
+#include "indexer.h"
+#include "epoch.h"
+#include "conf.h"
+#include "fileops.h"
+#include "flusher.h"
+#include "uring.h"
+
+/*
+ * The io_uring backend.  Writers copy log data into 64KB buffers and
+ * queue each full buffer, together with any open, close or sync the
+ * log needs, on the log itself.  Only the flusher talks to the ring:
+ * once per batch it stages every queued operation, linking those of
+ * the same log so they run in order, and submits the lot with a
+ * single io_uring_enter(2).  Logs are opened straight into the ring's
+ * registered file table and buffers come from a registered pool when
+ * one is free, so the kernel does not have to look up descriptors or
+ * map pages for every request.
+ */
+#define	UR_ENTRIES	1024		/* submission queue size */
+#define	UR_NBUFS	256		/* registered buffers */
+#define	UR_LOGBUFS	8		/* buffers one log may hold */
+#define	UR_MAXFILES	32768		/* registered file table */
+
+enum { UOP_OPEN, UOP_WRITE, UOP_FSYNC, UOP_CLOSE, UOP_INSTALL };
+
+struct ubuf {
+	char			*ub_data;
+	size_t			ub_len;
+	size_t			ub_payload;	/* session output in ub_len */
+	int			ub_index;	/* registered buffer or -1 */
+	STAILQ_ENTRY(ubuf)	ub_next;
+};
+
+struct uop {
+	int			uo_type;
+	struct snpmeta		*uo_sm;
+	struct ubuf		*uo_buf;
+	off_t			uo_off;
+	int			uo_fd;		/* unregistered close, or
+						   the file to install */
+	int			uo_final;
+	char			*uo_path;
+	struct digestval	*uo_dv;		/* of the segment closed */
+	STAILQ_ENTRY(uop)	uo_next;
+};
+
+struct ulog {
+	int			ul_slot;	/* registered file or -1 */
+	int			ul_fd;		/* used when ul_slot < 0 */
+	int			ul_closed;
+	struct ubuf		*ul_cur;	/* being filled */
+	off_t			ul_off;		/* of the next write */
+	u_long			ul_gen;		/* batch ul_tail belongs to */
+	struct io_uring_sqe	*ul_tail;
+	STAILQ_HEAD(, uop)	ul_ops;		/* not yet staged */
+	/* protected by ur_lock */
+	int			ul_nbufs;	/* held, queued or in flight */
+	int			ul_nops;	/* queued or in flight */
+};
+
+
+static struct uring ur;
+static u_long ur_gen;			/* flusher only */
+static u_int ur_inflight;		/* flusher only */
+
+static pthread_mutex_t ur_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ur_cv = PTHREAD_COND_INITIALIZER;
+static STAILQ_HEAD(, ubuf) ur_freebufs = STAILQ_HEAD_INITIALIZER(ur_freebufs);
+static int ur_nspare;			/* unregistered buffers on the list */
+static int *ur_slots;			/* free registered file slots */
+static int ur_nslots;
+static int ur_fixedbufs;		/* the pool is registered */
+
+static atomic_ulong ur_submits;
+static atomic_ulong ur_ops;
+static atomic_ulong ur_unfixed;
+static atomic_ulong ur_waits;
+static atomic_ulong ur_errors;
+
+static int
+ur_appendonly(void)
+{
+	int appendonly;
+
+	CONF_GET(tc_appendonly, appendonly);
+	return (appendonly);
+}
+
+static int
+ur_openflags(void)
+{
+	return (O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC |
+	    (ur_appendonly() ? O_APPEND : 0));
+}
+
+static int
+ur_getslot(void)
+{
+	int slot;
+
+	pthread_mutex_lock(&ur_lock);
+	slot = ur_nslots > 0 ? ur_slots[--ur_nslots] : -1;
+	pthread_mutex_unlock(&ur_lock);
+	return (slot);
+}
+
+/*
+ * Hand out an empty buffer, waiting for the disk if the log already
+ * holds its share.  Called with sm_lock held, which is dropped while
+ * waiting so the flusher can get at the buffers already queued.  The
+ * digest already covers the chunk being written, so sm_parked keeps
+ * the rotation thread from switching segments under us meanwhile;
+ * a session is only ever written by one thread at a time so no other
+ * writer gets in.
+ */
+static struct ubuf *
+ur_getbuf(struct snpmeta *sm)
+{
+	struct ulog *ul;
+	struct ubuf *ub;
+
+	ul = sm->sm_io;
+	pthread_mutex_lock(&ur_lock);
+	while (ul->ul_nbufs >= UR_LOGBUFS) {
+		atomic_fetch_add(&ur_waits, 1);
+		sm->sm_parked = 1;
+		pthread_mutex_unlock(&sm->sm_lock);
+		pthread_cond_wait(&ur_cv, &ur_lock);
+		pthread_mutex_unlock(&ur_lock);
+		pthread_mutex_lock(&sm->sm_lock);
+		sm->sm_parked = 0;
+		pthread_mutex_lock(&ur_lock);
+	}
+	ul->ul_nbufs++;
+	ub = STAILQ_FIRST(&ur_freebufs);
+	if (ub != NULL) {
+		STAILQ_REMOVE_HEAD(&ur_freebufs, ub_next);
+		if (ub->ub_index < 0)
+			ur_nspare--;
+	}
+	pthread_mutex_unlock(&ur_lock);
+	if (ub == NULL) {
+		ub = malloc(sizeof(*ub) + SM_BUFSIZE);
+		if (ub == NULL)
+			err(1, "malloc failed");
+		ub->ub_data = (char *)(ub + 1);
+		ub->ub_index = -1;
+	}
+	ub->ub_len = ub->ub_payload = 0;
+	return (ub);
+}
+
+/*
+ * Registered buffers go to the front of the free list so they are
+ * preferred; a few unregistered ones are kept around for bursts.
+ * Called with ur_lock held.
+ */
+static void
+ur_putbuf(struct ulog *ul, struct ubuf *ub)
+{
+	ul->ul_nbufs--;
+	if (ub->ub_index >= 0)
+		STAILQ_INSERT_HEAD(&ur_freebufs, ub, ub_next);
+	else if (ur_nspare < UR_NBUFS) {
+		STAILQ_INSERT_TAIL(&ur_freebufs, ub, ub_next);
+		ur_nspare++;
+	} else
+		free(ub);
+}
+
+/*
+ * Operations on logs outside the registered file table carry the
+ * descriptor that was current when they were queued.  Called with
+ * sm_lock held.
+ */
+static struct uop *
+ur_newop(struct snpmeta *sm, int type, const char *path)
+{
+	struct ulog *ul;
+	struct uop *uo;
+
+	ul = sm->sm_io;
+	uo = calloc(1, sizeof(*uo));
+	if (uo == NULL)
+		err(1, "calloc failed");
+	uo->uo_type = type;
+	uo->uo_sm = sm;
+	uo->uo_fd = ul->ul_fd;
+	if (path != NULL && (uo->uo_path = strdup(path)) == NULL)
+		err(1, "strdup failed");
+	pthread_mutex_lock(&ur_lock);
+	ul->ul_nops++;
+	pthread_mutex_unlock(&ur_lock);
+	return (uo);
+}
+
+static struct uop *
+ur_queue(struct snpmeta *sm, int type, const char *path)
+{
+	struct ulog *ul;
+	struct uop *uo;
+
+	ul = sm->sm_io;
+	uo = ur_newop(sm, type, path);
+	STAILQ_INSERT_TAIL(&ul->ul_ops, uo, uo_next);
+	return (uo);
+}
+
+/*
+ * The digest is only logged once the close has completed, together
+ * with the byte count at that point.
+ */
+static struct digestval *
+ur_dupdigest(struct digestval *dv)
+{
+	struct digestval *copy;
+
+	copy = malloc(sizeof(*copy));
+	if (copy == NULL)
+		err(1, "malloc failed");
+	*copy = *dv;
+	return (copy);
+}
+
+static void
+ur_queuecur(struct snpmeta *sm)
+{
+	struct ulog *ul;
+	struct uop *uo;
+
+	ul = sm->sm_io;
+	if (ul->ul_cur == NULL)
+		return;
+	if (ul->ul_cur->ub_len == 0) {
+		pthread_mutex_lock(&ur_lock);
+		ur_putbuf(ul, ul->ul_cur);
+		pthread_mutex_unlock(&ur_lock);
+		ul->ul_cur = NULL;
+		return;
+	}
+	uo = ur_queue(sm, UOP_WRITE, NULL);
+	uo->uo_buf = ul->ul_cur;
+	uo->uo_off = ul->ul_off;
+	ul->ul_off += ul->ul_cur->ub_len;
+	ul->ul_cur = NULL;
+}
+
+static void
+ur_complete(struct uop *uo, int res)
+{
+	struct snpmeta *sm;
+	struct ulog *ul;
+
+	sm = uo->uo_sm;
+	ul = sm->sm_io;
+	if (res < 0 && res != -ECANCELED) {
+		atomic_fetch_add(&ur_errors, 1);
+		errno = -res;
+		warn("%s: io_uring %s failed", uo->uo_path != NULL ?
+		    uo->uo_path : sm->fname,
+		    uo->uo_type == UOP_OPEN ? "open" :
+		    uo->uo_type == UOP_WRITE ? "write" :
+		    uo->uo_type == UOP_FSYNC ? "fsync" :
+		    uo->uo_type == UOP_CLOSE ? "close" : "install");
+	} else if (res == -ECANCELED)
+		atomic_fetch_add(&ur_errors, 1);
+	switch (uo->uo_type) {
+	case UOP_OPEN:
+		if (res >= 0 && ur_appendonly())
+			if (chflags(uo->uo_path, SF_APPEND) < 0)
+				warn("chflags failed");
+		break;
+	case UOP_WRITE:
+		if (res >= 0 && (size_t)res < uo->uo_buf->ub_len) {
+			atomic_fetch_add(&ur_errors, 1);
+			warnx("%s: short write", sm->fname);
+		}
+		if (res == (int)uo->uo_buf->ub_len)
+			sm->counter += uo->uo_buf->ub_payload;
+		break;
+	case UOP_CLOSE:
+		log_message_digest(uo->uo_path, uo->uo_dv, sm->counter);
+		compress_segment(uo->uo_path);
+		indexer_segment(uo->uo_path);
+		break;
+	case UOP_INSTALL:
+		/* the table holds its own reference */
+		close(uo->uo_fd);
+		break;
+	}
+	pthread_mutex_lock(&ur_lock);
+	if (uo->uo_buf != NULL)
+		ur_putbuf(ul, uo->uo_buf);
+	if (uo->uo_final && ul->ul_slot >= 0)
+		ur_slots[ur_nslots++] = ul->ul_slot;
+	ul->ul_nops--;
+	pthread_mutex_unlock(&ur_lock);
+	free(uo->uo_path);
+	free(uo->uo_dv);
+	free(uo);
+}
+
+/*
+ * Submit everything staged and wait for all of it to complete.
+ */
+static void
+ur_commit(void)
+{
+	struct io_uring_cqe *cqe;
+
+	if (ur_inflight == 0)
+		return;
+	while (ur_inflight > 0) {
+		atomic_fetch_add(&sm_writes, 1);
+		atomic_fetch_add(&ur_submits, 1);
+		if (uring_submit(&ur, ur_inflight) < 0 &&
+		    errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			err(1, "io_uring_enter failed");
+		while ((cqe = uring_peekcqe(&ur)) != NULL) {
+			ur_complete((struct uop *)(uintptr_t)cqe->user_data,
+			    cqe->res);
+			uring_cqeseen(&ur);
+			ur_inflight--;
+		}
+	}
+	ur_gen++;
+	pthread_mutex_lock(&ur_lock);
+	pthread_cond_broadcast(&ur_cv);
+	pthread_mutex_unlock(&ur_lock);
+}
+
+/*
+ * Turn an operation into a submission entry, linked to whatever the
+ * same log staged earlier in this batch.
+ */
+static void
+ur_stage(struct ulog *ul, struct uop *uo)
+{
+	struct io_uring_sqe *sqe;
+	struct ubuf *ub;
+
+	while ((sqe = uring_getsqe(&ur)) == NULL)
+		ur_commit();
+	if (uo->uo_fd < 0) {
+		sqe->fd = ul->ul_slot;
+		sqe->flags = IOSQE_FIXED_FILE;
+	} else
+		sqe->fd = uo->uo_fd;
+	switch (uo->uo_type) {
+	case UOP_OPEN:
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->fd = AT_FDCWD;
+		sqe->flags = 0;
+		sqe->addr = (uintptr_t)uo->uo_path;
+		/* direct descriptors cannot be close-on-exec */
+		sqe->open_flags = ur_openflags() & ~O_CLOEXEC;
+		sqe->len = S_IRUSR | S_IWUSR;
+		sqe->file_index = ul->ul_slot + 1;
+		break;
+	case UOP_WRITE:
+		ub = uo->uo_buf;
+		if (ub->ub_index >= 0 && ur_fixedbufs) {
+			sqe->opcode = IORING_OP_WRITE_FIXED;
+			sqe->buf_index = ub->ub_index;
+		} else {
+			sqe->opcode = IORING_OP_WRITE;
+			atomic_fetch_add(&ur_unfixed, 1);
+		}
+		sqe->addr = (uintptr_t)ub->ub_data;
+		sqe->len = ub->ub_len;
+		sqe->off = uo->uo_off;
+		break;
+	case UOP_FSYNC:
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+		break;
+	case UOP_CLOSE:
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->flags = 0;
+		if (uo->uo_fd < 0) {
+			sqe->fd = 0;
+			sqe->file_index = ul->ul_slot + 1;
+		}
+		break;
+	case UOP_INSTALL:
+		sqe->opcode = IORING_OP_FILES_UPDATE;
+		sqe->fd = -1;
+		sqe->flags = 0;
+		sqe->addr = (uintptr_t)&uo->uo_fd;
+		sqe->len = 1;
+		sqe->off = ul->ul_slot;
+		break;
+	}
+	sqe->user_data = (uintptr_t)uo;
+	if (ul->ul_tail != NULL && ul->ul_gen == ur_gen)
+		ul->ul_tail->flags |= IOSQE_IO_LINK;
+	ul->ul_tail = sqe;
+	ul->ul_gen = ur_gen;
+	ur_inflight++;
+	atomic_fetch_add(&ur_ops, 1);
+}
+
+static void
+ur_write(struct snpmeta *sm, const char *ptr, size_t size, int data)
+{
+	struct ulog *ul;
+	struct ubuf *ub;
+	size_t n;
+
+	ul = sm->sm_io;
+	while (size > 0) {
+		if (ul->ul_cur == NULL)
+			ul->ul_cur = ur_getbuf(sm);
+		ub = ul->ul_cur;
+		n = MIN(size, SM_BUFSIZE - ub->ub_len);
+		memcpy(ub->ub_data + ub->ub_len, ptr, n);
+		ub->ub_len += n;
+		if (data)
+			ub->ub_payload += n;
+		sm->sm_pending += n;
+		ptr += n;
+		size -= n;
+		if (ub->ub_len == SM_BUFSIZE) {
+			ur_queuecur(sm);
+			flusher_kick(sm);
+		}
+	}
+}
+
+/*
+ * Flusher side, with sm_lock held.
+ */
+static int
+ur_flush(struct snpmeta *sm)
+{
+	struct ulog *ul;
+	struct uop *uo;
+
+	ul = sm->sm_io;
+	ur_queuecur(sm);
+	if (STAILQ_EMPTY(&ul->ul_ops))
+		return (0);
+	while ((uo = STAILQ_FIRST(&ul->ul_ops)) != NULL) {
+		STAILQ_REMOVE_HEAD(&ul->ul_ops, uo_next);
+		ur_stage(ul, uo);
+	}
+	sm->sm_pending = 0;
+	return (1);
+}
+
+static int
+ur_sync(struct snpmeta *sm)
+{
+	struct ulog *ul;
+
+	ul = sm->sm_io;
+	if (ul->ul_closed || ul->ul_gen != ur_gen)
+		return (0);
+	ur_stage(ul, ur_newop(sm, UOP_FSYNC, NULL));
+	return (0);
+}
+
+/*
+ * Logs that do not fit in the registered file table are opened
+ * synchronously and written through an ordinary descriptor.  Later
+ * segments of every log are opened this way by the rotation thread.
+ */
+static int
+ur_preopen(const char *fname)
+{
+	int fd;
+
+	fd = open(fname, ur_openflags(), S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		return (-1);
+	if (ur_appendonly())
+		if (chflags(fname, SF_APPEND) < 0)
+			warn("chflags failed");
+	return (fd);
+}
+
+static int
+ur_open(struct snpmeta *sm, const char *fname)
+{
+	struct ulog *ul;
+
+	ul = calloc(1, sizeof(*ul));
+	if (ul == NULL)
+		return (-1);
+	STAILQ_INIT(&ul->ul_ops);
+	ul->ul_fd = -1;
+	ul->ul_slot = ur_getslot();
+	sm->sm_io = ul;
+	if (ul->ul_slot >= 0) {
+		ur_queue(sm, UOP_OPEN, fname);
+		return (0);
+	}
+	if ((ul->ul_fd = ur_preopen(fname)) < 0) {
+		free(ul);
+		sm->sm_io = NULL;
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Called with sm_lock held.  The old segment is closed and its digest
+ * taken once everything queued before has completed.  A log in the
+ * registered file table gets the new descriptor installed in its slot
+ * behind the close.
+ */
+static int
+ur_rotate(struct snpmeta *sm, const char *oname, struct digestval *dv,
+    const char *nname, int nfd)
+{
+	struct ulog *ul;
+	struct uop *uo;
+
+	ul = sm->sm_io;
+	ur_queuecur(sm);
+	uo = ur_queue(sm, UOP_CLOSE, oname);
+	uo->uo_dv = ur_dupdigest(dv);
+	if (ul->ul_slot >= 0) {
+		uo = ur_queue(sm, UOP_INSTALL, nname);
+		uo->uo_fd = nfd;
+	} else
+		ul->ul_fd = nfd;
+	ul->ul_off = 0;
+	flusher_kick(sm);
+	return (0);
+}
+
+static int
+ur_close(struct snpmeta *sm, const char *fname, struct digestval *dv)
+{
+	struct ulog *ul;
+	struct uop *uo;
+
+	ul = sm->sm_io;
+	pthread_mutex_lock(&sm->sm_lock);
+	ur_queuecur(sm);
+	uo = ur_queue(sm, UOP_CLOSE, fname);
+	uo->uo_final = 1;
+	uo->uo_dv = ur_dupdigest(dv);
+	ul->ul_closed = 1;
+	flusher_kick(sm);
+	pthread_mutex_unlock(&sm->sm_lock);
+	pthread_mutex_lock(&ur_lock);
+	while (ul->ul_nops > 0)
+		pthread_cond_wait(&ur_cv, &ur_lock);
+	pthread_mutex_unlock(&ur_lock);
+	/* the flusher may still be finishing the batch */
+	flusher_forget(sm);
+	free(ul);
+	sm->sm_io = NULL;
+	return (0);
+}
+
+static int
+ur_init(void)
+{
+	struct rlimit rl;
+	struct iovec *iov;
+	struct ubuf *ub;
+	char *pool;
+	int *fds, i, nfiles;
+
+	if (uring_init(&ur, UR_ENTRIES) < 0)
+		return (-1);
+	nfiles = UR_MAXFILES;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur / 2 < nfiles)
+		nfiles = rl.rlim_cur / 2;
+	fds = malloc(nfiles * sizeof(int));
+	ur_slots = malloc(nfiles * sizeof(int));
+	if (fds == NULL || ur_slots == NULL)
+		return (-1);
+	for (i = 0; i < nfiles; i++) {
+		fds[i] = -1;
+		ur_slots[i] = nfiles - i - 1;
+	}
+	if (uring_register(&ur, IORING_REGISTER_FILES, fds, nfiles) == 0)
+		ur_nslots = nfiles;
+	else
+		warn("io_uring: cannot register files");
+	free(fds);
+	pool = malloc(UR_NBUFS * (sizeof(*ub) + SM_BUFSIZE));
+	iov = malloc(UR_NBUFS * sizeof(*iov));
+	if (pool == NULL || iov == NULL)
+		return (-1);
+	for (i = 0; i < UR_NBUFS; i++) {
+		ub = (struct ubuf *)(pool + i * (sizeof(*ub) + SM_BUFSIZE));
+		ub->ub_data = (char *)(ub + 1);
+		ub->ub_index = i;
+		iov[i].iov_base = ub->ub_data;
+		iov[i].iov_len = SM_BUFSIZE;
+		STAILQ_INSERT_TAIL(&ur_freebufs, ub, ub_next);
+	}
+	if (uring_register(&ur, IORING_REGISTER_BUFFERS, iov, UR_NBUFS) == 0)
+		ur_fixedbufs = 1;
+	else
+		warn("io_uring: cannot register buffers");
+	free(iov);
+	return (0);
+}
+
+static void
+ur_dumpstats(FILE *fp)
+{
+	fprintf(fp, "io_uring statistics:\n"
+	    "%-10s %-10s %-10s %-10s %s\n",
+	    "SUBMITS", "OPS", "UNFIXED", "WAITS", "ERRORS");
+	fprintf(fp, "%-10lu %-10lu %-10lu %-10lu %lu\n",
+	    atomic_load(&ur_submits), atomic_load(&ur_ops),
+	    atomic_load(&ur_unfixed), atomic_load(&ur_waits),
+	    atomic_load(&ur_errors));
+}
+
+struct logio logio_uring = {
+	"uring",
+	1,
+	ur_init,
+	ur_open,
+	ur_write,
+	ur_flush,
+	ur_sync,
+	ur_preopen,
+	ur_rotate,
+	ur_close,
+	ur_commit,
+	ur_dumpstats
+};
+#endif	/* __linux__ */
@@ -0,0 +1,750 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/param.h>
+
+#include <utmpx.h>
+#include <err.h>
+#include <errno.h>
+#include <grp.h>
+#include <paths.h>
+#include <pwd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compat.h"
+#include "policy.h"
+
+#define	POL_HASHMIN	16
+
+#define	SET_HAS(s, c)	((s)[(c) >> 3] & (1 << ((c) & 7)))
+#define	SET_ADD(s, c)	((s)[(c) >> 3] |= (1 << ((c) & 7)))
+
+/* rules as they were given */
+struct prule {
+	char		*pr_pat;
+	int		 pr_kind;
+	int		 pr_verdict;
+	int		 pr_glob;	/* pattern, not a name */
+	int		 pr_member;	/* came from a group rule */
+};
+
+/* exact names, open addressing with linear probing */
+struct pentry {
+	const char	*pe_key;	/* NULL if the slot is free */
+	size_t		 pe_len;
+	uint32_t	 pe_hash;
+	int		 pe_verdict;
+};
+
+struct pset {
+	struct pentry	*ps_tab;
+	size_t		 ps_mask;
+	size_t		 ps_count;
+};
+
+/*
+ * All the patterns of a kind, as one DFA.  Bytes which no pattern
+ * tells apart share a class, which keeps the transition table small.
+ * State 0 is dead: nothing can match from there.
+ */
+struct pdfa {
+	uint8_t		 pd_class[256];
+	int		 pd_nclass;
+	int		 pd_nstates;	/* 0 if there are no patterns */
+	int		 pd_start;
+	uint16_t	*pd_next;	/* [state * pd_nclass + class] */
+	uint8_t		*pd_verdict;	/* by state */
+};
+
+struct pkind {
+	struct pset	 pk_set;
+	struct pdfa	 pk_dfa;
+	int		 pk_incl;	/* there are inclusive rules */
+	int		 pk_nexact;
+	int		 pk_nglob;
+	int		 pk_ngroup;	/* group rules, for users */
+	int		 pk_nmember;	/* ... and what they expanded to */
+};
+
+struct policy {
+	struct prule	*pl_rules;
+	size_t		 pl_nrules;
+	size_t		 pl_maxrules;
+	struct pkind	 pl_kinds[POL_NKINDS];
+};
+
+/* one element of a pattern: a star or a set of bytes */
+struct ptok {
+	int		 pt_star;
+	uint8_t		 pt_set[32];
+};
+
+static const char *kindnames[POL_NKINDS] = { "user", "tty" };
+
+static int
+isglob(const char *pat)
+{
+	return (strpbrk(pat, "*?[\\") != NULL);
+}
+
+/*
+ * Breaks a pattern up into tokens; runs of stars are folded into one.
+ * Returns the number of tokens, or -1 if a bracket is not closed.
+ */
+static int
+globparse(const char *pat, struct ptok *toks)
+{
+	const u_char *p;
+	struct ptok *t;
+	int c, i, neg;
+
+	t = toks;
+	for (p = (const u_char *)pat; *p != '\0'; p++) {
+		if (*p == '*' && t > toks && t[-1].pt_star)
+			continue;
+		memset(t, 0, sizeof(*t));
+		switch (*p) {
+		case '*':
+			t->pt_star = 1;
+			break;
+		case '?':
+			memset(t->pt_set, 0xff, sizeof(t->pt_set));
+			break;
+		case '[':
+			p++;
+			neg = (*p == '!' || *p == '^');
+			if (neg)
+				p++;
+			/* a ] right after the bracket is a member */
+			for (i = 0; *p != '\0' && (*p != ']' || i == 0);
+			    p++, i++)
+				if (p[1] == '-' && p[2] != ']' && p[2] != '\0') {
+					for (c = p[0]; c <= p[2]; c++)
+						SET_ADD(t->pt_set, c);
+					p += 2;
+				} else
+					SET_ADD(t->pt_set, *p);
+			if (*p != ']')
+				return (-1);
+			if (neg)
+				for (i = 0; i < (int)sizeof(t->pt_set); i++)
+					t->pt_set[i] ^= 0xff;
+			break;
+		case '\\':
+			if (p[1] != '\0')
+				p++;
+			/* FALLTHROUGH */
+		default:
+			SET_ADD(t->pt_set, *p);
+		}
+		t++;
+	}
+	return (t - toks);
+}
+
+struct policy *
+policy_new(void)
+{
+	return (calloc(1, sizeof(struct policy)));
+}
+
+static int
+addrule(struct policy *pol, int kind, const char *pat, int verdict,
+    int member)
+{
+	struct prule *pr;
+	size_t n;
+
+	if (pol->pl_nrules == pol->pl_maxrules) {
+		n = pol->pl_maxrules ? pol->pl_maxrules * 2 : 64;
+		pr = realloc(pol->pl_rules, n * sizeof(*pr));
+		if (pr == NULL)
+			return (-1);
+		pol->pl_rules = pr;
+		pol->pl_maxrules = n;
+	}
+	pr = &pol->pl_rules[pol->pl_nrules];
+	if ((pr->pr_pat = strdup(pat)) == NULL)
+		return (-1);
+	pr->pr_kind = kind;
+	pr->pr_verdict = verdict;
+	pr->pr_glob = !member && isglob(pat);
+	pr->pr_member = member;
+	pol->pl_nrules++;
+	if (verdict & POL_INCL)
+		pol->pl_kinds[kind].pk_incl = 1;
+	return (0);
+}
+
+/*
+ * Adds a user or tty rule.  Ttys may be given with or without the
+ * leading /dev/.
+ */
+int
+policy_add(struct policy *pol, int kind, const char *pat, int verdict)
+{
+	struct ptok *toks;
+	int n;
+
+	if (kind == POL_TTY &&
+	    strncmp(pat, _PATH_DEV, sizeof(_PATH_DEV) - 1) == 0)
+		pat += sizeof(_PATH_DEV) - 1;
+	if (*pat == '\0') {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (isglob(pat)) {
+		toks = malloc((strlen(pat) + 1) * sizeof(*toks));
+		if (toks == NULL)
+			return (-1);
+		n = globparse(pat, toks);
+		free(toks);
+		if (n < 0) {
+			errno = EINVAL;
+			return (-1);
+		}
+	}
+	return (addrule(pol, kind, pat, verdict, 0));
+}
+
+/*
+ * Adds the members of a group, both those listed with it and those
+ * who have it as their primary group, as they are now.  Later changes
+ * to the group are seen when the policy is loaded again.
+ */
+int
+policy_addgroup(struct policy *pol, const char *name, int verdict)
+{
+	struct pkind *pk;
+	struct passwd *pw;
+	struct group *gr;
+	char **mem;
+	gid_t gid;
+	int n;
+
+	errno = 0;
+	if ((gr = getgrnam(name)) == NULL) {
+		if (errno == 0)
+			errno = ENOENT;
+		return (-1);
+	}
+	gid = gr->gr_gid;
+	pk = &pol->pl_kinds[POL_USER];
+	pk->pk_ngroup++;
+	if (verdict & POL_INCL)
+		pk->pk_incl = 1;
+	n = 0;
+	for (mem = gr->gr_mem; *mem != NULL; mem++, n++)
+		if (addrule(pol, POL_USER, *mem, verdict, 1) < 0)
+			return (-1);
+	setpwent();
+	while ((pw = getpwent()) != NULL) {
+		if (pw->pw_gid != gid)
+			continue;
+		if (addrule(pol, POL_USER, pw->pw_name, verdict, 1) < 0) {
+			endpwent();
+			return (-1);
+		}
+		n++;
+	}
+	endpwent();
+	pk->pk_nmember += n;
+	return (0);
+}
+
+static uint32_t
+strhash(const char *s, size_t len)
+{
+	uint32_t h;
+
+	for (h = 2166136261U; len > 0; s++, len--)
+		h = (h ^ (u_char)*s) * 16777619U;
+	return (h);
+}
+
+static struct pentry *
+set_find(const struct pset *ps, const char *s, size_t len, uint32_t h,
+    size_t *probes)
+{
+	struct pentry *pe;
+	size_t i;
+
+	for (i = h & ps->ps_mask; ; i = (i + 1) & ps->ps_mask) {
+		pe = &ps->ps_tab[i];
+		if (probes != NULL)
+			(*probes)++;
+		if (pe->pe_key == NULL || (pe->pe_hash == h &&
+		    pe->pe_len == len && memcmp(pe->pe_key, s, len) == 0))
+			return (pe);
+	}
+}
+
+static int
+set_build(struct pset *ps, const struct policy *pol, int kind)
+{
+	const struct prule *pr;
+	struct pentry *pe;
+	size_t i, n, size;
+	uint32_t h;
+
+	n = 0;
+	for (i = 0; i < pol->pl_nrules; i++)
+		if (pol->pl_rules[i].pr_kind == kind &&
+		    !pol->pl_rules[i].pr_glob)
+			n++;
+	/* at most half full */
+	for (size = POL_HASHMIN; size < n * 2; size *= 2)
+		;
+	ps->ps_tab = calloc(size, sizeof(*ps->ps_tab));
+	if (ps->ps_tab == NULL)
+		return (-1);
+	ps->ps_mask = size - 1;
+	for (i = 0; i < pol->pl_nrules; i++) {
+		pr = &pol->pl_rules[i];
+		if (pr->pr_kind != kind || pr->pr_glob)
+			continue;
+		n = strlen(pr->pr_pat);
+		h = strhash(pr->pr_pat, n);
+		pe = set_find(ps, pr->pr_pat, n, h, NULL);
+		if (pe->pe_key == NULL) {
+			pe->pe_key = pr->pr_pat;
+			pe->pe_len = n;
+			pe->pe_hash = h;
+			ps->ps_count++;
+		}
+		pe->pe_verdict |= pr->pr_verdict;
+	}
+	return (0);
+}
+
+/*
+ * The state of the automaton being built: the tokens of all the
+ * patterns laid end to end, a position after each token and one more
+ * for the end of a pattern, and a subset of those positions for each
+ * DFA state.
+ */
+struct pbuild {
+	struct ptok	*pb_toks;
+	int		*pb_postok;	/* token at a position, -1 at the end */
+	uint8_t		*pb_posverdict;	/* of the pattern, at its end */
+	int		 pb_npos;
+	int		 pb_words;	/* per subset */
+	uint64_t	*pb_sets;	/* [state * pb_words] */
+	int		 pb_maxstates;
+	int		*pb_htab;	/* state + 1, or 0 */
+	size_t		 pb_hmask;
+};
+
+#define	PB_SET(s, p)	((s)[(p) >> 6] |= 1ULL << ((p) & 63))
+
+/* positions after a star are reachable without consuming a byte */
+static void
+pb_closure(const struct pbuild *pb, uint64_t *set)
+{
+	uint64_t m;
+	int p, t, w;
+
+	for (w = 0; w < pb->pb_words; w++)
+		for (m = set[w]; m != 0; m &= m - 1) {
+			p = w * 64 + __builtin_ctzll(m);
+			t = pb->pb_postok[p];
+			if (t < 0 || !pb->pb_toks[t].pt_star)
+				continue;
+			PB_SET(set, p + 1);
+			if ((p + 1) >> 6 == w)
+				m |= 1ULL << ((p + 1) & 63);
+		}
+}
+
+static void
+pb_step(const struct pbuild *pb, const uint64_t *from, int c, uint64_t *to)
+{
+	const struct ptok *tok;
+	uint64_t m;
+	int p, t, w;
+
+	memset(to, 0, pb->pb_words * sizeof(*to));
+	for (w = 0; w < pb->pb_words; w++)
+		for (m = from[w]; m != 0; m &= m - 1) {
+			p = w * 64 + __builtin_ctzll(m);
+			if ((t = pb->pb_postok[p]) < 0)
+				continue;
+			tok = &pb->pb_toks[t];
+			if (tok->pt_star)
+				PB_SET(to, p);
+			else if (SET_HAS(tok->pt_set, c))
+				PB_SET(to, p + 1);
+		}
+	pb_closure(pb, to);
+}
+
+/*
+ * Returns the state for the subset in the scratch slot just past the
+ * last state, adding it if it is new, or -1 if there would be too
+ * many states.
+ */
+static int
+pb_intern(struct pbuild *pb, struct pdfa *pd)
+{
+	uint64_t *set, h;
+	size_t i, bytes;
+	int w, s;
+
+	bytes = pb->pb_words * sizeof(uint64_t);
+	set = &pb->pb_sets[(size_t)pd->pd_nstates * pb->pb_words];
+	for (h = 0, w = 0; w < pb->pb_words; w++)
+		h = (h ^ set[w]) * 0x100000001b3ULL;
+	h ^= h >> 29;
+	for (i = h & pb->pb_hmask; pb->pb_htab[i] != 0;
+	    i = (i + 1) & pb->pb_hmask) {
+		s = pb->pb_htab[i] - 1;
+		if (memcmp(&pb->pb_sets[(size_t)s * pb->pb_words], set,
+		    bytes) == 0)
+			return (s);
+	}
+	if (pd->pd_nstates == pb->pb_maxstates)
+		return (-1);
+	pb->pb_htab[i] = ++pd->pd_nstates;
+	return (pd->pd_nstates - 1);
+}
+
+static int
+dfa_build(struct pdfa *pd, const struct policy *pol, int kind)
+{
+	const struct prule *pr;
+	struct pbuild pb;
+	uint64_t *set, *next, m;
+	uint16_t *tab;
+	int cls[256], remap[512], rep[256];
+	int c, i, n, ntoks, p, s, t, ret;
+	size_t len, r;
+
+	memset(&pb, 0, sizeof(pb));
+	len = 0;
+	n = 0;
+	for (r = 0; r < pol->pl_nrules; r++) {
+		pr = &pol->pl_rules[r];
+		if (pr->pr_kind == kind && pr->pr_glob) {
+			len += strlen(pr->pr_pat);
+			n++;
+		}
+	}
+	if (n == 0)
+		return (0);
+	ret = -1;
+	pb.pb_toks = malloc(len * sizeof(*pb.pb_toks));
+	pb.pb_postok = malloc((len + n) * sizeof(int));
+	pb.pb_posverdict = calloc(len + n, 1);
+	if (pb.pb_toks == NULL || pb.pb_postok == NULL ||
+	    pb.pb_posverdict == NULL)
+		goto out;
+	ntoks = 0;
+	for (r = 0; r < pol->pl_nrules; r++) {
+		pr = &pol->pl_rules[r];
+		if (pr->pr_kind != kind || !pr->pr_glob)
+			continue;
+		t = globparse(pr->pr_pat, &pb.pb_toks[ntoks]);
+		for (i = 0; i < t; i++)
+			pb.pb_postok[pb.pb_npos++] = ntoks + i;
+		pb.pb_posverdict[pb.pb_npos] = pr->pr_verdict;
+		pb.pb_postok[pb.pb_npos++] = -1;
+		ntoks += t;
+	}
+	/* split the bytes into classes no token tells apart */
+	memset(cls, 0, sizeof(cls));
+	pd->pd_nclass = 1;
+	for (t = 0; t < ntoks; t++) {
+		if (pb.pb_toks[t].pt_star)
+			continue;
+		memset(remap, -1, sizeof(remap));
+		for (n = 0, c = 0; c < 256; c++) {
+			i = cls[c] * 2 + (SET_HAS(pb.pb_toks[t].pt_set, c) != 0);
+			if (remap[i] < 0)
+				remap[i] = n++;
+			cls[c] = remap[i];
+		}
+		pd->pd_nclass = n;
+	}
+	for (c = 255; c >= 0; c--) {
+		pd->pd_class[c] = cls[c];
+		rep[cls[c]] = c;
+	}
+	pb.pb_words = (pb.pb_npos + 63) / 64;
+	pb.pb_maxstates = 64;
+	pb.pb_hmask = 2 * POL_MAXSTATES - 1;
+	pb.pb_htab = calloc(pb.pb_hmask + 1, sizeof(int));
+	pb.pb_sets = calloc((size_t)(pb.pb_maxstates + 1) * pb.pb_words,
+	    sizeof(uint64_t));
+	pd->pd_next = malloc((size_t)pb.pb_maxstates * pd->pd_nclass *
+	    sizeof(*pd->pd_next));
+	if (pb.pb_htab == NULL || pb.pb_sets == NULL || pd->pd_next == NULL)
+		goto out;
+	/* the dead state is the empty subset */
+	(void)pb_intern(&pb, pd);
+	set = &pb.pb_sets[pb.pb_words];
+	for (p = 0; p < pb.pb_npos; p++)
+		if (p == 0 || pb.pb_postok[p - 1] < 0)
+			PB_SET(set, p);
+	pb_closure(&pb, set);
+	pd->pd_start = pb_intern(&pb, pd);
+	for (s = 0; s < pd->pd_nstates; s++)
+		for (c = 0; c < pd->pd_nclass; c++) {
+			if (pd->pd_nstates == pb.pb_maxstates &&
+			    pb.pb_maxstates < POL_MAXSTATES) {
+				pb.pb_maxstates = MIN(pb.pb_maxstates * 2,
+				    POL_MAXSTATES);
+				next = realloc(pb.pb_sets,
+				    (size_t)(pb.pb_maxstates + 1) *
+				    pb.pb_words * sizeof(uint64_t));
+				if (next == NULL)
+					goto out;
+				pb.pb_sets = next;
+				tab = realloc(pd->pd_next,
+				    (size_t)pb.pb_maxstates * pd->pd_nclass *
+				    sizeof(*pd->pd_next));
+				if (tab == NULL)
+					goto out;
+				pd->pd_next = tab;
+			}
+			pb_step(&pb, &pb.pb_sets[(size_t)s * pb.pb_words],
+			    rep[c], &pb.pb_sets[(size_t)pd->pd_nstates *
+			    pb.pb_words]);
+			if ((i = pb_intern(&pb, pd)) < 0) {
+				warnx("%s patterns need more than %d states",
+				    kindnames[kind], POL_MAXSTATES);
+				errno = E2BIG;
+				goto out;
+			}
+			pd->pd_next[s * pd->pd_nclass + c] = i;
+		}
+	pd->pd_verdict = calloc(pd->pd_nstates, 1);
+	if (pd->pd_verdict == NULL)
+		goto out;
+	for (s = 0; s < pd->pd_nstates; s++) {
+		set = &pb.pb_sets[(size_t)s * pb.pb_words];
+		for (i = 0; i < pb.pb_words; i++)
+			for (m = set[i]; m != 0; m &= m - 1)
+				pd->pd_verdict[s] |= pb.pb_posverdict[i * 64 +
+				    __builtin_ctzll(m)];
+	}
+	ret = 0;
+out:
+	if (ret < 0) {
+		free(pd->pd_next);
+		pd->pd_next = NULL;
+		pd->pd_nstates = 0;
+	}
+	free(pb.pb_toks);
+	free(pb.pb_postok);
+	free(pb.pb_posverdict);
+	free(pb.pb_sets);
+	free(pb.pb_htab);
+	return (ret);
+}
+
+int
+policy_compile(struct policy *pol)
+{
+	const struct prule *pr;
+	struct pkind *pk;
+	size_t r;
+	int k;
+
+	for (r = 0; r < pol->pl_nrules; r++) {
+		pr = &pol->pl_rules[r];
+		pk = &pol->pl_kinds[pr->pr_kind];
+		if (pr->pr_glob)
+			pk->pk_nglob++;
+		else if (!pr->pr_member)
+			pk->pk_nexact++;
+	}
+	for (k = 0; k < POL_NKINDS; k++)
+		if (set_build(&pol->pl_kinds[k].pk_set, pol, k) < 0 ||
+		    dfa_build(&pol->pl_kinds[k].pk_dfa, pol, k) < 0)
+			return (-1);
+	return (0);
+}
+
+static int
+kind_match(const struct pkind *pk, const char *s, size_t len,
+    size_t *probes, size_t *steps)
+{
+	const struct pdfa *pd;
+	int st, v;
+	size_t i;
+
+	v = set_find(&pk->pk_set, s, len, strhash(s, len),
+	    probes)->pe_verdict;
+	pd = &pk->pk_dfa;
+	if (pd->pd_nstates > 0) {
+		st = pd->pd_start;
+		for (i = 0; i < len && st != 0; i++)
+			st = pd->pd_next[st * pd->pd_nclass +
+			    pd->pd_class[(u_char)s[i]]];
+		if (steps != NULL)
+			*steps += i;
+		v |= pd->pd_verdict[st];
+	}
+	if (v & POL_EXCL)
+		return (0);
+	return (!pk->pk_incl || (v & POL_INCL) != 0);
+}
+
+/*
+ * Returns non-zero if the login of user on line is to be monitored.
+ * Neither needs to be NUL terminated.
+ */
+int
+policy_match(const struct policy *pol, const char *user, size_t ulen,
+    const char *line, size_t llen)
+{
+	return (kind_match(&pol->pl_kinds[POL_USER], user, ulen,
+	    NULL, NULL) &&
+	    kind_match(&pol->pl_kinds[POL_TTY], line, llen, NULL, NULL));
+}
+
+static uint64_t
+clock_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+#define	RECUSER(up)	(up)->ut_user, strnlen((up)->ut_user, \
+			    sizeof((up)->ut_user))
+#define	RECLINE(up)	(up)->ut_line, strnlen((up)->ut_line, \
+			    sizeof((up)->ut_line))
+
+/*
+ * Describes the compiled policy and what classifying the given
+ * records with it costs.
+ */
+void
+policy_check(const struct policy *pol, FILE *fp, const struct utmpx *recs,
+    size_t nrecs)
+{
+	const struct pkind *pk;
+	const struct pset *ps;
+	const struct utmpx *up;
+	size_t i, probes, maxprobes, steps, sum, n, reps;
+	volatile int sink;
+	uint64_t t0, t1;
+	int k, sel;
+
+	for (k = 0; k < POL_NKINDS; k++) {
+		pk = &pol->pl_kinds[k];
+		ps = &pk->pk_set;
+		fprintf(fp, "%s rules: %d names, %d patterns", kindnames[k],
+		    pk->pk_nexact, pk->pk_nglob);
+		if (k == POL_USER)
+			fprintf(fp, ", %d groups (%d members)",
+			    pk->pk_ngroup, pk->pk_nmember);
+		fprintf(fp, "%s\n", pk->pk_incl ? "" : ", all included");
+		maxprobes = sum = 0;
+		for (i = 0; i <= ps->ps_mask; i++) {
+			if (ps->ps_tab[i].pe_key == NULL)
+				continue;
+			probes = 0;
+			(void)set_find(ps, ps->ps_tab[i].pe_key,
+			    ps->ps_tab[i].pe_len, ps->ps_tab[i].pe_hash,
+			    &probes);
+			sum += probes;
+			maxprobes = MAX(maxprobes, probes);
+		}
+		fprintf(fp, "  name set: %zu names in %zu slots, "
+		    "%.2f probes average, %zu most\n", ps->ps_count,
+		    ps->ps_mask + 1,
+		    ps->ps_count ? (double)sum / ps->ps_count : 0.0,
+		    maxprobes);
+		fprintf(fp, "  automaton: %d states, %d byte classes, "
+		    "%zu bytes\n", pk->pk_dfa.pd_nstates,
+		    pk->pk_dfa.pd_nstates ? pk->pk_dfa.pd_nclass : 0,
+		    (size_t)pk->pk_dfa.pd_nstates * (pk->pk_dfa.pd_nclass *
+		    sizeof(uint16_t) + 1));
+	}
+	if (nrecs == 0) {
+		fprintf(fp, "no logins to classify\n");
+		return;
+	}
+	probes = steps = n = 0;
+	for (i = 0; i < nrecs; i++) {
+		up = &recs[i];
+		sel = kind_match(&pol->pl_kinds[POL_USER], RECUSER(up),
+		    &probes, &steps);
+		if (sel)
+			sel = kind_match(&pol->pl_kinds[POL_TTY],
+			    RECLINE(up), &probes, &steps);
+		fprintf(fp, "%-8.*s %-12.*s %s\n", (int)sizeof(up->ut_user),
+		    up->ut_user, (int)sizeof(up->ut_line), up->ut_line,
+		    sel ? "monitored" : "skipped");
+		n += sel;
+	}
+	/* long enough for the clock not to matter */
+	reps = 0;
+	t0 = clock_nsec();
+	do {
+		for (i = 0; i < nrecs; i++)
+			sink = policy_match(pol, RECUSER(&recs[i]),
+			    RECLINE(&recs[i]));
+		reps++;
+		t1 = clock_nsec();
+	} while (t1 - t0 < 100000000ULL);
+	(void)sink;
+	fprintf(fp, "%zu of %zu logins monitored: %.1f ns, %.2f probes, "
+	    "%.2f automaton steps each\n", n, nrecs,
+	    (double)(t1 - t0) / (reps * nrecs),
+	    (double)probes / nrecs, (double)steps / nrecs);
+}
+
+void
+policy_free(struct policy *pol)
+{
+	struct pkind *pk;
+	size_t r;
+	int k;
+
+	if (pol == NULL)
+		return;
+	for (k = 0; k < POL_NKINDS; k++) {
+		pk = &pol->pl_kinds[k];
+		free(pk->pk_set.ps_tab);
+		free(pk->pk_dfa.pd_next);
+		free(pk->pk_dfa.pd_verdict);
+	}
+	for (r = 0; r < pol->pl_nrules; r++)
+		free(pol->pl_rules[r].pr_pat);
+	free(pol->pl_rules);
+	free(pol);
+}
@@ -0,0 +1,69 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef	POLICY_DOT_H_
+#define	POLICY_DOT_H_
+
+#include <stdio.h>
+
+/*
+ * Which logins are monitored.  Rules name users, groups and ttys, by
+ * name or by glob pattern, and may be negated to exclude.  They are
+ * compiled once, when the policy is loaded: exact names of each kind go
+ * into a hashed set, all the patterns of a kind into one automaton, and
+ * groups are expanded into their members.  Matching a utmp record then
+ * costs one hash lookup and one automaton walk per field, linear in the
+ * length of the name whatever the number of rules.
+ *
+ * A record is monitored if neither its user nor its tty is excluded
+ * and both are included; a kind without inclusive rules includes
+ * everything.
+ */
+#define	POL_USER	0
+#define	POL_TTY		1
+#define	POL_NKINDS	2
+
+#define	POL_INCL	0x01
+#define	POL_EXCL	0x02
+
+/* ceiling on automaton states, per kind */
+#define	POL_MAXSTATES	16384
+
+struct policy;
+struct utmpx;
+
+struct policy *policy_new(void);
+int policy_add(struct policy *, int, const char *, int);
+int policy_addgroup(struct policy *, const char *, int);
+int policy_compile(struct policy *);
+int policy_match(const struct policy *, const char *, size_t,
+    const char *, size_t);
+void policy_check(const struct policy *, FILE *, const struct utmpx *,
+    size_t);
+void policy_free(struct policy *);
+#endif	/* POLICY_DOT_H_ */
@@ -0,0 +1,371 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <utmpx.h>
+#include "utmp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <paths.h>
+#include <poll.h>
+#include <err.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <termios.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "compat.h"
+#include "termlog.h"
+
+/*
+ * termlog-pty: run a session on a private pty and give termlog a
+ * copy of everything written to it.  Output from the session is
+ * spliced into a pipe, tee(2)'d into the capture fifo and spliced
+ * on to the real terminal, so the bytes never pass through this
+ * process.  The fifo is opened non-blocking: if termlog is not
+ * keeping up, the capture copy is dropped rather than stalling the
+ * user, and a counter shared with termlog is bumped so the gap can
+ * be marked in the log.
+ */
+static struct termios	 oterm;
+static volatile sig_atomic_t winched;
+static char		 fifo[MAXPATHLEN];
+static char		 oflow[MAXPATHLEN];
+static u_long		 dropped;
+static _Atomic(uint64_t) *drops;
+
+static void
+catchwinch(int sig __unused)
+{
+	winched = 1;
+}
+
+static void
+restoretty(void)
+{
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &oterm);
+	if (fifo[0] != '\0')
+		unlink(fifo);
+	if (oflow[0] != '\0')
+		unlink(oflow);
+	if (dropped)
+		warnx("%lu bytes were not captured", dropped);
+}
+
+static void
+drop(ssize_t n)
+{
+	dropped += n;
+	if (drops != NULL)
+		atomic_fetch_add(drops, 1);
+}
+
+static void
+openoflow(void)
+{
+	void *p;
+	int fd;
+
+	if ((size_t)snprintf(oflow, sizeof(oflow), "%s%s", fifo,
+	    TERMLOG_OFLOW_SUFFIX) >= sizeof(oflow)) {
+		warnx("%s%s: name too long", fifo, TERMLOG_OFLOW_SUFFIX);
+		oflow[0] = '\0';
+		return;
+	}
+	/*
+	 * The spool directory is world-writable; never follow or reuse
+	 * whatever is already sitting under our name.
+	 */
+	(void)unlink(oflow);
+	fd = open(oflow, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW,
+	    S_IRUSR | S_IWUSR);
+	if (fd < 0 || ftruncate(fd, sizeof(*drops)) < 0) {
+		warn("%s", oflow);
+		oflow[0] = '\0';
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+	p = mmap(NULL, sizeof(*drops), PROT_READ | PROT_WRITE, MAP_SHARED,
+	    fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		warn("mmap %s failed", oflow);
+		return;
+	}
+	drops = p;
+}
+
+static int
+openfifo(const char *spool)
+{
+	char *line, *p;
+	int fd;
+
+	line = ttyname(STDIN_FILENO);
+	if (line == NULL)
+		err(1, "ttyname failed");
+	if (strncmp(line, _PATH_DEV, sizeof(_PATH_DEV) - 1) == 0)
+		line += sizeof(_PATH_DEV) - 1;
+	snprintf(fifo, sizeof(fifo), "%s/", spool);
+	p = fifo + strlen(fifo);
+	strlcpy(p, line, sizeof(fifo) - (p - fifo));
+	while ((p = index(p, '/')) != NULL)
+		*p = '_';
+	(void)unlink(fifo);
+	if (mkfifo(fifo, S_IRUSR | S_IWUSR) < 0) {
+		warn("mkfifo %s failed: session will not be logged", fifo);
+		fifo[0] = '\0';
+		return (-1);
+	}
+	/*
+	 * Opening read-write means we never see ENXIO before termlog
+	 * gets around to attaching, and whatever is written in the
+	 * meantime is buffered in the fifo.
+	 */
+	fd = open(fifo, O_RDWR | O_NONBLOCK);
+	if (fd < 0)
+		warn("open %s failed", fifo);
+	else
+		openoflow();
+	return (fd);
+}
+
+static void
+spawn(int master, char **argv)
+{
+	struct winsize ws;
+	const char *shell;
+	char *slave;
+	int fd;
+
+	slave = ptsname(master);
+	if (slave == NULL)
+		err(1, "ptsname failed");
+	if (setsid() < 0)
+		err(1, "setsid failed");
+	fd = open(slave, O_RDWR);
+	if (fd < 0)
+		err(1, "open %s failed", slave);
+	(void)ioctl(fd, TIOCSCTTY, 0);
+	tcsetattr(fd, TCSANOW, &oterm);
+	if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) == 0)
+		(void)ioctl(fd, TIOCSWINSZ, &ws);
+	dup2(fd, STDIN_FILENO);
+	dup2(fd, STDOUT_FILENO);
+	dup2(fd, STDERR_FILENO);
+	if (fd > STDERR_FILENO)
+		close(fd);
+	close(master);
+	if (*argv != NULL) {
+		execvp(argv[0], argv);
+		err(1, "exec %s failed", argv[0]);
+	}
+	shell = getenv("SHELL");
+	if (shell == NULL || *shell == '\0')
+		shell = _PATH_BSHELL;
+	execl(shell, shell, (char *)NULL);
+	err(1, "exec %s failed", shell);
+}
+
+static int
+writeall(int fd, char *ptr, ssize_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, ptr, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return (-1);
+		ptr += n;
+		len -= n;
+	}
+	return (0);
+}
+
+/*
+ * Fallback for kernels which cannot splice from a pty.
+ */
+static int
+copyout(int master, int cfd)
+{
+	char buf[BUFSIZ];
+	ssize_t n, m;
+
+	n = read(master, buf, sizeof(buf));
+	if (n <= 0)
+		return (n < 0 && (errno == EAGAIN || errno == EINTR) ? 0 : -1);
+	if (cfd >= 0) {
+		m = write(cfd, buf, n);
+		if (m < n)
+			drop(n - (m < 0 ? 0 : m));
+	}
+	return (writeall(STDOUT_FILENO, buf, n));
+}
+
+/*
+ * Returns 1 if the kernel cannot splice from a pty, in which case
+ * the caller should fall back to copyout().
+ */
+static int
+spliceout(int master, int pfd[2], int cfd)
+{
+	char buf[BUFSIZ];
+	ssize_t n, m, t;
+
+	n = splice(master, NULL, pfd[1], NULL, 65536,
+	    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return (0);
+	if (n < 0 && errno == EINVAL)
+		return (1);
+	if (n <= 0)
+		return (-1);
+	if (cfd >= 0) {
+		t = tee(pfd[0], cfd, n, SPLICE_F_NONBLOCK);
+		if (t < n)
+			drop(n - (t < 0 ? 0 : t));
+	}
+	while (n > 0) {
+		m = splice(pfd[0], NULL, STDOUT_FILENO, NULL, n,
+		    SPLICE_F_MOVE);
+		if (m < 0 && errno == EINTR)
+			continue;
+		if (m < 0 && errno == EINVAL) {
+			m = read(pfd[0], buf, MIN(n, (ssize_t)sizeof(buf)));
+			if (m > 0 && writeall(STDOUT_FILENO, buf, m) < 0)
+				return (-1);
+		}
+		if (m <= 0)
+			return (-1);
+		n -= m;
+	}
+	return (0);
+}
+
+void
+usage(char *execname)
+{
+	fprintf(stderr,
+	    "usage: %s [-d spooldir] [command [arg ...]]\n", execname);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct pollfd pfds[2];
+	struct termios rterm;
+	struct winsize ws;
+	const char *spool;
+	char buf[BUFSIZ];
+	int ch, master, cfd, pfd[2], nosplice, status;
+	pid_t pid;
+	ssize_t n;
+
+	spool = _PATH_TERMLOG_SPOOL;
+	while ((ch = getopt(argc, argv, "d:")) != -1)
+		switch (ch) {
+		case 'd':
+			spool = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	argc -= optind;
+	argv += optind;
+	if (tcgetattr(STDIN_FILENO, &oterm) < 0)
+		err(1, "standard input is not a terminal");
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+		err(1, "unable to allocate a pty");
+	cfd = openfifo(spool);
+	pid = fork();
+	if (pid < 0)
+		err(1, "fork failed");
+	if (pid == 0)
+		spawn(master, argv);
+	atexit(restoretty);
+	rterm = oterm;
+	cfmakeraw(&rterm);
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &rterm);
+	signal(SIGWINCH, catchwinch);
+	if (pipe(pfd) < 0)
+		err(1, "pipe failed");
+	nosplice = 0;
+	pfds[0].fd = STDIN_FILENO;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = master;
+	pfds[1].events = POLLIN;
+	for (;;) {
+		if (winched) {
+			winched = 0;
+			if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) == 0)
+				(void)ioctl(master, TIOCSWINSZ, &ws);
+		}
+		if (poll(pfds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			err(1, "poll failed");
+		}
+		if (pfds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+			if (!nosplice) {
+				nosplice = spliceout(master, pfd, cfd);
+				if (nosplice < 0)
+					break;
+			}
+			if (nosplice && copyout(master, cfd) < 0)
+				break;
+		}
+		if (pfds[0].revents & POLLIN) {
+			n = read(STDIN_FILENO, buf, sizeof(buf));
+			if (n <= 0)
+				break;
+			if (writeall(master, buf, n) < 0)
+				break;
+		}
+	}
+	close(master);
+	if (cfd >= 0)
+		close(cfd);
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+		exit(1);
+	exit(WEXITSTATUS(status));
+}
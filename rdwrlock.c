@@ -32,71 +32,120 @@
 
 #include "rdwrlock.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#define	RW_PAUSE()	__asm__ __volatile__("pause")
+#elif defined(__aarch64__)
+#define	RW_PAUSE()	__asm__ __volatile__("yield")
+#else
+#define	RW_PAUSE()	do { } while (0)
+#endif
+
 void
 rdwr_lock_init(struct rdwrlock *rwp)
 {
-#ifdef DEBUG_LOGS
-	DEBUG("initializing rw lock %p", rwp);
-#endif
-	rwp->lock = PTHREAD_MUTEX_INITIALIZER;
-	rwp->rdsok = PTHREAD_COND_INITIALIZER;
-	rwp->wrok = PTHREAD_COND_INITIALIZER;
-	rwp->rwlock = 0;
-	rwp->nwrs_wait = 0;
-	rwp->thrid = 0;
+	atomic_init(&rwp->rw_state, 0);
+	atomic_init(&rwp->rw_rdpark, 0);
+	atomic_init(&rwp->rw_wrpark, 0);
+	pthread_mutex_init(&rwp->rw_mtx, NULL);
+	pthread_cond_init(&rwp->rw_rdcv, NULL);
+	pthread_cond_init(&rwp->rw_wrcv, NULL);
+}
+
+/*
+ * Try to move the state from one where mask is clear to the same
+ * state plus add.
+ */
+static int
+rw_try(struct rdwrlock *rwp, uint32_t mask, uint32_t add)
+{
+	uint32_t s;
+
+	s = atomic_load_explicit(&rwp->rw_state, memory_order_relaxed);
+	while ((s & mask) == 0)
+		if (atomic_compare_exchange_weak_explicit(&rwp->rw_state, &s,
+		    s + add, memory_order_acquire, memory_order_relaxed))
+			return (1);
+	return (0);
+}
+
+/*
+ * Spin for a while, then sleep until the lock is released.  The park
+ * count goes up before the state is looked at again, and the state
+ * changes before rdwr_unlock() looks at the count, so either we see
+ * the lock free or the unlocker sees us; both happen under rw_mtx,
+ * so its wakeup cannot come before we wait.
+ */
+static void
+rw_wait(struct rdwrlock *rwp, uint32_t mask, atomic_int *park,
+    pthread_cond_t *cv)
+{
+	int i;
+
+	for (i = 0; i < RW_SPINS; i++) {
+		RW_PAUSE();
+		if ((atomic_load_explicit(&rwp->rw_state,
+		    memory_order_relaxed) & mask) == 0)
+			return;
+	}
+	pthread_mutex_lock(&rwp->rw_mtx);
+	atomic_fetch_add(park, 1);
+	while (atomic_load(&rwp->rw_state) & mask)
+		pthread_cond_wait(cv, &rwp->rw_mtx);
+	atomic_fetch_sub(park, 1);
+	pthread_mutex_unlock(&rwp->rw_mtx);
 }
 
 void
 rd_lock(struct rdwrlock *rwp)
 {
-#ifdef DEBUG_LOGS
-	DEBUG("aquiring read lock %p", rwp);
-#endif
 	assert(rwp != NULL);
-	pthread_mutex_lock(&rwp->lock);
-	while (rwp->rwlock < 0 || rwp->nwrs_wait)
-		pthread_cond_wait(&rwp->rdsok, &rwp->lock);
-	rwp->rwlock++;
-	pthread_mutex_unlock(&rwp->lock);
+	while (!rw_try(rwp, RW_WRITER | RW_WAITERS, RW_READER))
+		rw_wait(rwp, RW_WRITER | RW_WAITERS, &rwp->rw_rdpark,
+		    &rwp->rw_rdcv);
 }
 
 void
 wr_lock(struct rdwrlock *rwp)
 {
-#ifdef DEBUG_LOGS
-	DEBUG("aquiring write lock %p", rwp);
-#endif
 	assert(rwp != NULL);
-	pthread_mutex_lock(&rwp->lock);
-	rwp->thrid = pthread_self();
-	while (rwp->rwlock != 0) {
-		rwp->nwrs_wait++;
-		pthread_cond_wait(&rwp->wrok, &rwp->lock);
-		rwp->nwrs_wait--;
+	if (!rw_try(rwp, RW_WRITER | RW_WAITERS | RW_READERS, RW_WRITER)) {
+		/* from now on readers stay out */
+		atomic_fetch_add(&rwp->rw_state, RW_WAITER);
+		while (!rw_try(rwp, RW_WRITER | RW_READERS,
+		    RW_WRITER - RW_WAITER))
+			rw_wait(rwp, RW_WRITER | RW_READERS, &rwp->rw_wrpark,
+			    &rwp->rw_wrcv);
 	}
-	rwp->rwlock = -1;
-	pthread_mutex_unlock(&rwp->lock);
+	atomic_store_explicit(&rwp->rw_owner, pthread_self(),
+	    memory_order_relaxed);
 }
 
+/*
+ * Parked writers go first; readers are only woken once no writer is
+ * waiting, as they would go straight back to sleep otherwise.
+ */
 void
 rdwr_unlock(struct rdwrlock *rwp)
 {
-#ifdef DEBUG_LOGS
-	DEBUG("unlocking rw lock %p", rwp);
-#endif
+	uint32_t s;
+
 	assert(rwp != NULL);
-	pthread_mutex_lock(&rwp->lock);
-	if (rwp->rwlock < 0)
-		rwp->rwlock = 0;
-	else
-		rwp->rwlock--;
-	if (rwp->thrid != 0)
-		rwp->thrid = 0;
-	if (rwp->nwrs_wait && rwp->rwlock == 0) {
-		pthread_mutex_unlock(&rwp->lock);
-		pthread_cond_signal(&rwp->wrok);
-	} else if (rwp->nwrs_wait == 0) {
-		pthread_mutex_unlock(&rwp->lock);
-		pthread_cond_broadcast(&rwp->rdsok);
+	s = atomic_load_explicit(&rwp->rw_state, memory_order_relaxed);
+	if (s & RW_WRITER)
+		s = atomic_fetch_sub(&rwp->rw_state, RW_WRITER) - RW_WRITER;
+	else {
+		assert((s & RW_READERS) != 0);
+		s = atomic_fetch_sub(&rwp->rw_state, RW_READER) - RW_READER;
+		if (s & RW_READERS)
+			return;
+	}
+	if (atomic_load(&rwp->rw_wrpark) > 0) {
+		pthread_mutex_lock(&rwp->rw_mtx);
+		pthread_cond_signal(&rwp->rw_wrcv);
+		pthread_mutex_unlock(&rwp->rw_mtx);
+	} else if (atomic_load(&rwp->rw_rdpark) > 0 && (s & RW_WAITERS) == 0) {
+		pthread_mutex_lock(&rwp->rw_mtx);
+		pthread_cond_broadcast(&rwp->rw_rdcv);
+		pthread_mutex_unlock(&rwp->rw_mtx);
 	}
 }
@@ -29,24 +29,49 @@
 #ifndef	__RDWRLOCK_DOT_H__
 #define	__RDWRLOCK_DOT_H__
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * A reader/writer lock which prefers writers.  The whole state is a
+ * single word, so taking and releasing an uncontended lock is one
+ * atomic operation:
+ *
+ *	bits  0-15	readers holding the lock
+ *	bits 16-30	writers waiting for it
+ *	bit  31		held by a writer
+ *
+ * Readers are kept out as soon as a writer is waiting.  A thread
+ * which cannot get the lock spins RW_SPINS times before it parks on
+ * a condition variable; parked threads are counted, and releasing
+ * the lock only takes the mutex when somebody is parked.
+ */
+#define	RW_READER	0x00000001U
+#define	RW_READERS	0x0000ffffU
+#define	RW_WAITER	0x00010000U
+#define	RW_WAITERS	0x7fff0000U
+#define	RW_WRITER	0x80000000U
+#define	RW_SPINS	200
 
 struct rdwrlock {
-	pthread_mutex_t		lock;
-	int			rwlock;
-	pthread_cond_t		rdsok;
-	int		nwrs_wait;
-	pthread_cond_t		wrok;
-	pthread_t		thrid;
+	_Atomic uint32_t	rw_state;
+	_Atomic(pthread_t)	rw_owner;	/* writer holding it */
+	atomic_int		rw_rdpark;	/* parked readers */
+	atomic_int		rw_wrpark;	/* parked writers */
+	pthread_mutex_t		rw_mtx;		/* for parking only */
+	pthread_cond_t		rw_rdcv;
+	pthread_cond_t		rw_wrcv;
 };
 #define	M_OWNED		0x0000001U
 #define	M_NOTOWNED	0x0000002U
-#define	WRLOCK_ASSERT(what, thread) do {				\
-	pthread_t me;							\
-	me = pthread_self();						\
+#define	WRLOCK_ASSERT(what, rwp) do {					\
+	int owned;							\
+	owned = (atomic_load(&(rwp)->rw_state) & RW_WRITER) != 0 &&	\
+	    pthread_equal(atomic_load(&(rwp)->rw_owner), pthread_self());\
 	if (what == M_OWNED)						\
-		assert((thread)->thrid == me);				\
+		assert(owned);						\
 	else if (what == M_NOTOWNED)					\
-		assert((thread)->thrid != me);				\
+		assert(!owned);						\
 } while (0)
 void rdwr_lock_init(struct rdwrlock *);
 void rd_lock(struct rdwrlock *);
@@ -0,0 +1,158 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+
+#include <utmpx.h>
+#include "utmp.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "compat.h"
+#include "termlog.h"
+#include "registry.h"
+
+typedef _Atomic(struct snp_d *) regbucket_t;
+
+static regbucket_t bylinetab[REG_NBUCKETS];
+static regbucket_t byusertab[REG_NBUCKETS];
+
+#define	LINELEN	(UT_LINESIZE - 1)
+#define	NAMELEN	(UT_NAMESIZE - 1)
+
+/*
+ * FNV-1a.  Keys from utmp are not necessarily NUL terminated, so
+ * everything is bounded by the size of the session fields.
+ */
+static uint32_t
+reg_hash(const char *key, size_t max)
+{
+	uint32_t h;
+
+	for (h = 2166136261U; max > 0 && *key != '\0'; max--, key++)
+		h = (h ^ (u_char)*key) * 16777619U;
+	return (h & (REG_NBUCKETS - 1));
+}
+
+int
+reg_insert(struct snp_d *s)
+{
+	regbucket_t *b;
+	struct snp_d *p;
+
+	b = &bylinetab[reg_hash(s->s_line, LINELEN)];
+	for (p = atomic_load(b); p != NULL; p = atomic_load(&p->s_lnext))
+		if (strncmp(p->s_line, s->s_line, LINELEN) == 0)
+			return (-1);
+	atomic_store_explicit(&s->s_lnext, atomic_load(b),
+	    memory_order_relaxed);
+	atomic_store_explicit(b, s, memory_order_release);
+	b = &byusertab[reg_hash(s->s_username, NAMELEN)];
+	atomic_store_explicit(&s->s_unext, atomic_load(b),
+	    memory_order_relaxed);
+	atomic_store_explicit(b, s, memory_order_release);
+	return (0);
+}
+
+/*
+ * Unlink s.  Its own next pointers are left alone so readers which
+ * are standing on it can carry on walking the chain.
+ */
+void
+reg_remove(struct snp_d *s)
+{
+	regbucket_t *pp;
+	struct snp_d *p;
+
+	pp = &bylinetab[reg_hash(s->s_line, LINELEN)];
+	while ((p = atomic_load(pp)) != NULL && p != s)
+		pp = &p->s_lnext;
+	assert(p == s);
+	atomic_store_explicit(pp, atomic_load(&s->s_lnext),
+	    memory_order_release);
+	pp = &byusertab[reg_hash(s->s_username, NAMELEN)];
+	while ((p = atomic_load(pp)) != NULL && p != s)
+		pp = &p->s_unext;
+	assert(p == s);
+	atomic_store_explicit(pp, atomic_load(&s->s_unext),
+	    memory_order_release);
+}
+
+struct snp_d *
+reg_lookup_line(const char *line)
+{
+	struct snp_d *p;
+
+	p = atomic_load_explicit(&bylinetab[reg_hash(line, LINELEN)],
+	    memory_order_acquire);
+	for (; p != NULL; p = atomic_load_explicit(&p->s_lnext,
+	    memory_order_acquire))
+		if (strncmp(p->s_line, line, LINELEN) == 0)
+			return (p);
+	return (NULL);
+}
+
+int
+reg_foreach(void (*fn)(struct snp_d *, void *), void *arg)
+{
+	struct snp_d *p;
+	int i, n;
+
+	n = 0;
+	for (i = 0; i < REG_NBUCKETS; i++)
+		for (p = atomic_load_explicit(&bylinetab[i],
+		    memory_order_acquire); p != NULL;
+		    p = atomic_load_explicit(&p->s_lnext,
+		    memory_order_acquire), n++)
+			fn(p, arg);
+	return (n);
+}
+
+int
+reg_foreach_user(const char *user, void (*fn)(struct snp_d *, void *),
+    void *arg)
+{
+	struct snp_d *p;
+	int n;
+
+	n = 0;
+	p = atomic_load_explicit(&byusertab[reg_hash(user, NAMELEN)],
+	    memory_order_acquire);
+	for (; p != NULL; p = atomic_load_explicit(&p->s_unext,
+	    memory_order_acquire))
+		if (strncmp(p->s_username, user, NAMELEN) == 0) {
+			fn(p, arg);
+			n++;
+		}
+	return (n);
+}
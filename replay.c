@@ -0,0 +1,239 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+#include <unistd.h>
+
+#include "logfmt.h"
+
+/*
+ * termlog-replay: play a session log back at its original pace, or
+ * a multiple of it, or export part of it.  The sidecar index is used
+ * to find the starting point with a binary search; without one a
+ * binary log is scanned from the start and a text log can only be
+ * dumped whole.  Text logs are timed by their index entries only.
+ */
+static double speed = 1.0;
+static int xflag;
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: termlog-replay [-x] [-s speed] "
+	    "[-f from] [-t to] file\n");
+	exit(1);
+}
+
+/*
+ * Times are "+seconds" from the start of the log, "HH:MM[:SS]" on
+ * the day the log starts or "YYYY-mm-dd HH:MM[:SS]", all local time.
+ */
+static uint64_t
+parsetime(const char *str, uint64_t start)
+{
+	struct tm tm;
+	time_t t;
+	char *endp;
+	double secs;
+
+	if (*str == '+') {
+		secs = strtod(str + 1, &endp);
+		if (*endp != '\0' || secs < 0)
+			errx(1, "%s: invalid time", str);
+		return (start + secs * 1000000);
+	}
+	t = start / 1000000;
+	localtime_r(&t, &tm);
+	if ((endp = strptime(str, "%Y-%m-%d %H:%M", &tm)) == NULL) {
+		/* A failed conversion may leave tm half written. */
+		localtime_r(&t, &tm);
+		endp = strptime(str, "%H:%M", &tm);
+	}
+	if (endp == NULL)
+		errx(1, "%s: invalid time", str);
+	tm.tm_sec = 0;
+	if (*endp == ':' && (endp = strptime(endp, ":%S", &tm)) == NULL)
+		errx(1, "%s: invalid time", str);
+	if (*endp != '\0')
+		errx(1, "%s: invalid time", str);
+	tm.tm_isdst = -1;
+	return ((uint64_t)mktime(&tm) * 1000000);
+}
+
+static void
+pace(uint64_t *prev, uint64_t now)
+{
+	struct timespec ts;
+	double d;
+
+	if (xflag || speed <= 0 || *prev == 0 || now <= *prev) {
+		if (now > *prev)
+			*prev = now;
+		return;
+	}
+	fflush(stdout);
+	d = (now - *prev) / speed;
+	ts.tv_sec = d / 1000000;
+	ts.tv_nsec = ((uint64_t)d % 1000000) * 1000;
+	while (nanosleep(&ts, &ts) < 0)
+		;
+	*prev = now;
+}
+
+static void
+out(const char *buf, size_t len)
+{
+	if (fwrite(buf, 1, len, stdout) != len)
+		err(1, "stdout");
+}
+
+static void
+replaybinary(struct logread *lf, struct logidx *lx, int haveidx,
+    uint64_t from, uint64_t to)
+{
+	struct logrec lr;
+	uint64_t prev, t;
+	off_t off;
+	int ret;
+
+	if (haveidx && from != 0) {
+		logidx_get(lx, logidx_find(lx, from), &t, &off);
+		logread_seek(lf, off);
+	}
+	prev = 0;
+	while ((ret = logread_next(lf, &lr)) > 0) {
+		if (lr.lr_type == REC_TIME || lr.lr_time < from)
+			continue;
+		if (to != 0 && lr.lr_time > to)
+			break;
+		pace(&prev, lr.lr_time);
+		out(lr.lr_data, lr.lr_len);
+	}
+	if (ret < 0)
+		warnx("truncated or corrupt at offset %jd", (intmax_t)lr.lr_off);
+}
+
+static void
+replaytext(struct logread *lf, struct logidx *lx, int haveidx,
+    uint64_t from, uint64_t to)
+{
+	uint64_t prev, t, nt;
+	off_t off, noff;
+	size_t i;
+
+	if (!haveidx) {
+		if (from != 0 || to != 0)
+			errx(1, "no index, can not seek in a text log");
+		out((const char *)lf->lf_base, lf->lf_size);
+		return;
+	}
+	i = from != 0 ? logidx_find(lx, from) : 0;
+	logidx_get(lx, i, &t, &off);
+	if (from == 0)
+		off = 0;
+	prev = 0;
+	for (; i < lx->lx_count && (to == 0 || t <= to); i++) {
+		if (i + 1 < lx->lx_count)
+			logidx_get(lx, i + 1, &nt, &noff);
+		else
+			noff = lf->lf_size;
+		if ((size_t)noff > lf->lf_size)
+			noff = lf->lf_size;
+		pace(&prev, t);
+		if (noff > off)
+			out((const char *)lf->lf_base + off, noff - off);
+		off = noff;
+		t = nt;
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct logread lf;
+	struct logidx lx;
+	struct logrec lr;
+	const char *fflag, *tflag;
+	uint64_t start, from, to;
+	off_t off;
+	int ch, haveidx;
+
+	fflag = tflag = NULL;
+	while ((ch = getopt(argc, argv, "f:s:t:x")) != -1)
+		switch (ch) {
+		case 'f':
+			fflag = optarg;
+			break;
+		case 's':
+			speed = strtod(optarg, NULL);
+			break;
+		case 't':
+			tflag = optarg;
+			break;
+		case 'x':
+			xflag++;
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		usage();
+	if (logread_open(&lf, argv[0]) < 0)
+		err(1, "%s", argv[0]);
+	haveidx = logidx_open(&lx, argv[0]) == 0 && lx.lx_count > 0;
+	start = 0;
+	if (haveidx)
+		logidx_get(&lx, 0, &start, &off);
+	else if (lf.lf_binary && logread_next(&lf, &lr) > 0) {
+		start = lr.lr_time;
+		logread_seek(&lf, 0);
+	}
+	if (start == 0 && (fflag != NULL || tflag != NULL))
+		errx(1, "%s: no timing information", argv[0]);
+	from = fflag != NULL ? parsetime(fflag, start) : 0;
+	to = tflag != NULL ? parsetime(tflag, start) : 0;
+	if (lf.lf_binary)
+		replaybinary(&lf, &lx, haveidx, from, to);
+	else
+		replaytext(&lf, &lx, haveidx, from, to);
+	if (fflush(stdout) != 0)
+		err(1, "stdout");
+	logread_close(&lf);
+	if (haveidx)
+		logidx_close(&lx);
+	return (0);
+}
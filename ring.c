@@ -0,0 +1,109 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "ring.h"
+
+int
+ring_init(struct ring *r, size_t size)
+{
+	assert(size != 0 && (size & (size - 1)) == 0);
+	r->r_buf = malloc(size);
+	if (r->r_buf == NULL)
+		return (-1);
+	r->r_size = size;
+	r->r_head = r->r_tail = 0;
+	return (0);
+}
+
+void
+ring_destroy(struct ring *r)
+{
+	free(r->r_buf);
+	r->r_buf = NULL;
+}
+
+/*
+ * Describe the free space in at most two iovecs, in the order it
+ * should be filled.  Returns the number of iovecs used.
+ */
+int
+ring_freeiov(struct ring *r, struct iovec *iov)
+{
+	size_t off, space;
+
+	space = ring_space(r);
+	if (space == 0)
+		return (0);
+	off = r->r_head & (r->r_size - 1);
+	iov[0].iov_base = r->r_buf + off;
+	if (off + space <= r->r_size) {
+		iov[0].iov_len = space;
+		return (1);
+	}
+	iov[0].iov_len = r->r_size - off;
+	iov[1].iov_base = r->r_buf;
+	iov[1].iov_len = space - iov[0].iov_len;
+	return (2);
+}
+
+void
+ring_produce(struct ring *r, size_t n)
+{
+	assert(n <= ring_space(r));
+	r->r_head += n;
+}
+
+/*
+ * Return the length of the contiguous run of data at the tail of the
+ * ring and point *ptr at it.
+ */
+size_t
+ring_span(struct ring *r, char **ptr)
+{
+	size_t off, len;
+
+	len = ring_len(r);
+	off = r->r_tail & (r->r_size - 1);
+	if (off + len > r->r_size)
+		len = r->r_size - off;
+	*ptr = r->r_buf + off;
+	return (len);
+}
+
+void
+ring_consume(struct ring *r, size_t n)
+{
+	assert(n <= ring_len(r));
+	r->r_tail += n;
+}
@@ -0,0 +1,56 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef	RING_DOT_H_
+#define	RING_DOT_H_
+
+#include <sys/uio.h>
+
+/*
+ * Fixed size byte ring.  The producer fills the free space with
+ * readv(2) and the consumer takes contiguous spans out of it, so
+ * nothing is ever copied inside the ring.  r_head and r_tail count
+ * bytes and are only reduced modulo r_size when indexing.
+ */
+struct ring {
+	char		*r_buf;
+	size_t		r_size;		/* must be a power of 2 */
+	size_t		r_head;		/* bytes produced */
+	size_t		r_tail;		/* bytes consumed */
+};
+
+#define	ring_len(r)	((r)->r_head - (r)->r_tail)
+#define	ring_space(r)	((r)->r_size - ring_len(r))
+
+int ring_init(struct ring *, size_t);
+void ring_destroy(struct ring *);
+int ring_freeiov(struct ring *, struct iovec *);
+void ring_produce(struct ring *, size_t);
+size_t ring_span(struct ring *, char **);
+void ring_consume(struct ring *, size_t);
+#endif	/* RING_DOT_H_ */
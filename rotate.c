@@ -0,0 +1,335 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/param.h>
+#include <sys/time.h>
+
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "compat.h"
+#include "epoch.h"
+#include "conf.h"
+#include "fileops.h"
+#include "rotate.h"
+
+struct rotjob {
+	STAILQ_ENTRY(rotjob)	 rj_link;
+	struct snpmeta		*rj_sm;
+	void			(*rj_fn)(void *);
+	void			*rj_arg;
+};
+
+struct rotopen {
+	struct snpmeta		*ro_sm;
+	char			 ro_path[MAXPATHLEN];
+};
+
+/*
+ * Lock order: rot_slock, then sm_lock, then rot_qlock.  Nothing is
+ * called with rot_qlock held.
+ */
+static pthread_mutex_t rot_slock = PTHREAD_MUTEX_INITIALIZER;
+static TAILQ_HEAD(, snpmeta) rot_sessions =
+    TAILQ_HEAD_INITIALIZER(rot_sessions);
+static pthread_mutex_t rot_qlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rot_work;		/* on CLOCK_MONOTONIC */
+static pthread_cond_t rot_done = PTHREAD_COND_INITIALIZER;
+static STAILQ_HEAD(, rotjob) rot_queue = STAILQ_HEAD_INITIALIZER(rot_queue);
+static u_long rot_pending;		/* protected by rot_qlock */
+
+static atomic_ulong rot_counts[ROT_LATE + 1];
+static atomic_ulong rot_opened;
+static atomic_ulong rot_failed;
+
+static uint64_t
+monosecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec);
+}
+
+/*
+ * Queue fn(arg) to be run by the rotation thread, after everything
+ * queued before.  Returns -1 if it could not be; the caller has to
+ * see to it then.
+ */
+int
+rotate_defer(struct snpmeta *sm, void (*fn)(void *), void *arg)
+{
+	struct rotjob *rj;
+
+	if ((rj = malloc(sizeof(*rj))) == NULL)
+		return (-1);
+	rj->rj_sm = sm;
+	rj->rj_fn = fn;
+	rj->rj_arg = arg;
+	pthread_mutex_lock(&rot_qlock);
+	STAILQ_INSERT_TAIL(&rot_queue, rj, rj_link);
+	sm->sm_rotjobs++;
+	rot_pending++;
+	pthread_cond_signal(&rot_work);
+	pthread_mutex_unlock(&rot_qlock);
+	return (0);
+}
+
+static void
+preopen(void *arg)
+{
+	struct rotopen *ro;
+	struct snpmeta *sm;
+	int fd;
+
+	ro = arg;
+	sm = ro->ro_sm;
+	fd = logio->li_preopen(ro->ro_path);
+	if (fd < 0) {
+		warn("%s: next segment not opened", ro->ro_path);
+		atomic_fetch_add(&rot_failed, 1);
+	} else
+		atomic_fetch_add(&rot_opened, 1);
+	pthread_mutex_lock(&sm->sm_lock);
+	sm->sm_ahead = 0;
+	if (fd < 0)
+		sm->sm_retry = time(NULL) + ROTATE_RETRY;
+	else {
+		sm->sm_nextfd = fd;
+		sm->sm_retry = 0;
+	}
+	pthread_mutex_unlock(&sm->sm_lock);
+	free(ro);
+}
+
+/*
+ * Have the next segment of sm opened, unless it is already or that
+ * failed less than ROTATE_RETRY seconds ago.  Called with sm_lock
+ * held.
+ */
+void
+rotate_ahead(struct snpmeta *sm)
+{
+	struct rotopen *ro;
+
+	if (sm->sm_closing || sm->sm_ahead || sm->sm_nextfd >= 0 ||
+	    (sm->sm_retry != 0 && time(NULL) < sm->sm_retry))
+		return;
+	if ((ro = malloc(sizeof(*ro))) == NULL)
+		return;
+	ro->ro_sm = sm;
+	if ((size_t)snprintf(ro->ro_path, sizeof(ro->ro_path), "%s%d",
+	    sm->fname, sm->unit) >= sizeof(ro->ro_path)) {
+		warnx("%s%d: next segment not opened: name too long",
+		    sm->fname, sm->unit);
+		atomic_fetch_add(&rot_failed, 1);
+		sm->sm_retry = time(NULL) + ROTATE_RETRY;
+		free(ro);
+		return;
+	}
+	if (rotate_defer(sm, preopen, ro) < 0) {
+		free(ro);
+		return;
+	}
+	sm->sm_ahead = 1;
+}
+
+void
+rotate_count(int why)
+{
+	atomic_fetch_add(&rot_counts[why], 1);
+}
+
+void
+rotate_add(struct snpmeta *sm)
+{
+	pthread_mutex_lock(&rot_slock);
+	TAILQ_INSERT_TAIL(&rot_sessions, sm, sm_rotq);
+	pthread_mutex_unlock(&rot_slock);
+}
+
+/*
+ * Stop rotating sm and wait for whatever was queued for it.  Called
+ * without sm_lock held, before the log is closed; nothing more is
+ * queued for it afterwards.
+ */
+void
+rotate_forget(struct snpmeta *sm)
+{
+	pthread_mutex_lock(&sm->sm_lock);
+	sm->sm_closing = 1;
+	pthread_mutex_unlock(&sm->sm_lock);
+	pthread_mutex_lock(&rot_slock);
+	TAILQ_REMOVE(&rot_sessions, sm, sm_rotq);
+	pthread_mutex_unlock(&rot_slock);
+	pthread_mutex_lock(&rot_qlock);
+	while (sm->sm_rotjobs > 0)
+		pthread_cond_wait(&rot_done, &rot_qlock);
+	pthread_mutex_unlock(&rot_qlock);
+}
+
+/*
+ * The time based policies.  The next segment is opened ROTATE_LEAD
+ * seconds before an -R deadline, or half way to an -L one.  A log is
+ * only rotated if it has something in it, and for -L only if the
+ * session wrote to this segment.
+ */
+static void
+check(struct snpmeta *sm, time_t now, uint64_t mono, long rotsecs,
+    long idlesecs)
+{
+	time_t due;
+	uint64_t quiet;
+	int why;
+
+	pthread_mutex_lock(&sm->sm_lock);
+	why = -1;
+	if (sm->sm_fsize > 0 && rotsecs > 0) {
+		due = (sm->sm_segstart / rotsecs + 1) * rotsecs;
+		if (now >= due)
+			why = ROT_INTERVAL;
+		else if (now >= due - MIN(ROTATE_LEAD, rotsecs))
+			rotate_ahead(sm);
+	}
+	if (why < 0 && sm->sm_lastout != 0 && idlesecs > 0) {
+		quiet = mono - sm->sm_lastout / 1000000;
+		if (quiet >= (uint64_t)idlesecs)
+			why = ROT_IDLE;
+		else if (quiet >= (uint64_t)idlesecs / 2)
+			rotate_ahead(sm);
+	}
+	if (why >= 0)
+		(void)sm_rotate(sm, why);
+	pthread_mutex_unlock(&sm->sm_lock);
+}
+
+static void
+scan(void)
+{
+	struct snpmeta *sm;
+	long rotsecs, idlesecs;
+	uint64_t mono;
+	time_t now;
+
+	epoch_enter();
+	rotsecs = conf_get()->tc_rotsecs;
+	idlesecs = conf_get()->tc_idlesecs;
+	epoch_exit();
+	if (rotsecs == 0 && idlesecs == 0)
+		return;
+	now = time(NULL);
+	mono = monosecs();
+	pthread_mutex_lock(&rot_slock);
+	TAILQ_FOREACH(sm, &rot_sessions, sm_rotq)
+		check(sm, now, mono, rotsecs, idlesecs);
+	pthread_mutex_unlock(&rot_slock);
+}
+
+/*
+ * Runs queued work as it comes and looks at the time based policies
+ * once a second in between.
+ */
+static void *
+rotator(void *arg __unused)
+{
+	struct rotjob *rj;
+	struct timespec tick;
+	uint64_t next;
+
+	next = monosecs() + 1;
+	pthread_mutex_lock(&rot_qlock);
+	for (;;) {
+		tick.tv_sec = next;
+		tick.tv_nsec = 0;
+		while ((rj = STAILQ_FIRST(&rot_queue)) == NULL &&
+		    pthread_cond_timedwait(&rot_work, &rot_qlock,
+		    &tick) != ETIMEDOUT)
+			;
+		if (rj != NULL)
+			STAILQ_REMOVE_HEAD(&rot_queue, rj_link);
+		pthread_mutex_unlock(&rot_qlock);
+		if (rj != NULL)
+			rj->rj_fn(rj->rj_arg);
+		if (monosecs() >= next) {
+			scan();
+			next = monosecs() + 1;
+		}
+		pthread_mutex_lock(&rot_qlock);
+		if (rj != NULL) {
+			rj->rj_sm->sm_rotjobs--;
+			rot_pending--;
+			pthread_cond_broadcast(&rot_done);
+			free(rj);
+		}
+	}
+	/* NOTREACHED */
+	return (NULL);
+}
+
+int
+rotate_init(void)
+{
+	pthread_condattr_t attr;
+	pthread_t thr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&rot_work, &attr);
+	pthread_condattr_destroy(&attr);
+	return (pthread_create(&thr, NULL, rotator, NULL));
+}
+
+void
+rotate_dumpstats(FILE *fp)
+{
+	u_long pending;
+
+	pthread_mutex_lock(&rot_qlock);
+	pending = rot_pending;
+	pthread_mutex_unlock(&rot_qlock);
+	fprintf(fp, "Rotation statistics:\n"
+	    "%-10s %-10s %-10s %-10s %-10s %-10s %s\n",
+	    "SIZE", "INTERVAL", "IDLE", "LATE", "OPENED", "FAILED",
+	    "PENDING");
+	fprintf(fp, "%-10lu %-10lu %-10lu %-10lu %-10lu %-10lu %lu\n",
+	    atomic_load(&rot_counts[ROT_SIZE]),
+	    atomic_load(&rot_counts[ROT_INTERVAL]),
+	    atomic_load(&rot_counts[ROT_IDLE]),
+	    atomic_load(&rot_counts[ROT_LATE]),
+	    atomic_load(&rot_opened), atomic_load(&rot_failed), pending);
+}
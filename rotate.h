@@ -0,0 +1,65 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef	ROTATE_DOT_H_
+#define	ROTATE_DOT_H_
+
+#include <stdio.h>
+
+/*
+ * Segment rotation off the draining threads.  A single thread opens
+ * the next segment of a log ahead of time, when the current one is
+ * ROTATE_AHEAD of the way to -c or about to reach its -R or -L
+ * deadline, so that switching over only swaps descriptors.  Work left
+ * over from a rotation (closing the old segment, logging its digest,
+ * the manifest, compression and indexing) is handed to the same
+ * thread and done in the order it was queued.  A log whose next
+ * segment is not open yet when it is due simply carries on in the
+ * current one; failed opens are retried every ROTATE_RETRY seconds.
+ *
+ * The thread also rotates logs which have reached a multiple of -R
+ * seconds since the epoch, or have been quiet for -L seconds, so that
+ * their segments are closed without waiting for more output.
+ */
+#define	ROTATE_AHEAD(max)	((max) / 4 * 3)
+#define	ROTATE_LEAD		5	/* seconds */
+#define	ROTATE_RETRY		10	/* seconds */
+
+/* why a log was rotated, or ROT_LATE when it had to wait for the open */
+enum { ROT_SIZE, ROT_INTERVAL, ROT_IDLE, ROT_LATE };
+
+struct snpmeta;
+
+int rotate_init(void);
+void rotate_add(struct snpmeta *);
+void rotate_forget(struct snpmeta *);
+void rotate_ahead(struct snpmeta *);
+int rotate_defer(struct snpmeta *, void (*)(void *), void *);
+void rotate_count(int);
+void rotate_dumpstats(FILE *);
+#endif	/* ROTATE_DOT_H_ */
@@ -0,0 +1,881 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <regex.h>
+#include <err.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "compat.h"
+#include "logfmt.h"
+#include "trindex.h"
+
+/*
+ * termlog-search: find session output in the logs indexed by termlog
+ * -T.  The pattern is reduced to the trigrams any match must contain:
+ * all of those of the pattern for a fixed string, and for a regular
+ * expression those of the literal runs that every match of one of its
+ * alternatives has to go through.  Intersecting their postings in
+ * each shard gives the segments which may match; only those are read,
+ * by a pool of threads, and searched for real.  Results come out in
+ * shard order, like grep(1) output, whichever thread found them.
+ */
+struct branch {
+	uint32_t	*br_tri;
+	size_t		 br_n;
+};
+
+struct cand {
+	char		*cd_name;
+	char		*cd_out;
+	size_t		 cd_outlen;
+	int		 cd_match;
+	int		 cd_error;
+	int		 cd_dup;
+};
+
+struct addjob {
+	char		*aj_name;
+	char		 aj_day[TRI_DAYLEN];
+	uint32_t	*aj_tris;
+	size_t		 aj_n;
+	int		 aj_ok;
+};
+
+static struct branch	*branches;
+static int		 nbranches;
+static int		 unfiltered;	/* some alternative has no trigrams */
+static struct cand	*cands;
+static size_t		 ncands, capcands;
+static struct addjob	*addjobs;
+static size_t		 naddjobs;
+static atomic_size_t	 next;
+static const char	*pattern;
+static size_t		 patlen;
+static regex_t		 re;
+static int		 Eflag, iflag, lflag;
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	    "usage: termlog-search [-Eilv] [-C dir] [-j jobs] [-s day] "
+	    "[-T indexdir]\n"
+	    "                      [-u day] pattern\n"
+	    "       termlog-search -A [-v] [-C dir] [-j jobs] "
+	    "[-T indexdir] segment ...\n");
+	exit(2);
+}
+
+static int
+cmptri(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+/*
+ * Require the trigrams of a run of len literal bytes.
+ */
+static void
+addrun(struct branch *br, const char *run, size_t len)
+{
+	size_t i;
+
+	if (len < 3)
+		return;
+	br->br_tri = realloc(br->br_tri,
+	    (br->br_n + len - 2) * sizeof(*br->br_tri));
+	if (br->br_tri == NULL)
+		err(2, "realloc failed");
+	for (i = 0; i + 2 < len; i++)
+		br->br_tri[br->br_n++] = tri_fold((const u_char *)run + i);
+}
+
+/*
+ * Past the bracket expression starting at p.
+ */
+static const char *
+skipbracket(const char *p, const char *end)
+{
+	char c;
+
+	p++;
+	if (p < end && *p == '^')
+		p++;
+	if (p < end && *p == ']')
+		p++;
+	while (p < end && *p != ']') {
+		if (*p == '[' && p + 1 < end &&
+		    (p[1] == ':' || p[1] == '=' || p[1] == '.')) {
+			c = p[1];
+			for (p += 2; p + 1 < end; p++)
+				if (p[0] == c && p[1] == ']')
+					break;
+			p++;
+		}
+		p++;
+	}
+	return (p < end ? p + 1 : end);
+}
+
+/*
+ * Past the atom starting at p: an escape, a bracket expression, a
+ * group or a single byte.
+ */
+static const char *
+skipatom(const char *p, const char *end)
+{
+	int depth;
+
+	if (*p == '\\')
+		return (MIN(p + 2, end));
+	if (*p == '[')
+		return (skipbracket(p, end));
+	if (*p != '(')
+		return (p + 1);
+	for (depth = 0; p < end; ) {
+		if (*p == '(')
+			depth++;
+		else if (*p == ')' && --depth == 0)
+			return (p + 1);
+		p = *p == '(' || *p == ')' ? p + 1 : skipatom(p, end);
+	}
+	return (end);
+}
+
+/*
+ * Whether the quantifier at p, if any, lets the atom before it be
+ * left out.
+ */
+static int
+optional(const char *p, const char *end)
+{
+	if (p >= end)
+		return (0);
+	if (*p == '*' || *p == '?')
+		return (1);
+	return (*p == '{' && (p + 1 >= end || !isdigit((u_char)p[1]) ||
+	    p[1] == '0'));
+}
+
+/*
+ * Collect the literal runs every match of one alternative contains.
+ * A run ends at anything but a plain or escaped punctuation byte;
+ * bytes that may be repeated end it after them, and bytes that may be
+ * left out before them.
+ */
+static void
+parsebranch(struct branch *br, const char *p, const char *end)
+{
+	char *run;
+	const char *q;
+	size_t rl;
+	char c;
+
+	if ((run = malloc(end - p + 1)) == NULL)
+		err(2, "malloc failed");
+	rl = 0;
+	while (p < end) {
+		q = skipatom(p, end);
+		if (*p == '\\' && p + 1 < end && !isalnum((u_char)p[1]) &&
+		    strchr("<>`'", p[1]) == NULL)
+			c = p[1];
+		else if (*p != '\\' && strchr(".[]()*+?{}|^$", *p) == NULL)
+			c = *p;
+		else {
+			addrun(br, run, rl);
+			rl = 0;
+			if (*p == '{')
+				while (q < end && q[-1] != '}')
+					q++;
+			p = q;
+			continue;
+		}
+		if (optional(q, end)) {
+			addrun(br, run, rl);
+			rl = 0;
+		} else {
+			run[rl++] = c;
+			if (q < end && (*q == '+' || *q == '{')) {
+				addrun(br, run, rl);
+				rl = 0;
+			}
+		}
+		p = q;
+	}
+	addrun(br, run, rl);
+	free(run);
+	qsort(br->br_tri, br->br_n, sizeof(*br->br_tri), cmptri);
+}
+
+static void
+buildquery(void)
+{
+	struct branch *br;
+	const char *p, *start, *end;
+	int depth;
+
+	end = pattern + patlen;
+	start = pattern;
+	for (p = pattern, depth = 0; ; ) {
+		if (p == end || (Eflag && depth == 0 && *p == '|')) {
+			branches = realloc(branches,
+			    (nbranches + 1) * sizeof(*branches));
+			if (branches == NULL)
+				err(2, "realloc failed");
+			br = &branches[nbranches++];
+			memset(br, 0, sizeof(*br));
+			if (Eflag)
+				parsebranch(br, start, p);
+			else {
+				addrun(br, start, p - start);
+				qsort(br->br_tri, br->br_n,
+				    sizeof(*br->br_tri), cmptri);
+			}
+			if (br->br_n == 0)
+				unfiltered = 1;
+			if (p == end)
+				break;
+			start = ++p;
+			continue;
+		}
+		if (!Eflag)
+			p = end;
+		else if (*p == '(' || *p == ')') {
+			depth += *p == '(' ? 1 : -1;
+			p++;
+		} else
+			p = skipatom(p, end);
+	}
+}
+
+static void
+addcand(const char *name)
+{
+	if (ncands == capcands) {
+		capcands = capcands ? capcands * 2 : 1024;
+		cands = realloc(cands, capcands * sizeof(*cands));
+		if (cands == NULL)
+			err(2, "realloc failed");
+	}
+	memset(&cands[ncands], 0, sizeof(*cands));
+	if ((cands[ncands++].cd_name = strdup(name)) == NULL)
+		err(2, "strdup failed");
+}
+
+/*
+ * Mark the segments of the shard that have every trigram of br.
+ * Postings are intersected rarest first.
+ */
+static int
+intersect(const struct shard *sh, const struct branch *br, char *mark)
+{
+	uint32_t *acc, *ids, cnt;
+	ssize_t *ent;
+	size_t best, i, j, k, l, n;
+
+	if ((ent = calloc(br->br_n, sizeof(*ent))) == NULL)
+		err(2, "calloc failed");
+	acc = ids = NULL;
+	n = 0;
+	for (i = 0; i < br->br_n; i++)
+		if ((ent[i] = shard_find(sh, br->br_tri[i])) < 0)
+			goto out;
+	for (i = 1, best = 0; i < br->br_n; i++)
+		if (shard_count(sh, ent[i]) < shard_count(sh, ent[best]))
+			best = i;
+	acc = malloc(MAX(shard_count(sh, ent[best]), 1) * sizeof(*acc));
+	ids = malloc(MAX(sh->sh_nsegs, 1) * sizeof(*ids));
+	if (acc == NULL || ids == NULL)
+		err(2, "malloc failed");
+	if (shard_postings(sh, ent[best], acc) < 0)
+		goto bad;
+	n = shard_count(sh, ent[best]);
+	for (i = 0; i < br->br_n && n > 0; i++) {
+		if (i == best || (i > 0 && ent[i] == ent[i - 1]))
+			continue;
+		if (shard_postings(sh, ent[i], ids) < 0)
+			goto bad;
+		cnt = shard_count(sh, ent[i]);
+		for (j = k = l = 0; j < n && l < cnt; ) {
+			if (ids[l] < acc[j])
+				l++;
+			else if (ids[l] > acc[j])
+				j++;
+			else {
+				acc[k++] = acc[j++];
+				l++;
+			}
+		}
+		n = k;
+	}
+	for (i = 0; i < n; i++)
+		mark[acc[i]] = 1;
+out:
+	free(ent);
+	free(acc);
+	free(ids);
+	return (0);
+bad:
+	free(ent);
+	free(acc);
+	free(ids);
+	return (-1);
+}
+
+static size_t
+searchshard(const char *path)
+{
+	struct shard sh;
+	char *mark;
+	uint32_t i;
+	int b;
+
+	if (shard_open(&sh, path) < 0) {
+		warn("%s", path);
+		return (0);
+	}
+	if ((mark = calloc(MAX(sh.sh_nsegs, 1), 1)) == NULL)
+		err(2, "calloc failed");
+	if (unfiltered)
+		memset(mark, 1, sh.sh_nsegs);
+	for (b = 0; b < nbranches && !unfiltered; b++) {
+		if (intersect(&sh, &branches[b], mark) < 0) {
+			warnx("%s: corrupt postings, searching all of it",
+			    path);
+			memset(mark, 1, sh.sh_nsegs);
+			break;
+		}
+	}
+	for (i = 0; i < sh.sh_nsegs; i++)
+		if (mark[i])
+			addcand(sh.sh_names[i]);
+	free(mark);
+	i = sh.sh_nsegs;
+	shard_close(&sh);
+	return (i);
+}
+
+/*
+ * A segment whose set has not been merged into a shard yet.
+ */
+static void
+searchset(const char *path, const char *name)
+{
+	uint32_t *list;
+	size_t n, i;
+	int b;
+
+	if (tri_read(path, &list, &n) < 0) {
+		warn("%s", path);
+		return;
+	}
+	for (b = 0; b < nbranches; b++) {
+		for (i = 0; i < branches[b].br_n; i++)
+			if (bsearch(&branches[b].br_tri[i], list, n,
+			    sizeof(*list), cmptri) == NULL)
+				break;
+		if (i == branches[b].br_n)
+			break;
+	}
+	if (b < nbranches)
+		addcand(name);
+	free(list);
+}
+
+static int
+cmpstr(const void *a, const void *b)
+{
+	return (strcmp(*(char *const *)a, *(char *const *)b));
+}
+
+static int
+cmpcand(const void *a, const void *b)
+{
+	const struct cand *const *x = a, *const *y = b;
+	int c;
+
+	if ((c = strcmp((*x)->cd_name, (*y)->cd_name)) != 0)
+		return (c);
+	return (*x < *y ? -1 : *x > *y);
+}
+
+/*
+ * A segment can be in the index twice, if termlog stopped between
+ * merging its set and removing it or it was added again with -A.
+ * Keep the first.
+ */
+static void
+dedup(void)
+{
+	struct cand **byname;
+	size_t i, n;
+
+	if (ncands == 0)
+		return;
+	if ((byname = malloc(ncands * sizeof(*byname))) == NULL)
+		err(2, "malloc failed");
+	for (i = 0; i < ncands; i++)
+		byname[i] = &cands[i];
+	qsort(byname, ncands, sizeof(*byname), cmpcand);
+	for (i = 1; i < ncands; i++)
+		if (strcmp(byname[i]->cd_name, byname[i - 1]->cd_name) == 0)
+			byname[i]->cd_dup = 1;
+	free(byname);
+	for (i = n = 0; i < ncands; i++)
+		if (!cands[i].cd_dup)
+			cands[n++] = cands[i];
+		else
+			free(cands[i].cd_name);
+	ncands = n;
+}
+
+static int
+inrange(const char *day, const char *since, const char *until)
+{
+	if (since != NULL && strcmp(day, since) < 0)
+		return (0);
+	return (until == NULL || strncmp(day, until, strlen(until)) <= 0);
+}
+
+/*
+ * Gather the candidate segments of the shards and sets in the index
+ * whose day is in range.  Returns how many segments were looked at.
+ */
+static size_t
+gather(const char *dir, const char *since, const char *until)
+{
+	char path[MAXPATHLEN], day[TRI_DAYLEN], **names;
+	struct dirent *de;
+	struct stat sb;
+	size_t n, cap, i, len, total;
+	DIR *dp;
+	int shard;
+
+	if ((dp = opendir(dir)) == NULL)
+		err(2, "%s", dir);
+	names = NULL;
+	n = cap = 0;
+	while ((de = readdir(dp)) != NULL) {
+		if (n == cap) {
+			cap = cap ? cap * 2 : 64;
+			if ((names = realloc(names, cap * sizeof(*names))) ==
+			    NULL)
+				err(2, "realloc failed");
+		}
+		len = strlen(de->d_name);
+		if ((len > strlen(SHARD_SUFFIX) && strcmp(de->d_name + len -
+		    strlen(SHARD_SUFFIX), SHARD_SUFFIX) == 0) ||
+		    (len > strlen(TRI_SUFFIX) && strcmp(de->d_name + len -
+		    strlen(TRI_SUFFIX), TRI_SUFFIX) == 0))
+			if ((names[n++] = strdup(de->d_name)) == NULL)
+				err(2, "strdup failed");
+	}
+	closedir(dp);
+	/* shard names sort by day */
+	qsort(names, n, sizeof(*names), cmpstr);
+	total = 0;
+	for (shard = 1; shard >= 0; shard--)
+		for (i = 0; i < n; i++) {
+			len = strlen(names[i]);
+			snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+			if (shard) {
+				if (strcmp(names[i] + len -
+				    strlen(SHARD_SUFFIX), SHARD_SUFFIX) != 0)
+					continue;
+				names[i][len - strlen(SHARD_SUFFIX)] = '\0';
+				if (inrange(names[i], since, until))
+					total += searchshard(path);
+				names[i][len - strlen(SHARD_SUFFIX)] = '.';
+			} else {
+				if (strcmp(names[i] + len - strlen(TRI_SUFFIX),
+				    TRI_SUFFIX) != 0 || stat(path, &sb) < 0)
+					continue;
+				tri_day(sb.st_mtime, day);
+				if (!inrange(day, since, until))
+					continue;
+				names[i][len - strlen(TRI_SUFFIX)] = '\0';
+				searchset(path, names[i]);
+				total++;
+			}
+		}
+	for (i = 0; i < n; i++)
+		free(names[i]);
+	free(names);
+	dedup();
+	return (total);
+}
+
+/*
+ * The text of the segment, NUL terminated.
+ */
+static char *
+loadtext(const char *name, size_t *lenp)
+{
+	struct logread lf;
+	struct logrec lr;
+	char *buf;
+	size_t len;
+	int ret;
+
+	if (logread_open(&lf, name) < 0)
+		return (NULL);
+	len = 0;
+	while ((ret = logread_next(&lf, &lr)) > 0)
+		if (lr.lr_type != REC_TIME)
+			len += lr.lr_len;
+	if ((buf = malloc(len + 1)) == NULL) {
+		logread_close(&lf);
+		return (NULL);
+	}
+	logread_seek(&lf, 0);
+	len = 0;
+	while (logread_next(&lf, &lr) > 0)
+		if (lr.lr_type != REC_TIME) {
+			memcpy(buf + len, lr.lr_data, lr.lr_len);
+			len += lr.lr_len;
+		}
+	buf[len] = '\0';
+	logread_close(&lf);
+	if (ret < 0)
+		warnx("%s: truncated or corrupt at offset %jd", name,
+		    (intmax_t)lr.lr_off);
+	*lenp = len;
+	return (buf);
+}
+
+/*
+ * Where the first match at or after pos starts, or -1.
+ */
+static ssize_t
+findmatch(const char *buf, const char *fbuf, size_t pos, size_t len)
+{
+	regmatch_t pm;
+	const char *m;
+
+	if (!Eflag) {
+		m = memmem(fbuf + pos, len - pos, pattern, patlen);
+		return (m != NULL ? m - fbuf : -1);
+	}
+#ifdef REG_STARTEND
+	pm.rm_so = pos;
+	pm.rm_eo = len;
+	if (regexec(&re, buf, 1, &pm, REG_STARTEND) != 0)
+		return (-1);
+	return (pm.rm_so);
+#else
+	if (regexec(&re, buf + pos, 1, &pm, 0) != 0)
+		return (-1);
+	return (pos + pm.rm_so);
+#endif
+}
+
+/*
+ * Print the lines of the candidate which match, grep style.
+ */
+static void
+confirm(struct cand *cd)
+{
+	char *buf, *fbuf, *ls, *le;
+	size_t len, pos, i, lineno, counted;
+	ssize_t m;
+	FILE *out;
+
+	if ((buf = loadtext(cd->cd_name, &len)) == NULL) {
+		warn("%s", cd->cd_name);
+		cd->cd_error = 1;
+		return;
+	}
+	fbuf = buf;
+	if (iflag && !Eflag) {
+		if ((fbuf = malloc(len + 1)) == NULL)
+			err(2, "malloc failed");
+		for (i = 0; i < len; i++)
+			fbuf[i] = tolower((u_char)buf[i]);
+	}
+	out = NULL;
+	if (!lflag && (out = open_memstream(&cd->cd_out,
+	    &cd->cd_outlen)) == NULL)
+		err(2, "open_memstream failed");
+	lineno = 1;
+	counted = 0;
+	for (pos = 0; pos < len && (m = findmatch(buf, fbuf, pos, len)) >= 0;
+	    pos = le - buf + 1) {
+		cd->cd_match = 1;
+		if (lflag)
+			break;
+		ls = memrchr(buf + pos, '\n', m - pos);
+		ls = ls != NULL ? ls + 1 : buf + pos;
+		for (; counted < (size_t)(ls - buf); counted++)
+			if (buf[counted] == '\n')
+				lineno++;
+		if ((le = memchr(buf + m, '\n', len - m)) == NULL)
+			le = buf + len;
+		fprintf(out, "%s:%zu:", cd->cd_name, lineno);
+		fwrite(ls, 1, le - ls - (le > ls && le[-1] == '\r'), out);
+		putc('\n', out);
+	}
+	if (out != NULL)
+		fclose(out);
+	if (fbuf != buf)
+		free(fbuf);
+	free(buf);
+}
+
+static void *
+searcher(void *arg __unused)
+{
+	size_t i;
+
+	while ((i = atomic_fetch_add(&next, 1)) < ncands)
+		confirm(&cands[i]);
+	return (NULL);
+}
+
+static void *
+adder(void *arg __unused)
+{
+	struct triset ts;
+	struct addjob *aj;
+	struct stat sb;
+	char zpath[MAXPATHLEN];
+	size_t i;
+
+	if (triset_init(&ts) < 0)
+		err(2, "triset_init failed");
+	while ((i = atomic_fetch_add(&next, 1)) < naddjobs) {
+		aj = &addjobs[i];
+		snprintf(zpath, sizeof(zpath), "%s%s", aj->aj_name,
+		    LOGZ_SUFFIX);
+		if ((stat(aj->aj_name, &sb) < 0 && stat(zpath, &sb) < 0) ||
+		    tri_segment(&ts, aj->aj_name, &aj->aj_tris,
+		    &aj->aj_n) < 0) {
+			warn("%s", aj->aj_name);
+			continue;
+		}
+		tri_day(sb.st_mtime, aj->aj_day);
+		aj->aj_ok = 1;
+	}
+	triset_free(&ts);
+	return (NULL);
+}
+
+static int
+cmpday(const void *a, const void *b)
+{
+	const struct addjob *x = a, *y = b;
+
+	if (x->aj_ok != y->aj_ok)
+		return (y->aj_ok - x->aj_ok);
+	return (strcmp(x->aj_day, y->aj_day));
+}
+
+static void
+runjobs(long jobs, void *(*fn)(void *))
+{
+	pthread_t *thr;
+	long i;
+
+	if ((thr = calloc(jobs, sizeof(*thr))) == NULL)
+		err(2, "calloc failed");
+	atomic_store(&next, 0);
+	for (i = 0; i < jobs; i++)
+		if (pthread_create(&thr[i], NULL, fn, NULL) != 0)
+			err(2, "pthread_create failed");
+	for (i = 0; i < jobs; i++)
+		pthread_join(thr[i], NULL);
+	free(thr);
+}
+
+/*
+ * Index segments which termlog did not, such as those from before -T
+ * was used, into the shard of the day they were last written.
+ */
+static int
+addsegs(const char *dir, long jobs, int vflag, int argc, char *argv[])
+{
+	char path[MAXPATHLEN];
+	const char **names;
+	uint32_t **tris;
+	size_t *ns, i, j, k, len;
+	int error;
+
+	if (mkdir(dir, S_IRWXU) < 0 && errno != EEXIST)
+		err(2, "%s", dir);
+	naddjobs = argc;
+	addjobs = calloc(naddjobs, sizeof(*addjobs));
+	names = calloc(naddjobs, sizeof(*names));
+	tris = calloc(naddjobs, sizeof(*tris));
+	ns = calloc(naddjobs, sizeof(*ns));
+	if (addjobs == NULL || names == NULL || tris == NULL || ns == NULL)
+		err(2, "calloc failed");
+	for (i = 0; i < naddjobs; i++) {
+		if ((addjobs[i].aj_name = strdup(argv[i])) == NULL)
+			err(2, "strdup failed");
+		/* by the name termlog gave it */
+		len = strlen(argv[i]);
+		if (len > strlen(LOGZ_SUFFIX) && strcmp(argv[i] + len -
+		    strlen(LOGZ_SUFFIX), LOGZ_SUFFIX) == 0)
+			addjobs[i].aj_name[len - strlen(LOGZ_SUFFIX)] = '\0';
+	}
+	runjobs(jobs, adder);
+	qsort(addjobs, naddjobs, sizeof(*addjobs), cmpday);
+	error = 0;
+	for (i = 0; i < naddjobs && addjobs[i].aj_ok; i = j) {
+		for (j = i, k = 0; j < naddjobs && addjobs[j].aj_ok &&
+		    strcmp(addjobs[j].aj_day, addjobs[i].aj_day) == 0;
+		    j++, k++) {
+			names[k] = addjobs[j].aj_name;
+			tris[k] = addjobs[j].aj_tris;
+			ns[k] = addjobs[j].aj_n;
+		}
+		snprintf(path, sizeof(path), "%s/%s%s", dir,
+		    addjobs[i].aj_day, SHARD_SUFFIX);
+		if (shard_merge(path, names, tris, ns, k) < 0) {
+			warn("%s", path);
+			error = 1;
+		} else if (vflag)
+			printf("%s: %zu segments added\n", path, k);
+	}
+	if (i < naddjobs)
+		error = 1;
+	return (error ? 2 : 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *ixdir;
+	char *dir, *since, *until, msg[256];
+	size_t i, total, matched;
+	long jobs;
+	int Aflag, vflag, ch, error;
+
+	jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	dir = since = until = NULL;
+	ixdir = "index";
+	Aflag = vflag = 0;
+	while ((ch = getopt(argc, argv, "AC:Eij:ls:T:u:v")) != -1)
+		switch (ch) {
+		case 'A':
+			Aflag++;
+			break;
+		case 'C':
+			dir = optarg;
+			break;
+		case 'E':
+			Eflag++;
+			break;
+		case 'i':
+			iflag++;
+			break;
+		case 'j':
+			jobs = strtol(optarg, NULL, 10);
+			break;
+		case 'l':
+			lflag++;
+			break;
+		case 's':
+			since = optarg;
+			break;
+		case 'T':
+			ixdir = optarg;
+			break;
+		case 'u':
+			until = optarg;
+			break;
+		case 'v':
+			vflag++;
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (jobs <= 0)
+		jobs = 1;
+	if (dir != NULL && chdir(dir) < 0)
+		err(2, "%s", dir);
+	if (Aflag) {
+		if (argc == 0)
+			usage();
+		return (addsegs(ixdir, jobs, vflag, argc, argv));
+	}
+	if (argc != 1)
+		usage();
+	pattern = argv[0];
+	patlen = strlen(pattern);
+	if (Eflag) {
+		ch = regcomp(&re, pattern, REG_EXTENDED | REG_NEWLINE |
+		    (iflag ? REG_ICASE : 0));
+		if (ch != 0) {
+			regerror(ch, &re, msg, sizeof(msg));
+			errx(2, "%s: %s", pattern, msg);
+		}
+	} else if (iflag) {
+		if ((pattern = argv[0] = strdup(argv[0])) == NULL)
+			err(2, "strdup failed");
+		for (i = 0; i < patlen; i++)
+			argv[0][i] = tolower((u_char)argv[0][i]);
+	}
+	buildquery();
+	total = gather(ixdir, since, until);
+	runjobs(jobs, searcher);
+	error = 0;
+	matched = 0;
+	for (i = 0; i < ncands; i++) {
+		error |= cands[i].cd_error;
+		if (!cands[i].cd_match)
+			continue;
+		matched++;
+		if (lflag)
+			printf("%s\n", cands[i].cd_name);
+		else
+			fwrite(cands[i].cd_out, 1, cands[i].cd_outlen, stdout);
+	}
+	if (fflush(stdout) != 0)
+		err(2, "stdout");
+	if (vflag)
+		fprintf(stderr, "%zu segments indexed, %zu candidates, "
+		    "%zu matched\n", total, ncands, matched);
+	return (error ? 2 : matched > 0 ? 0 : 1);
+}
@@ -0,0 +1,104 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+/*
+ * termlog-stat: print the live statistics of a running termlog.  The
+ * region is only ever read, so looking costs the daemon nothing.
+ */
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: termlog-stat [-e] [-f statsfile] "
+	    "[-i interval]\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct stats_hdr *sh;
+	struct stat sb;
+	const char *path;
+	int ch, eflag, fd, interval;
+
+	path = _PATH_TERMLOG_STATMAP;
+	eflag = interval = 0;
+	while ((ch = getopt(argc, argv, "ef:i:")) != -1)
+		switch (ch) {
+		case 'e':
+			eflag = 1;
+			break;
+		case 'f':
+			path = optarg;
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	if (optind != argc)
+		usage();
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &sb) < 0)
+		err(1, "%s", path);
+	sh = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (sh == MAP_FAILED)
+		err(1, "%s", path);
+	close(fd);
+	if (stats_check(sh, sb.st_size) < 0)
+		errx(1, "%s: not a termlog statistics file, or another "
+		    "version", path);
+	if (kill(sh->sh_pid, 0) < 0 && errno == ESRCH)
+		warnx("termlog (pid %d) is not running, the statistics are "
+		    "stale", (int)sh->sh_pid);
+	for (;;) {
+		stats_print(stdout, sh, eflag ? STATS_EXPORT : STATS_TABLE);
+		if (fflush(stdout) != 0)
+			err(1, "stdout");
+		if (interval <= 0)
+			break;
+		sleep(interval);
+		printf("\n");
+	}
+	return (0);
+}
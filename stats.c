@@ -0,0 +1,376 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "compat.h"
+#include "stats.h"
+
+struct stats_hdr *stats;
+
+static pthread_mutex_t st_lock = PTHREAD_MUTEX_INITIALIZER;
+static char st_used[STATS_NSLOTS];	/* protected by st_lock */
+static u_int st_hint;
+/* sessions beyond STATS_NSLOTS count here, and nobody looks */
+static struct stats_session st_spare;
+
+uint64_t
+stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_STATS, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+/*
+ * Create the region at path.  If that fails we carry on with an
+ * anonymous one, so nobody else has to check.
+ */
+int
+stats_open(const char *path, int nworkers)
+{
+	struct stats_hdr *sh;
+	size_t size, woff, soff;
+	void *base;
+	int fd, i, ret;
+
+	woff = roundup(sizeof(struct stats_hdr), STATS_ALIGN);
+	soff = woff + nworkers * sizeof(struct stats_worker);
+	size = soff + STATS_NSLOTS * sizeof(struct stats_session);
+	base = MAP_FAILED;
+	ret = -1;
+	if (path != NULL) {
+		(void)unlink(path);
+		fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+		    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+		if (fd >= 0) {
+			if (ftruncate(fd, size) == 0)
+				base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				    MAP_SHARED, fd, 0);
+			close(fd);
+		}
+		if (base == MAP_FAILED)
+			warn("%s", path);
+		else
+			ret = 0;
+	}
+	if (base == MAP_FAILED)
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_ANON, -1, 0);
+	if (base == MAP_FAILED)
+		err(1, "mmap failed");
+	sh = base;
+	sh->sh_version = STATS_VERSION;
+	sh->sh_size = size;
+	sh->sh_nworkers = nworkers;
+	sh->sh_nslots = STATS_NSLOTS;
+	sh->sh_woff = woff;
+	sh->sh_soff = soff;
+	sh->sh_pid = getpid();
+	sh->sh_start = stats_now();
+	for (i = 0; i < STATS_NSLOTS; i++)
+		atomic_init(&STATS_SLOT(sh, i)->ss_gen, 1);
+	atomic_thread_fence(memory_order_release);
+	memcpy(sh->sh_magic, STATS_MAGIC, sizeof(sh->sh_magic));
+	stats = sh;
+	return (ret);
+}
+
+/*
+ * Give a new session a slot.  Slots are odd generation while free.
+ */
+struct stats_session *
+stats_attach(const char *user, const char *line, uint32_t sid)
+{
+	struct stats_session *ss;
+	u_int i, n;
+
+	STATS_INC(stats->sh_global.sg_attached);
+	STATS_INC(stats->sh_global.sg_sessions);
+	pthread_mutex_lock(&st_lock);
+	for (n = 0, i = st_hint; n < STATS_NSLOTS; n++, i++)
+		if (!st_used[i % STATS_NSLOTS])
+			break;
+	if (n == STATS_NSLOTS) {
+		pthread_mutex_unlock(&st_lock);
+		STATS_INC(stats->sh_global.sg_noslot);
+		return (&st_spare);
+	}
+	i %= STATS_NSLOTS;
+	st_used[i] = 1;
+	st_hint = i + 1;
+	pthread_mutex_unlock(&st_lock);
+	ss = STATS_SLOT(stats, i);
+	ss->ss_sid = sid;
+	strlcpy(ss->ss_user, user, sizeof(ss->ss_user));
+	strlcpy(ss->ss_line, line, sizeof(ss->ss_line));
+	ss->ss_start = stats_now();
+	STATS_SET(ss->ss_bytes, 0);
+	STATS_SET(ss->ss_reads, 0);
+	STATS_SET(ss->ss_writes, 0);
+	STATS_SET(ss->ss_flushes, 0);
+	STATS_SET(ss->ss_overflows, 0);
+	STATS_SET(ss->ss_reattaches, 0);
+	STATS_SET(ss->ss_qdepth, 0);
+	STATS_SET(ss->ss_lastact, ss->ss_start);
+	atomic_fetch_add_explicit(&ss->ss_gen, 1, memory_order_release);
+	return (ss);
+}
+
+void
+stats_detach(struct stats_session *ss)
+{
+	atomic_fetch_sub(&stats->sh_global.sg_sessions, 1);
+	if (ss == &st_spare)
+		return;
+	atomic_fetch_add_explicit(&ss->ss_gen, 1, memory_order_release);
+	pthread_mutex_lock(&st_lock);
+	st_used[ss - STATS_SLOT(stats, 0)] = 0;
+	pthread_mutex_unlock(&st_lock);
+}
+
+/*
+ * Is the region mapped at sh, size bytes long, one we understand?
+ */
+int
+stats_check(const struct stats_hdr *sh, size_t size)
+{
+	if (size < sizeof(*sh) ||
+	    memcmp(sh->sh_magic, STATS_MAGIC, sizeof(sh->sh_magic)) != 0 ||
+	    sh->sh_version != STATS_VERSION || sh->sh_size > size ||
+	    sh->sh_woff + (size_t)sh->sh_nworkers *
+	    sizeof(struct stats_worker) > sh->sh_soff ||
+	    sh->sh_soff + (size_t)sh->sh_nslots *
+	    sizeof(struct stats_session) > sh->sh_size)
+		return (-1);
+	return (0);
+}
+
+/*
+ * Copy a live slot; returns -1 if it is free or changed hands while
+ * we were looking.
+ */
+static int
+stats_copy(const struct stats_session *ss, struct stats_session *out)
+{
+	uint32_t gen;
+
+	gen = atomic_load_explicit(&ss->ss_gen, memory_order_acquire);
+	if (gen & 1)
+		return (-1);
+	memcpy(out, ss, sizeof(*out));
+	atomic_thread_fence(memory_order_acquire);
+	if (atomic_load_explicit(&ss->ss_gen, memory_order_relaxed) != gen)
+		return (-1);
+	return (0);
+}
+
+#define	LD(c)	((uintmax_t)atomic_load_explicit(&(c), memory_order_relaxed))
+
+static void
+quoted(FILE *fp, const char *s, size_t len)
+{
+	for (; len > 0 && *s != '\0'; s++, len--) {
+		if (*s == '"' || *s == '\\')
+			putc('\\', fp);
+		putc(*s, fp);
+	}
+}
+
+void
+stats_print(FILE *fp, const struct stats_hdr *sh, int fmt)
+{
+	const struct stats_worker *sw;
+	const struct stats_global *sg;
+	struct stats_session ss;
+	uintmax_t tot[8];
+	uint64_t now;
+	u_int i, j;
+
+	static const char *const names[8] = {
+		"bytes", "reads", "writes", "overflows", "reattaches",
+		"run_queue", "wakeups", "steals"
+	};
+
+	now = stats_now();
+	sg = &sh->sh_global;
+	memset(tot, 0, sizeof(tot));
+	for (i = 0; i < sh->sh_nworkers; i++) {
+		sw = STATS_WORKER(sh, i);
+		tot[0] += LD(sw->sw_bytes);
+		tot[1] += LD(sw->sw_reads);
+		tot[2] += LD(sw->sw_writes);
+		tot[3] += LD(sw->sw_overflows);
+		tot[4] += LD(sw->sw_reattaches);
+		tot[5] += LD(sw->sw_qlen);
+		tot[6] += LD(sw->sw_wakeups);
+		tot[7] += LD(sw->sw_steals);
+	}
+	if (fmt == STATS_EXPORT) {
+		fprintf(fp, "termlog_uptime_seconds %ju\n",
+		    (uintmax_t)(now - sh->sh_start) / 1000000);
+		fprintf(fp, "termlog_sessions %ju\n", LD(sg->sg_sessions));
+		fprintf(fp, "termlog_attached_total %ju\n",
+		    LD(sg->sg_attached));
+		fprintf(fp, "termlog_unslotted_total %ju\n",
+		    LD(sg->sg_noslot));
+		fprintf(fp, "termlog_flush_batches_total %ju\n",
+		    LD(sg->sg_batches));
+		fprintf(fp, "termlog_flushes_total %ju\n", LD(sg->sg_flushes));
+		fprintf(fp, "termlog_syncs_total %ju\n", LD(sg->sg_syncs));
+		for (j = 0; j < 8; j++)
+			fprintf(fp, "termlog_%s%s %ju\n", names[j],
+			    j == 5 ? "" : "_total", tot[j]);
+		for (i = 0; i < sh->sh_nslots; i++) {
+			if (stats_copy(STATS_SLOT(sh, i), &ss) < 0)
+				continue;
+#define	SESS(name, val)							\
+			do {						\
+				fprintf(fp, "termlog_session_%s{sid=\"%u\","	\
+				    "user=\"", name, ss.ss_sid);	\
+				quoted(fp, ss.ss_user, sizeof(ss.ss_user)); \
+				fprintf(fp, "\",tty=\"");		\
+				quoted(fp, ss.ss_line, sizeof(ss.ss_line)); \
+				fprintf(fp, "\"} %ju\n", (uintmax_t)(val)); \
+			} while (0)
+			SESS("bytes_total", LD(ss.ss_bytes));
+			SESS("reads_total", LD(ss.ss_reads));
+			SESS("writes_total", LD(ss.ss_writes));
+			SESS("flushes_total", LD(ss.ss_flushes));
+			SESS("overflows_total", LD(ss.ss_overflows));
+			SESS("reattaches_total", LD(ss.ss_reattaches));
+			SESS("queued_bytes", LD(ss.ss_qdepth));
+			SESS("last_activity_seconds", LD(ss.ss_lastact) /
+			    1000000);
+			SESS("buffer_bytes", LD(ss.ss_bufsize));
+			SESS("fill_rate_bytes_per_second", LD(ss.ss_rate));
+#undef	SESS
+		}
+		return;
+	}
+	fprintf(fp, "termlog pid %d, up %jus, %ju sessions, %ju attached, "
+	    "%ju without a slot\n", (int)sh->sh_pid,
+	    (uintmax_t)(now - sh->sh_start) / 1000000, LD(sg->sg_sessions),
+	    LD(sg->sg_attached), LD(sg->sg_noslot));
+	fprintf(fp, "%-14s %-10s %-10s %-9s %-9s %-8s %-10s %s\n",
+	    "BYTES", "READS", "WRITES", "OFLOWS", "REATTACH", "RUNQ",
+	    "FLUSHES", "SYNCS");
+	fprintf(fp, "%-14ju %-10ju %-10ju %-9ju %-9ju %-8ju %-10ju %ju\n",
+	    tot[0], tot[1], tot[2], tot[3], tot[4], tot[5],
+	    LD(sg->sg_flushes), LD(sg->sg_syncs));
+	fprintf(fp, "\n%-6s %-10s %-10s %-12s %-9s %-9s %-9s %-6s %-8s "
+	    "%-8s %s\n", "SID", "USER", "TTY", "BYTES", "READS", "WRITES",
+	    "FLUSHES", "OFLOW", "REATTACH", "QUEUED", "IDLE");
+	for (i = 0; i < sh->sh_nslots; i++) {
+		if (stats_copy(STATS_SLOT(sh, i), &ss) < 0)
+			continue;
+		fprintf(fp, "%-6u %-10.*s %-10.*s %-12ju %-9ju %-9ju %-9ju "
+		    "%-6ju %-8ju %-8ju %.1fs\n", ss.ss_sid,
+		    STATS_NAMELEN, ss.ss_user, STATS_NAMELEN, ss.ss_line,
+		    LD(ss.ss_bytes), LD(ss.ss_reads), LD(ss.ss_writes),
+		    LD(ss.ss_flushes), LD(ss.ss_overflows),
+		    LD(ss.ss_reattaches), LD(ss.ss_qdepth),
+		    now > LD(ss.ss_lastact) ?
+		    (now - LD(ss.ss_lastact)) / 1e6 : 0.0);
+	}
+}
+
+static void *
+exporter(void *arg)
+{
+	FILE *fp;
+	int fd, lfd;
+
+	lfd = (int)(intptr_t)arg;
+	for (;;) {
+		fd = accept(lfd, NULL, NULL);
+		if (fd < 0) {
+			if (errno != EINTR && errno != ECONNABORTED)
+				warn("accept failed");
+			continue;
+		}
+		if ((fp = fdopen(fd, "w")) == NULL) {
+			close(fd);
+			continue;
+		}
+		stats_print(fp, stats, STATS_EXPORT);
+		fclose(fp);
+	}
+	/* NOTREACHED */
+	return (NULL);
+}
+
+/*
+ * Serve the statistics in text form to whoever connects to the unix
+ * socket at path.
+ */
+int
+stats_export(const char *path)
+{
+	struct sockaddr_un sun;
+	pthread_t thr;
+	int fd;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlcpy(sun.sun_path, path, sizeof(sun.sun_path)) >=
+	    sizeof(sun.sun_path)) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+	/* a reader that goes away must not take us with it */
+	signal(SIGPIPE, SIG_IGN);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return (-1);
+	(void)unlink(path);
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 ||
+	    listen(fd, 16) < 0 ||
+	    pthread_create(&thr, NULL, exporter, (void *)(intptr_t)fd)) {
+		close(fd);
+		return (-1);
+	}
+	return (0);
+}
@@ -0,0 +1,145 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef	STATS_DOT_H_
+#define	STATS_DOT_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/*
+ * Live statistics, kept in a file that the daemon and termlog-stat
+ * both map.  The layout is fixed and versioned: a header, one block
+ * per worker and STATS_NSLOTS session slots, each on its own cache
+ * line so that threads updating different ones do not share lines.
+ * Counters are updated with relaxed atomics and read without any
+ * coordination with the daemon; a reader only has to make sure a
+ * session slot was not reused while it was copying it, which the
+ * slot generation tells it (odd while the slot changes hands).
+ *
+ * The global byte, read and write counts are the sums over the
+ * workers, which only ever increase.
+ */
+#define	_PATH_TERMLOG_STATMAP	"/var/run/termlog.stats"
+
+#define	STATS_MAGIC	"TLSTATS"
+#define	STATS_VERSION	2
+#define	STATS_NSLOTS	1024
+#define	STATS_ALIGN	64
+#define	STATS_NAMELEN	32
+
+#if defined(CLOCK_REALTIME_COARSE)
+#define	CLOCK_STATS	CLOCK_REALTIME_COARSE
+#elif defined(CLOCK_REALTIME_FAST)
+#define	CLOCK_STATS	CLOCK_REALTIME_FAST
+#else
+#define	CLOCK_STATS	CLOCK_REALTIME
+#endif
+
+typedef _Atomic uint64_t stat_t;
+
+struct stats_global {
+	stat_t		sg_sessions;	/* attached now */
+	stat_t		sg_attached;	/* since start */
+	stat_t		sg_noslot;	/* attached without a slot */
+	stat_t		sg_batches;	/* flusher passes */
+	stat_t		sg_flushes;
+	stat_t		sg_syncs;
+};
+
+struct stats_worker {
+	stat_t		sw_bytes;
+	stat_t		sw_reads;
+	stat_t		sw_writes;	/* chunks handed to the logs */
+	stat_t		sw_overflows;
+	stat_t		sw_reattaches;
+	stat_t		sw_qlen;	/* sessions on the run queue */
+	stat_t		sw_wakeups;
+	stat_t		sw_steals;
+} __attribute__((aligned(STATS_ALIGN)));
+
+struct stats_session {
+	_Atomic uint32_t ss_gen;
+	uint32_t	ss_sid;
+	char		ss_user[STATS_NAMELEN];
+	char		ss_line[STATS_NAMELEN];
+	uint64_t	ss_start;	/* usec */
+	stat_t		ss_bytes;
+	stat_t		ss_reads;
+	stat_t		ss_writes;
+	stat_t		ss_flushes;
+	stat_t		ss_overflows;
+	stat_t		ss_reattaches;
+	stat_t		ss_qdepth;	/* bytes read, not yet logged */
+	stat_t		ss_lastact;	/* usec */
+	stat_t		ss_bufsize;	/* capture buffer */
+	stat_t		ss_rate;	/* fill rate, bytes per second */
+} __attribute__((aligned(STATS_ALIGN)));
+
+struct stats_hdr {
+	char		sh_magic[8];
+	uint32_t	sh_version;
+	uint32_t	sh_size;	/* of the whole region */
+	uint32_t	sh_nworkers;
+	uint32_t	sh_nslots;
+	uint32_t	sh_woff;	/* offset of the worker blocks */
+	uint32_t	sh_soff;	/* ... and of the session slots */
+	int32_t		sh_pid;
+	uint32_t	sh_pad;
+	uint64_t	sh_start;	/* usec */
+	struct stats_global sh_global;
+} __attribute__((aligned(STATS_ALIGN)));
+
+#define	STATS_WORKER(sh, i)						\
+	((struct stats_worker *)((uintptr_t)(sh) + (sh)->sh_woff) + (i))
+#define	STATS_SLOT(sh, i)						\
+	((struct stats_session *)((uintptr_t)(sh) + (sh)->sh_soff) + (i))
+
+/* only the thread servicing a session updates its counters */
+#define	STATS_ADD(c, n)							\
+	atomic_store_explicit(&(c), atomic_load_explicit(&(c),		\
+	    memory_order_relaxed) + (n), memory_order_relaxed)
+#define	STATS_SET(c, v)							\
+	atomic_store_explicit(&(c), (v), memory_order_relaxed)
+#define	STATS_INC(c)							\
+	atomic_fetch_add_explicit(&(c), 1, memory_order_relaxed)
+
+#define	STATS_TABLE	0		/* stats_print() formats */
+#define	STATS_EXPORT	1
+
+extern struct stats_hdr *stats;
+
+int stats_open(const char *, int);
+struct stats_session *stats_attach(const char *, const char *, uint32_t);
+void stats_detach(struct stats_session *);
+int stats_check(const struct stats_hdr *, size_t);
+void stats_print(FILE *, const struct stats_hdr *, int);
+uint64_t stats_now(void);
+int stats_export(const char *);
+#endif	/* STATS_DOT_H_ */
@@ -30,13 +30,10 @@
 #include <sys/queue.h>
 #include <sys/stat.h>
 #include <sys/param.h>
-#include <sys/module.h>
-#include <sys/linker.h>
-#include <sys/snoop.h>
-#include <sys/event.h>
 #include <sys/time.h>
-#include <sys/filio.h>
+#include <sys/resource.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 
 #include <utmpx.h>
 #include "utmp.h"
@@ -54,24 +51,51 @@
 #include <limits.h>
 #include <assert.h>
 #include <syslog.h>
+#include <getopt.h>
 
+#include "compat.h"
 #include "termlog.h"
 #include "fileops.h"
 #include "rdwrlock.h"
+#include "capture.h"
+#include "evq.h"
+#include "worker.h"
+#include "epoch.h"
+#include "registry.h"
+#include "flusher.h"
+#include "latency.h"
+#include "chain.h"
+#include "budget.h"
+#include "policy.h"
+#include "conf.h"
+#include "rotate.h"
+#include "compress.h"
+#include "indexer.h"
+#include "utmpwatch.h"
+#include "stats.h"
+
+struct rdwrlock q_lock;		/* serializes session registry updates */
+#ifdef LATENCY_TRACE
+static uint64_t q_held;		/* when q_lock was taken */
+#endif
 
-struct rdwrlock q_lock;
-TAILQ_HEAD(tailhead, snp_d) head = TAILQ_HEAD_INITIALIZER(head);
-
-static char *ttylist[MAXTTYS];	/* user defined tty name lists */
-static char *userlist[MAXUSERS];/* user defined user lists */
 static char *thistty;		/* controlling tty */
 static char *oflag;		/* plugin specific options */
-static char *rootfs = "/";
-				/* devfs mount point */
-static int vflag;		/* verbose level */
-static int nflag = 20;		/* maximum number of snp devices we will use */
-static int iflag = 500000;	/* stat(2) interval of utmp in micro-secs */
-static int q_serialno;		/* serial number for queue */
+char *rootfs = "/";		/* devfs mount point */
+char *spooldir = _PATH_TERMLOG_SPOOL;
+				/* pty proxy fifo directory */
+int vflag;			/* verbose level */
+int fflag;
+static struct capsrc *capsrc;	/* where tty I/O comes from */
+static int wflag;		/* number of event loop threads */
+static struct utwatch utwatch;
+static char utmppath[MAXPATHLEN];
+static int utmpprimed;		/* the first scan is done */
+static atomic_ulong att_count;	/* logins attached to */
+static atomic_ulong att_total;	/* login to attach, usec */
+static atomic_ulong att_max;
+static int zlevel;		/* compress closed segments at this level */
+static int zjobs = 1;		/* ... with this many threads */
 int isdaemon = 0;
 
 #define	USRHDR	"USER"
@@ -80,11 +104,35 @@ int isdaemon = 0;
 #define BYTHDR	"BYTES"
 #define	HDRSIZE(x) (sizeof(x) - 1)
 
-extern int maxfsize;
-extern int appendonly;
+#define	OPT_CHECKPOLICY	256	/* long options only */
+
+extern int ckptsize;
+extern int binfmt;
+extern int vtstrip;
+extern int idxbytes;
+extern int idxsecs;
+extern long flushlatency;
+extern int durability;
 static int usrwidth = HDRSIZE(USRHDR);
 static int ttywidth = UT_LINESIZE;
-static int fflag;
+
+static struct capsrc *capsrcs[] = {
+#ifdef __FreeBSD__
+	&snp_capsrc,
+#endif
+#ifdef __linux__
+	&pty_capsrc,
+#endif
+	NULL
+};
+
+static struct logio *logios[] = {
+	&logio_stdio,
+#ifdef __linux__
+	&logio_uring,
+#endif
+	NULL
+};
 
 int
 dolog(char const *const fmt, ...)
@@ -103,42 +151,54 @@ dolog(char const *const fmt, ...)
 	return (0);
 }
 
-static int
-build_snp_device(int minor)
+static void
+dumpsession(struct snp_d *snp, void *arg)
 {
-	char devpath[MAXPATHLEN];
-	dev_t dev;
-	snprintf(devpath, sizeof(devpath) - 1,
-	    "%s/snp%d", _PATH_DEV, minor);
-	dev = makedev(_SNP_MAJOR, minor);
-	if (mknod(devpath, S_IFCHR | 0600, dev) < 0)
-		err(1, "mknod %s failed", devpath);
-	DEBUG(vflag, "created device snp%d", minor);
-	return (0);
+	FILE *fp;
+
+	fp = (FILE *)arg;
+	fprintf(fp, "%-*.*s %-*.*s %lu\n",
+	    usrwidth, usrwidth, snp->s_username,
+	    ttywidth, ttywidth, snp->s_line,
+	    snp->s_bytes);
 }
 
 static void
 dumpstats(FILE *fp)
 {
-	struct snp_d *snp;
+	u_long count;
 
 	assert(fp != NULL);
 	fprintf(fp, "Current snoop sessions:\n"
 	    "%-*.*s %-*.*s %s\n",
 	    usrwidth, usrwidth, USRHDR,
 	    ttywidth, ttywidth, TTYHDR, BYTHDR);
-	rd_lock(&q_lock);
-	TAILQ_FOREACH(snp, &head, glue)
-		fprintf(fp, "%-*.*s %-*.*s %lu\n",
-		    usrwidth, usrwidth, snp->s_username,
-		    ttywidth, ttywidth, snp->s_line,
-		    snp->s_bytes);
-	rdwr_unlock(&q_lock);
+	epoch_enter();
+	reg_foreach(dumpsession, fp);
+	epoch_exit();
+	count = atomic_load(&att_count);
+	fprintf(fp, "Login to attach latency:\n%-10s %-10s %s\n",
+	    "ATTACHED", "AVG(ms)", "MAX(ms)");
+	fprintf(fp, "%-10lu %-10.3f %.3f\n", count,
+	    count > 0 ? atomic_load(&att_total) / 1000.0 / count : 0.0,
+	    atomic_load(&att_max) / 1000.0);
+	worker_dumpstats(fp);
+	flusher_dumpstats(fp);
+	rotate_dumpstats(fp);
+	compress_dumpstats(fp);
+	indexer_dumpstats(fp);
+	budget_dumpstats(fp);
+	alert_dumpstats(fp);
+	lat_dump(fp);
 	fclose(fp);
 }
 
+/*
+ * SIGUSR1 is blocked in every thread and picked up with sigwait() by
+ * the main thread, which then calls us.
+ */
 static void
-catchusr(int sig __unused)
+writestats(void)
 {
 	char buf[MAXPATHLEN];
 	FILE *fp;
@@ -156,7 +216,7 @@ catchusr(int sig __unused)
 int
 skipcrtltty(struct utmpx *utmp)
 {
-	if (vflag == 0)
+	if (vflag == 0 || thistty == NULL)
 		return (0);
 	assert(utmp != NULL);
 	if (strcmp(thistty, utmp->ut_line) == 0)
@@ -164,278 +224,326 @@ skipcrtltty(struct utmpx *utmp)
 	return (0);
 }
 
-int
-handlesnpio(struct snp_d *s)
+/*
+ * q_lock is only ever taken for writing, so the hold time can live in
+ * a single variable.
+ */
+static void
+qlock(void)
 {
-	static int nalloc = 512;
-	int error, nbytes;
-	static char *ptr;
+	uint64_t t0 __unused;
 
-	assert(s != NULL);
-	WRLOCK_ASSERT(M_OWNED, &q_lock);
-	if (ioctl(s->s_fd, FIONREAD, &nbytes) < 0)
-		err(1, "ioctl FIONREAD failed");
-	switch (nbytes) {
-	case SNP_OFLOW:
-		DEBUG(vflag, "overflow on %s reconnecting line",
-		    s->s_line);
-		s->snp_overflow(s->s_meta);
-		close(s->s_fd);
-		s->s_fd = snpattach(s->s_line);
-		if (s->s_fd > 0) {
-			q_serialno++;
-			break;
-		}
-		/* FALL THROUGH */
-	case SNP_DETACH:
-	case SNP_TTYCLOSE:
-		DEBUG(vflag, "user %s disconnected line %s",
-		    s->s_username, s->s_line);
-		q_serialno++;
-		TAILQ_REMOVE(&head, s, glue);
-		close(s->s_fd);
-		s->snp_close(s->s_meta);
-		free(s);
-		break;
-	default:
-		if (ptr == NULL) {
-			DEBUG(vflag, "doing initial allocation of %d bytes",
-			    nalloc);
-			ptr = malloc(nalloc);
-		} else if (nalloc < nbytes) {
-			DEBUG(vflag, "adjusting input buffer to %d bytes",
-			    nbytes);
-			ptr = realloc(ptr, nbytes);
-			nalloc = nbytes;
-		}
-		if (ptr == NULL)
-			return (1);
-		error = read(s->s_fd, ptr, nbytes);
-		if (error < 0) {
-			warn("read failed");
-			return (1);
-		}
-		error = s->snp_write(s->s_meta, ptr, error);
-		if (error)
-			warn("write failed");
-		s->s_bytes += nbytes;
-	}
-	return (0);
+	t0 = LAT_NOW();
+	wr_lock(&q_lock);
+	LAT_RECORD(LAT_QWAIT, t0);
+#ifdef LATENCY_TRACE
+	q_held = lat_now();
+#endif
 }
 
-int
-buildfdlist(fd_set *fdset)
+static void
+qunlock(void)
 {
-	struct snp_d *snp;
-	int maxfd;
-
-	assert(fdset != NULL);
-	DEBUG(vflag, "refreshing fd set\n");
-	FD_ZERO(fdset);
-	maxfd = 0;
-	rd_lock(&q_lock);
-	TAILQ_FOREACH(snp, &head, glue) {
-		if (snp->s_fd > maxfd)
-			maxfd = snp->s_fd;
-		FD_SET(snp->s_fd, fdset);
-	}
+	LAT_SINCE(LAT_QHOLD, q_held);
 	rdwr_unlock(&q_lock);
-	maxfd++;
-	return (maxfd);
 }
 
-void *
-eventloop(void *arg __unused)
+/*
+ * Hand whatever is in the ring to the sink, a contiguous span at a
+ * time.  The write is timed once for the lot, from the end of the
+ * last read.
+ */
+static void
+sessflush(struct worker *w, struct snp_d *s)
 {
-	struct timeval tv = { 1, 0 };
-	int serialno, error, maxfd;
-	struct snp_d *snp, *snp2;
-	fd_set a_fds, r_fds;
+	size_t len;
+	char *ptr;
 
-	serialno = maxfd = 0;
-	for (;;) {
-		if (serialno != q_serialno) {
-			maxfd = buildfdlist(&a_fds);
-			serialno = q_serialno;
+	if (ring_len(&s->s_ring) == 0)
+		return;
+	STATS_SET(s->s_stats->ss_lastact, stats_now());
+	while ((len = ring_span(&s->s_ring, &ptr)) > 0) {
+		if (alert_enabled())
+			alert_scan(&s->s_alert, s->s_username, s->s_line,
+			    ptr, len);
+		if (s->snp_write(s->s_meta, ptr, len))
+			warn("write failed");
+		ring_consume(&s->s_ring, len);
+		STATS_ADD(w->w_stats->sw_writes, 1);
+		STATS_ADD(s->s_stats->ss_writes, 1);
+	}
+	LAT_STEP(LAT_WRITE, s->s_tlast);
+}
+
+/*
+ * Service a session which the event queue reported as readable.
+ * Notification is edge triggered, so keep reading into the session's
+ * ring until the capture source would block, or until the session
+ * has had its fair share of the worker.
+ */
+int
+handlesnpio(struct worker *w, struct snp_d *s)
+{
+	struct iovec iov[2];
+	int cnt, n, fd, total;
+
+	assert(s != NULL);
+	LAT_MARK(s->s_tlast);
+	for (total = 0; total < WORKER_QUANTUM; total += n) {
+		if ((cnt = ring_freeiov(&s->s_ring, iov)) == 0) {
+			sessflush(w, s);
+			cnt = ring_freeiov(&s->s_ring, iov);
 		}
-		r_fds = a_fds;
-		error = select(maxfd, &r_fds, NULL, NULL, &tv);
-		if (error < 0 && errno == EINTR) {
-			continue;
-		} else if (error < 0)
-			err(1, "select failed");
-		else if (error == 0) {
-			continue;
+		n = s->s_src->cs_readv(s->s_handle, iov, cnt);
+		switch (n) {
+		case 0:
+			sessflush(w, s);
+			return (SIO_DRAINED);
+		case -1:
+			/* no edge will come for it again */
+			warn("%s: read failed, detaching", s->s_line);
+			sessflush(w, s);
+			return (SIO_DETACH);
+		case CS_OFLOW:
+			DEBUG(vflag, "overflow on %s reconnecting line",
+			    s->s_line);
+			sessflush(w, s);
+			s->snp_overflow(s->s_meta);
+			s->s_oflows++;
+			STATS_ADD(w->w_stats->sw_overflows, 1);
+			STATS_ADD(s->s_stats->ss_overflows, 1);
+			if (s->s_src->cs_overflow(s->s_handle) == 0) {
+				STATS_ADD(w->w_stats->sw_reattaches, 1);
+				STATS_ADD(s->s_stats->ss_reattaches, 1);
+				fd = s->s_src->cs_fd(s->s_handle);
+				if (fd != s->s_fd) {
+					s->s_fd = fd;
+					if (evq_add(&s->s_worker->w_evq,
+					    fd, s) < 0)
+						warn("evq_add failed");
+				}
+				n = 0;
+				LAT_MARK(s->s_tlast);
+				continue;
+			}
+			/* FALL THROUGH */
+		case CS_DETACH:
+			DEBUG(vflag, "user %s disconnected line %s",
+			    s->s_username, s->s_line);
+			sessflush(w, s);
+			return (SIO_DETACH);
 		}
-		/*
-		 * Since its possible that handlesnpio will remove
-		 * elements from the TAILQ, we should use TAILQ_FOREACH_SAFE
-		 * instead of it's unsafe counter-part.
-		 */
-		wr_lock(&q_lock);
-		TAILQ_FOREACH_SAFE(snp, &head, glue, snp2) 
-			if (FD_ISSET(snp->s_fd, &r_fds))
-				handlesnpio(snp);
-		rdwr_unlock(&q_lock);
+		LAT_STEP(LAT_READ, s->s_tlast);
+		LAT_SINCE_AT(LAT_READABLE, s->s_tready, s->s_tlast);
+		ring_produce(&s->s_ring, n);
+		s->s_bytes += n;
+		STATS_ADD(w->w_stats->sw_bytes, n);
+		STATS_ADD(w->w_stats->sw_reads, 1);
+		STATS_ADD(s->s_stats->ss_bytes, n);
+		STATS_ADD(s->s_stats->ss_reads, 1);
 	}
+	sessflush(w, s);
+	return (SIO_MORE);
 }
-				
-void *
-watchutmp(void *arg __unused)
+
+static void
+sessdtor(void *arg)
 {
-	char path[MAXPATHLEN];
-	struct stat sb;
-	int fd;
-	int mtime;
+	struct snp_d *s;
 
-	snprintf(path, sizeof(path) - 1,
-	    "%s%s", rootfs, _PATH_UTMP);
-	mtime = 0;
+	s = (struct snp_d *)arg;
+	pthread_mutex_destroy(&s->s_mtx);
+	free(s);
+}
 
-	fd = open(path, O_RDONLY);
-	if (fd < 0)
-		err(1, "open utmp failed");
-	for (;;) {
-		if (fstat(fd, &sb) < 0)
-			err(1, "fstat failed");
-		if (sb.st_mtime != mtime) {
-			processutmp(&sb);
-			mtime = sb.st_mtime;
-		}
-		usleep(iflag);
-	}
+/*
+ * Tear down a session.  Must be called by the worker which owns it,
+ * once nobody else can be servicing it.
+ */
+void
+sessfree(struct snp_d *s)
+{
+	qlock();
+	reg_remove(s);
+	qunlock();
+	(void)evq_del(&s->s_worker->w_evq, s->s_fd);
+	s->s_src->cs_detach(s->s_handle);
+	s->snp_close(s->s_meta);
+	stats_detach(s->s_stats);
+	ring_destroy(&s->s_ring);
+	/* registry readers may still be looking at it */
+	epoch_defer(s, sessdtor);
+	epoch_reclaim();
 }
 
-int
-getsnpfd(char **snp, size_t len)
+
+/*
+ * A login appeared in utmp.  Returns non-zero if it should be tried
+ * again, which is the case if its tty can not be attached to yet.
+ */
+static int
+utmpadded(struct utmpx *up)
 {
-	struct stat sb;
-	char *snppath;
-	int unit, fd;
-
-	assert(*snp != NULL || len != 0);
-	snppath = *snp;
-	for (unit = 0; unit < nflag; unit++) {
-		snprintf(snppath, len - 1, "%ssnp%d",
-		    _PATH_DEV, unit);
-		if (fflag)
-			if (stat(snppath, &sb) < 0 &&
-			    errno == ENOENT)
-				build_snp_device(unit);
-		fd = open(snppath, O_RDONLY);
-		if (fd < 0 && errno != EBUSY) {
-			err(1, "open %s failed", snppath);
-		} else if (fd < 0) {
-			continue;
-		} else
-			return (fd);
+	struct timeval now;
+	long lat;
+
+	if (skipcrtltty(up) || !checkpolicy(up) || ttyislinked(up))
+		return (0);
+	if (!ttystat(up->ut_line, UT_LINESIZE) || linktty(up)) {
+		DEBUG(vflag, "unable to link %s", up->ut_line);
+		return (1);
 	}
-	return (-1);
+	/* logins which predate us say nothing about our latency */
+	if (!utmpprimed)
+		return (0);
+	gettimeofday(&now, NULL);
+	lat = (now.tv_sec - up->ut_tv.tv_sec) * 1000000L +
+	    (now.tv_usec - up->ut_tv.tv_usec);
+	if (lat < 0)
+		lat = 0;
+	atomic_fetch_add(&att_count, 1);
+	atomic_fetch_add(&att_total, lat);
+	if ((u_long)lat > atomic_load(&att_max))
+		atomic_store(&att_max, lat);
+	return (0);
 }
 
-int
-snpattach(char *tty_line)
+static void
+utmpremoved(struct utmpx *up)
 {
-	char *ptr, snpdev[MAXPATHLEN], line[MAXPATHLEN];
-	struct stat sb;
-#if __FreeBSD_version > 600000
-	int sdev;
-#else
-	dev_t sdev;
-#endif
-	int fd;
-
-	assert(tty_line != NULL);
-	ptr = &snpdev[0];
-	snprintf(line, sizeof(line) - 1, "%s%s%s", rootfs, _PATH_DEV,
-	    tty_line);
-	if (stat(line, &sb) < 0) {
-		warn("stat %s failed", tty_line);
-		return (-1);
-	}
-	if ((sb.st_mode & S_IFMT) != S_IFCHR) {
-		warn("%s not a device", tty_line);
-		return (-1);
-	}
-	if ((fd = getsnpfd(&ptr, MAXPATHLEN)) < 0) {
-		DEBUG(vflag,
-		    "snp open failed: retrying on next login/logout event\n");
-		return (-1);
-	}
-#if __FreeBSD_version > 600000
-	sdev = open(line, O_RDONLY | O_NONBLOCK);
-	if (sdev < 0) {
-		warn("open failed");
-		return (-1);
-	}
-#else
-	sdev = sb.st_rdev;
-#endif
-	if (ioctl(fd, SNPSTTY, &sdev) < 0) {
-		warn("ioctl SNPSTTY failed");
-		close(fd);
-		return (-1);
+	/* the session goes away by itself when its tty is closed */
+	DEBUG(vflag, "%.*s logged out of %.*s", UT_NAMESIZE, up->ut_user,
+	    UT_LINESIZE, up->ut_line);
+}
+
+void *
+watchutmp(void *arg __unused)
+{
+	const struct tlconf *tc;
+	long timeout;
+	u_int gen;
+
+	gen = 0;
+	for (;;) {
+		/*
+		 * After a reload every login is offered again, since
+		 * some which were passed over may be monitored now.
+		 * Those say nothing about our latency either.
+		 */
+		epoch_enter();
+		tc = conf_get();
+		if (tc->tc_gen != gen) {
+			if (gen != 0) {
+				utw_reset(&utwatch);
+				utmpprimed = 0;
+			}
+			gen = tc->tc_gen;
+			utwatch.uw_poll = tc->tc_iflag;
+		}
+		epoch_exit();
+		if (utw_scan(&utwatch, utmpadded, utmpremoved) < 0)
+			warn("%s", utmppath);
+		utmpprimed = 1;
+		/*
+		 * Without changes to utmp we only need to wake up to
+		 * retry a login, to free sessions or to reload.
+		 */
+		for (;;) {
+			timeout = epoch_reclaim() > 0 ||
+			    utwatch.uw_nretry > 0 ? utwatch.uw_poll : -1;
+			if (utw_wait(&utwatch, timeout) ||
+			    utwatch.uw_nretry > 0)
+				break;
+		}
 	}
-#if __FreeBSD_version > 600000
-	close(sdev);
-#endif
-	DEBUG(vflag, "%s fd %d %s attached to tty %s",
-	    snpdev, fd, ptr, line);
-	return (fd);
 }
 
 int
 ttyislinked(struct utmpx *utmp)
 {
-	struct snp_d *s;
+	int linked;
 
 	assert(utmp != NULL);
-	rd_lock(&q_lock);
-	TAILQ_FOREACH(s, &head, glue) {
-		assert(s != NULL);
-		if (strcmp(s->s_line, utmp->ut_line) == 0) {
-			rdwr_unlock(&q_lock);
-			return (1);
-		}
-	}
-	rdwr_unlock(&q_lock);
-	return (0);
+	epoch_enter();
+	linked = reg_lookup_line(utmp->ut_line) != NULL;
+	epoch_exit();
+	return (linked);
 }
 
 int
 linktty(struct utmpx *utmp)
 {
 	struct snp_d *s;
-	int len, fd;
+	void *handle;
+	int len;
 
 	assert(utmp != NULL);
-	fd = snpattach(utmp->ut_line);
-	if (fd < 0)
+	handle = capsrc->cs_attach(utmp->ut_line);
+	if (handle == NULL)
 		return (1);
 	s = malloc(sizeof(struct snp_d));
 	if (s == NULL)
 		goto error;
+	if (ring_init(&s->s_ring, SESSION_RINGSIZE) < 0) {
+		free(s);
+		goto error;
+	}
 	DEBUG(vflag, "building snoop session for user %s",
 	    utmp->ut_user);
 	if ((len = strlcpy(s->s_username, utmp->ut_user,
 	    UT_NAMESIZE)) > usrwidth)
 		usrwidth = len;
 	strlcpy(s->s_line, utmp->ut_line, UT_LINESIZE);
-	s->snp_write = snp_write_log;
+	s->snp_write = budget_enabled() ? snp_write_budget : snp_write_log;
 	s->snp_setup = snp_setup;
 	s->snp_close = snp_remove;
 	s->snp_overflow = snp_overflow;
-	s->s_fd = fd;
+	s->s_src = capsrc;
+	s->s_handle = handle;
+	s->s_fd = capsrc->cs_fd(handle);
+	s->s_stats = stats_attach(s->s_username, s->s_line, 0);
 	s->s_meta = s->snp_setup(s, oflag);
+	if (s->s_meta == NULL) {
+		warnx("%s: cannot open log", s->s_line);
+		stats_detach(s->s_stats);
+		ring_destroy(&s->s_ring);
+		free(s);
+		goto error;
+	}
 	s->s_bytes = 0;
-	wr_lock(&q_lock);
-	TAILQ_INSERT_HEAD(&head, s, glue);
-	q_serialno++;
-	rdwr_unlock(&q_lock);
+	alert_init(&s->s_alert);
+	pthread_mutex_init(&s->s_mtx, NULL);
+	atomic_init(&s->s_queued, 0);
+	atomic_init(&s->s_dead, 0);
+	atomic_init(&s->s_busy, 0);
+	qlock();
+	if (reg_insert(s) < 0) {
+		DEBUG(vflag, "%s is already linked", s->s_line);
+		qunlock();
+		s->snp_close(s->s_meta);
+		stats_detach(s->s_stats);
+		pthread_mutex_destroy(&s->s_mtx);
+		ring_destroy(&s->s_ring);
+		free(s);
+		goto error;
+	}
+	worker_assign(s);
+	if (evq_add(&s->s_worker->w_evq, s->s_fd, s) < 0) {
+		warn("evq_add failed");
+		reg_remove(s);
+		qunlock();
+		atomic_fetch_sub(&s->s_worker->w_nsessions, 1);
+		s->snp_close(s->s_meta);
+		stats_detach(s->s_stats);
+		ring_destroy(&s->s_ring);
+		/* registry readers may still be looking at it */
+		epoch_defer(s, sessdtor);
+		goto error;
+	}
+	qunlock();
 	return (0);
 error:
-	if (s != NULL)
-		free(s);
+	capsrc->cs_detach(handle);
 	return (1);
 }
 
@@ -455,94 +563,178 @@ ttystat(char *line, int size)
 }
 
 int
-checkuserlist(struct utmpx *utmp)
+checkpolicy(struct utmpx *utmp)
 {
-	char *user;
-	char **ulist;
+	int match;
 
 	assert(utmp != NULL);
-	ulist = userlist;
-	if (*ulist == NULL)
-		return (1);
-	while ((user = *ulist++))
-		if (strcmp(utmp->ut_user, user) == 0)
-			return (1);
+	epoch_enter();
+	match = policy_match(conf_get()->tc_policy,
+	    utmp->ut_user, strnlen(utmp->ut_user, sizeof(utmp->ut_user)),
+	    utmp->ut_line, strnlen(utmp->ut_line, sizeof(utmp->ut_line)));
+	epoch_exit();
+	return (match);
+}
+
+static int
+strtoval(char *string, int flag)
+{
+	char *endp;
+	int val;
+
+	/* XXX range checking ? */
+	val = strtoul(string, &endp, 0);
+	if (*endp != '\0')
+		if (!flag)
+			err(1, "%s: invalid number", string);
+	return (val);
+}
+
+/*
+ * Index spacing is either a size, with an optional k or m suffix,
+ * or a number of seconds followed by s.
+ */
+static int
+parsespacing(const char *str)
+{
+	char *endp;
+	long val;
+
+	val = strtol(str, &endp, 10);
+	if (endp == str || val <= 0)
+		return (-1);
+	if (strcmp(endp, "s") == 0)
+		idxsecs = val;
+	else if (*endp == '\0')
+		idxbytes = val;
+	else if (strcmp(endp, "k") == 0)
+		idxbytes = val * 1024;
+	else if (strcmp(endp, "m") == 0)
+		idxbytes = val * 1024 * 1024;
+	else
+		return (-1);
 	return (0);
 }
 
-int
-checkttylist(struct utmpx *utmp)
+static struct utmpx *chkrecs;	/* logins for --check-policy */
+static size_t chknrecs;
+
+static int
+chkadded(struct utmpx *up)
 {
-	char *tty;
-	char **tlist;
+	struct utmpx *recs;
 
-	assert(utmp != NULL);
-	tlist = ttylist;
-	if (*tlist == NULL)
-		return (1);
-	while ((tty = *tlist++))
-		if (strcmp(utmp->ut_line, tty) == 0)
-			return (1);
+	recs = realloc(chkrecs, (chknrecs + 1) * sizeof(*recs));
+	if (recs == NULL)
+		err(1, "realloc failed");
+	chkrecs = recs;
+	chkrecs[chknrecs++] = *up;
 	return (0);
 }
 
+static void
+chkremoved(struct utmpx *up __unused)
+{
+}
+
 /*
- * Rather than calling fread() on every element of the utmp array
- * stored in a file, it makes more sense to mmap(2) the file
- * and use the mmaping instead. In benchmarks I have done, it
- * was concluded that the array element access through the mmap
- * was close to twice as fast.
+ * --check-policy: report on the policy as compiled and classify the
+ * logins in utmp with it, then exit.
  */
-int
-processutmp(struct stat *sb)
+static void
+policyreport(const struct tlconf *tc)
 {
-	struct utmpx *up;
+	struct utwatch uw;
 
-	while (up = getutxent()) {
-		if (up->ut_user == '\0' || skipcrtltty(up) ||
-		    !ttystat(up->ut_line, UT_LINESIZE) ||
-		    !checkttylist(up) || !checkuserlist(up) || ttyislinked(up))
-			continue;
-		if (linktty(up))
-			DEBUG(vflag, "unable to link %s", up->ut_line);
+	if (utw_open(&uw, utmppath, tc->tc_iflag) < 0 ||
+	    utw_scan(&uw, chkadded, chkremoved) < 0)
+		err(1, "%s", utmppath);
+	policy_check(tc->tc_policy, stdout, chkrecs, chknrecs);
+	exit(0);
+}
+
+/*
+ * A snapshot of the configuration as it is now, or NULL if it is not
+ * valid.
+ */
+static struct tlconf *
+newconf(void)
+{
+	struct tlconf *tc;
+
+	if ((tc = conf_build()) == NULL)
+		return (NULL);
+	/* append-only segments could not be replaced */
+	if (tc->tc_appendonly && zlevel > 0) {
+		warnx("-a and -z are mutually exclusive");
+		conf_free(tc);
+		return (NULL);
 	}
-	return (0);
+	return (tc);
 }
 
-static int
-strtoval(char *string, int flag)
+/*
+ * SIGHUP: swap in a new configuration.  Attached sessions carry on,
+ * and the utmp watcher offers every login to the new policy.
+ */
+static void
+reload(void)
 {
-	char *endp;
-	int val;
+	struct tlconf *tc;
 
-	/* XXX range checking ? */
-	val = strtoul(string, &endp, 0);
-	if (*endp != '\0')
-		if (!flag)
-			err(1, "%s: invalid number", string);
-	return (val);
+	if ((tc = newconf()) == NULL) {
+		dolog("configuration not reloaded");
+		return;
+	}
+	conf_publish(tc);
+	utw_wakeup(&utwatch);
+	dolog("configuration %u loaded", tc->tc_gen);
 }
 
+static const struct option longopts[] = {
+	{ "check-policy",	no_argument,	NULL,	OPT_CHECKPOLICY },
+	{ NULL,			0,		NULL,	0 }
+};
+
 int
 main(int argc, char *argv [])
 {
-	int ch;
-	char **tlist, **ulist;
-	pthread_t thr[2];
-
-	tlist = ttylist;
-	ulist = userlist;
-	while ((ch = getopt(argc, argv, "aC:c:d:Dfi:o:n:t:u:v")) != -1)
+	int ch, checkonly, sig;
+	char *bflag, *eflag, *Mflag, *Oflag, *Tflag;
+	const char *sflag;
+	struct capsrc **csp;
+	struct logio **lip;
+	struct rlimit rl;
+	struct tlconf *tc;
+	pthread_t thr;
+	sigset_t set;
+
+	checkonly = 0;
+	bflag = eflag = Mflag = Oflag = Tflag = NULL;
+	sflag = _PATH_TERMLOG_STATMAP;
+	while ((ch = getopt_long(argc, argv,
+	    "A:aBb:C:c:d:De:F:fI:i:K:L:M:No:n:O:P:p:Q:q:R:S:s:T:t:u:vw:Z:z:",
+	    longopts, NULL)) != -1)
 		switch (ch) {
+		case 'A':
+			if (alert_load(optarg) < 0)
+				exit(1);
+			break;
 		case 'a':
-			appendonly++;
+			confargs.tc_appendonly = 1;
+			break;
+		case 'B':
+			binfmt++;
+			break;
+		case 'b':
+			bflag = optarg;
 			break;
 		case 'C':
 			if (chdir(optarg) < 0)
 				err(1, "chdir failed");
 			break;
 		case 'c':
-			maxfsize = strtoval(optarg, 0);
+			confargs.tc_maxfsize = strtoval(optarg, 0);
 			break;
 		case 'd':
 			rootfs = optarg;
@@ -550,46 +742,116 @@ main(int argc, char *argv [])
 		case 'D':
 			isdaemon++;
 			break;
+		case 'e':
+			eflag = optarg;
+			break;
+		case 'F':
+			if (flusher_parselatency(optarg, &flushlatency) < 0)
+				errx(1, "%s: invalid latency", optarg);
+			break;
 		case 'f':
 			fflag++;
 			break;
+		case 'I':
+			if (parsespacing(optarg) < 0)
+				errx(1, "%s: invalid index spacing", optarg);
+			break;
 		case 'i':
-			iflag = strtoval(optarg, 0);
+			confargs.tc_iflag = strtoval(optarg, 0);
+			break;
+		case 'K':
+			ckptsize = strtoval(optarg, 0);
+			break;
+		case 'L':
+			confargs.tc_idlesecs = strtoval(optarg, 0);
+			break;
+		case 'M':
+			Mflag = optarg;
+			break;
+		case 'N':
+			vtstrip++;
 			break;
 		case 'o':
 			oflag = optarg;
 			break;
 		case 'n':
-			nflag = strtoval(optarg, 0);
+			confargs.tc_nflag = strtoval(optarg, 0);
+			break;
+		case 'O':
+			Oflag = optarg;
+			break;
+		case 'P':
+			spooldir = optarg;
+			break;
+		case 'p':
+			if (conf_addfile(optarg) < 0)
+				err(1, "conf_addfile failed");
+			break;
+		case 'Q':
+			if (budget_parse(optarg, &userbudget) < 0)
+				errx(1, "%s: invalid budget", optarg);
+			break;
+		case 'q':
+			if (budget_parse(optarg, &sessbudget) < 0)
+				errx(1, "%s: invalid budget", optarg);
+			break;
+		case 'R':
+			confargs.tc_rotsecs = strtoval(optarg, 0);
+			break;
+		case 'S':
+			durability = flusher_parsemode(optarg);
+			if (durability < 0)
+				errx(1, "%s: invalid durability mode", optarg);
+			break;
+		case 's':
+			sflag = optarg;
+			break;
+		case 'T':
+			Tflag = optarg;
 			break;
 		case 't':
-			if (tlist == &ttylist[MAXTTYS]) {
-				warnx("ignoring tty %s: max tty list exceeded",
-				    optarg);
-				break;
-			}
-			*tlist++ = optarg;
+			if (conf_addrule(POL_TTY, optarg) < 0)
+				err(1, "conf_addrule failed");
 			break;
 		case 'u':
-			if (ulist == &userlist[MAXUSERS]) {
-				warnx("ignoring user %s: max userlist exceeded",
-				    optarg);
-				break;
-			}
-			*ulist++ = optarg;
+			if (conf_addrule(POL_USER, optarg) < 0)
+				err(1, "conf_addrule failed");
 			break;
 		case 'v':
 			vflag++;
 			DEBUG(vflag, "termlog %s",
 			     TERMLOG_VERSION);
 			break;
+		case 'w':
+			wflag = strtoval(optarg, 0);
+			break;
+		case 'Z':
+			zjobs = strtoval(optarg, 0);
+			break;
+		case 'z':
+			zlevel = strtoval(optarg, 0);
+			break;
+		case OPT_CHECKPOLICY:
+			checkonly++;
+			break;
 		case '?':
 		default:
 			usage(argv[0]);
 		}
-	if (modfind("snp") == -1)
-		if (kldload("snp") == -1 || modfind("snp") == -1)
-			err(1, "snp module not available");
+	(void)snprintf(utmppath, sizeof(utmppath), "%s%s", rootfs,
+	    _PATH_UTMP);
+	if ((tc = newconf()) == NULL)
+		exit(1);
+	conf_publish(tc);
+	if (checkonly)
+		policyreport(tc);
+	for (csp = capsrcs; *csp != NULL; csp++)
+		if (bflag == NULL || strcmp(bflag, (*csp)->cs_name) == 0)
+			break;
+	if (*csp == NULL)
+		errx(1, "%s: capture backend not supported", bflag);
+	capsrc = *csp;
+	capsrc->cs_init();
 	thistty = ttyname(0);
 	if (thistty) {
 		thistty = rindex(thistty, '/');
@@ -600,23 +862,79 @@ main(int argc, char *argv [])
 #ifdef DEBUGGING
 	fprintf(stderr, "NOTE: debugging and assertions are enabled\n");
 #endif
-	signal(SIGUSR1, catchusr);
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	sigaddset(&set, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	/*
+	 * Every attached tty costs us at least one descriptor.
+	 */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		(void)setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	if (Mflag != NULL && chain_open(Mflag) < 0)
+		err(1, "%s", Mflag);
+	for (lip = logios; *lip != NULL; lip++)
+		if (Oflag == NULL || strcmp(Oflag, (*lip)->li_name) == 0)
+			break;
+	if (*lip == NULL)
+		errx(1, "%s: output backend not supported", Oflag);
+	logio = *lip;
+	if (logio->li_init != NULL && logio->li_init() < 0) {
+		warn("%s output unavailable, falling back to %s",
+		    logio->li_name, logio_stdio.li_name);
+		logio = &logio_stdio;
+	}
+	if (wflag <= 0)
+		wflag = sysconf(_SC_NPROCESSORS_ONLN);
+	if (wflag <= 0)
+		wflag = 1;
+	(void)stats_open(sflag, wflag);
+	if (eflag != NULL && stats_export(eflag) < 0)
+		err(1, "%s", eflag);
+	if (vtstrip) {
+		(void)vt_select(NULL);
+		DEBUG(vflag, "plain text runs found with %s", vt_path());
+	}
+	if (worker_init(wflag) < 0)
+		err(1, "worker_init failed");
+	if (flusher_init() != 0)
+		err(1, "flusher_init failed");
+	if (rotate_init() != 0)
+		err(1, "rotate_init failed");
+	if (compress_init(zlevel, zjobs) != 0)
+		err(1, "compress_init failed");
+	if (indexer_init(Tflag) != 0)
+		err(1, "%s", Tflag);
 	rdwr_lock_init(&q_lock);
-	TAILQ_INIT(&head);
-	if (pthread_create(&thr[0], NULL, watchutmp, NULL))
-		err(1, "pthread_create failed");
-	if (pthread_create(&thr[1], NULL, eventloop, NULL))
+	worker_start();
+	if (utw_open(&utwatch, utmppath, tc->tc_iflag) < 0)
+		err(1, "open utmp failed");
+	if (pthread_create(&thr, NULL, watchutmp, NULL))
 		err(1, "pthread_create failed");
-	for (;;)
-		pause();
+	for (;;) {
+		if (sigwait(&set, &sig) != 0)
+			continue;
+		if (sig == SIGUSR1)
+			writestats();
+		else if (sig == SIGHUP)
+			reload();
+	}
 }
 
 void
 usage(char *execname)
 {
 	fprintf(stderr,
-	    "usage: %s [-fv] [-C dir] [-c count] [-i interval] [-n max devs]\n"
-	    "               [-u username] [-t tty]\n",
+	    "usage: %s [-BfNv] [-A rules] [-b backend] [-C dir] [-c count]\n"
+	    "               [-e socket] [-F latency] [-I spacing] [-i interval]\n"
+	    "               [-K bytes] [-L idle] [-M manifest] [-n max devs]\n"
+	    "               [-O stdio|uring] [-P spooldir] [-p policy]\n"
+	    "               [-Q userbudget] [-q budget] [-R interval]\n"
+	    "               [-S none|flush|fdatasync]\n"
+	    "               [-s statsfile] [-T indexdir] [-u username] [-t tty]\n"
+	    "               [-w workers] [-Z jobs] [-z level] [--check-policy]\n",
 	    execname);
 	exit(1);
 }
@@ -29,17 +29,25 @@
 #define _TERMLOG_DOT_H_
 
 #define DEFAULT_LINE_BUFSIZE	1024U
-#define	MAXUSERS	10U
-#define	MAXTTYS		10U
+#define	SESSION_RINGSIZE	(32 * 1024)	/* must be a power of 2 */
 
 #undef	DEBUGGING
 #undef	DEBUG_LOCKS
+/* LATENCY_TRACE comes from the Makefile, see latency.h */
 #define	TERMLOG_VERSION	"2.5-RELEASE"
 #define _PATH_TERMLOG_STATS	"termlog.stats"
+#define	_PATH_TERMLOG_SPOOL	"/var/run/termlog"
+#define	TERMLOG_OFLOW_SUFFIX	".oflow"	/* pty proxy drop counter */
 #define	_SNP_MAJOR 53
 
 #include <sys/types.h>
 #include <sys/queue.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "alert.h"
+#include "ring.h"
 #ifndef DEBUGGING
 #undef NDEBUG
 #endif
@@ -50,37 +58,66 @@
             (var) && ((tvar) = TAILQ_NEXT((var), field), 1);		\
             (var) = (tvar))
 #endif
+struct capsrc;
+struct worker;
+struct stats_session;
 struct snp_d {
 	char		s_username[UT_NAMESIZE];
         char		s_line[UT_LINESIZE];
         int		s_fd;
+	struct capsrc  *s_src;
+	void	       *s_handle;
         void	       *s_meta;
 	int		(*snp_write)(void *data, char *ptr, int size);
 	void	       *(*snp_setup)(void *data, char *config);
 	int		(*snp_close)(void *data);
 	int		(*snp_overflow)(void *data);
 	u_long		s_bytes;
-        TAILQ_ENTRY(snp_d) glue;
+	struct stats_session *s_stats;	/* in the stats region */
+	struct ring	s_ring;		/* read but not yet written */
+	_Atomic(struct snp_d *) s_lnext;	/* registry, by line */
+	_Atomic(struct snp_d *) s_unext;	/* registry, by user */
+	struct worker  *s_worker;	/* owns our readiness registration */
+	pthread_mutex_t	s_mtx;		/* held while being serviced */
+	atomic_int	s_queued;	/* on some worker's run queue */
+	atomic_int	s_dead;		/* waiting for owner to free */
+	atomic_int	s_busy;		/* workers which have it in hand */
+	TAILQ_ENTRY(snp_d) s_runq;
+	uint64_t	s_key;		/* run queue order, under w_lock */
+	_Atomic(uint64_t) s_deadline;	/* expected overflow, usec */
+	uint64_t	s_tdrain;	/* capture buffer last emptied */
+	uint64_t	s_rate;		/* fill rate, bytes per second */
+	u_long		s_backlog;	/* read since s_tdrain */
+	int		s_bufsize;	/* capacity of the capture buffer */
+	u_int		s_oflows;
+	struct alertsess s_alert;	/* -A matcher state */
+#ifdef LATENCY_TRACE
+	uint64_t	s_tready;	/* when it was found readable */
+	uint64_t	s_tlast;	/* end of the last timed stage */
+#endif
 };
+
+/*
+ * handlesnpio() return values
+ */
+#define	SIO_DRAINED	0	/* nothing left to read */
+#define	SIO_MORE	1	/* quantum used up, more data pending */
+#define	SIO_DETACH	2	/* session is gone, call sessfree() */
 #define	DEBUG(v, fmt, args...)						\
 	do {								\
 		if (v > 0)						\
 			fprintf(stderr, "DEBUG: " fmt "\n", ##args);	\
 	} while (0)
 
-int getsnpfd(char **, size_t);
 int ttystat(char *, int);
-int processutmp(struct stat *);
 int linktty(struct utmpx *);
-int snpattach(char *);
 void *watchutmp(void *);
 int ttyislinked(struct utmpx *);
 void usage(char *);
-int checkuserlist(struct utmpx *);
-int checkttylist(struct utmpx *);
+int checkpolicy(struct utmpx *);
 int skipcrtltty(struct utmpx *);
-int handlesnpio(struct snp_d *);
-int buildfdlist(fd_set *);
+int handlesnpio(struct worker *, struct snp_d *);
+void sessfree(struct snp_d *);
 void *eventloop(void *);
 int dolog(char const *const fmt, ...);
 #endif
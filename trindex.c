@@ -0,0 +1,661 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/file.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logfmt.h"
+#include "trindex.h"
+
+#define	SHARD_HDRLEN	(TRI_MAGICLEN + 12)
+#define	SHARD_DIRLEN	16
+
+struct tbuf {
+	unsigned char	*tb_buf;
+	size_t		 tb_len;
+	size_t		 tb_cap;
+};
+
+struct tdir {
+	uint32_t	 td_tri;
+	uint32_t	 td_count;
+	uint64_t	 td_off;
+};
+
+static const unsigned char *
+getvar(const unsigned char *p, const unsigned char *end, uint32_t *v)
+{
+	uint32_t x;
+	int shift;
+
+	x = 0;
+	for (shift = 0; p < end && shift < 35; shift += 7) {
+		x |= (uint32_t)(*p & 0x7f) << shift;
+		if ((*p++ & 0x80) == 0) {
+			*v = x;
+			return (p);
+		}
+	}
+	return (NULL);
+}
+
+static int
+tb_grow(struct tbuf *tb, size_t len)
+{
+	unsigned char *p;
+	size_t cap;
+
+	if (tb->tb_len + len <= tb->tb_cap)
+		return (0);
+	cap = tb->tb_cap ? tb->tb_cap : 4096;
+	while (cap < tb->tb_len + len)
+		cap *= 2;
+	if ((p = realloc(tb->tb_buf, cap)) == NULL)
+		return (-1);
+	tb->tb_buf = p;
+	tb->tb_cap = cap;
+	return (0);
+}
+
+static int
+putvar(struct tbuf *tb, uint32_t v)
+{
+	if (tb_grow(tb, 5) < 0)
+		return (-1);
+	while (v >= 0x80) {
+		tb->tb_buf[tb->tb_len++] = v | 0x80;
+		v >>= 7;
+	}
+	tb->tb_buf[tb->tb_len++] = v;
+	return (0);
+}
+
+static void
+put32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t
+get32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+	    (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+static uint32_t
+fold(u_char c)
+{
+	return (c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+}
+
+/*
+ * The trigram starting at p, as the index has it.
+ */
+uint32_t
+tri_fold(const unsigned char *p)
+{
+	return (fold(p[0]) << 16 | fold(p[1]) << 8 | fold(p[2]));
+}
+
+int
+triset_init(struct triset *ts)
+{
+	ts->ts_bits = calloc(TRI_NGRAMS / 64, sizeof(uint64_t));
+	if (ts->ts_bits == NULL)
+		return (-1);
+	ts->ts_last = 0;
+	ts->ts_have = 0;
+	return (0);
+}
+
+/*
+ * Add the trigrams of buf, including those that straddle it and what
+ * was added before.
+ */
+void
+triset_add(struct triset *ts, const void *buf, size_t len)
+{
+	const u_char *p, *end;
+	uint64_t *bits;
+	uint32_t t;
+
+	p = buf;
+	end = p + len;
+	bits = ts->ts_bits;
+	t = ts->ts_last;
+	for (; ts->ts_have < 2 && p < end; ts->ts_have++)
+		t = t << 8 | fold(*p++);
+	for (; p < end; p++) {
+		t = (t << 8 | fold(*p)) & (TRI_NGRAMS - 1);
+		bits[t >> 6] |= (uint64_t)1 << (t & 63);
+	}
+	ts->ts_last = t;
+}
+
+/*
+ * Hand back the set as an ascending list and empty it for the next
+ * segment.
+ */
+int
+triset_take(struct triset *ts, uint32_t **listp, size_t *np)
+{
+	uint32_t *list;
+	uint64_t w;
+	size_t i, n;
+
+	n = 0;
+	for (i = 0; i < TRI_NGRAMS / 64; i++)
+		n += __builtin_popcountll(ts->ts_bits[i]);
+	list = malloc(MAX(n, 1) * sizeof(*list));
+	if (list == NULL)
+		return (-1);
+	n = 0;
+	for (i = 0; i < TRI_NGRAMS / 64; i++) {
+		for (w = ts->ts_bits[i]; w != 0; w &= w - 1)
+			list[n++] = i << 6 | __builtin_ctzll(w);
+		ts->ts_bits[i] = 0;
+	}
+	ts->ts_last = 0;
+	ts->ts_have = 0;
+	*listp = list;
+	*np = n;
+	return (0);
+}
+
+void
+triset_free(struct triset *ts)
+{
+	free(ts->ts_bits);
+	ts->ts_bits = NULL;
+}
+
+/*
+ * The trigrams of the text of the segment at path, which may have
+ * been compressed since.
+ */
+int
+tri_segment(struct triset *ts, const char *path, uint32_t **listp,
+    size_t *np)
+{
+	struct logread lf;
+	struct logrec lr;
+	int ret;
+
+	if (logread_open(&lf, path) < 0)
+		return (-1);
+	while ((ret = logread_next(&lf, &lr)) > 0)
+		if (lr.lr_type != REC_TIME)
+			triset_add(ts, lr.lr_data, lr.lr_len);
+	logread_close(&lf);
+	if (triset_take(ts, listp, np) < 0)
+		return (-1);
+	if (ret < 0) {
+		free(*listp);
+		errno = EINVAL;
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Write the parts to a fresh file next to path and rename it over
+ * path, so readers see either the old file or the new one.
+ */
+static int
+writefile(const char *path, const struct tbuf *const *parts, int n)
+{
+	char tmp[MAXPATHLEN];
+	FILE *fp;
+	int fd, i, ret;
+
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >=
+	    sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+	if ((fd = mkstemp(tmp)) < 0)
+		return (-1);
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		(void)unlink(tmp);
+		return (-1);
+	}
+	ret = 0;
+	for (i = 0; i < n; i++)
+		if (parts[i]->tb_len > 0 && fwrite(parts[i]->tb_buf, 1,
+		    parts[i]->tb_len, fp) != parts[i]->tb_len)
+			ret = -1;
+	if (fflush(fp) != 0 || fsync(fileno(fp)) < 0)
+		ret = -1;
+	if (fclose(fp) != 0)
+		ret = -1;
+	if (ret == 0 && rename(tmp, path) < 0)
+		ret = -1;
+	if (ret < 0)
+		(void)unlink(tmp);
+	return (ret);
+}
+
+int
+tri_write(const char *path, const uint32_t *list, size_t n)
+{
+	const struct tbuf *parts[1];
+	struct tbuf tb;
+	uint32_t prev;
+	size_t i;
+	int ret;
+
+	memset(&tb, 0, sizeof(tb));
+	ret = -1;
+	if (tb_grow(&tb, TRI_MAGICLEN + 4) < 0)
+		goto out;
+	memcpy(tb.tb_buf, TRI_MAGIC, TRI_MAGICLEN);
+	put32(tb.tb_buf + TRI_MAGICLEN, n);
+	tb.tb_len = TRI_MAGICLEN + 4;
+	for (prev = 0, i = 0; i < n; prev = list[i++])
+		if (putvar(&tb, list[i] - prev) < 0)
+			goto out;
+	parts[0] = &tb;
+	ret = writefile(path, parts, 1);
+out:
+	free(tb.tb_buf);
+	return (ret);
+}
+
+int
+tri_read(const char *path, uint32_t **listp, size_t *np)
+{
+	const unsigned char *base, *p, *end;
+	uint32_t *list, n, prev, v;
+	size_t size, i;
+	int how;
+
+	if ((base = logfmt_load(path, &size, &how)) == NULL)
+		return (-1);
+	list = NULL;
+	if (size < TRI_MAGICLEN + 4 ||
+	    memcmp(base, TRI_MAGIC, TRI_MAGICLEN) != 0)
+		goto bad;
+	n = get32(base + TRI_MAGICLEN);
+	end = base + size;
+	p = base + TRI_MAGICLEN + 4;
+	/* every trigram takes a byte at least */
+	if (n > (size_t)(end - p) ||
+	    (list = malloc(MAX(n, 1) * sizeof(*list))) == NULL)
+		goto bad;
+	for (prev = 0, i = 0; i < n; prev = list[i++]) {
+		if ((p = getvar(p, end, &v)) == NULL)
+			goto bad;
+		list[i] = prev + v;
+	}
+	logfmt_unload(base, size, how);
+	*listp = list;
+	*np = n;
+	return (0);
+bad:
+	free(list);
+	logfmt_unload(base, size, how);
+	errno = EINVAL;
+	return (-1);
+}
+
+/*
+ * The name of the shard for time t, without the suffix.
+ */
+void
+tri_day(time_t t, char *buf)
+{
+	struct tm tm;
+
+	localtime_r(&t, &tm);
+	strftime(buf, TRI_DAYLEN, "%Y-%m-%d", &tm);
+}
+
+int
+shard_open(struct shard *sh, const char *path)
+{
+	const unsigned char *p, *end;
+	uint32_t i, nameslen;
+
+	memset(sh, 0, sizeof(*sh));
+	sh->sh_base = logfmt_load(path, &sh->sh_size, &sh->sh_how);
+	if (sh->sh_base == NULL)
+		return (-1);
+	if (sh->sh_size < SHARD_HDRLEN ||
+	    memcmp(sh->sh_base, SHARD_MAGIC, TRI_MAGICLEN) != 0)
+		goto bad;
+	p = sh->sh_base + TRI_MAGICLEN;
+	sh->sh_nsegs = get32(p);
+	sh->sh_ntri = get32(p + 4);
+	nameslen = get32(p + 8);
+	p += 12;
+	end = sh->sh_base + sh->sh_size;
+	if (nameslen > (size_t)(end - p) || sh->sh_ntri > TRI_NGRAMS ||
+	    (size_t)sh->sh_ntri * SHARD_DIRLEN > (size_t)(end - p) - nameslen ||
+	    sh->sh_nsegs > nameslen)
+		goto bad;
+	sh->sh_names = calloc(MAX(sh->sh_nsegs, 1), sizeof(char *));
+	if (sh->sh_names == NULL)
+		goto bad;
+	end = p + nameslen;
+	for (i = 0; i < sh->sh_nsegs; i++) {
+		sh->sh_names[i] = (const char *)p;
+		if ((p = memchr(p, '\0', end - p)) == NULL)
+			goto bad;
+		p++;
+	}
+	sh->sh_dir = end;
+	sh->sh_post = sh->sh_dir + (size_t)sh->sh_ntri * SHARD_DIRLEN;
+	sh->sh_postlen = sh->sh_base + sh->sh_size - sh->sh_post;
+	return (0);
+bad:
+	shard_close(sh);
+	errno = EINVAL;
+	return (-1);
+}
+
+/*
+ * The directory entry of trigram t, or -1 if no segment has it.
+ */
+ssize_t
+shard_find(const struct shard *sh, uint32_t t)
+{
+	size_t lo, hi, mid;
+	uint32_t v;
+
+	lo = 0;
+	hi = sh->sh_ntri;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		v = get32(sh->sh_dir + mid * SHARD_DIRLEN);
+		if (v == t)
+			return (mid);
+		if (v < t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (-1);
+}
+
+uint32_t
+shard_count(const struct shard *sh, size_t i)
+{
+	return (get32(sh->sh_dir + i * SHARD_DIRLEN + 4));
+}
+
+/*
+ * Decode the postings of directory entry i into ids, which has room
+ * for shard_count() of them.
+ */
+int
+shard_postings(const struct shard *sh, size_t i, uint32_t *ids)
+{
+	const unsigned char *d, *p, *end;
+	uint64_t off;
+	uint32_t n, j, prev, v;
+
+	d = sh->sh_dir + i * SHARD_DIRLEN;
+	n = get32(d + 4);
+	off = get32(d + 8) | (uint64_t)get32(d + 12) << 32;
+	if (off > sh->sh_postlen)
+		goto bad;
+	p = sh->sh_post + off;
+	end = sh->sh_post + sh->sh_postlen;
+	for (prev = 0, j = 0; j < n; prev = ids[j++]) {
+		if ((p = getvar(p, end, &v)) == NULL)
+			goto bad;
+		ids[j] = prev + v;
+		if (ids[j] >= sh->sh_nsegs || (j > 0 && v == 0))
+			goto bad;
+	}
+	return (0);
+bad:
+	errno = EINVAL;
+	return (-1);
+}
+
+void
+shard_close(struct shard *sh)
+{
+	if (sh->sh_base != NULL)
+		logfmt_unload(sh->sh_base, sh->sh_size, sh->sh_how);
+	free(sh->sh_names);
+	memset(sh, 0, sizeof(*sh));
+}
+
+/*
+ * Merge sources: 0 is the shard as it was, 1 on the sets of the new
+ * segments.  A heap orders them by their next trigram, ties by source
+ * so the segment numbers come out ascending.
+ */
+struct msrc {
+	uint32_t	 ms_tri;
+	size_t		 ms_pos;
+	size_t		 ms_end;
+	const uint32_t	*ms_list;	/* NULL for the old shard */
+};
+
+#define	MS_LESS(a, b)	((a)->ms_tri < (b)->ms_tri || \
+	((a)->ms_tri == (b)->ms_tri && (a) < (b)))
+
+static void
+heap_down(struct msrc **h, size_t n, size_t i)
+{
+	struct msrc *t;
+	size_t c;
+
+	for (; (c = 2 * i + 1) < n; i = c) {
+		if (c + 1 < n && MS_LESS(h[c + 1], h[c]))
+			c++;
+		if (!MS_LESS(h[c], h[i]))
+			break;
+		t = h[c];
+		h[c] = h[i];
+		h[i] = t;
+	}
+}
+
+static void
+ms_load(const struct shard *sh, struct msrc *ms)
+{
+	if (ms->ms_list == NULL)
+		ms->ms_tri = get32(sh->sh_dir + ms->ms_pos * SHARD_DIRLEN);
+	else
+		ms->ms_tri = ms->ms_list[ms->ms_pos];
+}
+
+/*
+ * Add n segments and their trigram sets to the shard at path,
+ * creating it if need be.  The shard is rewritten and replaced, with
+ * its lock file held from reading it to the rename.
+ */
+int
+shard_merge(const char *path, const char *const *names,
+    uint32_t *const *tris, const size_t *ntris, int n)
+{
+	struct shard sh;
+	struct msrc *src, **heap;
+	struct tbuf hdr, nam, dir, post;
+	const struct tbuf *parts[4];
+	unsigned char *d;
+	uint32_t *ids, prev, tri;
+	size_t hn, maxtri, ntri, cnt, j;
+	char lock[MAXPATHLEN];
+	int i, lockfd, ret;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memset(&nam, 0, sizeof(nam));
+	memset(&dir, 0, sizeof(dir));
+	memset(&post, 0, sizeof(post));
+	if ((size_t)snprintf(lock, sizeof(lock), "%s%s", path,
+	    SHARD_LOCK) >= sizeof(lock)) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+	if ((lockfd = open(lock, O_RDWR | O_CREAT | O_NOFOLLOW,
+	    S_IRUSR | S_IWUSR)) < 0)
+		return (-1);
+	while (flock(lockfd, LOCK_EX) < 0)
+		if (errno != EINTR) {
+			close(lockfd);
+			return (-1);
+		}
+	if (shard_open(&sh, path) < 0) {
+		if (errno != ENOENT) {
+			close(lockfd);
+			return (-1);
+		}
+		memset(&sh, 0, sizeof(sh));
+	}
+	ret = -1;
+	ids = NULL;
+	src = calloc(n + 1, sizeof(*src));
+	heap = calloc(n + 1, sizeof(*heap));
+	if (src == NULL || heap == NULL)
+		goto out;
+	maxtri = sh.sh_ntri;
+	for (i = 0; i < n; i++)
+		maxtri += ntris[i];
+	maxtri = MIN(maxtri, TRI_NGRAMS);
+	if (sh.sh_nsegs > 0 &&
+	    (ids = malloc(sh.sh_nsegs * sizeof(*ids))) == NULL)
+		goto out;
+	if (tb_grow(&dir, maxtri * SHARD_DIRLEN) < 0)
+		goto out;
+
+	/* the names, old ones first */
+	if (sh.sh_nsegs > 0) {
+		cnt = (const unsigned char *)sh.sh_dir -
+		    (const unsigned char *)sh.sh_names[0];
+		if (tb_grow(&nam, cnt) < 0)
+			goto out;
+		memcpy(nam.tb_buf, sh.sh_names[0], cnt);
+		nam.tb_len = cnt;
+	}
+	for (i = 0; i < n; i++) {
+		cnt = strlen(names[i]) + 1;
+		if (tb_grow(&nam, cnt) < 0)
+			goto out;
+		memcpy(nam.tb_buf + nam.tb_len, names[i], cnt);
+		nam.tb_len += cnt;
+	}
+
+	hn = 0;
+	if (sh.sh_ntri > 0) {
+		src[0].ms_end = sh.sh_ntri;
+		ms_load(&sh, &src[0]);
+		heap[hn++] = &src[0];
+	}
+	for (i = 0; i < n; i++) {
+		src[i + 1].ms_list = tris[i];
+		src[i + 1].ms_end = ntris[i];
+		if (ntris[i] == 0)
+			continue;
+		ms_load(&sh, &src[i + 1]);
+		heap[hn++] = &src[i + 1];
+	}
+	for (j = hn; j-- > 0; )
+		heap_down(heap, hn, j);
+
+	ntri = 0;
+	while (hn > 0) {
+		tri = heap[0]->ms_tri;
+		d = dir.tb_buf + ntri * SHARD_DIRLEN;
+		put32(d, tri);
+		put32(d + 8, post.tb_len);
+		put32(d + 12, (uint64_t)post.tb_len >> 32);
+		cnt = 0;
+		prev = 0;
+		while (hn > 0 && heap[0]->ms_tri == tri) {
+			if (heap[0]->ms_list == NULL) {
+				if (shard_postings(&sh, heap[0]->ms_pos,
+				    ids) < 0)
+					goto out;
+				for (j = 0; j < shard_count(&sh,
+				    heap[0]->ms_pos); j++, cnt++) {
+					if (putvar(&post, ids[j] - prev) < 0)
+						goto out;
+					prev = ids[j];
+				}
+			} else {
+				j = sh.sh_nsegs + (heap[0] - src) - 1;
+				if (putvar(&post, j - prev) < 0)
+					goto out;
+				prev = j;
+				cnt++;
+			}
+			if (++heap[0]->ms_pos == heap[0]->ms_end)
+				heap[0] = heap[--hn];
+			else
+				ms_load(&sh, heap[0]);
+			heap_down(heap, hn, 0);
+		}
+		put32(d + 4, cnt);
+		ntri++;
+	}
+	dir.tb_len = ntri * SHARD_DIRLEN;
+
+	if (tb_grow(&hdr, SHARD_HDRLEN) < 0)
+		goto out;
+	memcpy(hdr.tb_buf, SHARD_MAGIC, TRI_MAGICLEN);
+	put32(hdr.tb_buf + TRI_MAGICLEN, sh.sh_nsegs + n);
+	put32(hdr.tb_buf + TRI_MAGICLEN + 4, ntri);
+	put32(hdr.tb_buf + TRI_MAGICLEN + 8, nam.tb_len);
+	hdr.tb_len = SHARD_HDRLEN;
+	parts[0] = &hdr;
+	parts[1] = &nam;
+	parts[2] = &dir;
+	parts[3] = &post;
+	ret = writefile(path, parts, 4);
+out:
+	close(lockfd);
+	shard_close(&sh);
+	free(ids);
+	free(src);
+	free(heap);
+	free(hdr.tb_buf);
+	free(nam.tb_buf);
+	free(dir.tb_buf);
+	free(post.tb_buf);
+	return (ret);
+}
@@ -0,0 +1,109 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef	TRINDEX_DOT_H_
+#define	TRINDEX_DOT_H_
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Trigram index over closed log segments (termlog -T).  The text of a
+ * segment, what termlog-cat would print, is reduced to the set of
+ * byte trigrams it contains, ASCII letters folded to lower case.  A
+ * set is first written on its own, the segment name plus TRI_SUFFIX
+ * in the index directory:
+ *
+ *	TRI_MAGIC, uint32_t count, count trigrams
+ *
+ * and then merged into the shard of the day the segment was closed,
+ * YYYY-MM-DD plus SHARD_SUFFIX, which inverts the sets:
+ *
+ *	SHARD_MAGIC
+ *	uint32_t	segments
+ *	uint32_t	trigrams
+ *	uint32_t	length of the names
+ *	names		NUL terminated, one per segment
+ *	directory	per trigram in ascending order: uint32_t trigram,
+ *			uint32_t count, uint64_t offset in the postings
+ *	postings	per trigram, the segments holding it, ascending
+ *
+ * Fixed size integers are little endian.  Trigrams and segment
+ * numbers in lists are ascending and stored as varint deltas from the
+ * previous one (from 0 for the first).  A shard is replaced as a
+ * whole each time segments are merged into it, under flock(2) on the
+ * shard name plus SHARD_LOCK so that termlog and termlog-search -A do
+ * not lose each other's segments; the set of a segment is removed
+ * once its shard has it.
+ */
+#define	TRI_MAGIC	"TLOGTRI1"
+#define	TRI_SUFFIX	".tri"
+#define	SHARD_MAGIC	"TLOGSHD1"
+#define	SHARD_SUFFIX	".shard"
+#define	SHARD_LOCK	".lock"
+#define	TRI_MAGICLEN	8
+#define	TRI_NGRAMS	(1 << 24)
+#define	TRI_DAYLEN	11		/* YYYY-MM-DD and the NUL */
+
+struct triset {
+	uint64_t	*ts_bits;	/* TRI_NGRAMS of them */
+	uint32_t	 ts_last;	/* the bytes before the next */
+	int		 ts_have;	/* how many of them there are */
+};
+
+struct shard {
+	const unsigned char *sh_base;
+	size_t		 sh_size;
+	int		 sh_how;	/* see logfmt_load() */
+	uint32_t	 sh_nsegs;
+	uint32_t	 sh_ntri;
+	const char	**sh_names;
+	const unsigned char *sh_dir;
+	const unsigned char *sh_post;
+	size_t		 sh_postlen;
+};
+
+uint32_t tri_fold(const unsigned char *);
+int triset_init(struct triset *);
+void triset_add(struct triset *, const void *, size_t);
+int triset_take(struct triset *, uint32_t **, size_t *);
+void triset_free(struct triset *);
+int tri_segment(struct triset *, const char *, uint32_t **, size_t *);
+int tri_write(const char *, const uint32_t *, size_t);
+int tri_read(const char *, uint32_t **, size_t *);
+void tri_day(time_t, char *);
+int shard_open(struct shard *, const char *);
+ssize_t shard_find(const struct shard *, uint32_t);
+uint32_t shard_count(const struct shard *, size_t);
+int shard_postings(const struct shard *, size_t, uint32_t *);
+void shard_close(struct shard *);
+int shard_merge(const char *, const char *const *, uint32_t *const *,
+    const size_t *, int);
+#endif	/* TRINDEX_DOT_H_ */
@@ -0,0 +1,175 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifdef __linux__
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+int
+uring_init(struct uring *u, unsigned entries)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(u, 0, sizeof(*u));
+	memset(&p, 0, sizeof(p));
+	u->u_fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (u->u_fd < 0)
+		return (-1);
+	u->u_sqringsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->u_cqringsz = p.cq_off.cqes +
+	    p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->u_cqringsz > u->u_sqringsz)
+			u->u_sqringsz = u->u_cqringsz;
+		u->u_cqringsz = u->u_sqringsz;
+	}
+	sq = mmap(NULL, u->u_sqringsz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, u->u_fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto fail;
+	u->u_sqring = sq;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		cq = sq;
+	else {
+		cq = mmap(NULL, u->u_cqringsz, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, u->u_fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			goto fail;
+	}
+	u->u_cqring = cq;
+	u->u_sqessz = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->u_sqes = mmap(NULL, u->u_sqessz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, u->u_fd, IORING_OFF_SQES);
+	if (u->u_sqes == MAP_FAILED) {
+		u->u_sqes = NULL;
+		goto fail;
+	}
+	u->u_sqhead = (unsigned *)(sq + p.sq_off.head);
+	u->u_sqtail = (unsigned *)(sq + p.sq_off.tail);
+	u->u_sqmask = *(unsigned *)(sq + p.sq_off.ring_mask);
+	u->u_sqentries = p.sq_entries;
+	u->u_sqarray = (unsigned *)(sq + p.sq_off.array);
+	u->u_sqlocal = *u->u_sqtail;
+	u->u_cqhead = (unsigned *)(cq + p.cq_off.head);
+	u->u_cqtail = (unsigned *)(cq + p.cq_off.tail);
+	u->u_cqmask = *(unsigned *)(cq + p.cq_off.ring_mask);
+	u->u_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return (0);
+fail:
+	if (u->u_sqring != NULL)
+		munmap(u->u_sqring, u->u_sqringsz);
+	if (u->u_cqring != NULL && u->u_cqring != u->u_sqring)
+		munmap(u->u_cqring, u->u_cqringsz);
+	close(u->u_fd);
+	u->u_fd = -1;
+	return (-1);
+}
+
+int
+uring_register(struct uring *u, unsigned opcode, void *arg, unsigned nr)
+{
+	return (syscall(__NR_io_uring_register, u->u_fd, opcode, arg, nr));
+}
+
+unsigned
+uring_sqspace(struct uring *u)
+{
+	unsigned head;
+
+	head = atomic_load_explicit((_Atomic unsigned *)u->u_sqhead,
+	    memory_order_acquire);
+	return (u->u_sqentries - (u->u_sqlocal - head));
+}
+
+/*
+ * Hand out the next free submission entry, cleared.  Entries become
+ * visible to the kernel on the next uring_submit().
+ */
+struct io_uring_sqe *
+uring_getsqe(struct uring *u)
+{
+	struct io_uring_sqe *sqe;
+	unsigned idx;
+
+	if (uring_sqspace(u) == 0)
+		return (NULL);
+	idx = u->u_sqlocal & u->u_sqmask;
+	sqe = &u->u_sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	u->u_sqarray[idx] = idx;
+	u->u_sqlocal++;
+	return (sqe);
+}
+
+/*
+ * Publish everything queued since the last call and wait until at
+ * least nwait completions are available.  May return early with
+ * EINTR, in which case the caller just tries again.
+ */
+int
+uring_submit(struct uring *u, unsigned nwait)
+{
+	unsigned n;
+
+	n = u->u_sqlocal - *u->u_sqtail;
+	atomic_store_explicit((_Atomic unsigned *)u->u_sqtail, u->u_sqlocal,
+	    memory_order_release);
+	return (syscall(__NR_io_uring_enter, u->u_fd, n, nwait,
+	    nwait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0));
+}
+
+struct io_uring_cqe *
+uring_peekcqe(struct uring *u)
+{
+	unsigned head, tail;
+
+	head = *u->u_cqhead;
+	tail = atomic_load_explicit((_Atomic unsigned *)u->u_cqtail,
+	    memory_order_acquire);
+	if (head == tail)
+		return (NULL);
+	return (&u->u_cqes[head & u->u_cqmask]);
+}
+
+void
+uring_cqeseen(struct uring *u)
+{
+	atomic_store_explicit((_Atomic unsigned *)u->u_cqhead,
+	    *u->u_cqhead + 1, memory_order_release);
+}
+#endif	/* __linux__ */
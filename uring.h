@@ -0,0 +1,68 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef	URING_DOT_H_
+#define	URING_DOT_H_
+
+/*
+ * A minimal io_uring(7) wrapper built directly on the system calls, so
+ * that liburing is not needed.  Only one thread may submit to or reap
+ * from a ring.  Linux only.
+ */
+#ifdef __linux__
+#include <linux/io_uring.h>
+
+struct uring {
+	int			u_fd;
+	unsigned		*u_sqhead;
+	unsigned		*u_sqtail;
+	unsigned		u_sqmask;
+	unsigned		u_sqentries;
+	unsigned		*u_sqarray;
+	unsigned		u_sqlocal;	/* tail not yet published */
+	struct io_uring_sqe	*u_sqes;
+	unsigned		*u_cqhead;
+	unsigned		*u_cqtail;
+	unsigned		u_cqmask;
+	struct io_uring_cqe	*u_cqes;
+	void			*u_sqring;
+	size_t			u_sqringsz;
+	void			*u_cqring;
+	size_t			u_cqringsz;
+	size_t			u_sqessz;
+};
+
+int uring_init(struct uring *, unsigned);
+int uring_register(struct uring *, unsigned, void *, unsigned);
+struct io_uring_sqe *uring_getsqe(struct uring *);
+unsigned uring_sqspace(struct uring *);
+int uring_submit(struct uring *, unsigned);
+struct io_uring_cqe *uring_peekcqe(struct uring *);
+void uring_cqeseen(struct uring *);
+#endif
+#endif	/* URING_DOT_H_ */
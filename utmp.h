@@ -5,8 +5,10 @@
 #define UT_NAMESIZE	32
 #define UT_HOSTSIZE	128
 
+#ifndef __linux__
 #define _PATH_UTMP	"/var/run/utx.active"
 #define _PATH_WTMP	"/var/log/utx.log"
 #define _PATH_LASTLOG	"/var/log/utx.lastlogin"
+#endif
 
 #endif
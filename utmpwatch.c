@@ -0,0 +1,402 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#else
+#include <sys/event.h>
+#endif
+#include <poll.h>
+
+#include <utmpx.h>
+#include "utmp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utmpwatch.h"
+
+#define	ISLOGIN(up)	((up)->ut_type == USER_PROCESS && (up)->ut_user[0] != '\0')
+
+/*
+ * (Re)establish the watch on the file.
+ */
+static int
+utw_watch(struct utwatch *uw)
+{
+#ifdef __linux__
+	uw->uw_wd = inotify_add_watch(uw->uw_fd, uw->uw_path, IN_MODIFY |
+	    IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF);
+	return (uw->uw_wd < 0 ? -1 : 0);
+#else
+	struct kevent kev;
+	int fd;
+
+	fd = open(uw->uw_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return (-1);
+	EV_SET(&kev, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE |
+	    NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | NOTE_RENAME, 0, NULL);
+	if (kevent(uw->uw_fd, &kev, 1, NULL, 0, NULL) < 0) {
+		close(fd);
+		return (-1);
+	}
+	uw->uw_wd = fd;
+	return (0);
+#endif
+}
+
+static void
+utw_lost(struct utwatch *uw)
+{
+#ifdef __linux__
+	(void)inotify_rm_watch(uw->uw_fd, uw->uw_wd);
+#else
+	close(uw->uw_wd);		/* and with it the kevent */
+#endif
+	uw->uw_wd = -1;
+	(void)utw_watch(uw);
+}
+
+int
+utw_open(struct utwatch *uw, const char *path, long poll)
+{
+	struct stat sb;
+#ifndef __linux__
+	struct kevent kev;
+#endif
+
+	memset(uw, 0, sizeof(*uw));
+	uw->uw_path = path;
+	uw->uw_poll = poll;
+	uw->uw_wd = -1;
+	if (stat(path, &sb) < 0)
+		return (-1);
+	if (pipe2(uw->uw_wake, O_NONBLOCK | O_CLOEXEC) < 0)
+		return (-1);
+#ifdef __linux__
+	uw->uw_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+	uw->uw_fd = kqueue();
+	EV_SET(&kev, uw->uw_wake[0], EVFILT_READ, EV_ADD, 0, 0, NULL);
+	if (uw->uw_fd >= 0 && kevent(uw->uw_fd, &kev, 1, NULL, 0, NULL) < 0) {
+		close(uw->uw_fd);
+		uw->uw_fd = -1;
+	}
+#endif
+	if (uw->uw_fd >= 0 && utw_watch(uw) < 0) {
+		close(uw->uw_fd);
+		uw->uw_fd = -1;
+	}
+	if (uw->uw_fd < 0)
+		warn("%s: can not watch, polling", path);
+	return (0);
+}
+
+/*
+ * Empties the wakeup pipe.  Returns 1 if utw_wakeup() was called.
+ */
+static int
+utw_woken(struct utwatch *uw)
+{
+	char buf[64];
+	int woken;
+
+	woken = 0;
+	while (read(uw->uw_wake[0], buf, sizeof(buf)) > 0)
+		woken = 1;
+	return (woken);
+}
+
+/*
+ * The fallback: stat(2) the file every uw_poll micro-seconds.
+ */
+static int
+utw_poll(struct utwatch *uw, long usec)
+{
+	struct pollfd pfd;
+	struct stat sb;
+
+	if (usec < 0 || usec > uw->uw_poll)
+		usec = uw->uw_poll;
+	pfd.fd = uw->uw_wake[0];
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, (int)((usec + 999) / 1000)) > 0 && utw_woken(uw))
+		return (1);
+	if (stat(uw->uw_path, &sb) < 0)
+		return (0);
+	return (sb.st_size != uw->uw_size ||
+	    sb.st_mtim.tv_sec != uw->uw_mtime.tv_sec ||
+	    sb.st_mtim.tv_nsec != uw->uw_mtime.tv_nsec);
+}
+
+/*
+ * Wait up to usec micro-seconds, or for ever if usec is negative, for
+ * the database to change or for utw_wakeup().  Returns 1 if either
+ * may have happened.
+ */
+int
+utw_wait(struct utwatch *uw, long usec)
+{
+#ifdef __linux__
+	char buf[4096]
+	    __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event *ie;
+	struct pollfd pfd[2];
+	ssize_t cc;
+	char *p;
+	int lost;
+#else
+	struct kevent kev;
+	struct timespec ts;
+#endif
+	int n;
+
+	if (uw->uw_fd < 0)
+		return (utw_poll(uw, usec));
+	if (uw->uw_wd < 0) {
+		/* the file went away; look for it again in a while */
+		(void)utw_poll(uw, usec);
+		return (utw_watch(uw) == 0);
+	}
+#ifdef __linux__
+	pfd[0].fd = uw->uw_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = uw->uw_wake[0];
+	pfd[1].events = POLLIN;
+	n = poll(pfd, 2, usec < 0 ? -1 : (int)((usec + 999) / 1000));
+	if (n <= 0)
+		return (0);
+	if (pfd[1].revents)
+		(void)utw_woken(uw);
+	lost = 0;
+	while ((cc = read(uw->uw_fd, buf, sizeof(buf))) > 0)
+		for (p = buf; p < buf + cc; p += sizeof(*ie) + ie->len) {
+			ie = (struct inotify_event *)(void *)p;
+			if (ie->wd == uw->uw_wd && ie->mask &
+			    (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+				lost = 1;
+		}
+	if (lost)
+		utw_lost(uw);
+#else
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	n = kevent(uw->uw_fd, NULL, 0, &kev, 1, usec < 0 ? NULL : &ts);
+	if (n <= 0)
+		return (0);
+	if (kev.filter == EVFILT_READ) {
+		(void)utw_woken(uw);
+		return (1);
+	}
+	if (kev.fflags & (NOTE_DELETE | NOTE_RENAME))
+		utw_lost(uw);
+#endif
+	return (1);
+}
+
+static int
+utw_grow(struct utwatch *uw, size_t n)
+{
+	struct utmpx *recs;
+	time_t *retry;
+	size_t cap;
+
+	if (n <= uw->uw_cap)
+		return (0);
+	cap = MAX(n, uw->uw_cap * 2);
+	recs = realloc(uw->uw_recs, cap * sizeof(*recs));
+	if (recs == NULL)
+		return (-1);
+	uw->uw_recs = recs;
+	retry = realloc(uw->uw_retry, cap * sizeof(*retry));
+	if (retry == NULL)
+		return (-1);
+	memset(retry + uw->uw_cap, 0, (cap - uw->uw_cap) * sizeof(*retry));
+	uw->uw_retry = retry;
+	uw->uw_cap = cap;
+	return (0);
+}
+
+static void
+utw_noretry(struct utwatch *uw, size_t i)
+{
+	if (uw->uw_retry[i] != 0) {
+		uw->uw_retry[i] = 0;
+		uw->uw_nretry--;
+	}
+}
+
+/*
+ * Compare recs, slot by slot, with the previous scan.  utmp writers
+ * update records in place, so a slot that has not changed needs no
+ * looking at unless its handler asked for another go.
+ */
+static int
+utw_diff(struct utwatch *uw, const struct utmpx *recs, size_t n,
+    int (*added)(struct utmpx *), void (*removed)(struct utmpx *))
+{
+	struct utmpx old;
+	time_t now;
+	size_t i;
+
+	if (utw_grow(uw, n) < 0)
+		return (-1);
+	now = time(NULL);
+	for (i = 0; i < n; i++) {
+		if (i < uw->uw_nrecs &&
+		    memcmp(&recs[i], &uw->uw_recs[i], sizeof(*recs)) == 0) {
+			if (uw->uw_retry[i] == 0)
+				continue;
+			if (uw->uw_retry[i] < now) {
+				utw_noretry(uw, i);
+				continue;
+			}
+		} else {
+			old = uw->uw_recs[i];
+			uw->uw_recs[i] = recs[i];
+			if (i < uw->uw_nrecs && ISLOGIN(&old))
+				removed(&old);
+			utw_noretry(uw, i);
+		}
+		if (!ISLOGIN(&uw->uw_recs[i]) || added(&uw->uw_recs[i]) == 0)
+			utw_noretry(uw, i);
+		else if (uw->uw_retry[i] == 0) {
+			uw->uw_retry[i] = now + UTW_RETRYSECS;
+			uw->uw_nretry++;
+		}
+	}
+	for (; i < uw->uw_nrecs; i++) {
+		if (ISLOGIN(&uw->uw_recs[i]))
+			removed(&uw->uw_recs[i]);
+		utw_noretry(uw, i);
+	}
+	uw->uw_nrecs = n;
+	return (0);
+}
+
+/*
+ * Hand records that appeared since the last scan to added and those
+ * that went away to removed.  added returns non-zero to have the
+ * record offered again.
+ */
+int
+utw_scan(struct utwatch *uw, int (*added)(struct utmpx *),
+    void (*removed)(struct utmpx *))
+{
+	struct stat sb;
+	struct utmpx *recs;
+	size_t n;
+	int ret;
+#ifdef __linux__
+	int fd;
+
+	fd = open(uw->uw_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return (-1);
+	if (fstat(fd, &sb) < 0) {
+		close(fd);
+		return (-1);
+	}
+	/* utmp files are only ever extended, a record at a time */
+	n = sb.st_size / sizeof(struct utmpx);
+	recs = NULL;
+	if (n > 0) {
+		recs = mmap(NULL, n * sizeof(*recs), PROT_READ, MAP_SHARED,
+		    fd, 0);
+		if (recs == MAP_FAILED) {
+			close(fd);
+			return (-1);
+		}
+	}
+	close(fd);
+#else
+	struct utmpx *up, *nrecs;
+	size_t cap;
+
+	if (stat(uw->uw_path, &sb) < 0 ||
+	    setutxdb(UTXDB_ACTIVE, uw->uw_path) < 0)
+		return (-1);
+	recs = NULL;
+	n = cap = 0;
+	while ((up = getutxent()) != NULL) {
+		if (n == cap) {
+			cap = cap ? cap * 2 : 64;
+			nrecs = realloc(recs, cap * sizeof(*recs));
+			if (nrecs == NULL) {
+				free(recs);
+				endutxent();
+				return (-1);
+			}
+			recs = nrecs;
+		}
+		recs[n++] = *up;
+	}
+	endutxent();
+#endif
+	uw->uw_mtime = sb.st_mtim;
+	uw->uw_size = sb.st_size;
+	ret = utw_diff(uw, recs, n, added, removed);
+#ifdef __linux__
+	if (recs != NULL)
+		munmap(recs, n * sizeof(*recs));
+#else
+	free(recs);
+#endif
+	return (ret);
+}
+
+/*
+ * Makes utw_wait() return early; safe to call from any thread.
+ */
+void
+utw_wakeup(struct utwatch *uw)
+{
+	(void)write(uw->uw_wake[1], "", 1);
+}
+
+/*
+ * Forget the last scan, so that the next one offers every record.
+ */
+void
+utw_reset(struct utwatch *uw)
+{
+	uw->uw_nrecs = 0;
+	if (uw->uw_retry != NULL)
+		memset(uw->uw_retry, 0, uw->uw_cap * sizeof(*uw->uw_retry));
+	uw->uw_nretry = 0;
+}
@@ -0,0 +1,69 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef	UTMPWATCH_DOT_H_
+#define	UTMPWATCH_DOT_H_
+
+/*
+ * Waits for the utmp database to change, with inotify(7) on Linux
+ * and an EVFILT_VNODE kevent on BSD, falling back to checking its
+ * modification time every uw_poll micro-seconds.  Each scan compares
+ * the database with the copy taken by the previous one and only
+ * reports records which were added or removed.  On Linux the file is
+ * mapped and read in place; elsewhere it is read with getutxent(3).
+ *
+ * A record whose handler asks for it to be retried is offered again
+ * on every scan for UTW_RETRYSECS, changed or not; a login usually
+ * shows up in utmp a little before its tty can be attached to.
+ */
+#define	UTW_RETRYSECS	30
+
+struct utmpx;
+
+struct utwatch {
+	const char	*uw_path;
+	long		 uw_poll;	/* usec, when there is no watch */
+	int		 uw_fd;		/* inotify or kqueue, -1 to poll */
+	int		 uw_wd;		/* watch or watched fd, -1 if lost */
+	int		 uw_wake[2];	/* pipe, see utw_wakeup() */
+	struct timespec	 uw_mtime;
+	off_t		 uw_size;
+	struct utmpx	*uw_recs;	/* as of the last scan */
+	time_t		*uw_retry;	/* retry slot until, or 0 */
+	size_t		 uw_nrecs;
+	size_t		 uw_cap;
+	size_t		 uw_nretry;
+};
+
+int utw_open(struct utwatch *, const char *, long);
+int utw_wait(struct utwatch *, long);
+int utw_scan(struct utwatch *, int (*)(struct utmpx *),
+    void (*)(struct utmpx *));
+void utw_wakeup(struct utwatch *);
+void utw_reset(struct utwatch *);
+#endif	/* UTMPWATCH_DOT_H_ */
@@ -0,0 +1,298 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+
+#include "compat.h"
+#include "digest.h"
+#include "chain.h"
+#include "logfmt.h"
+
+/*
+ * termlog-verify: check a manifest written by termlog -M and the
+ * segments it lists.  The links are checked first, which only takes
+ * the manifest itself.  The segments are then rehashed by a pool of
+ * threads in manifest order; once a bad segment is found nothing
+ * after it is looked at, since the first broken link is all that is
+ * reported.  Checkpoint records are used to narrow down where a
+ * segment was altered.
+ */
+struct seg {
+	u_long		sg_seq;
+	char		sg_link[DIGEST_SHA256_LEN];
+	char		sg_sha256[DIGEST_SHA256_LEN];
+	off_t		sg_size;
+	char		*sg_name;
+	char		sg_why[256];
+};
+
+static struct seg	*segs;
+static size_t		 nsegs;
+static atomic_size_t	 next;
+static atomic_size_t	 firstbad;
+static const char	*logdir;
+static int		 vflag;
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	    "usage: termlog-verify [-v] [-C dir] [-j jobs] manifest\n");
+	exit(2);
+}
+
+static void
+readmanifest(const char *path)
+{
+	char line[1024], name[MAXPATHLEN];
+	struct seg *sg;
+	size_t cap;
+	intmax_t size;
+	FILE *fp;
+	u_long lineno;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		err(2, "%s", path);
+	cap = 0;
+	for (lineno = 1; fgets(line, sizeof(line), fp) != NULL; lineno++) {
+		if (line[0] == '#')
+			continue;
+		if (nsegs == cap) {
+			cap = cap ? cap * 2 : 1024;
+			segs = realloc(segs, cap * sizeof(*segs));
+			if (segs == NULL)
+				err(2, "realloc failed");
+		}
+		sg = &segs[nsegs];
+		memset(sg, 0, sizeof(*sg));
+		if (sscanf(line, "%lu %64s %64s %jd %1023[^\n]", &sg->sg_seq,
+		    sg->sg_link, sg->sg_sha256, &size, name) != 5)
+			errx(2, "%s:%lu: malformed line", path, lineno);
+		sg->sg_size = size;
+		if ((sg->sg_name = strdup(name)) == NULL)
+			err(2, "strdup failed");
+		nsegs++;
+	}
+	fclose(fp);
+}
+
+/*
+ * Walk the chain; returns the index of the first bad link or nsegs.
+ */
+static size_t
+checklinks(void)
+{
+	char prev[DIGEST_SHA256_LEN], link[DIGEST_SHA256_LEN];
+	struct seg *sg;
+	size_t i;
+
+	memset(prev, '0', DIGEST_SHA256_LEN - 1);
+	prev[DIGEST_SHA256_LEN - 1] = '\0';
+	for (i = 0; i < nsegs; i++) {
+		sg = &segs[i];
+		if (sg->sg_seq != i + 1) {
+			snprintf(sg->sg_why, sizeof(sg->sg_why),
+			    "sequence number %lu, expected %zu", sg->sg_seq,
+			    i + 1);
+			return (i);
+		}
+		if (chain_link(prev, sg->sg_sha256, sg->sg_size, sg->sg_name,
+		    link) < 0 || strcmp(link, sg->sg_link) != 0) {
+			snprintf(sg->sg_why, sizeof(sg->sg_why),
+			    "manifest entry does not match its link");
+			return (i);
+		}
+		strlcpy(prev, link, sizeof(prev));
+	}
+	return (nsegs);
+}
+
+/*
+ * Hash the segment, checking every checkpoint record on the way.
+ * Returns 0 if it matches the manifest.  Records are in band, and a
+ * session can print anything, so one that does not match is taken
+ * for session output: only the digest of the whole segment decides,
+ * and the last record that matched says up to where it is intact.
+ */
+static int
+checkseg(struct seg *sg)
+{
+	struct digest d;
+	struct digestval dv;
+	char path[MAXPATHLEN], sha[DIGEST_SHA256_LEN], rec[128];
+	const void *map;
+	char *base, *p, *q, *s, *end;
+	size_t len, size;
+	off_t good, off;
+	intmax_t ckoff;
+	int bad, how;
+
+	snprintf(path, sizeof(path), "%s/%s", logdir, sg->sg_name);
+	/* compressed segments are inflated */
+	if ((map = logfmt_load(path, &size, &how)) == NULL) {
+		snprintf(sg->sg_why, sizeof(sg->sg_why), "%s",
+		    strerror(errno));
+		return (-1);
+	}
+	base = (char *)(uintptr_t)map;
+	if (how == LF_MAPPED && size > 0)
+		(void)madvise(base, size, MADV_SEQUENTIAL);
+	if (digest_init(&d, DIGEST_SHA256) < 0)
+		errx(2, "digest_init failed");
+	bad = 0;
+	good = 0;
+	end = base + size;
+	p = s = base;			/* hashed up to p, search from s */
+	while (s < end && (q = memmem(s, end - s, CHAIN_CKPT,
+	    sizeof(CHAIN_CKPT) - 1)) != NULL) {
+		s = q + 1;
+		off = q - base;
+		len = MIN(end - q, (ptrdiff_t)sizeof(rec) - 1);
+		memcpy(rec, q, len);
+		rec[len] = '\0';
+		if (sscanf(rec + sizeof(CHAIN_CKPT) - 1, "%jd %64s", &ckoff,
+		    sha) != 2 || ckoff > off || off - ckoff > CHAIN_CKPTSLOP ||
+		    base + ckoff < p)
+			continue;	/* not ours, just session output */
+		digest_update(&d, p, base + ckoff - p);
+		p = base + ckoff;
+		digest_peek(&d, &dv);
+		if (strcmp(dv.dv_sha256, sha) == 0)
+			good = ckoff;
+	}
+	digest_update(&d, p, end - p);
+	digest_final(&d, &dv);
+	if ((off_t)size != sg->sg_size) {
+		snprintf(sg->sg_why, sizeof(sg->sg_why),
+		    "size %jd, expected %jd, intact up to %jd",
+		    (intmax_t)size, (intmax_t)sg->sg_size, (intmax_t)good);
+		bad = 1;
+	} else if (strcmp(dv.dv_sha256, sg->sg_sha256) != 0) {
+		snprintf(sg->sg_why, sizeof(sg->sg_why),
+		    "altered after offset %jd", (intmax_t)good);
+		bad = 1;
+	}
+	digest_free(&d);
+	logfmt_unload(base, size, how);
+	return (bad ? -1 : 0);
+}
+
+static void *
+verifier(void *arg __unused)
+{
+	size_t i, cur;
+
+	while ((i = atomic_fetch_add(&next, 1)) < nsegs) {
+		if (i >= atomic_load(&firstbad))
+			break;
+		if (checkseg(&segs[i]) == 0) {
+			if (vflag)
+				printf("%s: ok\n", segs[i].sg_name);
+			continue;
+		}
+		cur = atomic_load(&firstbad);
+		while (i < cur &&
+		    !atomic_compare_exchange_weak(&firstbad, &cur, i))
+			;
+	}
+	return (NULL);
+}
+
+int
+main(int argc, char *argv[])
+{
+	pthread_t *thr;
+	struct seg *sg;
+	char *dir;
+	long jobs;
+	int ch, i;
+
+	jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	dir = NULL;
+	while ((ch = getopt(argc, argv, "C:j:v")) != -1)
+		switch (ch) {
+		case 'C':
+			dir = optarg;
+			break;
+		case 'j':
+			jobs = strtol(optarg, NULL, 10);
+			break;
+		case 'v':
+			vflag++;
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		usage();
+	if (jobs <= 0)
+		jobs = 1;
+	readmanifest(argv[0]);
+	if (dir == NULL) {
+		if ((dir = strdup(argv[0])) == NULL)
+			err(2, "strdup failed");
+		dir = dirname(dir);
+	}
+	logdir = dir;
+	atomic_store(&firstbad, checklinks());
+	thr = calloc(jobs, sizeof(*thr));
+	if (thr == NULL)
+		err(2, "calloc failed");
+	for (i = 0; i < jobs; i++)
+		if (pthread_create(&thr[i], NULL, verifier, NULL) != 0)
+			err(2, "pthread_create failed");
+	for (i = 0; i < jobs; i++)
+		pthread_join(thr[i], NULL);
+	if (atomic_load(&firstbad) == nsegs) {
+		printf("%s: %zu segments verified\n", argv[0], nsegs);
+		return (0);
+	}
+	sg = &segs[atomic_load(&firstbad)];
+	printf("%s: first broken link at %lu (%s): %s\n", argv[0],
+	    sg->sg_seq, sg->sg_name, sg->sg_why);
+	return (1);
+}
@@ -0,0 +1,292 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define	VT_SIMD
+#endif
+
+#include "vtstrip.h"
+
+#define	VT_GROUND	0
+#define	VT_ESC		1	/* after ESC */
+#define	VT_ESCINT	2	/* ESC and intermediate bytes */
+#define	VT_CSI		3
+#define	VT_STR		4	/* OSC, DCS, SOS, PM or APC, until ST */
+
+#define	C_BS		0x08
+#define	C_BEL		0x07
+#define	C_CAN		0x18
+#define	C_SUB		0x1a
+#define	C_ESC		0x1b
+#define	C_DEL		0x7f
+
+typedef const u_char *(*vt_plain_t)(const u_char *, const u_char *);
+
+static const u_char *vt_plain_scalar(const u_char *, const u_char *);
+
+/* set once by vt_select() before any worker runs */
+static vt_plain_t vt_plain = vt_plain_scalar;
+static const char *vt_name = "scalar";
+
+/*
+ * Whether c needs the state machine when outside of a sequence.
+ */
+static inline int
+vt_special(u_char c)
+{
+	return ((c < 0x20 && c != '\t' && c != '\n') || c == C_DEL);
+}
+
+void
+vt_init(struct vtstate *vs)
+{
+	vs->vs_state = VT_GROUND;
+}
+
+/*
+ * Take back the last character of out, but not past a newline.
+ */
+static size_t
+vt_erase(const char *out, size_t olen)
+{
+	while (olen > 0 && ((u_char)out[olen - 1] & 0xc0) == 0x80)
+		olen--;
+	if (olen > 0 && out[olen - 1] != '\n')
+		olen--;
+	return (olen);
+}
+
+static size_t
+vt_byte(struct vtstate *vs, char *out, size_t olen, u_char c)
+{
+	switch (vs->vs_state) {
+	case VT_GROUND:
+		if (c == C_ESC)
+			vs->vs_state = VT_ESC;
+		else if (c == C_BS)
+			olen = vt_erase(out, olen);
+		else if (!vt_special(c))
+			out[olen++] = c;
+		break;
+	case VT_ESC:
+		if (c == '[')
+			vs->vs_state = VT_CSI;
+		else if (c == ']' || c == 'P' || c == 'X' || c == '^' ||
+		    c == '_')
+			vs->vs_state = VT_STR;
+		else if (c >= 0x20 && c <= 0x2f)
+			vs->vs_state = VT_ESCINT;
+		else if ((c >= 0x30 && c <= 0x7e) || c >= 0x80 ||
+		    c == C_CAN || c == C_SUB)
+			vs->vs_state = VT_GROUND;
+		break;
+	case VT_ESCINT:
+		if (c == C_ESC)
+			vs->vs_state = VT_ESC;
+		else if (c >= 0x30 || c == C_CAN || c == C_SUB)
+			vs->vs_state = VT_GROUND;
+		break;
+	case VT_CSI:
+		if (c == C_ESC)
+			vs->vs_state = VT_ESC;
+		else if (c >= 0x40 || c == C_CAN || c == C_SUB)
+			vs->vs_state = VT_GROUND;
+		break;
+	case VT_STR:
+		if (c == C_ESC)
+			vs->vs_state = VT_ESC;	/* ESC \ ends it */
+		else if (c == C_BEL || c == C_CAN || c == C_SUB)
+			vs->vs_state = VT_GROUND;
+		break;
+	}
+	return (olen);
+}
+
+/*
+ * Append the plain text of in to out, which has olen bytes already
+ * and room for len more, and return its new length.  out and in must
+ * not overlap.
+ */
+size_t
+vt_strip(struct vtstate *vs, char *out, size_t olen, const char *in,
+    size_t len)
+{
+	const u_char *p, *q, *end;
+
+	p = (const u_char *)in;
+	end = p + len;
+	while (p < end) {
+		if (vs->vs_state == VT_GROUND) {
+			q = vt_plain(p, end);
+			memcpy(out + olen, p, q - p);
+			olen += q - p;
+			if ((p = q) == end)
+				break;
+		}
+		olen = vt_byte(vs, out, olen, *p++);
+	}
+	return (olen);
+}
+
+/*
+ * The same a byte at a time, for comparison.
+ */
+size_t
+vt_strip_scalar(struct vtstate *vs, char *out, size_t olen, const char *in,
+    size_t len)
+{
+	const u_char *p, *end;
+
+	p = (const u_char *)in;
+	for (end = p + len; p < end; p++)
+		olen = vt_byte(vs, out, olen, *p);
+	return (olen);
+}
+
+static const u_char *
+vt_plain_scalar(const u_char *p, const u_char *end)
+{
+	while (p < end && !vt_special(*p))
+		p++;
+	return (p);
+}
+
+#ifdef VT_SIMD
+__attribute__((target("sse2")))
+static inline u_int
+vt_mask_sse2(__m128i a)
+{
+	__m128i ctl, ok;
+
+	/* a <= 0x1f, unsigned */
+	ctl = _mm_cmpeq_epi8(_mm_min_epu8(a, _mm_set1_epi8(0x1f)), a);
+	ok = _mm_or_si128(_mm_cmpeq_epi8(a, _mm_set1_epi8('\t')),
+	    _mm_cmpeq_epi8(a, _mm_set1_epi8('\n')));
+	return (_mm_movemask_epi8(_mm_or_si128(_mm_andnot_si128(ok, ctl),
+	    _mm_cmpeq_epi8(a, _mm_set1_epi8(C_DEL)))));
+}
+
+/*
+ * The first byte at or after p that is not plain text, or end.
+ */
+__attribute__((target("sse2")))
+static const u_char *
+vt_plain_sse2(const u_char *p, const u_char *end)
+{
+	uint32_t m;
+
+	for (; end - p >= 32; p += 32) {
+		m = vt_mask_sse2(_mm_loadu_si128((const __m128i *)
+		    (const void *)p)) | vt_mask_sse2(_mm_loadu_si128(
+		    (const __m128i *)(const void *)(p + 16))) << 16;
+		if (m != 0)
+			return (p + __builtin_ctz(m));
+	}
+	if (end - p >= 16) {
+		m = vt_mask_sse2(_mm_loadu_si128((const __m128i *)
+		    (const void *)p));
+		if (m != 0)
+			return (p + __builtin_ctz(m));
+		p += 16;
+	}
+	return (vt_plain_scalar(p, end));
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t
+vt_mask_avx2(__m256i a)
+{
+	__m256i ctl, ok;
+
+	ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(a, _mm256_set1_epi8(0x1f)),
+	    a);
+	ok = _mm256_or_si256(_mm256_cmpeq_epi8(a, _mm256_set1_epi8('\t')),
+	    _mm256_cmpeq_epi8(a, _mm256_set1_epi8('\n')));
+	return (_mm256_movemask_epi8(_mm256_or_si256(
+	    _mm256_andnot_si256(ok, ctl),
+	    _mm256_cmpeq_epi8(a, _mm256_set1_epi8(C_DEL)))));
+}
+
+__attribute__((target("avx2")))
+static const u_char *
+vt_plain_avx2(const u_char *p, const u_char *end)
+{
+	uint64_t m;
+
+	for (; end - p >= 64; p += 64) {
+		m = vt_mask_avx2(_mm256_loadu_si256((const __m256i *)
+		    (const void *)p)) | (uint64_t)vt_mask_avx2(
+		    _mm256_loadu_si256((const __m256i *)(const void *)
+		    (p + 32))) << 32;
+		if (m != 0)
+			return (p + __builtin_ctzll(m));
+	}
+	return (vt_plain_sse2(p, end));
+}
+#endif
+
+/*
+ * Pick the widest run finder the CPU has, or the one named: avx2,
+ * sse2 or scalar.  Returns -1 if that one can not be used here.
+ * Not thread safe; call it before vt_strip() is first used.
+ */
+int
+vt_select(const char *name)
+{
+#ifdef VT_SIMD
+	if ((name == NULL || strcmp(name, "avx2") == 0) &&
+	    __builtin_cpu_supports("avx2")) {
+		vt_plain = vt_plain_avx2;
+		vt_name = "avx2";
+		return (0);
+	}
+	if ((name == NULL || strcmp(name, "sse2") == 0) &&
+	    __builtin_cpu_supports("sse2")) {
+		vt_plain = vt_plain_sse2;
+		vt_name = "sse2";
+		return (0);
+	}
+#endif
+	if (name == NULL || strcmp(name, "scalar") == 0) {
+		vt_plain = vt_plain_scalar;
+		vt_name = "scalar";
+		return (0);
+	}
+	return (-1);
+}
+
+const char *
+vt_path(void)
+{
+	return (vt_name);
+}
@@ -0,0 +1,54 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef	VTSTRIP_DOT_H_
+#define	VTSTRIP_DOT_H_
+
+#include <stddef.h>
+
+/*
+ * Turns terminal output into plain text: escape sequences (CSI, OSC
+ * and the other string controls, and two or three byte ESC sequences)
+ * are dropped, as are carriage returns and the C0 controls other than
+ * tab and newline, and a backspace takes back the character before it
+ * unless that went out in an earlier call.  Sequences may be split
+ * across calls; vtstate carries where the last call left off.  Runs
+ * of plain bytes are found with AVX2 or SSE2, 64 or 32 bytes at a
+ * time, where the CPU has them.
+ */
+struct vtstate {
+	int		vs_state;
+};
+
+void vt_init(struct vtstate *);
+size_t vt_strip(struct vtstate *, char *, size_t, const char *, size_t);
+size_t vt_strip_scalar(struct vtstate *, char *, size_t, const char *,
+    size_t);
+int vt_select(const char *);
+const char *vt_path(void);
+#endif	/* VTSTRIP_DOT_H_ */
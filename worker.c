@@ -0,0 +1,395 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+
+#include <utmpx.h>
+#include "utmp.h"
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "compat.h"
+#include "latency.h"
+#include "termlog.h"
+#include "capture.h"
+#include "stats.h"
+#include "worker.h"
+
+static struct worker *workers;
+static int nworkers;
+
+extern int vflag;
+
+int
+worker_init(int n)
+{
+	struct worker *w;
+	int i;
+
+	assert(n > 0);
+	workers = calloc(n, sizeof(struct worker));
+	if (workers == NULL)
+		return (-1);
+	nworkers = n;
+	for (i = 0; i < n; i++) {
+		w = &workers[i];
+		w->w_id = i;
+		w->w_stats = STATS_WORKER(stats, i);
+		if (evq_init(&w->w_evq) < 0)
+			return (-1);
+		if (pipe(w->w_wake) < 0)
+			return (-1);
+		(void)fcntl(w->w_wake[0], F_SETFL, O_NONBLOCK);
+		(void)fcntl(w->w_wake[1], F_SETFL, O_NONBLOCK);
+		/* A NULL cookie marks the wakeup pipe */
+		if (evq_add(&w->w_evq, w->w_wake[0], NULL) < 0)
+			return (-1);
+		pthread_mutex_init(&w->w_lock, NULL);
+		TAILQ_INIT(&w->w_runq);
+	}
+	return (0);
+}
+
+void
+worker_start(void)
+{
+	int i;
+
+	for (i = 0; i < nworkers; i++)
+		if (pthread_create(&workers[i].w_thr, NULL, eventloop,
+		    &workers[i]))
+			err(1, "pthread_create failed");
+}
+
+static uint64_t
+now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+/*
+ * Hand a new session to the worker with the fewest sessions.
+ */
+void
+worker_assign(struct snp_d *s)
+{
+	struct worker *w;
+	int i;
+
+	s->s_tdrain = now_usec();
+	s->s_rate = 0;
+	s->s_backlog = 0;
+	s->s_oflows = 0;
+	s->s_bufsize = s->s_src->cs_bufsize(s->s_handle, 0);
+	atomic_init(&s->s_deadline, UINT64_MAX);
+	STATS_SET(s->s_stats->ss_bufsize, s->s_bufsize);
+
+	w = &workers[0];
+	for (i = 1; i < nworkers; i++)
+		if (workers[i].w_nsessions < w->w_nsessions)
+			w = &workers[i];
+	s->s_worker = w;
+	atomic_fetch_add(&w->w_nsessions, 1);
+}
+
+/*
+ * Queue s behind everything that is due before it.  Most sessions go
+ * in at the tail, so that is where we look from.
+ */
+static void
+enqueue(struct worker *w, struct snp_d *s)
+{
+	struct snp_d *p;
+	uint64_t key;
+
+	if (atomic_exchange(&s->s_queued, 1))
+		return;
+	LAT_STAMP(s->s_tready);
+	key = now_usec() + SCHED_SLACK;
+	s->s_key = MIN(key, atomic_load_explicit(&s->s_deadline,
+	    memory_order_relaxed));
+	pthread_mutex_lock(&w->w_lock);
+	TAILQ_FOREACH_REVERSE(p, &w->w_runq, runq, s_runq)
+		if (p->s_key <= s->s_key)
+			break;
+	if (p == NULL)
+		TAILQ_INSERT_HEAD(&w->w_runq, s, s_runq);
+	else
+		TAILQ_INSERT_AFTER(&w->w_runq, p, s, s_runq);
+	atomic_fetch_add(&w->w_qlen, 1);
+	pthread_mutex_unlock(&w->w_lock);
+}
+
+/*
+ * Take the first session off w's run queue.  A thief skips sessions
+ * which are waiting for their owner to release them.  The caller has
+ * the session in hand until service() is done with it.
+ */
+static struct snp_d *
+dequeue(struct worker *w, int thief)
+{
+	struct snp_d *s;
+
+	pthread_mutex_lock(&w->w_lock);
+	s = TAILQ_FIRST(&w->w_runq);
+	if (thief)
+		while (s != NULL && atomic_load(&s->s_dead))
+			s = TAILQ_NEXT(s, s_runq);
+	if (s != NULL) {
+		TAILQ_REMOVE(&w->w_runq, s, s_runq);
+		atomic_fetch_sub(&w->w_qlen, 1);
+		atomic_store(&s->s_queued, 0);
+		atomic_fetch_add(&s->s_busy, 1);
+	}
+	pthread_mutex_unlock(&w->w_lock);
+	return (s);
+}
+
+/*
+ * Take work from whichever worker has the longest backlog.  The
+ * length is read without the lock; a stale value only means we pick
+ * a slightly worse victim.
+ */
+static struct snp_d *
+steal(struct worker *self)
+{
+	struct worker *w, *victim;
+	int i;
+
+	victim = NULL;
+	for (i = 0; i < nworkers; i++) {
+		w = &workers[i];
+		if (w == self || w->w_qlen == 0)
+			continue;
+		if (victim == NULL || w->w_qlen > victim->w_qlen)
+			victim = w;
+	}
+	if (victim == NULL)
+		return (NULL);
+	return (dequeue(victim, 1));
+}
+
+/*
+ * We have more than we can handle right away: get an idle worker
+ * to come and help.
+ */
+static void
+kick(struct worker *self)
+{
+	struct worker *w;
+	int i;
+
+	for (i = 0; i < nworkers; i++) {
+		w = &workers[i];
+		if (w == self || !atomic_load(&w->w_idle))
+			continue;
+		(void)write(w->w_wake[1], "", 1);
+		return;
+	}
+}
+
+/*
+ * Called with s_mtx held after a turn which read n bytes.  The rate
+ * is only sampled once the buffer has been drained, as that is when
+ * we know everything that arrived since the last drain.
+ */
+static void
+schedule(struct snp_d *s, u_long n, int oflow, int more)
+{
+	uint64_t now, dt;
+	int size;
+
+	now = now_usec();
+	s->s_backlog += n;
+	if (more) {
+		/* there is data waiting right now */
+		atomic_store_explicit(&s->s_deadline, now,
+		    memory_order_relaxed);
+		return;
+	}
+	dt = now - s->s_tdrain;
+	if (dt > 0)
+		s->s_rate = (3 * s->s_rate +
+		    (uint64_t)s->s_backlog * 1000000 / dt) / 4;
+	if ((oflow || s->s_backlog >= (u_long)s->s_bufsize / 4 * 3) &&
+	    s->s_bufsize > 0 && s->s_bufsize < SCHED_MAXBUF) {
+		size = s->s_src->cs_bufsize(s->s_handle,
+		    MIN(s->s_bufsize * 2, SCHED_MAXBUF));
+		if (size > s->s_bufsize) {
+			DEBUG(vflag, "capture buffer of %s grown to %d",
+			    s->s_line, size);
+			s->s_bufsize = size;
+			STATS_SET(s->s_stats->ss_bufsize, size);
+		}
+	}
+	s->s_tdrain = now;
+	s->s_backlog = 0;
+	atomic_store_explicit(&s->s_deadline, s->s_rate == 0 ? UINT64_MAX :
+	    now + (uint64_t)s->s_bufsize * 1000000 / s->s_rate,
+	    memory_order_relaxed);
+	STATS_SET(s->s_stats->ss_rate, s->s_rate);
+}
+
+/*
+ * Everything that decides what happens to s next is done under s_mtx;
+ * once we let go of it, s may already have been freed.
+ */
+static void
+service(struct worker *w, struct snp_d *s)
+{
+	u_long bytes;
+	u_int oflows;
+	int error, release;
+
+	if (s->s_worker != w)
+		STATS_ADD(w->w_stats->sw_steals, 1);
+	release = 0;
+	pthread_mutex_lock(&s->s_mtx);
+	if (atomic_load(&s->s_dead)) {
+		error = SIO_DETACH;
+	} else {
+		bytes = s->s_bytes;
+		oflows = s->s_oflows;
+		error = handlesnpio(w, s);
+		if (error == SIO_DETACH)
+			atomic_store(&s->s_dead, 1);
+		else
+			schedule(s, s->s_bytes - bytes, s->s_oflows != oflows,
+			    error == SIO_MORE);
+	}
+	switch (error) {
+	case SIO_MORE:
+		enqueue(w, s);
+		break;
+	case SIO_DETACH:
+		/*
+		 * Only the owner may release the session, as its
+		 * readiness queue may still hold a reference to it,
+		 * and only when no other worker has it queued or in
+		 * hand.  Anyone else gives it back to the owner.
+		 */
+		if (s->s_worker != w)
+			enqueue(s->s_worker, s);
+		else if (!atomic_load(&s->s_queued) &&
+		    atomic_load(&s->s_busy) == 1)
+			release = 1;
+		break;
+	}
+	atomic_fetch_sub(&s->s_busy, 1);
+	pthread_mutex_unlock(&s->s_mtx);
+	if (release) {
+		atomic_fetch_sub(&w->w_nsessions, 1);
+		sessfree(s);
+	}
+}
+
+void *
+eventloop(void *arg)
+{
+	void *ready[EVQ_MAXEVENTS];
+	struct worker *w;
+	struct snp_d *s;
+	char buf[64];
+	int i, n, busy;
+
+	w = (struct worker *)arg;
+	busy = 0;
+	for (;;) {
+		/*
+		 * Only sleep when there is nothing queued here and
+		 * nothing left to steal, otherwise just poll for new
+		 * readiness so our own sessions are not starved.
+		 */
+		if (!busy && w->w_qlen == 0)
+			atomic_store(&w->w_idle, 1);
+		n = evq_wait(&w->w_evq, ready, EVQ_MAXEVENTS,
+		    atomic_load(&w->w_idle) ? 1000 : 0);
+		atomic_store(&w->w_idle, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		else if (n < 0)
+			err(1, "evq_wait failed");
+		if (n > 0)
+			STATS_ADD(w->w_stats->sw_wakeups, 1);
+		for (i = 0; i < n; i++) {
+			if (ready[i] == NULL) {
+				while (read(w->w_wake[0], buf, sizeof(buf)) > 0)
+					;
+				continue;
+			}
+			enqueue(w, ready[i]);
+		}
+		if (w->w_qlen > 1)
+			kick(w);
+		for (i = w->w_qlen; i > 0 && (s = dequeue(w, 0)) != NULL; i--)
+			service(w, s);
+		busy = 0;
+		if (w->w_qlen == 0 && (s = steal(w)) != NULL) {
+			service(w, s);
+			busy = 1;
+		}
+		/* what is left for the next turn */
+		STATS_SET(w->w_stats->sw_qlen, atomic_load(&w->w_qlen));
+	}
+}
+
+void
+worker_dumpstats(FILE *fp)
+{
+	struct worker *w;
+	int i;
+
+	fprintf(fp, "Worker statistics:\n"
+	    "%-6s %-8s %-8s %-12s %-10s %-10s %s\n",
+	    "WORKER", "SESSIONS", "QUEUED", "BYTES", "READS", "WAKEUPS",
+	    "STEALS");
+	for (i = 0; i < nworkers; i++) {
+		w = &workers[i];
+		fprintf(fp, "%-6d %-8d %-8d %-12lu %-10lu %-10lu %lu\n",
+		    w->w_id, atomic_load(&w->w_nsessions),
+		    atomic_load(&w->w_qlen),
+		    (u_long)w->w_stats->sw_bytes, (u_long)w->w_stats->sw_reads,
+		    (u_long)w->w_stats->sw_wakeups,
+		    (u_long)w->w_stats->sw_steals);
+	}
+}
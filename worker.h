@@ -0,0 +1,75 @@
+/*-
+ * Copyright (c) 2002-2005 Christian S.J. Peron
+ * Copyright (c) 2002-2005 Seccuris Labs, Inc
+ * All rights reserved.
+ *
+ * This software was developed for Seccuris Labs by Christian S.J. Peron.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef	WORKER_DOT_H_
+#define	WORKER_DOT_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "evq.h"
+
+/*
+ * Sessions are sharded over a set of event loop threads.  Each worker
+ * owns the readiness queue its sessions are registered with and a run
+ * queue of sessions known to have data.  A worker which runs out of
+ * work steals queued sessions from the others, and a session is never
+ * given more than WORKER_QUANTUM bytes per turn so one busy tty cannot
+ * monopolise a thread.
+ *
+ * Run queues are ordered by when each session's capture buffer is
+ * expected to fill up, estimated from how fast it has been filling
+ * since it was last drained.  Nothing waits more than SCHED_SLACK
+ * behind sessions which are about to overflow, and buffers that come
+ * close to filling up between two turns are doubled, up to
+ * SCHED_MAXBUF, where the capture source allows it.
+ */
+#define	WORKER_QUANTUM	(256 * 1024)
+#define	SCHED_SLACK	(10 * 1000)	/* usec */
+#define	SCHED_MAXBUF	(1024 * 1024)
+
+TAILQ_HEAD(runq, snp_d);
+
+struct worker {
+	pthread_t	w_thr;
+	int		w_id;
+	struct evq	w_evq;
+	int		w_wake[2];	/* pipe used to kick an idle worker */
+	atomic_int	w_idle;
+	atomic_int	w_nsessions;
+	pthread_mutex_t	w_lock;		/* protects w_runq */
+	struct runq	w_runq;
+	atomic_int	w_qlen;
+	struct stats_worker *w_stats;	/* counters, in the stats region */
+};
+
+int worker_init(int);
+void worker_start(void);
+void worker_assign(struct snp_d *);
+void worker_dumpstats(FILE *);
+#endif	/* WORKER_DOT_H_ */